@@ -0,0 +1,203 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/**
+ * Benchmark for the slice header parse in lib/src/bitstream.c on captured h264 frames,
+ * walking the whole frame compared to only its first unit, as the video receiver does.
+ * Each frame is padded to the size of a large IDR frame with captured slice data.
+ *
+ * Usage: chiaki-bench-bitstream [iterations]
+ *
+ * Fails if the two ways parse anything differently.
+ */
+
+#include <chiaki/bitstream.h>
+#include <chiaki/takion.h>
+#include <chiaki/gkcrypt.h>
+#include <chiaki/base64.h>
+#include <chiaki/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
+
+#define FRAME_SIZE (1 << 20)
+#define UNITS_COUNT 24
+
+typedef struct real_video_unit_t
+{
+	uint8_t *data;
+	size_t size;
+} RealVideoUnit;
+
+// The captured stream comes from the takion unit tests, which check every packet while decrypting it
+#define MUNIT_ERROR false
+#define munit_assert(expr) do { if(!(expr)) return false; } while(0)
+#define munit_assert_size(a, op, b) munit_assert((a) op (b))
+#define munit_assert_memory_equal(size, a, b) munit_assert(!memcmp((a), (b), (size)))
+
+static bool load_units(RealVideoUnit *units)
+{
+#include "../test/takion_av_packet_parse_real_video.inl"
+
+	const RealVideoUnit captured[UNITS_COUNT] = {
+		{ nalu_0, sizeof(nalu_0) },
+		{ nalu_1, sizeof(nalu_1) },
+		{ nalu_2, sizeof(nalu_2) },
+		{ nalu_3, sizeof(nalu_3) },
+		{ nalu_4, sizeof(nalu_4) },
+		{ nalu_5, sizeof(nalu_5) },
+		{ nalu_6, sizeof(nalu_6) },
+		{ nalu_7, sizeof(nalu_7) },
+		{ nalu_8, sizeof(nalu_8) },
+		{ nalu_9, sizeof(nalu_9) },
+		{ nalu_10, sizeof(nalu_10) },
+		{ nalu_11, sizeof(nalu_11) },
+		{ nalu_12, sizeof(nalu_12) },
+		{ nalu_13, sizeof(nalu_13) },
+		{ nalu_14, sizeof(nalu_14) },
+		{ nalu_15, sizeof(nalu_15) },
+		{ nalu_16, sizeof(nalu_16) },
+		{ nalu_17, sizeof(nalu_17) },
+		{ nalu_18, sizeof(nalu_18) },
+		{ nalu_19, sizeof(nalu_19) },
+		{ nalu_20, sizeof(nalu_20) },
+		{ nalu_21, sizeof(nalu_21) },
+		{ nalu_22, sizeof(nalu_22) },
+		{ nalu_23, sizeof(nalu_23) }
+	};
+	for(size_t i = 0; i < UNITS_COUNT; i++)
+	{
+		units[i].data = malloc(captured[i].size);
+		if(!units[i].data)
+			return false;
+		memcpy(units[i].data, captured[i].data, captured[i].size);
+		units[i].size = captured[i].size;
+	}
+	return true;
+}
+
+#undef munit_assert_memory_equal
+#undef munit_assert_size
+#undef munit_assert
+#undef MUNIT_ERROR
+
+// every unit starting with a start code after its 2 byte header is the first unit of a frame
+static bool unit_starts_frame(const RealVideoUnit *unit)
+{
+	return unit->size > 6 && !memcmp(unit->data + 2, "\x00\x00\x00\x01", 4);
+}
+
+static uint64_t bench_slices(ChiakiBitstream *bs, uint8_t *frames, unsigned *sizes, size_t frames_count, unsigned long iterations,
+		ChiakiBitstreamSlice *slices, bool *parsed)
+{
+	uint64_t start = chiaki_time_now_monotonic_us();
+	for(unsigned long it = 0; it < iterations; it++)
+	{
+		for(size_t i = 0; i < frames_count; i++)
+			parsed[i] = chiaki_bitstream_slice(bs, frames + i * FRAME_SIZE, sizes[i], &slices[i]);
+	}
+	return chiaki_time_now_monotonic_us() - start;
+}
+
+static void report(const char *name, uint64_t us, size_t slices)
+{
+	printf("%-28s %10.1f us/slice\n", name, (double)us / (double)slices);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 4;
+	if(!iterations)
+		iterations = 1;
+
+	int ret = 1;
+	RealVideoUnit units[UNITS_COUNT] = { 0 };
+	uint8_t *frames = NULL;
+	if(!load_units(units))
+	{
+		fprintf(stderr, "Failed to decrypt the captured stream\n");
+		goto cleanup;
+	}
+
+	ChiakiBitstream bs;
+	chiaki_bitstream_init(&bs, NULL, CHIAKI_CODEC_H264);
+	uint8_t header[] = {
+		0x00, 0x00, 0x00, 0x01, 0x67, 0x4d, 0x40, 0x32, 0x91, 0x8a, 0x01, 0xe0, 0x08, 0x9f, 0x97, 0x01,
+		0x6a, 0x02, 0x02, 0x02, 0x80, 0x00, 0x03, 0xe9, 0x00, 0x01, 0xd4, 0xc0, 0x44, 0xd0, 0xf1, 0xf1,
+		0x50, 0x00, 0x00, 0x00, 0x01, 0x68, 0xee, 0x3c, 0x80,
+	};
+	if(!chiaki_bitstream_header(&bs, header, ARRAY_SIZE(header)))
+	{
+		fprintf(stderr, "Failed to parse the stream header\n");
+		goto cleanup;
+	}
+
+	size_t frames_count = 0;
+	for(size_t i = 0; i < UNITS_COUNT; i++)
+		if(unit_starts_frame(&units[i]))
+			frames_count++;
+
+	frames = malloc(frames_count * FRAME_SIZE);
+	if(!frames)
+		goto cleanup;
+
+	// the first unit of each frame, followed by the captured data of the other units
+	unsigned unit_sizes[UNITS_COUNT];
+	unsigned full_sizes[UNITS_COUNT];
+	size_t frame = 0;
+	size_t rest = 0;
+	for(size_t i = 0; i < UNITS_COUNT; i++)
+	{
+		if(!unit_starts_frame(&units[i]))
+			continue;
+		uint8_t *buf = frames + frame * FRAME_SIZE;
+		size_t cur = units[i].size - 2;
+		memcpy(buf, units[i].data + 2, cur);
+		unit_sizes[frame] = (unsigned)cur;
+		while(cur < FRAME_SIZE)
+		{
+			RealVideoUnit *unit = &units[rest++ % UNITS_COUNT];
+			if(unit->size <= 6 || unit_starts_frame(unit))
+				continue;
+			size_t part = unit->size - 2;
+			if(part > FRAME_SIZE - cur)
+				part = FRAME_SIZE - cur;
+			memcpy(buf + cur, unit->data + 2, part);
+			cur += part;
+		}
+		full_sizes[frame] = FRAME_SIZE;
+		frame++;
+	}
+
+	printf("%lu iterations of %zu frames of %d KiB\n", iterations, frames_count, FRAME_SIZE / 1024);
+
+	ChiakiBitstreamSlice slices_full[UNITS_COUNT];
+	ChiakiBitstreamSlice slices_unit[UNITS_COUNT];
+	bool parsed_full[UNITS_COUNT];
+	bool parsed_unit[UNITS_COUNT];
+	report("whole frame", bench_slices(&bs, frames, full_sizes, frames_count, iterations, slices_full, parsed_full), frames_count * iterations);
+	report("first unit", bench_slices(&bs, frames, unit_sizes, frames_count, iterations, slices_unit, parsed_unit), frames_count * iterations);
+
+	// knowing where the frame ends must not change what is parsed
+	for(size_t i = 0; i < frames_count; i++)
+	{
+		if(parsed_unit[i] != parsed_full[i]
+			|| (parsed_unit[i] && (slices_unit[i].slice_type != slices_full[i].slice_type
+				|| slices_unit[i].offset != 0
+				|| (slices_unit[i].slice_type == CHIAKI_BITSTREAM_SLICE_P
+					&& slices_unit[i].reference_frame != slices_full[i].reference_frame))))
+		{
+			fprintf(stderr, "Frame %zu parsed differently within its first unit\n", i);
+			goto cleanup;
+		}
+	}
+	ret = 0;
+
+cleanup:
+	free(frames);
+	for(size_t i = 0; i < UNITS_COUNT; i++)
+		free(units[i].data);
+	return ret;
+}
@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/**
+ * Benchmark for the haptics DSP in lib/src/haptics.c,
+ * compared against the per-sample scalar loops it replaces.
+ *
+ * Usage: chiaki-bench-haptics [iterations]
+ */
+
+#include <chiaki/haptics.h>
+#include <chiaki/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// one haptics packet as received from the console (10ms at 3kHz)
+#define PACKET_FRAMES 30
+#define PACKET_SIZE (PACKET_FRAMES * CHIAKI_HAPTICS_FRAME_SIZE)
+
+static volatile int32_t sink;
+
+static void reference_deinterleave(const uint8_t *buf, size_t frames_count, int16_t *left, int16_t *right)
+{
+	int16_t amplitudel = 0, amplituder = 0;
+	for(size_t i = 0; i < frames_count; i++)
+	{
+		size_t cur = i * CHIAKI_HAPTICS_FRAME_SIZE;
+		memcpy(&amplitudel, buf + cur, sizeof(int16_t));
+		left[i] = amplitudel;
+		memcpy(&amplituder, buf + cur + sizeof(int16_t), sizeof(int16_t));
+		right[i] = amplituder;
+	}
+}
+
+static void reference_mean(const uint8_t *buf, size_t frames_count, int32_t *left, int32_t *right)
+{
+	int16_t amplitudel = 0, amplituder = 0;
+	int32_t suml = 0, sumr = 0;
+	for(size_t i = 0; i < frames_count; i++)
+	{
+		size_t cur = i * CHIAKI_HAPTICS_FRAME_SIZE;
+		memcpy(&amplitudel, buf + cur, sizeof(int16_t));
+		memcpy(&amplituder, buf + cur + sizeof(int16_t), sizeof(int16_t));
+		suml += amplitudel;
+		sumr += amplituder;
+	}
+	*left = suml / (int32_t)frames_count;
+	*right = sumr / (int32_t)frames_count;
+}
+
+static void report(const char *name, uint64_t start_us, uint64_t end_us, unsigned long iterations)
+{
+	double ns = (double)(end_us - start_us) * 1000.0 / (double)iterations;
+	printf("%-28s %10.1f ns/packet\n", name, ns);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+	if(!iterations)
+		iterations = 1;
+
+	uint8_t buf[PACKET_SIZE];
+	srand(1234);
+	for(size_t i = 0; i < PACKET_SIZE; i++)
+		buf[i] = (uint8_t)rand();
+
+	int16_t left[PACKET_FRAMES], right[PACKET_FRAMES];
+	int16_t *upsampled = malloc(chiaki_haptics_resampler_dualsense_samples(PACKET_FRAMES) * sizeof(int16_t));
+	if(!upsampled)
+		return 1;
+
+	printf("%lu iterations of %d frame haptics packets\n", iterations, PACKET_FRAMES);
+
+	uint64_t start = chiaki_time_now_monotonic_us();
+	for(unsigned long it = 0; it < iterations; it++)
+	{
+		reference_deinterleave(buf, PACKET_FRAMES, left, right);
+		sink += left[it % PACKET_FRAMES];
+	}
+	report("deinterleave (reference)", start, chiaki_time_now_monotonic_us(), iterations);
+
+	start = chiaki_time_now_monotonic_us();
+	for(unsigned long it = 0; it < iterations; it++)
+	{
+		chiaki_haptics_deinterleave(buf, PACKET_FRAMES, left, right);
+		sink += left[it % PACKET_FRAMES];
+	}
+	report("deinterleave", start, chiaki_time_now_monotonic_us(), iterations);
+
+	start = chiaki_time_now_monotonic_us();
+	for(unsigned long it = 0; it < iterations; it++)
+	{
+		int32_t l, r;
+		reference_mean(buf, PACKET_FRAMES, &l, &r);
+		sink += l + r;
+	}
+	report("mean (reference)", start, chiaki_time_now_monotonic_us(), iterations);
+
+	start = chiaki_time_now_monotonic_us();
+	for(unsigned long it = 0; it < iterations; it++)
+	{
+		ChiakiHapticsEnvelope envelope;
+		chiaki_haptics_envelope(buf, PACKET_FRAMES, &envelope);
+		sink += envelope.mean_left + envelope.rms_right;
+	}
+	report("envelope", start, chiaki_time_now_monotonic_us(), iterations);
+
+	ChiakiHapticsResampler resampler;
+	chiaki_haptics_resampler_init(&resampler);
+	start = chiaki_time_now_monotonic_us();
+	for(unsigned long it = 0; it < iterations; it++)
+	{
+		chiaki_haptics_resampler_dualsense(&resampler, buf, PACKET_FRAMES, upsampled);
+		sink += upsampled[it % PACKET_FRAMES];
+	}
+	report("resampler dualsense", start, chiaki_time_now_monotonic_us(), iterations);
+
+	free(upsampled);
+	return 0;
+}
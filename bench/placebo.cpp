@@ -0,0 +1,287 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/**
+ * Benchmark for the libplacebo render path of the GUI (QmlMainWindow::render()) without a window.
+ * The decoded frames of a recording are rendered with each video preset into offscreen targets of
+ * the common stream and display sizes.
+ *
+ * Usage: chiaki-bench-placebo <recording> [frames] [repeats]
+ *
+ * The recording is anything FFmpeg can open, e.g. a raw h264/hevc dump of a stream.
+ * Custom uses the render parameters saved by the GUI and is skipped if there are none.
+ * Any Vulkan device works, including lavapipe, which is only good for comparing presets with each other.
+ */
+
+#include "renderparams.h"
+
+#include <QSettings>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libplacebo/log.h>
+#include <libplacebo/renderer.h>
+#include <libplacebo/vulkan.h>
+#include <libplacebo/utils/libav.h>
+}
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+// frames rendered before measuring, for the shaders to be compiled and the GPU timers to have results
+#define WARMUP_FRAMES 10
+
+struct Target {
+    const char *name;
+    int w, h;
+};
+
+static const Target targets[] = {
+    { "720p", 1280, 720 },
+    { "1080p", 1920, 1080 },
+    { "4k", 3840, 2160 },
+};
+
+struct Preset {
+    const char *name;
+    const struct pl_render_params *params;
+};
+
+static int64_t nowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Called for every shader pass with the GPU time it took the last time it ran
+static void render_info_cb(void *priv, const struct pl_render_info *info)
+{
+    uint64_t *gpu_ns = static_cast<uint64_t *>(priv);
+    *gpu_ns += info->pass->last;
+}
+
+static bool decode(const char *path, size_t max_frames, std::vector<AVFrame *> *frames)
+{
+    AVFormatContext *format_ctx = nullptr;
+    if (avformat_open_input(&format_ctx, path, nullptr, nullptr) < 0) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return false;
+    }
+    avformat_find_stream_info(format_ctx, nullptr);
+
+    const AVCodec *codec = nullptr;
+    int stream = av_find_best_stream(format_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    AVCodecContext *codec_ctx = stream >= 0 ? avcodec_alloc_context3(codec) : nullptr;
+    if (!codec_ctx
+        || avcodec_parameters_to_context(codec_ctx, format_ctx->streams[stream]->codecpar) < 0
+        || avcodec_open2(codec_ctx, codec, nullptr) < 0) {
+        fprintf(stderr, "No decodable video in %s\n", path);
+        avcodec_free_context(&codec_ctx);
+        avformat_close_input(&format_ctx);
+        return false;
+    }
+
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    bool flushing = false;
+    while (frames->size() < max_frames) {
+        int r = avcodec_receive_frame(codec_ctx, frame);
+        if (r == 0) {
+            frames->push_back(av_frame_clone(frame));
+            av_frame_unref(frame);
+            continue;
+        }
+        if (r != AVERROR(EAGAIN) || flushing)
+            break;
+        if (av_read_frame(format_ctx, packet) < 0) {
+            flushing = true;
+            avcodec_send_packet(codec_ctx, nullptr);
+            continue;
+        }
+        if (packet->stream_index == stream)
+            avcodec_send_packet(codec_ctx, packet);
+        av_packet_unref(packet);
+    }
+
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    avcodec_free_context(&codec_ctx);
+    avformat_close_input(&format_ctx);
+    return !frames->empty();
+}
+
+// Same as the Custom preset of the GUI, from the settings it saved
+static std::unique_ptr<RenderParamsSnapshot> load_custom_params(pl_log log)
+{
+    QSettings settings(QStringLiteral("Chiaki"), QStringLiteral("pl_render_params"));
+    settings.beginGroup("placebo_settings");
+    QMap<QString, QString> values;
+    for (const QString &key : settings.allKeys())
+        values.insert(key, settings.value(key).toString());
+    settings.endGroup();
+    if (values.isEmpty())
+        return nullptr;
+
+    QStringList invalid;
+    std::unique_ptr<RenderParamsSnapshot> custom(new RenderParamsSnapshot(log, &pl_render_high_quality_params, values, &invalid));
+    for (const QString &option : invalid)
+        fprintf(stderr, "Ignoring invalid custom render param %s\n", qPrintable(option));
+    return custom;
+}
+
+static void bench(pl_gpu gpu, pl_renderer renderer, const Preset &preset, const Target &target,
+        const std::vector<pl_frame> &images, unsigned long repeats)
+{
+    struct pl_tex_params tex_params = {};
+    tex_params.w = target.w;
+    tex_params.h = target.h;
+    tex_params.format = pl_find_fmt(gpu, PL_FMT_UNORM, 4, 8, 8, PL_FMT_CAP_RENDERABLE);
+    tex_params.renderable = true;
+    pl_tex tex = tex_params.format ? pl_tex_create(gpu, &tex_params) : nullptr;
+    if (!tex) {
+        fprintf(stderr, "Failed to create %dx%d target\n", target.w, target.h);
+        return;
+    }
+
+    // like a swapchain frame, with the video fitted in as VideoMode::Normal does
+    struct pl_frame target_frame = {};
+    target_frame.num_planes = 1;
+    target_frame.planes[0].texture = tex;
+    target_frame.planes[0].components = 4;
+    for (int i = 0; i < 4; i++)
+        target_frame.planes[0].component_mapping[i] = i;
+    target_frame.repr = pl_color_repr_rgb;
+    target_frame.color = pl_color_space_srgb;
+    target_frame.crop = { 0, 0, static_cast<float>(target.w), static_cast<float>(target.h) };
+    pl_rect2df crop = images[0].crop;
+    pl_rect2df_aspect_copy(&target_frame.crop, &crop, 0.0);
+
+    uint64_t gpu_ns = 0;
+    struct pl_render_params params = *preset.params;
+    params.info_callback = render_info_cb;
+    params.info_priv = &gpu_ns;
+
+    for (size_t i = 0; i < WARMUP_FRAMES; i++)
+        pl_render_image(renderer, &images[i % images.size()], &target_frame, &params);
+    pl_gpu_finish(gpu);
+
+    gpu_ns = 0;
+    int64_t cpu_us = 0;
+    int64_t cpu_max_us = 0;
+    const unsigned long count = repeats * images.size();
+    const int64_t start_us = nowUs();
+    for (unsigned long i = 0; i < count; i++) {
+        const int64_t frame_start_us = nowUs();
+        if (!pl_render_image(renderer, &images[i % images.size()], &target_frame, &params))
+            fprintf(stderr, "Failed to render frame\n");
+        const int64_t frame_us = nowUs() - frame_start_us;
+        cpu_us += frame_us;
+        if (frame_us > cpu_max_us)
+            cpu_max_us = frame_us;
+    }
+    pl_gpu_finish(gpu);
+    const int64_t wall_us = nowUs() - start_us;
+
+    char gpu_ms[16] = "n/a"; // without timer queries
+    if (gpu_ns)
+        snprintf(gpu_ms, sizeof(gpu_ms), "%.3f", gpu_ns / 1e6 / count);
+    printf("%-12s %-6s %10.3f %10.3f %10s %10.1f\n", preset.name, target.name,
+        cpu_us / 1000.0 / count, cpu_max_us / 1000.0, gpu_ms, count * 1e6 / wall_us);
+
+    pl_tex_destroy(gpu, &tex);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <recording> [frames] [repeats]\n", argv[0]);
+        return 1;
+    }
+    const size_t max_frames = argc > 2 ? strtoul(argv[2], nullptr, 0) : 60;
+    unsigned long repeats = argc > 3 ? strtoul(argv[3], nullptr, 0) : 5;
+    if (!repeats)
+        repeats = 1;
+
+    std::vector<AVFrame *> frames;
+    if (!decode(argv[1], max_frames ? max_frames : 1, &frames))
+        return 1;
+
+    struct pl_log_params log_params = {};
+    log_params.log_cb = pl_log_simple;
+    log_params.log_level = PL_LOG_WARN;
+    pl_log log = pl_log_create(PL_API_VER, &log_params);
+
+    // as in QmlMainWindow::init(), minus the surface and decode extensions
+    struct pl_vk_inst_params vk_inst_params = {};
+    pl_vk_inst vk_inst = pl_vk_inst_create(log, &vk_inst_params);
+    if (!vk_inst) {
+        fprintf(stderr, "Failed to create Vulkan instance\n");
+        return 1;
+    }
+    struct pl_vulkan_params vulkan_params = {
+        .instance = vk_inst->instance,
+        .get_proc_addr = vk_inst->get_proc_addr,
+        .allow_software = true,
+        PL_VULKAN_DEFAULTS
+    };
+    pl_vulkan vulkan = pl_vulkan_create(log, &vulkan_params);
+    if (!vulkan) {
+        fprintf(stderr, "Failed to create Vulkan device\n");
+        pl_vk_inst_destroy(&vk_inst);
+        return 1;
+    }
+    pl_gpu gpu = vulkan->gpu;
+    pl_renderer renderer = pl_renderer_create(log, gpu);
+
+    // uploaded once up front, so only rendering is measured
+    std::vector<pl_frame> images(frames.size());
+    std::vector<std::array<pl_tex, 4>> image_tex(frames.size());
+    for (size_t i = 0; i < frames.size(); i++) {
+        image_tex[i].fill(nullptr);
+        struct pl_avframe_params avparams = {};
+        avparams.frame = frames[i];
+        avparams.tex = image_tex[i].data();
+        if (!pl_map_avframe_ex(gpu, &images[i], &avparams)) {
+            fprintf(stderr, "Failed to map frame %zu\n", i);
+            return 1;
+        }
+    }
+
+    std::unique_ptr<RenderParamsSnapshot> custom = load_custom_params(log);
+    std::vector<Preset> presets = {
+        { "fast", &pl_render_fast_params },
+        { "default", &pl_render_default_params },
+        { "highquality", &pl_render_high_quality_params },
+    };
+    if (custom)
+        presets.push_back({ "custom", custom->params() });
+
+    VkPhysicalDeviceProperties device_props = {};
+    auto get_device_props = reinterpret_cast<PFN_vkGetPhysicalDeviceProperties>(
+        vk_inst->get_proc_addr(vk_inst->instance, "vkGetPhysicalDeviceProperties"));
+    if (get_device_props)
+        get_device_props(vulkan->phys_device, &device_props);
+    printf("%zu frames of %dx%d from %s, %lu repeats on %s\n", frames.size(), frames[0]->width, frames[0]->height,
+        argv[1], repeats, device_props.deviceName);
+    printf("%-12s %-6s %10s %10s %10s %10s\n", "preset", "target", "cpu ms", "cpu max", "gpu ms", "fps");
+    for (const Preset &preset : presets) {
+        for (const Target &target : targets)
+            bench(gpu, renderer, preset, target, images, repeats);
+    }
+
+    for (size_t i = 0; i < frames.size(); i++) {
+        pl_unmap_avframe(gpu, &images[i]);
+        for (pl_tex &tex : image_tex[i])
+            pl_tex_destroy(gpu, &tex);
+        av_frame_free(&frames[i]);
+    }
+    custom.reset();
+    pl_renderer_destroy(&renderer);
+    pl_vulkan_destroy(&vulkan);
+    pl_vk_inst_destroy(&vk_inst);
+    pl_log_destroy(&log);
+    return 0;
+}
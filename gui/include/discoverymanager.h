@@ -25,16 +25,6 @@ struct DiscoveryHost
 
 Q_DECLARE_METATYPE(DiscoveryHost)
 
-struct ManualService
-{
-	~ManualService() { chiaki_discovery_service_fini(&service); }
-
-	class DiscoveryManager *manager;
-	bool discovered = false;
-	DiscoveryHost discovery_host;
-	ChiakiDiscoveryService service;
-};
-
 class Settings;
 
 class DiscoveryManager : public QObject
@@ -45,18 +35,21 @@ class DiscoveryManager : public QObject
 
 	private:
 		ChiakiLog log;
-		QList<ChiakiDiscoveryService> services;
+		// pings IPv4, IPv6 and the manual hosts from a single thread
 		ChiakiDiscoveryService service;
-		ChiakiDiscoveryService service_ipv6;
 		bool service_active;
-		bool service_active_ipv6;
 		QList<DiscoveryHost> hosts;
+		// position of each host in hosts by host_id
+		QHash<QString, qsizetype> host_indices;
+		bool hosts_update_pending = false;
 		Settings *settings = {};
-		QHash<QString, ManualService*> manual_services;
+
+		void ClearHosts();
+		void ScheduleHostsUpdated();
 
 	private slots:
-		void DiscoveryServiceHosts(QList<DiscoveryHost> hosts);
-		void UpdateManualServices();
+		void DiscoveryServiceHostEvent(int event, DiscoveryHost host);
+		void UpdateManualHosts();
 
 	public:
 		explicit DiscoveryManager(QObject *parent = nullptr);
@@ -68,7 +61,7 @@ class DiscoveryManager : public QObject
 		void SendWakeup(const QString &host, const QByteArray &regist_key, bool ps5);
 
 		bool GetActive() const { return service_active; }
-		const QList<DiscoveryHost> GetHosts() const;
+		const QList<DiscoveryHost> GetHosts() const { return hosts; }
 
 	signals:
 		void HostsUpdated();
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libplacebo/renderer.h>
+}
+
+// Maps decoded frames to libplacebo frames for the render thread and measures what each way of getting them there costs.
+//
+// Vulkan frames are wrapped as they are. VAAPI surfaces are imported as DMA-BUFs, once per surface of the decoder's
+// pool, since the decoder keeps recycling the same few. Everything else is uploaded into the textures passed in,
+// after having been downloaded from the decoder on the frame thread if it was a hardware frame of another format.
+class FrameMapper
+{
+public:
+    enum class Path {
+        None,
+        Vulkan,
+        DmaBuf,
+        Upload,
+        // downloaded from the hardware decoder, then uploaded
+        Download,
+        Count
+    };
+
+    struct Stats {
+        Path path = Path::None;
+        // all totals since the mapper was created
+        uint64_t frames = 0;
+        uint64_t map_us = 0;
+        uint64_t downloads = 0;
+        uint64_t download_us = 0;
+        uint64_t cache_hits = 0;
+        uint64_t cache_misses = 0;
+        uint64_t fallbacks = 0;
+        size_t cache_size = 0;
+        // since the previous call of stats()
+        int64_t map_max_us = 0;
+    };
+
+    // imports of surfaces beyond this are not kept, no decoder pool is that large
+    static const size_t CacheMax = 64;
+
+    static const char *pathName(Path path);
+
+    FrameMapper();
+    ~FrameMapper();
+
+    // Render thread. Same as pl_map_avframe_ex(), frame stays owned by the caller. tex must point to 4 textures.
+    bool map(pl_gpu gpu, struct pl_frame *out, const AVFrame *frame, pl_tex *tex);
+    // Render thread. Accepts empty frames like pl_unmap_avframe().
+    void unmap(pl_gpu gpu, struct pl_frame *frame);
+    // Render thread. Drops all imports, those that frames are still mapped from go once they are unmapped.
+    void clear(pl_gpu gpu);
+
+    // Frame thread, after a hardware frame has been downloaded.
+    void pushDownload(int64_t download_us);
+    // The zero copy path failed and everything is downloaded from now on.
+    void pushFallback();
+
+    // Any thread, resets map_max_us.
+    Stats stats();
+
+private:
+    struct Import {
+        pl_tex tex[4] = {};
+        int num_tex = 0;
+        size_t mapped = 0; // frames currently mapped from it
+        bool retired = false; // destroyed once nothing is mapped from it anymore
+    };
+
+    // what a frame mapped from an import keeps alive until it is unmapped
+    struct Mapping {
+        AVFrame *frame;
+        Import *surface_import;
+    };
+
+    bool mapDmaBuf(pl_gpu gpu, struct pl_frame *out, const AVFrame *frame);
+    bool importSurface(pl_gpu gpu, Import *surface_import, const AVFrame *frame, const AVFrame *drm_frame);
+    void releaseImport(pl_gpu gpu, Import *surface_import);
+    void retireImports(pl_gpu gpu);
+
+    AVBufferRef *pool = nullptr; // hw_frames_ctx the imports are from, kept so its surfaces stay what they are
+    std::unordered_map<uintptr_t, Import *> imports; // by VASurfaceID
+    std::vector<Import *> retired_imports; // still mapped by frames from before the pool changed
+    std::unordered_set<const void *> mappings; // user_data of the frames mapped from imports
+    uint64_t downloads_seen = 0;
+
+    std::atomic<Path> path;
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> map_us;
+    std::atomic<int64_t> map_max_us;
+    std::atomic<uint64_t> downloads;
+    std::atomic<uint64_t> download_us;
+    std::atomic<uint64_t> cache_hits;
+    std::atomic<uint64_t> cache_misses;
+    std::atomic<uint64_t> fallbacks;
+    std::atomic<size_t> cache_size;
+};
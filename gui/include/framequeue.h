@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <chiaki/metrics.h>
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// Hands decoded frames from the decoder thread to the render thread.
+// Lock-free for exactly one producer and one consumer, every frame is timestamped when queued.
+// If the queue is full, the producer drops the oldest frame, so the newest one always gets in.
+// Drops and waits are counted in the lib's metrics registry as renderer.*.
+// Which frame is shown when is up to the PresentationScheduler.
+class FrameQueue
+{
+public:
+    enum class DropReason {
+        // replaced by a newer frame before it could be shown (LowestLatency)
+        Superseded,
+        // skipped to keep up with the stream (Smoothest)
+        Late,
+        // pushed out by a newer frame while the queue was full
+        Overflow,
+        Count
+    };
+
+    static const size_t Capacity = 4;
+
+    // clock of the queued timestamps
+    static int64_t nowUs();
+
+    FrameQueue();
+    ~FrameQueue();
+
+    // Producer side, takes ownership of frame. Drops the oldest queued frame if there is no room.
+    void push(AVFrame *frame);
+
+    // Consumer side. Fills queued_us with the times the queued frames were pushed, oldest first,
+    // and returns how many there are.
+    size_t peek(int64_t *queued_us, size_t max) const;
+
+    // Consumer side. The frames reported by peek() may have been dropped on overflow in the meantime.
+    // Frees skip frames, counting them as reason, and returns the next one.
+    // Returns nullptr if no frame is left, otherwise the caller owns the frame.
+    AVFrame *pop(size_t skip, DropReason reason);
+
+    // Consumer side, free everything that is queued.
+    void clear();
+
+    size_t depth() const;
+    // since the process started, shared by all queues
+    uint64_t drops(DropReason reason) const { return chiaki_metric_get(drop_metrics[static_cast<size_t>(reason)]); }
+    // time the last popped frame spent in the queue
+    int64_t lastWaitUs() const { return last_wait_us; }
+
+private:
+    // atomic because a slot the consumer is still reading can be refilled after dropping its frame
+    struct Entry {
+        std::atomic<AVFrame *> frame;
+        std::atomic<int64_t> queued_us;
+    };
+
+    AVFrame *take(int64_t *queued_us);
+    void drop(DropReason reason);
+
+    Entry entries[Capacity];
+    std::atomic<size_t> head; // total frames pushed, only written by the producer
+    std::atomic<size_t> tail; // total frames popped or dropped on overflow, advanced by CAS on both sides
+    ChiakiMetric *drop_metrics[static_cast<size_t>(DropReason::Count)];
+    ChiakiMetric *wait_metric;
+    std::atomic<int64_t> last_wait_us;
+};
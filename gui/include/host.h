@@ -4,7 +4,9 @@
 #define CHIAKI_HOST_H
 
 #include <chiaki/regist.h>
+#include <chiaki/session.h>
 
+#include <QDateTime>
 #include <QMetaType>
 #include <QString>
 
@@ -128,6 +130,25 @@ class PsnHost
 
 };
 
+class ConnectProfile
+{
+	private:
+		QString key; // server MAC for local connections, DUID for PSN connections
+		ChiakiConnectProfile profile;
+		QDateTime validated;
+
+	public:
+		ConnectProfile();
+		ConnectProfile(const QString &key, const ChiakiConnectProfile &profile);
+
+		const QString &GetKey() const						{ return key; }
+		const ChiakiConnectProfile &GetProfile() const		{ return profile; }
+		QDateTime GetValidated() const						{ return validated; }
+
+		void SaveToSettings(QSettings *settings) const;
+		static ConnectProfile LoadFromSettings(QSettings *settings);
+};
+
 Q_DECLARE_METATYPE(HostMAC)
 Q_DECLARE_METATYPE(RegisteredHost)
 Q_DECLARE_METATYPE(ManualHost)
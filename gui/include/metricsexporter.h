@@ -0,0 +1,31 @@
+#pragma once
+
+#include <QObject>
+#include <QTimer>
+
+#include <chiaki/metrics.h>
+
+#include <cstdio>
+
+// Appends samples of the lib's metrics registry to a file on its own timer, to look at a session afterwards.
+// Sampling only reads the registry's atomics, so it never holds up the threads updating the metrics.
+class MetricsExporter : public QObject
+{
+    Q_OBJECT
+
+public:
+    MetricsExporter(QObject *parent = nullptr);
+    ~MetricsExporter();
+
+    // Written as CSV if path ends in .csv and as JSON lines otherwise, appending to what is already there.
+    bool start(const QString &path, int interval_ms);
+    void stop();
+
+private:
+    void exportSample();
+
+    QTimer timer;
+    FILE *file = nullptr;
+    ChiakiMetricsFormat format = CHIAKI_METRICS_FORMAT_JSONL;
+    bool header = false;
+};
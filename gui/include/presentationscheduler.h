@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Decides per display refresh which queued frame to show and whether to blend it with the one shown before.
+//
+// The frame interval of the stream and the jitter of the frames are estimated from the times they were queued,
+// the refresh interval and vsync phase of the display from the times presents returned, as long as presents wait for
+// the vsync (FIFO). Otherwise the vsync is free-running from the refresh rate guess.
+// In Smoothest mode, every frame is due at its arrival plus a delay that just covers the jitter and is shown at the
+// vsync it falls into. If the stream and the display cadence don't divide evenly, the frame is blended with the
+// previous one by how much of the vsync each covers, instead of showing the uneven repeat pattern as judder. That
+// needs every frame one vsync before the interval it starts in, so blending adds a vsync to the delay.
+// In LowestLatency mode, the newest frame is always shown right away.
+//
+// Plain bookkeeping without Qt or libplacebo, so it can be driven by a headless renderer.
+// All times are microseconds of FrameQueue::nowUs(). Only the stats getters may be called from other threads.
+class PresentationScheduler
+{
+public:
+    enum class Mode {
+        LowestLatency,
+        Smoothest
+    };
+
+    struct Plan {
+        // queued frames to drop
+        size_t skip = 0;
+        // the frame after the skipped ones replaces the current one, otherwise the current one is shown again
+        bool show = false;
+        // blend the previous and the current frame, placed at timestamps
+        bool mix = false;
+        // previous and current frame relative to the start of the vsync interval the upcoming vsync shows,
+        // in vsyncs, as pl_frame_mix wants them
+        float timestamps[2] = {};
+    };
+
+    // time between two new frames on screen, 1 ms per bucket, the last one collects everything longer
+    static const size_t HistogramBuckets = 50;
+    // frames that may wait for their turn in Smoothest mode, older ones are skipped
+    static const size_t BacklogMax = 2;
+
+    PresentationScheduler();
+
+    void setMode(Mode mode) { current_mode = mode; }
+    Mode mode() const { return current_mode; }
+
+    // guess until presents have been measured, e.g. from QScreen
+    void setRefreshRate(double hz);
+
+    // Call before rendering, with the push times of the queued frames, oldest first.
+    Plan plan(int64_t now_us, const int64_t *queued_us, size_t count);
+
+    // Call once the frame has been presented.
+    // vsync_paced tells whether the present had to wait for a vsync, only those times say anything about the display:
+    // false in MAILBOX or IMMEDIATE present mode and for on-demand renders that found the swapchain idle.
+    void presented(int64_t now_us, bool new_frame, bool vsync_paced);
+
+    int64_t frameIntervalUs() const { return frame_interval_pub.load(std::memory_order_relaxed); }
+    int64_t vsyncIntervalUs() const { return vsync_interval_pub.load(std::memory_order_relaxed); }
+    int64_t jitterUs() const { return jitter_pub.load(std::memory_order_relaxed); }
+    int64_t delayUs() const { return delay_pub.load(std::memory_order_relaxed); }
+    uint64_t histogram(size_t bucket) const { return histogram_counts[bucket].load(std::memory_order_relaxed); }
+
+private:
+    void frameArrived(int64_t arrival_us);
+    bool cadenceMismatch() const;
+    void publish();
+
+    Mode current_mode = Mode::LowestLatency;
+
+    int64_t last_arrival_us = 0;
+    int64_t frame_interval_us = 0;
+    int64_t jitter_us = 0;
+    int64_t delay_us = 0;
+
+    int64_t vsync_phase_us = 0; // predicted time of the last vsync
+    int64_t vsync_interval_us = 0;
+    bool vsync_measured = false;
+
+    bool have_current = false;
+    bool have_previous = false;
+    int64_t current_due_us = 0;
+    int64_t previous_due_us = 0;
+    int64_t last_new_frame_us = 0;
+
+    std::atomic<int64_t> frame_interval_pub;
+    std::atomic<int64_t> vsync_interval_pub;
+    std::atomic<int64_t> jitter_pub;
+    std::atomic<int64_t> delay_pub;
+    std::atomic<uint64_t> histogram_counts[HistogramBuckets];
+};
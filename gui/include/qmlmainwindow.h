@@ -2,12 +2,20 @@
 
 #include "streamsession.h"
 #include "settings.h"
+#include "framequeue.h"
+#include "framemapper.h"
+#include "presentationscheduler.h"
+#include "renderparams.h"
 
-#include <QMutex>
+#include <QVariantList>
+#include <QVariantMap>
 #include <QWindow>
 #include <QQuickWindow>
 #include <QLoggingCategory>
 
+#include <memory>
+#include <vector>
+
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavutil/hwcontext_vulkan.h>
@@ -44,6 +52,11 @@ class QmlMainWindow : public QWindow
     Q_PROPERTY(VideoMode videoMode READ videoMode WRITE setVideoMode NOTIFY videoModeChanged)
     Q_PROPERTY(float ZoomFactor READ zoomFactor WRITE setZoomFactor NOTIFY zoomFactorChanged)
     Q_PROPERTY(VideoPreset videoPreset READ videoPreset WRITE setVideoPreset NOTIFY videoPresetChanged)
+    Q_PROPERTY(FramePacing framePacing READ framePacing WRITE setFramePacing NOTIFY framePacingChanged)
+    Q_PROPERTY(QVariantMap frameQueueStats READ frameQueueStats NOTIFY frameQueueStatsChanged)
+    Q_PROPERTY(QVariantList frameTimeHistogram READ frameTimeHistogram NOTIFY frameTimeHistogramChanged)
+    Q_PROPERTY(QVariantMap frameMappingStats READ frameMappingStats NOTIFY frameMappingStatsChanged)
+    Q_PROPERTY(QVariantList metrics READ metrics NOTIFY metricsChanged)
 
 public:
     enum class VideoMode {
@@ -61,6 +74,12 @@ public:
     };
     Q_ENUM(VideoPreset);
 
+    enum class FramePacing {
+        LowestLatency,
+        Smoothest
+    };
+    Q_ENUM(FramePacing);
+
     QmlMainWindow(Settings *settings,  bool exit_app_on_stream_exit = false);
     QmlMainWindow(const StreamSessionConnectInfo &connect_info);
     ~QmlMainWindow();
@@ -84,12 +103,22 @@ public:
     VideoPreset videoPreset() const;
     void setVideoPreset(VideoPreset mode);
 
+    FramePacing framePacing() const;
+    void setFramePacing(FramePacing pacing);
+
+    QVariantMap frameQueueStats() const;
+    QVariantList frameTimeHistogram() const;
+    QVariantMap frameMappingStats() const;
+    QVariantList metrics() const;
+
     Q_INVOKABLE void grabInput();
     Q_INVOKABLE void releaseInput();
     Q_INVOKABLE void updatePlacebo();
 
     void show();
-    void presentFrame(AVFrame *frame, int32_t frames_lost);
+    void presentFrame(AVFrame *frame);
+    // Called on the frame thread for hardware frames that had to be downloaded before presentFrame()
+    void reportFrameDownload(int64_t download_us);
 
     AVBufferRef *vulkanHwDeviceCtx();
 
@@ -100,7 +129,13 @@ signals:
     void videoModeChanged();
     void zoomFactorChanged();
     void videoPresetChanged();
+    void framePacingChanged();
+    void frameQueueStatsChanged();
+    void frameTimeHistogramChanged();
+    void frameMappingStatsChanged();
+    void metricsChanged();
     void menuRequested();
+    void metricsRequested();
 
 private:
     void init(Settings *settings, bool exit_app_on_stream_exit = false);
@@ -114,6 +149,8 @@ private:
     void beginFrame();
     void endFrame();
     void render();
+    void compileCustomRenderParams();
+    void sampleMetrics();
     bool handleShortcut(QKeyEvent *event);
     bool event(QEvent *event) override;
     QObject *focusObject() const override;
@@ -123,10 +160,24 @@ private:
     bool keep_video = false;
     int grab_input = 0;
     int dropped_frames = 0;
-    int dropped_frames_current = 0;
+    ChiakiMetric *metric_decoder_frames_lost = {};
+    int64_t decoder_frames_lost_prev = 0;
+    uint64_t frame_queue_drops_prev[static_cast<size_t>(FrameQueue::DropReason::Count)] = {};
+    QVariantMap frame_queue_stats;
+    uint64_t frame_time_histogram_prev[PresentationScheduler::HistogramBuckets] = {};
+    QVariantList frame_time_histogram;
+    std::atomic<double> screen_refresh_rate = {0.0};
+    FrameMapper::Stats frame_mapping_prev;
+    QVariantMap frame_mapping_stats;
+    ChiakiMetric *metric_frames_presented = {};
+    ChiakiMetric *metric_render_us = {};
+    // what the registry held a second ago, counters are shown as rates
+    std::vector<ChiakiMetricSample> metrics_prev;
+    QVariantList metrics_overlay;
     VideoMode video_mode = VideoMode::Normal;
     float zoom_factor = 0;
     VideoPreset video_preset = VideoPreset::HighQuality;
+    std::atomic<FramePacing> frame_pacing = {FramePacing::LowestLatency};
     Settings *settings = {};
 
     QmlBackend *backend = {};
@@ -143,11 +194,16 @@ private:
     VkSurfaceKHR surface = VK_NULL_HANDLE;
     int vk_decode_queue_index = -1;
     QSize swapchain_size;
-    QMutex frame_mutex;
     QThread *render_thread = {};
-    AVFrame *av_frame = {};
+    FrameQueue frame_queue;
+    PresentationScheduler presentation_scheduler;
+    bool swapchain_fifo = false;
+    bool render_chained = false; // this render was requested by the previous one
+    FrameMapper frame_mapper;
     pl_frame current_frame = {};
     pl_frame previous_frame = {};
+    uint64_t current_frame_signature = 0; // previous_frame is always the one before
+    bool previous_frame_concealed = false;
     std::atomic<bool> render_scheduled = {false};
 
     QVulkanInstance *qt_vk_inst = {};
@@ -162,8 +218,10 @@ private:
     bool quick_frame = false;
     bool quick_need_sync = false;
     std::atomic<bool> quick_need_render = {false};
-    pl_options renderparams_opts = {};
-    bool renderparams_changed = false;
+    // by VideoPreset, only touched on the GUI thread
+    std::array<std::shared_ptr<const RenderParamsSnapshot>, 4> render_presets;
+    // the one render() uses, swapped with std::atomic_store()
+    std::shared_ptr<const RenderParamsSnapshot> active_render_params;
 
     struct {
         PFN_vkGetDeviceProcAddr vkGetDeviceProcAddr;
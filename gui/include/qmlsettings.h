@@ -45,6 +45,7 @@ class QmlSettings : public QObject
     Q_PROPERTY(uint customResolutionWidth READ customResolutionWidth WRITE setCustomResolutionWidth NOTIFY customResolutionWidthChanged)
     Q_PROPERTY(uint customResolutionHeight READ customResolutionHeight WRITE setCustomResolutionHeight NOTIFY customResolutionHeightChanged)
     Q_PROPERTY(int videoPreset READ videoPreset WRITE setVideoPreset NOTIFY videoPresetChanged)
+    Q_PROPERTY(int presentationPolicy READ presentationPolicy WRITE setPresentationPolicy NOTIFY presentationPolicyChanged)
     Q_PROPERTY(float sZoomFactor READ sZoomFactor WRITE setSZoomFactor NOTIFY sZoomFactorChanged)
     Q_PROPERTY(int packetLossMax READ packetLossMax WRITE setPacketLossMax NOTIFY packetLossMaxChanged)
     Q_PROPERTY(QString autoConnectMac READ autoConnectMac WRITE setAutoConnectMac NOTIFY autoConnectMacChanged)
@@ -240,6 +241,9 @@ public:
     int videoPreset() const;
     void setVideoPreset(int preset);
 
+    int presentationPolicy() const;
+    void setPresentationPolicy(int policy);
+
     QString autoConnectMac() const;
     void setAutoConnectMac(const QString &mac);
 
@@ -531,6 +535,7 @@ signals:
     void customResolutionHeightChanged();
     void sZoomFactorChanged();
     void videoPresetChanged();
+    void presentationPolicyChanged();
     void autoConnectMacChanged();
     void audioDevicesChanged();
     void registeredHostsChanged();
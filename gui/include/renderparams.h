@@ -0,0 +1,30 @@
+#pragma once
+
+#include <QMap>
+#include <QString>
+#include <QStringList>
+
+extern "C" {
+#include <libplacebo/options.h>
+}
+
+// libplacebo render parameters, either a builtin preset or compiled once from the options the user set.
+// Never changed after construction, so the render thread can keep using one while the GUI thread swaps in another.
+class RenderParamsSnapshot
+{
+public:
+    // params must outlive the snapshot, e.g. pl_render_default_params
+    explicit RenderParamsSnapshot(const struct pl_render_params *params);
+    // Applies values on top of base. Options that can't be set are skipped and added to invalid as key=value.
+    RenderParamsSnapshot(pl_log log, const struct pl_render_params *base, const QMap<QString, QString> &values, QStringList *invalid);
+    ~RenderParamsSnapshot();
+
+    RenderParamsSnapshot(const RenderParamsSnapshot &) = delete;
+    RenderParamsSnapshot &operator=(const RenderParamsSnapshot &) = delete;
+
+    const struct pl_render_params *params() const { return render_params; }
+
+private:
+    pl_options opts = {};
+    const struct pl_render_params *render_params;
+};
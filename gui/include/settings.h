@@ -65,6 +65,11 @@ enum class PlaceboPreset {
 	Custom
 };
 
+enum class PresentationPolicy {
+	LowestLatency,
+	Smoothest
+};
+
 enum class WindowType {
 	SelectedResolution,
 	CustomResolution,
@@ -188,6 +193,7 @@ class Settings : public QObject
 		size_t ps4s_registered;
 		QMap<int, ManualHost> manual_hosts;
 		int manual_hosts_id_next;
+		QMap<QString, ConnectProfile> connect_profiles;
 
 		void LoadRegisteredHosts(QSettings *qsettings = nullptr);
 		void SaveRegisteredHosts(QSettings *qsettings = nullptr);
@@ -198,6 +204,9 @@ class Settings : public QObject
 		void LoadManualHosts(QSettings *qsettings = nullptr);
 		void SaveManualHosts(QSettings *qsettings = nullptr);
 
+		void LoadConnectProfiles();
+		void SaveConnectProfiles();
+
 		void LoadControllerMappings(QSettings *qsettings = nullptr);
 		void SaveControllerMappings(QSettings *qsettings = nullptr);
 
@@ -305,12 +314,25 @@ class Settings : public QObject
 		PlaceboPreset GetPlaceboPreset() const;
 		void SetPlaceboPreset(PlaceboPreset preset);
 
+		PresentationPolicy GetPresentationPolicy() const;
+		void SetPresentationPolicy(PresentationPolicy policy);
+
 		float GetZoomFactor() const;
 		void SetZoomFactor(float factor);
 
 		float GetPacketLossMax() const;
 		void SetPacketLossMax(float factor);
 
+		/**
+		 * Stream socket options for managed networks, only read from the settings file (group "socket").
+		 */
+		ChiakiSocketTuning GetSocketTuning() const;
+
+		/**
+		 * Only read from the settings file (group "threads"), realtime scheduling is opt-in.
+		 */
+		ChiakiThreadProfile GetThreadProfile() const;
+
 		RegisteredHost GetAutoConnectHost() const;
 		void SetAutoConnectHost(const QByteArray &mac);
 
@@ -604,6 +626,14 @@ class Settings : public QObject
 		bool GetManualHostExists(int id)							{ return manual_hosts.contains(id); }
 		ManualHost GetManualHost(int id) const						{ return manual_hosts[id]; }
 
+		/**
+		 * @return the cached connection profile for a console (by MAC or DUID),
+		 * invalid if there is none or it is too old to be trusted
+		 */
+		ChiakiConnectProfile GetConnectProfile(const QString &key) const;
+		void SetConnectProfile(const ConnectProfile &profile);
+		void RemoveConnectProfile(const QString &key);
+
 		QMap<QString, QString> GetControllerMappings() const		{ return controller_mappings; }
 		void SetControllerMapping(const QString &vidpid, const QString &mapping);
 		void RemoveControllerMapping(const QString &vidpid);
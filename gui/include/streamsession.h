@@ -7,6 +7,10 @@
 #include <chiaki/opusdecoder.h>
 #include <chiaki/opusencoder.h>
 #include <chiaki/ffmpegdecoder.h>
+#include <chiaki/haptics.h>
+#include <chiaki/miccapture.h>
+#include <chiaki/ringbuffer.h>
+#include <chiaki/metrics.h>
 
 #if CHIAKI_LIB_ENABLE_PI_DECODER
 #include <chiaki/pidecoder.h>
@@ -38,8 +42,11 @@
 #include <QTimer>
 #include <QQueue>
 #include <QElapsedTimer>
+#include <QVariantMap>
+
+#include <atomic>
+
 #if CHIAKI_GUI_ENABLE_SPEEX
-#include <QQueue>
 #include <speex/speex_echo.h>
 #include <speex/speex_preprocess.h>
 #endif
@@ -80,6 +87,8 @@ struct StreamSessionConnectInfo
 	QString initial_login_pin;
 	ChiakiConnectVideoProfile video_profile;
 	double packet_loss_max;
+	ChiakiSocketTuning socket_tuning;
+	ChiakiThreadProfile thread_profile;
 	unsigned int audio_buffer_size;
 	bool fullscreen;
 	bool zoom;
@@ -99,6 +108,7 @@ struct StreamSessionConnectInfo
 	int32_t echo_suppress_level;
 #endif
 	QString duid;
+	QString connect_profile_key;
 	QString psn_token;
 	QString psn_account_id;
 	uint16_t dpad_touch_increment;
@@ -122,13 +132,6 @@ struct StreamSessionConnectInfo
 			bool stretch);
 };
 
-struct MicBuf
-{
-	int16_t *buf;
-	uint32_t size_bytes;
-	uint32_t current_byte;
-};
-
 class StreamSession : public QObject
 {
 	friend class StreamSessionPrivate;
@@ -139,6 +142,8 @@ class StreamSession : public QObject
 	Q_PROPERTY(double measuredBitrate READ GetMeasuredBitrate NOTIFY MeasuredBitrateChanged)
 	Q_PROPERTY(double averagePacketLoss READ GetAveragePacketLoss NOTIFY AveragePacketLossChanged)
 	Q_PROPERTY(bool muted READ GetMuted WRITE SetMuted NOTIFY MutedChanged)
+	Q_PROPERTY(double micLatency READ GetMicLatency NOTIFY MicLatencyChanged)
+	Q_PROPERTY(QVariantMap linkQuality READ GetLinkQuality NOTIFY LinkQualityChanged)
 	Q_PROPERTY(bool cantDisplay READ GetCantDisplay NOTIFY CantDisplayChanged)
 
 	private:
@@ -147,7 +152,7 @@ class StreamSession : public QObject
 		ChiakiOpusDecoder opus_decoder;
 		ChiakiOpusEncoder opus_encoder;
 		bool connected;
-		bool muted;
+		std::atomic<bool> muted; // also read by the capture callback and the mic encode thread
 		bool mic_connected;
 #ifdef Q_OS_MACOS
 		bool mic_authorization;
@@ -155,9 +160,15 @@ class StreamSession : public QObject
 		bool allow_unmute;
 		int input_block;
 		QString host;
+		Settings *settings;
+		QString connect_profile_key;
+		bool connect_profile_used = false;
 		double measured_bitrate = 0;
 		double average_packet_loss = 0;
-		QList<double> packet_loss_history;
+		double mic_latency = 0;
+		QVariantMap link_quality;
+		ChiakiMetric *metric_bitrate_kbps;
+		ChiakiMetric *metric_packet_loss_avg_ppm;
 		bool cant_display = false;
 		int haptics_handheld;
 		QHash<int, Controller *> controllers;
@@ -180,7 +191,6 @@ class StreamSession : public QObject
 		int16_t * sdeck_haptics_senderr;
 		int sdeck_queue_segment;
 		uint64_t sdeck_last_haptic;
-		bool sdeck_skipl, sdeck_skipr;
 		bool enable_steamdeck_haptics;
 		ChiakiOrientationTracker sdeck_orient_tracker;
 		ChiakiAccelNewZero sdeck_accel_zero, sdeck_real_accel;
@@ -219,6 +229,8 @@ class StreamSession : public QObject
 		SDL_AudioDeviceID audio_out;
 		SDL_AudioDeviceID audio_in;
 		size_t audio_out_sample_size;
+		unsigned int audio_out_channels = 0;
+		unsigned int audio_out_rate = 0;
 		bool audio_out_drain_queue;
 		unsigned int audio_buffer_size;
 		ChiakiHolepunchSession holepunch_session;
@@ -227,16 +239,27 @@ class StreamSession : public QObject
 		SpeexPreprocessState *preprocess_state;
 		bool speech_processing_enabled;
 		uint8_t *echo_resampler_buf, *mic_resampler_buf;
-		QQueue<int16_t *> echo_to_cancel;
+		// mono playback frames, written by the audio sink and read by the mic encode thread
+		ChiakiRingBuffer echo_to_cancel;
+		std::atomic<bool> echo_to_cancel_init;
+		int16_t *echo_buf;
 #endif
 		SDL_AudioDeviceID haptics_output;
-		uint8_t *haptics_resampler_buf;
-		MicBuf mic_buf;
+		int16_t *haptics_resampler_buf;
+		ChiakiHapticsResampler haptics_resampler;
+		ChiakiMicCapture mic_capture;
+		bool mic_capture_started;
+		uint32_t mic_frame_size_bytes;
 		QMap<Qt::Key, int> key_map;
 		QElapsedTimer connect_timer;
+		QElapsedTimer first_frame_timer;
+		uint64_t startup_ms = 0;
 
+		void OpenAudioOut(unsigned int channels, unsigned int rate);
 		void PushAudioFrame(int16_t *buf, size_t samples_count);
 		void PushHapticsFrame(uint8_t *buf, size_t buf_size);
+		void EncodeMicFrame(int16_t *buf, size_t samples_count);
+		void StopMic();
 		void CantDisplayMessage(bool cant_display);
 		ChiakiErrorCode InitiatePsnConnection(QString psn_token);
 #ifdef Q_OS_MACOS
@@ -279,6 +302,8 @@ class StreamSession : public QObject
 		double GetMeasuredBitrate()	{ return measured_bitrate; }
 		double GetAveragePacketLoss()	{ return average_packet_loss; }
 		bool GetMuted()	{ return muted; }
+		double GetMicLatency()	{ return mic_latency; }
+		QVariantMap GetLinkQuality()	{ return link_quality; }
 		void SetMuted(bool enable)	{ if (enable != muted) ToggleMute(); }
 		bool GetCantDisplay()	{ return cant_display; }
 		ChiakiErrorCode ConnectPsnConnection(QString duid, bool ps5);
@@ -287,6 +312,7 @@ class StreamSession : public QObject
 		ChiakiLog *GetChiakiLog()				{ return log.GetChiakiLog(); }
 		QList<Controller *> GetControllers()	{ return controllers.values(); }
 		ChiakiFfmpegDecoder *GetFfmpegDecoder()	{ return ffmpeg_decoder; }
+		const ChiakiThreadProfile &GetThreadProfile()	{ return session.connect_info.thread_profile; }
 #if CHIAKI_LIB_ENABLE_PI_DECODER
 		ChiakiPiDecoder *GetPiDecoder()	{ return pi_decoder; }
 #endif
@@ -296,7 +322,6 @@ class StreamSession : public QObject
 		void HandleMouseReleaseEvent(QMouseEvent *event);
 		void HandleMousePressEvent(QMouseEvent *event);
 		void HandleMouseMoveEvent(QMouseEvent *event, qreal width, qreal height);
-		void ReadMic(const QByteArray &micdata);
 
 		void BlockInput(bool block) { input_block = block ? 1 : 2; SendFeedbackState(); }
 
@@ -313,6 +338,8 @@ class StreamSession : public QObject
 		void MeasuredBitrateChanged();
 		void AveragePacketLossChanged();
 		void MutedChanged();
+		void MicLatencyChanged();
+		void LinkQualityChanged();
 		void CantDisplayChanged(bool cant_display);
 
 	private slots:
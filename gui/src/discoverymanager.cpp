@@ -4,6 +4,8 @@
 #include <exception.h>
 #include <settings.h>
 
+#include <QTimer>
+
 #include <cstring>
 
 #ifdef _WIN32
@@ -18,9 +20,13 @@
 #include <ifaddrs.h>
 #endif
 
+// pings back off from PING_FAST_MS after a change to PING_MS while nothing happens,
+// a console that stopped answering is dropped after DROP_PINGS pings, so within 1.5 s at most
 #define PING_MS		500
-#define HOSTS_MAX	16
+#define PING_FAST_MS	250
 #define DROP_PINGS	3
+// hosts are found by hash, so a subnet with dozens of consoles costs no more per ping than a few
+#define HOSTS_MAX	64
 
 HostMAC DiscoveryHost::GetHostMAC() const
 {
@@ -33,29 +39,24 @@ HostMAC DiscoveryHost::GetHostMAC() const
 	return HostMAC((uint8_t *)data.constData());
 }
 
-static void DiscoveryServiceHostsCallback(ChiakiDiscoveryHost *hosts, size_t hosts_count, void *user);
-static void DiscoveryServiceHostsManualCallback(ChiakiDiscoveryHost *hosts, size_t hosts_count, void *user);
+static void DiscoveryServiceHostCallback(ChiakiDiscoveryServiceHostEvent event, ChiakiDiscoveryHost *host, void *user);
 
 DiscoveryManager::DiscoveryManager(QObject *parent) : QObject(parent)
 {
 	chiaki_log_init(&log, CHIAKI_LOG_ALL & ~CHIAKI_LOG_VERBOSE, chiaki_log_cb_print, nullptr);
 
 	service_active = false;
-	service_active_ipv6 = false;
 }
 
 DiscoveryManager::~DiscoveryManager()
 {
 	if(service_active)
 		chiaki_discovery_service_fini(&service);
-	if(service_active_ipv6)
-		chiaki_discovery_service_fini(&service_ipv6);
-	qDeleteAll(manual_services);
 }
 
 void DiscoveryManager::SetActive(bool active)
 {
-	if(service_active == active && service_active_ipv6 == active)
+	if(service_active == active)
 		return;
 
 	if(active)
@@ -64,9 +65,10 @@ void DiscoveryManager::SetActive(bool active)
 		{
 			ChiakiDiscoveryServiceOptions options = {};
 			options.ping_ms = PING_MS;
+			options.ping_fast_ms = PING_FAST_MS;
 			options.hosts_max = HOSTS_MAX;
 			options.host_drop_pings = DROP_PINGS;
-			options.cb = DiscoveryServiceHostsCallback;
+			options.host_cb = DiscoveryServiceHostCallback;
 			options.cb_user = this;
 
 			struct sockaddr_in in_addr = {};
@@ -77,6 +79,15 @@ void DiscoveryManager::SetActive(bool active)
 			options.send_addr = &addr;
 			options.send_addr_size = sizeof(in_addr);
 			options.send_host = nullptr;
+
+			struct sockaddr_in6 in_addr_ipv6 = {};
+			in_addr_ipv6.sin6_family = AF_INET6;
+			inet_pton(AF_INET6, "FF02::1", &in_addr_ipv6.sin6_addr);
+			struct sockaddr_storage addr_ipv6;
+			memcpy(&addr_ipv6, &in_addr_ipv6, sizeof(in_addr_ipv6));
+			options.send_addr_ipv6 = &addr_ipv6;
+			options.send_addr_ipv6_size = sizeof(in_addr_ipv6);
+
 			options.broadcast_addrs = nullptr;
 			options.broadcast_num = 0;
 			QList<int32_t> broadcast_addresses;
@@ -206,40 +217,14 @@ void DiscoveryManager::SetActive(bool active)
 			if(err != CHIAKI_ERR_SUCCESS)
 			{
 				service_active = false;
-				CHIAKI_LOGE(&log, "DiscoveryManager failed to init Discovery Service IPV4");
+				CHIAKI_LOGE(&log, "DiscoveryManager failed to init Discovery Service");
 				return;
 			}
 			else
 				service_active = true;
 		}
-		if(!service_active_ipv6)
-		{
-			ChiakiDiscoveryServiceOptions options_ipv6 = {};
-			options_ipv6.ping_ms = PING_MS;
-			options_ipv6.hosts_max = HOSTS_MAX;
-			options_ipv6.host_drop_pings = DROP_PINGS;
-			options_ipv6.cb = DiscoveryServiceHostsCallback;
-			options_ipv6.cb_user = this;
-			struct sockaddr_in6 in_addr_ipv6 = {};
-			in_addr_ipv6.sin6_family = AF_INET6;
-			inet_pton(AF_INET6, "FF02::1", &in_addr_ipv6.sin6_addr);
-			struct sockaddr_storage addr_ipv6;
-			memcpy(&addr_ipv6, &in_addr_ipv6, sizeof(in_addr_ipv6));
-			options_ipv6.send_addr = &addr_ipv6;
-			options_ipv6.send_addr_size = sizeof(in_addr_ipv6);
-			options_ipv6.send_host = nullptr;
 
-			ChiakiErrorCode err = chiaki_discovery_service_init(&service_ipv6, &options_ipv6, &log);
-			if(err != CHIAKI_ERR_SUCCESS)
-			{
-				service_active_ipv6 = false;
-				CHIAKI_LOGE(&log, "DiscoveryManager failed to init Discovery Service IPV6");
-			}
-			else
-				service_active_ipv6 = true;
-		}
-
-		UpdateManualServices();
+		UpdateManualHosts();
 	}
 	else
 	{
@@ -248,15 +233,8 @@ void DiscoveryManager::SetActive(bool active)
 			chiaki_discovery_service_fini(&service);
 			service_active = false;
 		}
-		if(service_active_ipv6)
-		{
-			chiaki_discovery_service_fini(&service_ipv6);
-			service_active_ipv6 = false;
-		}
-		qDeleteAll(manual_services);
-		manual_services.clear();
 
-		hosts = {};
+		ClearHosts();
 		emit HostsUpdated();
 	}
 
@@ -266,9 +244,9 @@ void DiscoveryManager::SetSettings(Settings *settings)
 {
 	this->settings = settings;
 	chiaki_log_set_level(&log, settings->GetLogLevelMask());
-	connect(settings, &Settings::ManualHostsUpdated, this, &DiscoveryManager::UpdateManualServices);
-	connect(settings, &Settings::RegisteredHostsUpdated, this, &DiscoveryManager::UpdateManualServices);
-	UpdateManualServices();
+	connect(settings, &Settings::ManualHostsUpdated, this, &DiscoveryManager::UpdateManualHosts);
+	connect(settings, &Settings::RegisteredHostsUpdated, this, &DiscoveryManager::UpdateManualHosts);
+	UpdateManualHosts();
 }
 
 void DiscoveryManager::SendWakeup(const QString &host, const QByteArray &regist_key, bool ps5)
@@ -290,38 +268,69 @@ void DiscoveryManager::SendWakeup(const QString &host, const QByteArray &regist_
 		CHIAKI_LOGE(&log, "DiscoveryManager got invalid regist key for wakeup");
 		throw Exception("Invalid regist key");
 	}
-	char *ipv6 = strchr(host.toUtf8().data(), ':');
 	ChiakiErrorCode err;
-	if(ipv6)
-		err = chiaki_discovery_wakeup(&log, service_active_ipv6 ? &service_ipv6.discovery : nullptr, host.toUtf8().constData(), credential, ps5);
+	if(service_active)
+		err = chiaki_discovery_service_wakeup(&service, host.toUtf8().constData(), credential, ps5);
 	else
-		err = chiaki_discovery_wakeup(&log, service_active ? &service.discovery : nullptr, host.toUtf8().constData(), credential, ps5);
+		err = chiaki_discovery_wakeup(&log, nullptr, host.toUtf8().constData(), credential, ps5);
 
 	if(err != CHIAKI_ERR_SUCCESS)
 		throw Exception(QString("Failed to send Packet: %1").arg(chiaki_error_string(err)));
 }
 
-const QList<DiscoveryHost> DiscoveryManager::GetHosts() const
+void DiscoveryManager::ClearHosts()
 {
-	QList<DiscoveryHost> ret = hosts;
-	QSet<QString> discovered_hosts;
-	for(const auto &host : std::as_const(ret))
-		discovered_hosts.insert(host.host_addr);
-	for(auto s : std::as_const(manual_services))
-		if(s->discovered && !discovered_hosts.contains(s->discovery_host.host_addr))
-			ret.append(s->discovery_host);
-	return ret;
+	hosts.clear();
+	host_indices.clear();
 }
 
-void DiscoveryManager::DiscoveryServiceHosts(QList<DiscoveryHost> hosts)
+void DiscoveryManager::ScheduleHostsUpdated()
 {
-	this->hosts = std::move(hosts);
-	emit HostsUpdated();
+	// a burst of events, e.g. when discovery starts, results in a single update
+	if(hosts_update_pending)
+		return;
+	hosts_update_pending = true;
+	QTimer::singleShot(0, this, [this] {
+		hosts_update_pending = false;
+		emit HostsUpdated();
+	});
 }
 
-void DiscoveryManager::UpdateManualServices()
+void DiscoveryManager::DiscoveryServiceHostEvent(int event, DiscoveryHost host)
 {
-	if(!settings || (!service_active && !service_active_ipv6))
+	if(!service_active)
+		return;
+
+	auto it = host_indices.constFind(host.host_id);
+	if(event == CHIAKI_DISCOVERY_SERVICE_HOST_REMOVED)
+	{
+		if(it == host_indices.constEnd())
+			return;
+		qsizetype index = it.value();
+		hosts.removeAt(index);
+		host_indices.erase(it);
+		for(auto &i : host_indices)
+			if(i > index)
+				i--;
+		ScheduleHostsUpdated();
+		return;
+	}
+
+	if(it == host_indices.constEnd())
+	{
+		host_indices.insert(host.host_id, hosts.size());
+		hosts.append(std::move(host));
+		ScheduleHostsUpdated();
+		return;
+	}
+
+	hosts[it.value()] = std::move(host);
+	ScheduleHostsUpdated();
+}
+
+void DiscoveryManager::UpdateManualHosts()
+{
+	if(!settings || !service_active)
 		return;
 
 	QSet<QString> hosts;
@@ -329,99 +338,40 @@ void DiscoveryManager::UpdateManualServices()
 		if(settings->GetRegisteredHostRegistered(host.GetMAC()))
 			hosts.insert(host.GetHost());
 
-	const auto keys = manual_services.keys();
-	for(const auto &key : keys)
-		if(!hosts.contains(key))
-			delete manual_services.take(key);
-
+	QList<QByteArray> hosts_utf8;
 	for(const auto &host : std::as_const(hosts))
-	{
-		if(manual_services.contains(host))
-			continue;
-
-		ManualService *s = new ManualService;
-		s->manager = this;
-		manual_services[host] = s;
-
-		ChiakiDiscoveryServiceOptions options = {};
-		options.ping_ms = PING_MS;
-		options.ping_initial_ms = PING_MS;
-		options.hosts_max = 1;
-		options.host_drop_pings = DROP_PINGS;
-		options.cb = DiscoveryServiceHostsManualCallback;
-		options.cb_user = s;
-
-		QByteArray host_utf8 = host.toUtf8();
-		options.send_host = host_utf8.data();
-		char *ipv6 = strchr(options.send_host, ':');
-		struct sockaddr_storage addr;
-		if(ipv6)
-		{
-			addr.ss_family = AF_INET6;
-			options.send_addr = &addr;
-			options.send_addr_size = sizeof(struct sockaddr_in6);
-		}
-		else
-		{
-			addr.ss_family = AF_INET;
-			options.send_addr = &addr;
-			options.send_addr_size = sizeof(struct sockaddr_in);
-		}
-		ChiakiErrorCode err = chiaki_discovery_service_init(&s->service, &options, &log);
-		if(err != CHIAKI_ERR_SUCCESS)
-		{
-			CHIAKI_LOGE(&log, "DiscoveryManager failed to init manual discovery service for host: %s with error %s", qPrintable(host), chiaki_error_string(err));
-			manual_services.remove(host);
-			continue;
-		}
-	}
+		hosts_utf8.append(host.toUtf8());
+	QList<const char *> hosts_data;
+	for(const auto &host : std::as_const(hosts_utf8))
+		hosts_data.append(host.constData());
+
+	ChiakiErrorCode err = chiaki_discovery_service_set_manual_hosts(&service, hosts_data.data(), hosts_data.size());
+	if(err != CHIAKI_ERR_SUCCESS)
+		CHIAKI_LOGE(&log, "DiscoveryManager failed to set manual hosts: %s", chiaki_error_string(err));
 }
 
 class DiscoveryManagerPrivate
 {
 	public:
-		static void DiscoveryServiceHosts(DiscoveryManager *discovery_manager, const QList<DiscoveryHost> &hosts)
-		{
-			QMetaObject::invokeMethod(discovery_manager, "DiscoveryServiceHosts", Qt::ConnectionType::QueuedConnection, Q_ARG(QList<DiscoveryHost>, hosts));
-		}
-
-		static void DiscoveryServiceManualHost(DiscoveryManager *discovery_manager)
+		static void DiscoveryServiceHostEvent(DiscoveryManager *discovery_manager, ChiakiDiscoveryServiceHostEvent event, const DiscoveryHost &host)
 		{
-			QMetaObject::invokeMethod(discovery_manager, &DiscoveryManager::HostsUpdated);
+			QMetaObject::invokeMethod(discovery_manager, "DiscoveryServiceHostEvent", Qt::ConnectionType::QueuedConnection, Q_ARG(int, event), Q_ARG(DiscoveryHost, host));
 		}
 };
 
-static QList<DiscoveryHost> CreateHostsList(ChiakiDiscoveryHost *hosts, size_t hosts_count)
+static DiscoveryHost CreateHost(ChiakiDiscoveryHost *h)
 {
-	QList<DiscoveryHost> hosts_list;
-	hosts_list.reserve(hosts_count);
-
-	for(size_t i=0; i<hosts_count; i++)
-	{
-		ChiakiDiscoveryHost *h = hosts + i;
-		DiscoveryHost o = {};
-		o.ps5 = chiaki_discovery_host_is_ps5(h);
-		o.state = h->state;
-		o.host_request_port = h->host_request_port;
+	DiscoveryHost o = {};
+	o.ps5 = chiaki_discovery_host_is_ps5(h);
+	o.state = h->state;
+	o.host_request_port = h->host_request_port;
 #define CONVERT_STRING(name) if(h->name) { o.name = QString::fromLocal8Bit(h->name); }
-		CHIAKI_DISCOVERY_HOST_STRING_FOREACH(CONVERT_STRING)
+	CHIAKI_DISCOVERY_HOST_STRING_FOREACH(CONVERT_STRING)
 #undef CONVERT_STRING
-		hosts_list.append(o);
-	}
-
-	return hosts_list;
-}
-
-static void DiscoveryServiceHostsCallback(ChiakiDiscoveryHost *hosts, size_t hosts_count, void *user)
-{
-	DiscoveryManagerPrivate::DiscoveryServiceHosts(reinterpret_cast<DiscoveryManager *>(user), CreateHostsList(hosts, hosts_count));
+	return o;
 }
 
-static void DiscoveryServiceHostsManualCallback(ChiakiDiscoveryHost *hosts, size_t hosts_count, void *user)
+static void DiscoveryServiceHostCallback(ChiakiDiscoveryServiceHostEvent event, ChiakiDiscoveryHost *host, void *user)
 {
-	ManualService *s = reinterpret_cast<ManualService *>(user);
-	s->discovered = hosts_count;
-	if(s->discovered)
-		s->discovery_host = CreateHostsList(hosts, hosts_count).at(0);
-	DiscoveryManagerPrivate::DiscoveryServiceManualHost(s->manager);
+	DiscoveryManagerPrivate::DiscoveryServiceHostEvent(reinterpret_cast<DiscoveryManager *>(user), event, CreateHost(host));
 }
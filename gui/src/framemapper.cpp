@@ -0,0 +1,296 @@
+#include "framemapper.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+extern "C" {
+#include <libavutil/hwcontext.h>
+#include <libavutil/pixdesc.h>
+#include <libplacebo/utils/libav.h>
+}
+
+#if defined(__linux__) && __has_include(<libavutil/hwcontext_drm.h>)
+#define FRAME_MAPPER_DMABUF_CACHE
+extern "C" {
+#include <libavutil/hwcontext_drm.h>
+}
+#endif
+
+static int64_t nowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char *FrameMapper::pathName(Path path)
+{
+    switch (path) {
+    case Path::Vulkan: return "vulkan";
+    case Path::DmaBuf: return "dmabuf";
+    case Path::Upload: return "upload";
+    case Path::Download: return "download";
+    default: return "none";
+    }
+}
+
+FrameMapper::FrameMapper()
+    : path(Path::None)
+    , frames(0)
+    , map_us(0)
+    , map_max_us(0)
+    , downloads(0)
+    , download_us(0)
+    , cache_hits(0)
+    , cache_misses(0)
+    , fallbacks(0)
+    , cache_size(0)
+{
+}
+
+FrameMapper::~FrameMapper()
+{
+    // the textures are gone with the gpu, only our own bookkeeping is left
+    for (auto &entry : imports)
+        delete entry.second;
+    for (Import *surface_import : retired_imports)
+        delete surface_import;
+    av_buffer_unref(&pool);
+}
+
+bool FrameMapper::map(pl_gpu gpu, struct pl_frame *out, const AVFrame *frame, pl_tex *tex)
+{
+    const int64_t start_us = nowUs();
+    Path frame_path;
+    bool ok;
+    switch (frame->format) {
+    case AV_PIX_FMT_VULKAN:
+        frame_path = Path::Vulkan;
+        break;
+    case AV_PIX_FMT_VAAPI:
+    case AV_PIX_FMT_DRM_PRIME:
+        frame_path = Path::DmaBuf;
+        break;
+    default: {
+        // a session either downloads all of its hardware frames or none
+        const uint64_t downloads_now = downloads.load(std::memory_order_relaxed);
+        frame_path = downloads_now != downloads_seen ? Path::Download : Path::Upload;
+        downloads_seen = downloads_now;
+        break;
+    }
+    }
+
+    if (frame->format == AV_PIX_FMT_VAAPI && mapDmaBuf(gpu, out, frame)) {
+        ok = true;
+    } else {
+        struct pl_avframe_params params = {};
+        params.frame = frame;
+        params.tex = tex;
+        ok = pl_map_avframe_ex(gpu, out, &params);
+    }
+    if (!ok)
+        return false;
+
+    const int64_t elapsed_us = nowUs() - start_us;
+    path.store(frame_path, std::memory_order_relaxed);
+    frames.fetch_add(1, std::memory_order_relaxed);
+    map_us.fetch_add(elapsed_us, std::memory_order_relaxed);
+    int64_t max_us = map_max_us.load(std::memory_order_relaxed);
+    while (elapsed_us > max_us && !map_max_us.compare_exchange_weak(max_us, elapsed_us, std::memory_order_relaxed))
+        ;
+    return true;
+}
+
+void FrameMapper::unmap(pl_gpu gpu, struct pl_frame *frame)
+{
+    auto it = mappings.find(frame->user_data);
+    if (it == mappings.end()) {
+        pl_unmap_avframe(gpu, frame);
+        return;
+    }
+    mappings.erase(it);
+    Mapping *mapping = static_cast<Mapping *>(frame->user_data);
+    av_frame_free(&mapping->frame);
+    releaseImport(gpu, mapping->surface_import);
+    delete mapping;
+    memset(frame, 0, sizeof(*frame));
+}
+
+void FrameMapper::clear(pl_gpu gpu)
+{
+    retireImports(gpu);
+    av_buffer_unref(&pool);
+}
+
+void FrameMapper::pushDownload(int64_t download_us)
+{
+    downloads.fetch_add(1, std::memory_order_relaxed);
+    this->download_us.fetch_add(download_us, std::memory_order_relaxed);
+}
+
+void FrameMapper::pushFallback()
+{
+    fallbacks.fetch_add(1, std::memory_order_relaxed);
+}
+
+FrameMapper::Stats FrameMapper::stats()
+{
+    Stats stats;
+    stats.path = path.load(std::memory_order_relaxed);
+    stats.frames = frames.load(std::memory_order_relaxed);
+    stats.map_us = map_us.load(std::memory_order_relaxed);
+    stats.downloads = downloads.load(std::memory_order_relaxed);
+    stats.download_us = download_us.load(std::memory_order_relaxed);
+    stats.cache_hits = cache_hits.load(std::memory_order_relaxed);
+    stats.cache_misses = cache_misses.load(std::memory_order_relaxed);
+    stats.fallbacks = fallbacks.load(std::memory_order_relaxed);
+    stats.cache_size = cache_size.load(std::memory_order_relaxed);
+    stats.map_max_us = map_max_us.exchange(0, std::memory_order_relaxed);
+    return stats;
+}
+
+// The decoder's surfaces are synced and exported every time, which is cheap, but only imported into Vulkan
+// the first time they are seen.
+bool FrameMapper::mapDmaBuf(pl_gpu gpu, struct pl_frame *out, const AVFrame *frame)
+{
+#ifdef FRAME_MAPPER_DMABUF_CACHE
+    if (!(gpu->import_caps.tex & PL_HANDLE_DMA_BUF) || !frame->hw_frames_ctx)
+        return false;
+
+    AVFrame *drm_frame = av_frame_alloc();
+    if (!drm_frame)
+        return false;
+    drm_frame->format = AV_PIX_FMT_DRM_PRIME;
+    if (av_hwframe_map(drm_frame, frame, AV_HWFRAME_MAP_READ) < 0) {
+        av_frame_free(&drm_frame);
+        return false;
+    }
+
+    if (!pool || pool->data != frame->hw_frames_ctx->data) {
+        // new pool, e.g. after a resolution change, surface ids might be reused
+        retireImports(gpu);
+        av_buffer_unref(&pool);
+        pool = av_buffer_ref(frame->hw_frames_ctx);
+    }
+
+    const uintptr_t surface = reinterpret_cast<uintptr_t>(frame->data[3]);
+    Import *surface_import;
+    auto it = imports.find(surface);
+    if (it != imports.end()) {
+        surface_import = it->second;
+        cache_hits.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        if (imports.size() >= CacheMax)
+            retireImports(gpu);
+        surface_import = new Import;
+        if (!importSurface(gpu, surface_import, frame, drm_frame)) {
+            surface_import->retired = true;
+            releaseImport(gpu, surface_import);
+            av_frame_free(&drm_frame);
+            return false;
+        }
+        imports[surface] = surface_import;
+        cache_misses.fetch_add(1, std::memory_order_relaxed);
+    }
+    av_frame_free(&drm_frame);
+
+    pl_frame_from_avframe(out, frame);
+    if (out->num_planes != surface_import->num_tex) {
+        memset(out, 0, sizeof(*out));
+        return false;
+    }
+    for (int i = 0; i < surface_import->num_tex; i++)
+        out->planes[i].texture = surface_import->tex[i];
+
+    Mapping *mapping = new Mapping;
+    mapping->frame = av_frame_clone(frame); // keeps the decoder from writing into the surface while it is shown
+    mapping->surface_import = surface_import;
+    surface_import->mapped++;
+    out->user_data = mapping;
+    mappings.insert(mapping);
+    cache_size.store(imports.size(), std::memory_order_relaxed);
+    return true;
+#else
+    (void)gpu;
+    (void)out;
+    (void)frame;
+    return false;
+#endif
+}
+
+bool FrameMapper::importSurface(pl_gpu gpu, Import *surface_import, const AVFrame *frame, const AVFrame *drm_frame)
+{
+#ifdef FRAME_MAPPER_DMABUF_CACHE
+    const AVDRMFrameDescriptor *desc = reinterpret_cast<const AVDRMFrameDescriptor *>(drm_frame->data[0]);
+    const AVHWFramesContext *hwfc = reinterpret_cast<const AVHWFramesContext *>(frame->hw_frames_ctx->data);
+    const AVPixFmtDescriptor *fmt_desc = av_pix_fmt_desc_get(hwfc->sw_format);
+    if (!fmt_desc || desc->nb_layers > 4)
+        return false;
+
+    // one texture per layer, like pl_map_avframe_ex() does it
+    for (int i = 0; i < desc->nb_layers; i++) {
+        const AVDRMLayerDescriptor *layer = &desc->layers[i];
+        if (layer->nb_planes != 1)
+            return false;
+        const AVDRMPlaneDescriptor *plane = &layer->planes[0];
+        const AVDRMObjectDescriptor *object = &desc->objects[plane->object_index];
+        pl_fmt fmt = pl_find_fourcc(gpu, layer->format);
+        if (!fmt)
+            return false;
+
+        struct pl_tex_params params = {};
+        params.w = frame->width;
+        params.h = frame->height;
+        if ((i == 1 || i == 2) && !(fmt_desc->flags & AV_PIX_FMT_FLAG_RGB)) {
+            params.w = AV_CEIL_RSHIFT(params.w, fmt_desc->log2_chroma_w);
+            params.h = AV_CEIL_RSHIFT(params.h, fmt_desc->log2_chroma_h);
+        }
+        params.format = fmt;
+        params.sampleable = true;
+        params.blit_src = fmt->caps & PL_FMT_CAP_BLITTABLE;
+        params.import_handle = PL_HANDLE_DMA_BUF;
+        params.shared_mem.handle.fd = object->fd;
+        params.shared_mem.size = object->size;
+        params.shared_mem.offset = plane->offset;
+        params.shared_mem.drm_format_mod = object->format_modifier;
+        params.shared_mem.stride_w = plane->pitch;
+        surface_import->tex[i] = pl_tex_create(gpu, &params);
+        if (!surface_import->tex[i])
+            return false;
+        surface_import->num_tex = i + 1;
+    }
+    return surface_import->num_tex > 0;
+#else
+    (void)gpu;
+    (void)surface_import;
+    (void)frame;
+    (void)drm_frame;
+    return false;
+#endif
+}
+
+void FrameMapper::releaseImport(pl_gpu gpu, Import *surface_import)
+{
+    if (surface_import->mapped)
+        surface_import->mapped--;
+    // cached imports stay, even if nothing is mapped from them
+    if (surface_import->mapped || !surface_import->retired)
+        return;
+    for (int i = 0; i < surface_import->num_tex; i++)
+        pl_tex_destroy(gpu, &surface_import->tex[i]);
+    retired_imports.erase(std::remove(retired_imports.begin(), retired_imports.end(), surface_import), retired_imports.end());
+    delete surface_import;
+}
+
+void FrameMapper::retireImports(pl_gpu gpu)
+{
+    for (auto &entry : imports) {
+        Import *surface_import = entry.second;
+        surface_import->retired = true;
+        if (surface_import->mapped)
+            retired_imports.push_back(surface_import);
+        else
+            releaseImport(gpu, surface_import);
+    }
+    imports.clear();
+    cache_size.store(0, std::memory_order_relaxed);
+}
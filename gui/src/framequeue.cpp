@@ -0,0 +1,115 @@
+#include "framequeue.h"
+
+#include <algorithm>
+#include <chrono>
+
+static const uint64_t wait_us_bounds[] = { 1000, 2000, 4000, 8000, 16000, 33000, 66000 };
+
+int64_t FrameQueue::nowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+FrameQueue::FrameQueue()
+    : head(0)
+    , tail(0)
+    , last_wait_us(0)
+{
+    ChiakiMetrics *metrics = chiaki_metrics_default();
+    drop_metrics[static_cast<size_t>(DropReason::Superseded)] = chiaki_metrics_register_counter(metrics, "renderer.frames_superseded");
+    drop_metrics[static_cast<size_t>(DropReason::Late)] = chiaki_metrics_register_counter(metrics, "renderer.frames_late");
+    drop_metrics[static_cast<size_t>(DropReason::Overflow)] = chiaki_metrics_register_counter(metrics, "renderer.frames_overflowed");
+    wait_metric = chiaki_metrics_register_histogram(metrics, "renderer.frame_wait_us", wait_us_bounds, sizeof(wait_us_bounds) / sizeof(wait_us_bounds[0]));
+}
+
+FrameQueue::~FrameQueue()
+{
+    clear();
+}
+
+void FrameQueue::push(AVFrame *frame)
+{
+    const size_t h = head.load(std::memory_order_relaxed);
+    size_t t = tail.load(std::memory_order_acquire);
+    if (h - t >= Capacity) {
+        // the newest frame is the one worth showing, so the oldest makes room.
+        // If the consumer took it in the meantime, that made room just as well.
+        if (tail.compare_exchange_strong(t, t + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            AVFrame *oldest = entries[t % Capacity].frame.load(std::memory_order_relaxed);
+            av_frame_free(&oldest);
+            drop(DropReason::Overflow);
+        }
+    }
+    Entry &entry = entries[h % Capacity];
+    entry.frame.store(frame, std::memory_order_relaxed);
+    entry.queued_us.store(nowUs(), std::memory_order_relaxed);
+    head.store(h + 1, std::memory_order_release);
+}
+
+AVFrame *FrameQueue::take(int64_t *queued_us)
+{
+    size_t t = tail.load(std::memory_order_acquire);
+    for (;;) {
+        if (t == head.load(std::memory_order_acquire))
+            return nullptr;
+        const Entry &entry = entries[t % Capacity];
+        AVFrame *frame = entry.frame.load(std::memory_order_relaxed);
+        const int64_t entry_queued_us = entry.queued_us.load(std::memory_order_relaxed);
+        // fails if the producer dropped this frame on overflow, then try the next one
+        if (tail.compare_exchange_weak(t, t + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            if (queued_us)
+                *queued_us = entry_queued_us;
+            return frame;
+        }
+    }
+}
+
+void FrameQueue::drop(DropReason reason)
+{
+    chiaki_metric_inc(drop_metrics[static_cast<size_t>(reason)]);
+}
+
+size_t FrameQueue::peek(int64_t *queued_us, size_t max) const
+{
+    const size_t t = tail.load(std::memory_order_acquire);
+    // one more than fits if the producer dropped a frame between the two loads
+    size_t count = head.load(std::memory_order_acquire) - t;
+    if (count > Capacity)
+        count = Capacity;
+    count = std::min(count, max);
+    for (size_t i = 0; i < count; i++)
+        queued_us[i] = entries[(t + i) % Capacity].queued_us.load(std::memory_order_relaxed);
+    return count;
+}
+
+AVFrame *FrameQueue::pop(size_t skip, DropReason reason)
+{
+    for (size_t i = 0; i < skip; i++) {
+        AVFrame *frame = take(nullptr);
+        if (!frame)
+            return nullptr;
+        av_frame_free(&frame);
+        drop(reason);
+    }
+
+    int64_t queued_us;
+    AVFrame *frame = take(&queued_us);
+    if (frame) {
+        last_wait_us = nowUs() - queued_us;
+        chiaki_metric_observe(wait_metric, last_wait_us);
+    }
+    return frame;
+}
+
+void FrameQueue::clear()
+{
+    while (AVFrame *frame = take(nullptr))
+        av_frame_free(&frame);
+}
+
+size_t FrameQueue::depth() const
+{
+    const size_t t = tail.load(std::memory_order_acquire);
+    const size_t count = head.load(std::memory_order_acquire) - t;
+    return count > Capacity ? Capacity : count;
+}
@@ -174,3 +174,38 @@ ChiakiTarget PsnHost::GetTarget() const
 		return target;
 	}
 }
+
+ConnectProfile::ConnectProfile()
+{
+	memset(&profile, 0, sizeof(profile));
+}
+
+ConnectProfile::ConnectProfile(const QString &key, const ChiakiConnectProfile &profile)
+	: key(key),
+	profile(profile),
+	validated(QDateTime::currentDateTimeUtc())
+{
+}
+
+void ConnectProfile::SaveToSettings(QSettings *settings) const
+{
+	settings->setValue("key", key);
+	settings->setValue("target", (int)profile.target);
+	settings->setValue("mtu_in", profile.mtu_in);
+	settings->setValue("mtu_out", profile.mtu_out);
+	settings->setValue("rtt_us", (qulonglong)profile.rtt_us);
+	settings->setValue("validated", validated);
+}
+
+ConnectProfile ConnectProfile::LoadFromSettings(QSettings *settings)
+{
+	ConnectProfile r;
+	r.key = settings->value("key").toString();
+	r.profile.target = (ChiakiTarget)settings->value("target").toInt();
+	r.profile.mtu_in = settings->value("mtu_in").toUInt();
+	r.profile.mtu_out = settings->value("mtu_out").toUInt();
+	r.profile.rtt_us = settings->value("rtt_us").toULongLong();
+	r.profile.valid = !r.key.isEmpty() && r.profile.mtu_in && r.profile.mtu_out;
+	r.validated = settings->value("validated").toDateTime();
+	return r;
+}
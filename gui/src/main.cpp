@@ -9,6 +9,7 @@ int main(int argc, char *argv[]) { return real_main(argc, argv); }
 #include <controllermanager.h>
 #include <discoverymanager.h>
 #include <qmlmainwindow.h>
+#include <metricsexporter.h>
 #include <QApplication>
 #include <QtTypes>
 
@@ -156,9 +157,23 @@ int real_main(int argc, char *argv[])
 	QCommandLineOption passcode_option("passcode", "Automatically send your PlayStation login passcode (only affects users with a login passcode set on their PlayStation console).", "passcode");
 	parser.addOption(passcode_option);
 
+	QCommandLineOption metrics_export_option("metrics-export", "Append samples of the streaming metrics to file, as CSV if it ends in .csv and as JSON lines otherwise.", "file");
+	parser.addOption(metrics_export_option);
+
+	QCommandLineOption metrics_interval_option("metrics-interval", "Milliseconds between the samples written by --metrics-export.", "ms", "1000");
+	parser.addOption(metrics_interval_option);
+
 	parser.process(app);
 	QStringList args = parser.positionalArguments();
 
+	MetricsExporter metrics_exporter;
+	if(parser.isSet(metrics_export_option)
+		&& !metrics_exporter.start(parser.value(metrics_export_option), parser.value(metrics_interval_option).toInt()))
+	{
+		printf("Failed to open %s for --metrics-export\n", parser.value(metrics_export_option).toLocal8Bit().constData());
+		return 1;
+	}
+
 	Settings settings(parser.isSet(profile_option) ? parser.value(profile_option) : QString());
 	bool exit_app_on_stream_exit = parser.isSet(stream_exit_option);
 	if(parser.isSet(profile_option))
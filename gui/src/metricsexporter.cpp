@@ -0,0 +1,56 @@
+#include "metricsexporter.h"
+
+#include <QDateTime>
+#include <QLoggingCategory>
+
+Q_DECLARE_LOGGING_CATEGORY(chiakiGui);
+
+MetricsExporter::MetricsExporter(QObject *parent)
+    : QObject(parent)
+{
+    connect(&timer, &QTimer::timeout, this, &MetricsExporter::exportSample);
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    stop();
+}
+
+bool MetricsExporter::start(const QString &path, int interval_ms)
+{
+    stop();
+    file = fopen(path.toLocal8Bit().constData(), "a");
+    if (!file) {
+        qCWarning(chiakiGui) << "Failed to open" << path << "for exporting metrics";
+        return false;
+    }
+    format = path.endsWith(QStringLiteral(".csv"), Qt::CaseInsensitive) ? CHIAKI_METRICS_FORMAT_CSV : CHIAKI_METRICS_FORMAT_JSONL;
+    // the column names only once, at the top of a new file
+    fseek(file, 0, SEEK_END);
+    header = ftell(file) == 0;
+    timer.start(qMax(interval_ms, 10));
+    qCInfo(chiakiGui) << "Exporting metrics to" << path << "every" << timer.interval() << "ms";
+    return true;
+}
+
+void MetricsExporter::stop()
+{
+    timer.stop();
+    if (!file)
+        return;
+    exportSample();
+    fclose(file);
+    file = nullptr;
+}
+
+void MetricsExporter::exportSample()
+{
+    const ChiakiErrorCode err = chiaki_metrics_export(chiaki_metrics_default(), file, format, QDateTime::currentMSecsSinceEpoch(), header);
+    header = false;
+    // complete samples end up in the file even if the process doesn't
+    fflush(file);
+    if (err != CHIAKI_ERR_SUCCESS) {
+        qCWarning(chiakiGui) << "Failed to export metrics:" << chiaki_error_string(err);
+        timer.stop();
+    }
+}
@@ -0,0 +1,163 @@
+#include "presentationscheduler.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+// gaps of more intervals than this (stream paused, nothing rendered) are not used to update the estimates
+static const int64_t GapIntervalsMax = 4;
+// cadences closer to a whole ratio than this only judder every few seconds, not worth blurring every frame for
+static const double CadenceMismatchMin = 0.05;
+
+PresentationScheduler::PresentationScheduler()
+    : frame_interval_pub(0)
+    , vsync_interval_pub(0)
+    , jitter_pub(0)
+    , delay_pub(0)
+{
+    for (auto &count : histogram_counts)
+        count = 0;
+}
+
+void PresentationScheduler::setRefreshRate(double hz)
+{
+    if (vsync_measured || hz < 1.0)
+        return;
+    vsync_interval_us = static_cast<int64_t>(1000000.0 / hz);
+    publish();
+}
+
+void PresentationScheduler::frameArrived(int64_t arrival_us)
+{
+    if (arrival_us <= last_arrival_us)
+        return;
+    const int64_t d = arrival_us - last_arrival_us;
+    const bool first = !last_arrival_us;
+    last_arrival_us = arrival_us;
+    if (first)
+        return;
+
+    if (!frame_interval_us) {
+        if (d < 200000)
+            frame_interval_us = d;
+        return;
+    }
+    const int64_t k = (d + frame_interval_us / 2) / frame_interval_us;
+    if (k < 1 || k > GapIntervalsMax) {
+        // two frames right after each other also happen, they only count as jitter
+        if (k < 1)
+            jitter_us += (std::abs(d - frame_interval_us) - jitter_us) / 16;
+        return;
+    }
+    frame_interval_us += (d / k - frame_interval_us) / 16;
+    jitter_us += (std::abs(d - k * frame_interval_us) - jitter_us) / 16;
+}
+
+bool PresentationScheduler::cadenceMismatch() const
+{
+    if (!frame_interval_us || !vsync_interval_us)
+        return false;
+    const double ratio = static_cast<double>(frame_interval_us) / static_cast<double>(vsync_interval_us);
+    return std::abs(ratio - static_cast<double>(static_cast<int64_t>(ratio + 0.5))) > CadenceMismatchMin;
+}
+
+PresentationScheduler::Plan PresentationScheduler::plan(int64_t now_us, const int64_t *queued_us, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        frameArrived(queued_us[i]);
+
+    Plan plan;
+    if (current_mode == Mode::LowestLatency || !vsync_interval_us) {
+        delay_us = 0;
+        if (count) {
+            plan.skip = count - 1;
+            plan.show = true;
+            have_previous = have_current;
+            previous_due_us = current_due_us;
+            have_current = true;
+            current_due_us = queued_us[count - 1];
+        }
+        publish();
+        return plan;
+    }
+
+    // with blending, the image scanned out at a vsync stands for the vsync interval before it, so a frame is shown
+    // at the first vsync after it starts and has to be there before that interval starts, one vsync earlier than
+    // without blending, where it is shown at the vsync closest to it
+    const bool mismatch = cadenceMismatch();
+
+    // enough delay to have the next frame in time despite the jitter, but never a backlog of more than that
+    delay_us = std::min(2 * jitter_us + (mismatch ? vsync_interval_us : 0), static_cast<int64_t>(BacklogMax) * frame_interval_us);
+
+    // the vsync this frame is going to be scanned out at
+    int64_t vsync_us = now_us;
+    if (vsync_phase_us)
+        vsync_us = vsync_phase_us + ((now_us - vsync_phase_us) / vsync_interval_us + 1) * vsync_interval_us;
+
+    const int64_t deadline_us = mismatch ? vsync_us : vsync_us + vsync_interval_us / 2;
+    // frames go out in order, one per vsync, unless the backlog grows too long
+    int64_t show = count && queued_us[0] + delay_us < deadline_us ? 0 : -1;
+    if (count > BacklogMax && show < static_cast<int64_t>(count - 1 - BacklogMax))
+        show = static_cast<int64_t>(count - 1 - BacklogMax);
+    if (!have_current && count && show < 0)
+        show = 0;
+
+    if (show >= 0) {
+        plan.skip = static_cast<size_t>(show);
+        plan.show = true;
+        have_previous = have_current;
+        previous_due_us = current_due_us;
+        have_current = true;
+        current_due_us = std::max(queued_us[show] + delay_us, previous_due_us);
+    }
+
+    if (mismatch && have_previous && have_current) {
+        const float v = static_cast<float>(vsync_interval_us);
+        const int64_t interval_start_us = vsync_us - vsync_interval_us;
+        plan.timestamps[0] = static_cast<float>(previous_due_us - interval_start_us) / v;
+        plan.timestamps[1] = static_cast<float>(current_due_us - interval_start_us) / v;
+        // once the current frame covers the whole vsync there is nothing left to blend
+        plan.mix = plan.timestamps[1] > 0.0f && plan.timestamps[1] < 1.0f;
+    }
+
+    publish();
+    return plan;
+}
+
+void PresentationScheduler::presented(int64_t now_us, bool new_frame, bool vsync_paced)
+{
+    // other present times don't follow the display, plan() keeps projecting the last measured or guessed vsync
+    if (vsync_paced && vsync_phase_us && vsync_interval_us) {
+        // follow the vsync like a PLL, single late presents only nudge it
+        const int64_t k = (now_us - vsync_phase_us + vsync_interval_us / 2) / vsync_interval_us;
+        const int64_t predicted_us = vsync_phase_us + k * vsync_interval_us;
+        const int64_t error_us = now_us - predicted_us;
+        if (k >= 1 && k <= GapIntervalsMax) {
+            vsync_interval_us += error_us / (16 * k);
+            vsync_measured = true;
+            vsync_phase_us = predicted_us + error_us / 8;
+        } else {
+            vsync_phase_us = now_us;
+        }
+    } else if (vsync_paced) {
+        if (vsync_phase_us && !vsync_interval_us && now_us - vsync_phase_us < 100000)
+            vsync_interval_us = now_us - vsync_phase_us;
+        vsync_phase_us = now_us;
+    }
+
+    if (new_frame) {
+        if (last_new_frame_us) {
+            const size_t bucket = std::min(static_cast<size_t>((now_us - last_new_frame_us) / 1000), HistogramBuckets - 1);
+            histogram_counts[bucket].fetch_add(1, std::memory_order_relaxed);
+        }
+        last_new_frame_us = now_us;
+    }
+    publish();
+}
+
+void PresentationScheduler::publish()
+{
+    frame_interval_pub.store(frame_interval_us, std::memory_order_relaxed);
+    vsync_interval_pub.store(vsync_interval_us, std::memory_order_relaxed);
+    jitter_pub.store(jitter_us, std::memory_order_relaxed);
+    delay_pub.store(delay_us, std::memory_order_relaxed);
+}
@@ -136,6 +136,58 @@ Pane {
         }
     }
 
+    ListModel {
+        id: hostsModel
+
+        function entry(host) {
+            // every entry needs all roles, set() keeps the ones that are missing
+            return {
+                discovered: !!host.discovered,
+                manual: !!host.manual,
+                registered: !!host.registered,
+                display: !!host.display,
+                ps5: !!host.ps5,
+                name: host.name || "",
+                duid: host.duid || "",
+                address: host.address || "",
+                mac: host.mac || "",
+                state: host.state || "",
+                app: host.app || "",
+                titleId: host.titleId || ""
+            };
+        }
+
+        // Only touch the entries that actually changed, so the delegates of all other consoles stay as they are
+        function sync(hosts) {
+            while (count > hosts.length)
+                remove(count - 1);
+            for (let i = 0; i < hosts.length; ++i) {
+                const e = entry(hosts[i]);
+                if (i >= count) {
+                    append(e);
+                    continue;
+                }
+                const cur = get(i);
+                for (const key in e) {
+                    if (cur[key] !== e[key]) {
+                        set(i, e);
+                        break;
+                    }
+                }
+            }
+        }
+
+        Component.onCompleted: sync(Chiaki.hosts)
+    }
+
+    Connections {
+        target: Chiaki
+
+        function onHostsChanged() {
+            hostsModel.sync(Chiaki.hosts);
+        }
+    }
+
     ListView {
         id: hostsView
         keyNavigationWraps: true
@@ -147,7 +199,7 @@ Pane {
             bottomMargin: 50
         }
         clip: true
-        model: Chiaki.hosts
+        model: hostsModel
         onCountChanged: {
             if(!hostsView.currentItem)
                 hostsView.incrementCurrentIndex();
@@ -166,31 +218,31 @@ Pane {
             }
         }
         delegate: ItemDelegate {
-            visible: modelData.display
+            visible: model.display
             id: delegate
             width: parent ? parent.width : 0
-            height: modelData.display ? 180 : 0
+            height: model.display ? 180 : 0
             highlighted: ListView.isCurrentItem
             onClicked: connectToHost()
 
             function connectToHost() {
-                if(modelData.discovered)
-                    Chiaki.connectToHost(index, modelData.name);
+                if(model.discovered)
+                    Chiaki.connectToHost(index, model.name);
                 else
                     Chiaki.connectToHost(index);
             }
 
             function wakeUpHost() {
-                if(!modelData.discovered && !modelData.duid)
+                if(!model.discovered && !model.duid)
                     Chiaki.wakeUpHost(index);
             }
 
             function deleteHost() {
-                if (modelData.manual)
+                if (model.manual)
                     root.showConfirmDialog(qsTr("Delete Console"), qsTr("Are you sure you want to delete this console?"), () => {Chiaki.deleteHost(index)});
                         
-                else if (modelData.discovered && !modelData.registered)
-                    root.showConfirmDialog(qsTr("Hide Console"), qsTr("Are you sure you want to hide this console?") + "\n\n" + qsTr("Note: You can unhide from the Consoles section of the Settings under Hidden Consoles"), () => Chiaki.hideHost(modelData.mac, modelData.name));
+                else if (model.discovered && !model.registered)
+                    root.showConfirmDialog(qsTr("Hide Console"), qsTr("Are you sure you want to hide this console?") + "\n\n" + qsTr("Note: You can unhide from the Consoles section of the Settings under Hidden Consoles"), () => Chiaki.hideHost(model.mac, model.name));
 
             }
 
@@ -212,7 +264,7 @@ Pane {
                     Layout.fillHeight: true
                     Layout.preferredWidth: 150
                     fillMode: Image.PreserveAspectFit
-                    source: "image://svg/console-ps" + (modelData.ps5 ? "5" : "4") + (modelData.state == "standby" ? "#light_standby" : "#light_on")
+                    source: "image://svg/console-ps" + (model.ps5 ? "5" : "4") + (model.state == "standby" ? "#light_standby" : "#light_on")
                     sourceSize: Qt.size(width, height)
                 }
 
@@ -220,22 +272,22 @@ Pane {
                     Layout.alignment: Qt.AlignLeft | Qt.AlignVCenter
                     text: {
                         let t = "";
-                        if (modelData.name)
-                            t += modelData.name + "\n";
-                        if (modelData.address)
-                            t += qsTr("Address: %1").arg(modelData.address);
-                        if (modelData.mac)
-                            t += "\n" + qsTr("ID: %1 (%2)").arg(modelData.mac).arg(modelData.registered ? qsTr("registered") : qsTr("unregistered"));
-                        if (modelData.duid)
+                        if (model.name)
+                            t += model.name + "\n";
+                        if (model.address)
+                            t += qsTr("Address: %1").arg(model.address);
+                        if (model.mac)
+                            t += "\n" + qsTr("ID: %1 (%2)").arg(model.mac).arg(model.registered ? qsTr("registered") : qsTr("unregistered"));
+                        if (model.duid)
                         {
                             t += "\n" + qsTr("Remote Connection via PSN");
                         } 
                         else
                         {
                             t += "\n";
-                            if(modelData.discovered)
+                            if(model.discovered)
                             {
-                                if(modelData.manual)
+                                if(model.manual)
                                     t += qsTr("discovered + manual")
                                 else
                                     t += qsTr("discovered");
@@ -251,15 +303,15 @@ Pane {
                     Layout.alignment: Qt.AlignLeft | Qt.AlignVCenter
                     text: {
                         let t = "";
-                        if(modelData.duid)
+                        if(model.duid)
                             return t;
-                        t += qsTr("State: %1").arg(modelData.state);
-                        if(!modelData.discovered)
+                        t += qsTr("State: %1").arg(model.state);
+                        if(!model.discovered)
                             return t;
-                        if (modelData.app)
-                            t += "\n" + qsTr("App: %1").arg(modelData.app);
-                        if (modelData.titleId)
-                            t += "\n" + qsTr("Title ID: %1").arg(modelData.titleId);
+                        if (model.app)
+                            t += "\n" + qsTr("App: %1").arg(model.app);
+                        if (model.titleId)
+                            t += "\n" + qsTr("Title ID: %1").arg(model.titleId);
                         return t;
                     }
                 }
@@ -272,12 +324,12 @@ Pane {
 
                     Button {
                         Layout.alignment: Qt.AlignCenter
-                        text: modelData.manual ? qsTr("Delete") : qsTr("Hide")
+                        text: model.manual ? qsTr("Delete") : qsTr("Hide")
                         flat: true
                         padding: 20
                         leftPadding: delegate.highlighted ? 50 : undefined
                         focusPolicy: Qt.NoFocus
-                        visible: modelData.manual || (modelData.discovered && !modelData.registered)
+                        visible: model.manual || (model.discovered && !model.registered)
                         onClicked: delegate.deleteHost()
                         Material.roundedScale: Material.SmallScale
 
@@ -301,7 +353,7 @@ Pane {
                         flat: true
                         padding: 20
                         leftPadding: delegate.highlighted ? 50 : undefined
-                        visible: modelData.registered && !modelData.duid && !modelData.discovered
+                        visible: model.registered && !model.duid && !model.discovered
                         focusPolicy: Qt.NoFocus
                         onClicked: delegate.wakeUpHost()
                         Material.roundedScale: Material.SmallScale
@@ -326,7 +378,7 @@ Pane {
                         flat: true
                         padding: 20
                         leftPadding: delegate.highlighted ? 50 : undefined
-                        visible: modelData.registered
+                        visible: model.registered
                         focusPolicy: Qt.NoFocus
                         onClicked: delegate.setConsolePin()
                         Material.roundedScale: Material.SmallScale
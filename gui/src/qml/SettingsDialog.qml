@@ -414,6 +414,26 @@ DialogView {
                         text: qsTr("(High Quality)")
                     }
 
+                    Label {
+                        Layout.alignment: Qt.AlignRight
+                        text: qsTr("Frame Pacing:")
+                    }
+
+                    C.ComboBox {
+                        Layout.preferredWidth: 400
+                        model: [qsTr("Lowest Latency (show newest frame)"), qsTr("Smoothest (one frame per vsync)")]
+                        currentIndex: Chiaki.settings.presentationPolicy
+                        onActivated: (index) => {
+                            Chiaki.settings.presentationPolicy = index;
+                            Chiaki.window.framePacing = index == 1 ? ChiakiWindow.FramePacing.Smoothest : ChiakiWindow.FramePacing.LowestLatency;
+                        }
+                    }
+
+                    Label {
+                        Layout.alignment: Qt.AlignRight
+                        text: qsTr("(Lowest Latency)")
+                    }
+
                     Label {
                         Layout.alignment: Qt.AlignRight
                         text: qsTr("Custom Renderer Settings")
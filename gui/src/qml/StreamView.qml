@@ -160,6 +160,54 @@ Item {
         }
     }
 
+    // everything the metrics registry holds, per second, toggled with Ctrl+I and left on while playing
+    Rectangle {
+        id: metricsView
+        anchors {
+            left: parent.left
+            top: parent.top
+            margins: 20
+        }
+        width: metricsGrid.implicitWidth + 20
+        height: metricsGrid.implicitHeight + 20
+        color: Qt.rgba(0.0, 0.0, 0.0, 0.6)
+        radius: 8
+        opacity: 0.0
+        visible: opacity
+
+        Behavior on opacity { NumberAnimation { duration: 250 } }
+
+        GridLayout {
+            id: metricsGrid
+            anchors.centerIn: parent
+            columns: 2
+            columnSpacing: 15
+            rowSpacing: 0
+
+            Repeater {
+                model: metricsView.visible ? Chiaki.window.metrics : []
+                Label {
+                    Layout.row: index
+                    Layout.column: 0
+                    text: modelData.name
+                    font.pixelSize: 13
+                }
+            }
+
+            Repeater {
+                model: metricsView.visible ? Chiaki.window.metrics : []
+                Label {
+                    Layout.row: index
+                    Layout.column: 1
+                    Layout.alignment: Qt.AlignRight
+                    text: modelData.value
+                    color: Material.accent
+                    font.pixelSize: 13
+                }
+            }
+        }
+    }
+
     Item {
         id: menuView
         property bool closing: false
@@ -445,6 +493,115 @@ Item {
                         font.pixelSize: 18
                     }
                 }
+
+                Label {
+                    property var stats: Chiaki.window.frameQueueStats
+                    text: {
+                        if (!stats)
+                            return "";
+                        let reasons = [];
+                        for (const reason of ["decoder", "superseded", "late", "overflow"]) {
+                            if (stats[reason])
+                                reasons.push("%1 %2".arg(stats[reason]).arg(reason));
+                        }
+                        return qsTr("queue %1, %2 ms").arg(stats.depth).arg(stats.waitMs.toFixed(1))
+                            + (reasons.length ? " (" + reasons.join(", ") + ")" : "")
+                            + (Chiaki.window.framePacing == ChiakiWindow.FramePacing.Smoothest && stats.vsyncMs
+                                ? qsTr(", frames every %1 ± %2 ms on %3 ms vsync, held %4 ms").arg(stats.frameIntervalMs.toFixed(1)).arg(stats.jitterMs.toFixed(1)).arg(stats.vsyncMs.toFixed(1)).arg(stats.delayMs.toFixed(1))
+                                : "");
+                    }
+                    font.pixelSize: 15
+                    opacity: parent.visible && Chiaki.window.droppedFrames ? 1.0 : 0.0
+                    visible: opacity
+
+                    Behavior on opacity { NumberAnimation { duration: 250 } }
+                }
+
+                Label {
+                    property var mapping: Chiaki.window.frameMappingStats
+                    text: mapping ? qsTr("%1 path, %2 ms per frame (max %3 ms)").arg(mapping.path).arg(mapping.mapMs.toFixed(2)).arg(mapping.mapMaxMs.toFixed(2))
+                        + (mapping.downloadMs ? qsTr(", download %1 ms").arg(mapping.downloadMs.toFixed(2)) : "")
+                        + (mapping.cacheSize ? qsTr(", %1 surfaces imported, %2 new").arg(mapping.cacheSize).arg(mapping.cacheMisses) : "")
+                        + (mapping.fallbacks ? qsTr(", zero copy failed") : "") : ""
+                    font.pixelSize: 15
+                    opacity: parent.visible && Chiaki.window.droppedFrames ? 1.0 : 0.0
+                    visible: opacity
+
+                    Behavior on opacity { NumberAnimation { duration: 250 } }
+                }
+
+                // time between new frames on screen over the last second, 1 ms per bar
+                Row {
+                    id: frameTimeHistogram
+                    property var buckets: Chiaki.window.frameTimeHistogram
+                    property int peak: buckets ? Math.max(1, ...buckets) : 1
+                    Layout.alignment: Qt.AlignBottom
+                    spacing: 1
+                    opacity: parent.visible && Chiaki.window.droppedFrames ? 1.0 : 0.0
+                    visible: opacity
+
+                    Behavior on opacity { NumberAnimation { duration: 250 } }
+
+                    Repeater {
+                        model: frameTimeHistogram.buckets
+                        Rectangle {
+                            anchors.bottom: parent.bottom
+                            width: 2
+                            height: Math.max(1, 18 * modelData / frameTimeHistogram.peak)
+                            color: Material.accent
+                        }
+                    }
+                }
+
+                Label {
+                    property var quality: Chiaki.session?.linkQuality
+                    text: quality ? qsTr("rtt %1 ± %2 ms, resend after %3 ms").arg(quality.rttMs.toFixed(1)).arg(quality.rttVarMs.toFixed(1)).arg(quality.resendTimeoutMs)
+                        + (quality.resent ? qsTr(" (%1 resent)").arg(quality.resent) : "")
+                        + (quality.recoveries ? qsTr(", picture recovered in %1 ms").arg(quality.recoveryMs.toFixed(0)) : "")
+                        + (quality.sendDropped ? qsTr(", %1 sends dropped, input queued %2 ms").arg(quality.sendDropped).arg(quality.sendInputMs.toFixed(1)) : "")
+                        + (quality.queueDelayMs >= 5 ? qsTr(", frames %1 ms late, jitter %2 ms").arg(quality.queueDelayMs.toFixed(0)).arg(quality.frameJitterMs.toFixed(1)) : "") : ""
+                    font.pixelSize: 15
+                    opacity: parent.visible && quality && (Chiaki.session.averagePacketLoss || quality.resent || quality.sendDropped || quality.queueDelayMs >= 5) ? 1.0 : 0.0
+                    visible: opacity
+
+                    Behavior on opacity { NumberAnimation { duration: 250 } }
+                }
+
+                Label {
+                    property var quality: Chiaki.session?.linkQuality
+                    text: quality ? qsTr("socket rcv %1 KiB, snd %2 KiB").arg(Math.round(quality.rcvbuf / 1024)).arg(Math.round(quality.sndbuf / 1024))
+                        + (quality.dscp ? qsTr(", input DSCP %1").arg(quality.dscp) : "")
+                        + (quality.busyPollUs ? qsTr(", busy poll %1 µs").arg(quality.busyPollUs) : "")
+                        + (quality.rxTimestamps ? qsTr(", rx timestamps") : "") : ""
+                    font.pixelSize: 15
+                    opacity: parent.visible && quality && (quality.dscp || quality.busyPollUs || quality.rxTimestamps) ? 1.0 : 0.0
+                    visible: opacity
+
+                    Behavior on opacity { NumberAnimation { duration: 250 } }
+                }
+
+                Label {
+                    Layout.leftMargin: micLatencyLabel.width + 6
+                    text: qsTr("mic latency")
+                    font.pixelSize: 15
+                    opacity: parent.visible && Chiaki.session && !Chiaki.session.muted && Chiaki.session.micLatency ? 1.0 : 0.0
+                    visible: opacity
+
+                    Behavior on opacity { NumberAnimation { duration: 250 } }
+
+                    Label {
+                        id: micLatencyLabel
+                        anchors {
+                            right: parent.left
+                            baseline: parent.baseline
+                            rightMargin: 5
+                        }
+                        text: visible ? "%1<font size=\"1\">ms</font>".arg(Chiaki.session.micLatency.toFixed(1)) : ""
+                        color: Material.accent
+                        font.bold: true
+                        font.pixelSize: 18
+                    }
+                }
             }
         }
     }
@@ -611,5 +768,9 @@ Item {
                 return;
             menuView.toggle();
         }
+
+        function onMetricsRequested() {
+            metricsView.opacity = metricsView.visible ? 0.0 : 1.0;
+        }
     }
 }
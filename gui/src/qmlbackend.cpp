@@ -17,6 +17,7 @@
 #include <QImageReader>
 #include <QProcessEnvironment>
 #include <QDesktopServices>
+#include <QElapsedTimer>
 
 #define PSN_DEVICES_TRIES 2
 #define MAX_PSN_RECONNECT_TRIES 6
@@ -716,6 +717,19 @@ void QmlBackend::createSession(const StreamSessionConnectInfo &connect_info)
         return;
     }
 
+    ChiakiThreadAttrs decoder_attrs = session->GetThreadProfile().decoder;
+    QMetaObject::invokeMethod(frame_thread->parent(), [decoder_attrs]() {
+        ChiakiThreadAttrs applied;
+        if (chiaki_thread_set_attrs_self(&decoder_attrs, &applied) != CHIAKI_ERR_SUCCESS
+            && chiaki_thread_attrs_failure_first(&decoder_attrs))
+            qCWarning(chiakiGui) << "Frame thread runs with" << chiaki_thread_priority_string(applied.priority)
+                << "priority instead of" << chiaki_thread_priority_string(decoder_attrs.priority);
+    });
+    // the frame thread outlives the session, whichever way it ends
+    connect(session, &QObject::destroyed, frame_thread->parent(), []() {
+        chiaki_thread_reset_attrs_self();
+    });
+
     connect(session, &StreamSession::FfmpegFrameAvailable, frame_thread->parent(), [this]() {
         ChiakiFfmpegDecoder *decoder = session->GetFfmpegDecoder();
         if (!decoder) {
@@ -734,6 +748,8 @@ void QmlBackend::createSession(const StreamSessionConnectInfo &connect_info)
 #endif
         };
         if (frame->hw_frames_ctx && (!zero_copy_formats.contains(frame->format) || disable_zero_copy)) {
+            QElapsedTimer download_timer;
+            download_timer.start();
             AVFrame *sw_frame = av_frame_alloc();
             if (av_hwframe_transfer_data(sw_frame, frame, 0) < 0) {
                 qCWarning(chiakiGui) << "Failed to transfer frame from hardware";
@@ -744,8 +760,9 @@ void QmlBackend::createSession(const StreamSessionConnectInfo &connect_info)
             av_frame_copy_props(sw_frame, frame);
             av_frame_unref(frame);
             frame = sw_frame;
+            window->reportFrameDownload(download_timer.nsecsElapsed() / 1000);
         }
-        QMetaObject::invokeMethod(window, std::bind(&QmlMainWindow::presentFrame, window, frame, frames_lost));
+        window->presentFrame(frame);
     });
 
     connect(session, &StreamSession::SessionQuit, this, [this](ChiakiQuitReason reason, const QString &reason_str) {
@@ -1080,6 +1097,8 @@ void QmlBackend::connectToHost(int index, QString nickname)
                 fullscreen,
                 zoom,
                 stretch);
+        if(server.registered)
+            info.connect_profile_key = server.registered_host.GetServerMAC().ToString();
         createSession(info);
     }
     else
@@ -1096,6 +1115,7 @@ void QmlBackend::connectToHost(int index, QString nickname)
                 fullscreen,
                 zoom,
                 stretch);
+        info.connect_profile_key = server.duid;
 
         QString expiry_s = settings->GetPsnAuthTokenExpiry();
         QString refresh = settings->GetPsnRefreshToken();
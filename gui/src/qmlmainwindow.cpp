@@ -14,6 +14,7 @@
 #include <QShortcut>
 #include <QStandardPaths>
 #include <QGuiApplication>
+#include <QScreen>
 #include <QVulkanInstance>
 #include <QQuickItem>
 #include <QQmlEngine>
@@ -49,6 +50,9 @@ static void placebo_log_cb(void *user, pl_log_level level, const char *msg)
     }
 }
 
+// CPU time of render(), from the swapchain frame to its submission
+static const uint64_t render_us_bounds[] = { 500, 1000, 2000, 4000, 8000, 16000 };
+
 static QString shader_cache_path()
 {
     static QString path = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/pl_shader.cache";
@@ -125,8 +129,9 @@ QmlMainWindow::~QmlMainWindow()
 
     av_buffer_unref(&vulkan_hw_dev_ctx);
 
-    pl_unmap_avframe(placebo_vulkan->gpu, &current_frame);
-    pl_unmap_avframe(placebo_vulkan->gpu, &previous_frame);
+    frame_mapper.unmap(placebo_vulkan->gpu, &current_frame);
+    frame_mapper.unmap(placebo_vulkan->gpu, &previous_frame);
+    frame_mapper.clear(placebo_vulkan->gpu);
 
     pl_tex_destroy(placebo_vulkan->gpu, &quick_tex);
     pl_vulkan_sem_destroy(placebo_vulkan->gpu, &quick_sem);
@@ -143,7 +148,8 @@ QmlMainWindow::~QmlMainWindow()
     pl_renderer_destroy(&placebo_renderer);
     pl_vulkan_destroy(&placebo_vulkan);
     pl_vk_inst_destroy(&placebo_vk_inst);
-    pl_options_free(&renderparams_opts);
+    active_render_params.reset();
+    render_presets.fill(nullptr);
     pl_log_destroy(&placebo_log);
 }
 
@@ -240,9 +246,41 @@ QmlMainWindow::VideoPreset QmlMainWindow::videoPreset() const
 void QmlMainWindow::setVideoPreset(VideoPreset preset)
 {
     video_preset = preset;
+    std::atomic_store(&active_render_params, render_presets[static_cast<size_t>(preset)]);
     emit videoPresetChanged();
 }
 
+QmlMainWindow::FramePacing QmlMainWindow::framePacing() const
+{
+    return frame_pacing;
+}
+
+void QmlMainWindow::setFramePacing(FramePacing pacing)
+{
+    frame_pacing = pacing;
+    emit framePacingChanged();
+}
+
+QVariantMap QmlMainWindow::frameQueueStats() const
+{
+    return frame_queue_stats;
+}
+
+QVariantList QmlMainWindow::frameTimeHistogram() const
+{
+    return frame_time_histogram;
+}
+
+QVariantMap QmlMainWindow::frameMappingStats() const
+{
+    return frame_mapping_stats;
+}
+
+QVariantList QmlMainWindow::metrics() const
+{
+    return metrics_overlay;
+}
+
 void QmlMainWindow::setSettings(Settings *new_settings)
 {
     settings = new_settings;
@@ -281,27 +319,26 @@ void QmlMainWindow::show()
         showMaximized();
 }
 
-void QmlMainWindow::presentFrame(AVFrame *frame, int32_t frames_lost)
+// Called on the decoder's frame thread, the frame goes straight to the render thread through frame_queue
+void QmlMainWindow::presentFrame(AVFrame *frame)
 {
-    frame_mutex.lock();
-    if (av_frame) {
-        qCDebug(chiakiGui) << "Dropping rendering frame";
-        dropped_frames_current++;
-        av_frame_free(&av_frame);
-    }
-    av_frame = frame;
-    frame_mutex.unlock();
+    frame_queue.push(frame);
 
-    dropped_frames_current += frames_lost;
+    QMetaObject::invokeMethod(this, [this]() {
+        if (!has_video) {
+            has_video = true;
+            if (!grab_input && settings->GetHideCursor())
+                setCursor(Qt::BlankCursor);
+            emit hasVideoChanged();
+        }
 
-    if (!has_video) {
-        has_video = true;
-        if (!grab_input && settings->GetHideCursor())
-            setCursor(Qt::BlankCursor);
-        emit hasVideoChanged();
-    }
+        update();
+    });
+}
 
-    update();
+void QmlMainWindow::reportFrameDownload(int64_t download_us)
+{
+    frame_mapper.pushDownload(download_us);
 }
 
 AVBufferRef *QmlMainWindow::vulkanHwDeviceCtx()
@@ -350,6 +387,13 @@ void QmlMainWindow::init(Settings *settings, bool exit_app_on_stream_exit)
 {
     setSurfaceType(QWindow::VulkanSurface);
 
+    // before the render thread is started, it only ever sees them registered
+    ChiakiMetrics *registry = chiaki_metrics_default();
+    metric_decoder_frames_lost = chiaki_metrics_register_counter(registry, "decoder.frames_lost");
+    decoder_frames_lost_prev = chiaki_metric_get(metric_decoder_frames_lost);
+    metric_frames_presented = chiaki_metrics_register_counter(registry, "renderer.frames_presented");
+    metric_render_us = chiaki_metrics_register_histogram(registry, "renderer.render_us", render_us_bounds, std::size(render_us_bounds));
+
     const char *vk_exts[] = {
         nullptr,
         VK_KHR_SURFACE_EXTENSION_NAME,
@@ -535,21 +579,84 @@ void QmlMainWindow::init(Settings *settings, bool exit_app_on_stream_exit)
 
     QMetaObject::invokeMethod(quick_render, &QQuickRenderControl::initialize);
 
+    sampleMetrics();
+
     QTimer *dropped_frames_timer = new QTimer(this);
     dropped_frames_timer->setInterval(1000);
     dropped_frames_timer->start();
     connect(dropped_frames_timer, &QTimer::timeout, this, [this]() {
-        if (dropped_frames != dropped_frames_current) {
-            dropped_frames = dropped_frames_current;
+        // drops per second by reason, frames that never made it to the decoder are counted by the lib
+        QVariantMap stats;
+        const int64_t decoder_frames_lost = chiaki_metric_get(metric_decoder_frames_lost);
+        int dropped = static_cast<int>(decoder_frames_lost - decoder_frames_lost_prev);
+        decoder_frames_lost_prev = decoder_frames_lost;
+        stats["decoder"] = dropped;
+        static const std::pair<FrameQueue::DropReason, const char *> reasons[] = {
+            { FrameQueue::DropReason::Superseded, "superseded" },
+            { FrameQueue::DropReason::Late, "late" },
+            { FrameQueue::DropReason::Overflow, "overflow" },
+        };
+        for (const auto &reason : reasons) {
+            uint64_t &prev = frame_queue_drops_prev[static_cast<size_t>(reason.first)];
+            const uint64_t drops = frame_queue.drops(reason.first);
+            stats[reason.second] = static_cast<int>(drops - prev);
+            dropped += static_cast<int>(drops - prev);
+            prev = drops;
+        }
+        stats["depth"] = static_cast<int>(frame_queue.depth());
+        stats["waitMs"] = frame_queue.lastWaitUs() / 1000.0;
+        stats["frameIntervalMs"] = presentation_scheduler.frameIntervalUs() / 1000.0;
+        stats["vsyncMs"] = presentation_scheduler.vsyncIntervalUs() / 1000.0;
+        stats["jitterMs"] = presentation_scheduler.jitterUs() / 1000.0;
+        stats["delayMs"] = presentation_scheduler.delayUs() / 1000.0;
+        if (stats != frame_queue_stats) {
+            frame_queue_stats = stats;
+            emit frameQueueStatsChanged();
+        }
+        // new frames per second by time since the one before, 1 ms per bucket
+        QVariantList histogram;
+        for (size_t i = 0; i < PresentationScheduler::HistogramBuckets; i++) {
+            const uint64_t count = presentation_scheduler.histogram(i);
+            histogram.append(static_cast<int>(count - frame_time_histogram_prev[i]));
+            frame_time_histogram_prev[i] = count;
+        }
+        if (histogram != frame_time_histogram) {
+            frame_time_histogram = histogram;
+            emit frameTimeHistogramChanged();
+        }
+        // how decoded frames get to the renderer and what that cost over the last second
+        const FrameMapper::Stats mapping = frame_mapper.stats();
+        const uint64_t mapped = mapping.frames - frame_mapping_prev.frames;
+        const uint64_t downloaded = mapping.downloads - frame_mapping_prev.downloads;
+        QVariantMap mapping_stats;
+        mapping_stats["path"] = FrameMapper::pathName(mapping.path);
+        mapping_stats["mapMs"] = mapped ? (mapping.map_us - frame_mapping_prev.map_us) / 1000.0 / mapped : 0.0;
+        mapping_stats["mapMaxMs"] = mapping.map_max_us / 1000.0;
+        mapping_stats["downloadMs"] = downloaded ? (mapping.download_us - frame_mapping_prev.download_us) / 1000.0 / downloaded : 0.0;
+        mapping_stats["cacheHits"] = static_cast<int>(mapping.cache_hits - frame_mapping_prev.cache_hits);
+        mapping_stats["cacheMisses"] = static_cast<int>(mapping.cache_misses - frame_mapping_prev.cache_misses);
+        mapping_stats["cacheSize"] = static_cast<int>(mapping.cache_size);
+        mapping_stats["fallbacks"] = static_cast<int>(mapping.fallbacks);
+        if (mapping.path != frame_mapping_prev.path)
+            qCInfo(chiakiGui) << "Frames are mapped through" << FrameMapper::pathName(mapping.path);
+        frame_mapping_prev = mapping;
+        if (mapping_stats != frame_mapping_stats) {
+            frame_mapping_stats = mapping_stats;
+            emit frameMappingStatsChanged();
+        }
+        // only a guess for the render thread until it has measured the vsync itself
+        screen_refresh_rate = screen() ? screen()->refreshRate() : 0.0;
+        if (dropped_frames != dropped) {
+            dropped_frames = dropped;
             emit droppedFramesChanged();
         }
-        dropped_frames_current = 0;
+        sampleMetrics();
     });
 
-    this->renderparams_opts = pl_options_alloc(this->placebo_log);
-    pl_options_reset(this->renderparams_opts, &pl_render_high_quality_params);
-    this->renderparams_changed = true;
-
+    render_presets[static_cast<size_t>(VideoPreset::Fast)] = std::make_shared<RenderParamsSnapshot>(&pl_render_fast_params);
+    render_presets[static_cast<size_t>(VideoPreset::Default)] = std::make_shared<RenderParamsSnapshot>(&pl_render_default_params);
+    render_presets[static_cast<size_t>(VideoPreset::HighQuality)] = std::make_shared<RenderParamsSnapshot>(&pl_render_high_quality_params);
+    compileCustomRenderParams();
 
     switch (settings->GetPlaceboPreset()) {
     case PlaceboPreset::Fast:
@@ -567,6 +674,7 @@ void QmlMainWindow::init(Settings *settings, bool exit_app_on_stream_exit)
         break;
     }
     setZoomFactor(settings->GetZoomFactor());
+    setFramePacing(settings->GetPresentationPolicy() == PresentationPolicy::Smoothest ? FramePacing::Smoothest : FramePacing::LowestLatency);
 }
 
 void QmlMainWindow::update()
@@ -597,7 +705,78 @@ void QmlMainWindow::scheduleUpdate()
 
 void QmlMainWindow::updatePlacebo()
 {
-    renderparams_changed = true;
+    compileCustomRenderParams();
+}
+
+// Reading the settings and parsing the options happens here on the GUI thread, render() only picks up the result
+void QmlMainWindow::compileCustomRenderParams()
+{
+    Q_ASSERT(QThread::currentThread() == QGuiApplication::instance()->thread());
+
+    QStringList invalid;
+    std::shared_ptr<const RenderParamsSnapshot> custom = std::make_shared<RenderParamsSnapshot>(placebo_log, &pl_render_high_quality_params, settings->GetPlaceboValues(), &invalid);
+    for (const QString &key : invalid)
+        qCCritical(chiakiGui) << "Failed to load custom render param: " << key;
+    if (!invalid.isEmpty())
+        qCInfo(chiakiGui) << "Updated custom render parameters with one or more invalid parameters.";
+    else
+        qCInfo(chiakiGui) << "Updated custom render parameters successfully.";
+
+    render_presets[static_cast<size_t>(VideoPreset::Custom)] = custom;
+    if (video_preset == VideoPreset::Custom)
+        std::atomic_store(&active_render_params, custom);
+}
+
+// Once per second on the GUI thread, only reads the registry's atomics
+void QmlMainWindow::sampleMetrics()
+{
+    std::vector<ChiakiMetricSample> samples(CHIAKI_METRICS_MAX);
+    samples.resize(chiaki_metrics_sample(chiaki_metrics_default(), samples.data(), samples.size()));
+
+    QVariantList overlay;
+    for (size_t i = 0; i < samples.size(); i++) {
+        const ChiakiMetricSample &sample = samples[i];
+        // metrics keep their index, the ones registered within the last second start at 0
+        const ChiakiMetricSample *prev = i < metrics_prev.size() ? &metrics_prev[i] : nullptr;
+        QString value;
+        switch (sample.type) {
+        case CHIAKI_METRIC_TYPE_COUNTER:
+            value = QStringLiteral("%1/s").arg(sample.value - (prev ? prev->value : 0));
+            break;
+        case CHIAKI_METRIC_TYPE_GAUGE:
+            value = QString::number(sample.value);
+            break;
+        case CHIAKI_METRIC_TYPE_HISTOGRAM: {
+            const uint64_t count = sample.value - (prev ? prev->value : 0);
+            if (!count) {
+                value = QStringLiteral("-");
+                break;
+            }
+            const uint64_t sum = sample.sum - (prev ? prev->sum : 0);
+            // the bucket the 95th percentile falls into
+            uint64_t seen = 0;
+            size_t p95 = 0;
+            for (; p95 < sample.bounds_count; p95++) {
+                seen += sample.buckets[p95] - (prev ? prev->buckets[p95] : 0);
+                if (seen * 100 >= count * 95)
+                    break;
+            }
+            value = QStringLiteral("%1/s, avg %2, p95 %3").arg(count).arg(sum / count)
+                .arg(p95 < sample.bounds_count ? QStringLiteral("≤ %1").arg(sample.bounds[p95]) : QStringLiteral("> %1").arg(sample.bounds[sample.bounds_count - 1]));
+            break;
+        }
+        }
+        QVariantMap entry;
+        entry["name"] = QString::fromUtf8(sample.name);
+        entry["value"] = value;
+        overlay.append(entry);
+    }
+    metrics_prev = std::move(samples);
+
+    if (overlay != metrics_overlay) {
+        metrics_overlay = overlay;
+        emit metricsChanged();
+    }
 }
 
 void QmlMainWindow::createSwapchain()
@@ -646,6 +825,7 @@ void QmlMainWindow::createSwapchain()
         .swapchain_depth = 1,
     };
     placebo_swapchain = pl_vulkan_create_swapchain(placebo_vulkan, &swapchain_params);
+    swapchain_fifo = swapchain_params.present_mode == VK_PRESENT_MODE_FIFO_KHR;
 }
 
 void QmlMainWindow::destroySwapchain()
@@ -761,41 +941,50 @@ void QmlMainWindow::render()
     Q_ASSERT(QThread::currentThread() == render_thread);
 
     render_scheduled = false;
+    const bool chained = render_chained;
+    render_chained = false;
 
     if (!placebo_swapchain)
         return;
 
-    AVFrame *frame = nullptr;
     pl_tex *tex = &placebo_tex[0];
 
-    frame_mutex.lock();
-    if (av_frame || (!has_video && !keep_video)) {
-        pl_unmap_avframe(placebo_vulkan->gpu, &previous_frame);
-        if (av_frame && av_frame->decode_error_flags) {
+    const bool smoothest = frame_pacing == FramePacing::Smoothest;
+    presentation_scheduler.setMode(smoothest ? PresentationScheduler::Mode::Smoothest : PresentationScheduler::Mode::LowestLatency);
+    presentation_scheduler.setRefreshRate(screen_refresh_rate);
+    int64_t queued_us[FrameQueue::Capacity];
+    const size_t queued = frame_queue.peek(queued_us, FrameQueue::Capacity);
+    const PresentationScheduler::Plan plan = presentation_scheduler.plan(FrameQueue::nowUs(), queued_us, queued);
+
+    AVFrame *frame = nullptr;
+    if (plan.show)
+        frame = frame_queue.pop(plan.skip, smoothest ? FrameQueue::DropReason::Late : FrameQueue::DropReason::Superseded);
+    const bool new_frame = frame;
+    if (frame || (!has_video && !keep_video)) {
+        frame_mapper.unmap(placebo_vulkan->gpu, &previous_frame);
+        previous_frame_concealed = frame && frame->decode_error_flags;
+        // the previous frame is kept to blend over a broken one, or with the new one if the cadence needs it
+        if (frame && (previous_frame_concealed || plan.mix)) {
             std::swap(previous_frame, current_frame);
             if (previous_frame.planes[0].texture == *tex)
                 tex = &placebo_tex[4];
         }
-        pl_unmap_avframe(placebo_vulkan->gpu, &current_frame);
-        std::swap(frame, av_frame);
+        frame_mapper.unmap(placebo_vulkan->gpu, &current_frame);
     }
-    frame_mutex.unlock();
 
     if (frame) {
-        struct pl_avframe_params avparams = {
-            .frame = frame,
-            .tex = tex,
-        };
-        if (!pl_map_avframe_ex(placebo_vulkan->gpu, &current_frame, &avparams))
+        if (!frame_mapper.map(placebo_vulkan->gpu, &current_frame, frame, tex))
         {
             qCWarning(chiakiGui) << "Failed to map AVFrame to Placebo frame!";
             if(backend && backend->zeroCopy())
             {
                 qCInfo(chiakiGui) << "Mapping frame failed, trying without zero copy!";
                 backend->disableZeroCopy();
+                frame_mapper.pushFallback();
             }
         }
         av_frame_free(&frame);
+        current_frame_signature++;
     }
 
     struct pl_swapchain_frame sw_frame = {};
@@ -804,6 +993,7 @@ void QmlMainWindow::render()
         return;
     }
 
+    const int64_t render_start_us = FrameQueue::nowUs();
     struct pl_frame target_frame = {};
     pl_frame_from_swapchain(&target_frame, &sw_frame);
 
@@ -828,40 +1018,9 @@ void QmlMainWindow::render()
     target_frame.overlays = &overlay;
     target_frame.num_overlays = 1;
 
-    const struct pl_render_params *render_params;
-    switch (video_preset) {
-    case VideoPreset::Fast:
-        render_params = &pl_render_fast_params;
-        break;
-    case VideoPreset::Default:
-        render_params = &pl_render_default_params;
-        break;
-    case VideoPreset::HighQuality:
-        render_params = &pl_render_high_quality_params;
-        break;
-    case VideoPreset::Custom:
-        if (renderparams_changed) {
-            renderparams_changed = false;
-            QMap<QString, QString> paramsData = settings->GetPlaceboValues();
-            QMapIterator<QString, QString> i(paramsData);
-            bool invalid_render_params = false;
-            while (i.hasNext()) {
-                i.next();
-                if(!pl_options_set_str(this->renderparams_opts, i.key().toUtf8().constData(), i.value().toUtf8().constData()))
-                {
-                    invalid_render_params = true;
-                    qCCritical(chiakiGui) << "Failed to load custom render param: " << i.key() << " with value: " << i.value();
-                }
-            }
-            if (invalid_render_params)
-                qCInfo(chiakiGui) << "Updated custom render parameters with one or more invalid parameters.";
-            else {
-                qCInfo(chiakiGui) << "Updated custom render parameters successfully.";
-            }
-        }
-        render_params = &(this->renderparams_opts->params);
-        break;
-    }
+    // kept alive for this frame, even if the GUI thread swaps in another one meanwhile
+    const std::shared_ptr<const RenderParamsSnapshot> render_params_snapshot = std::atomic_load(&active_render_params);
+    const struct pl_render_params *render_params = render_params_snapshot ? render_params_snapshot->params() : &pl_render_default_params;
 
     if (current_frame.num_planes) {
         pl_rect2df crop = current_frame.crop;
@@ -887,20 +1046,19 @@ void QmlMainWindow::render()
         pl_swapchain_colorspace_hint(placebo_swapchain, &current_frame.color);
     }
 
-    if (current_frame.num_planes && previous_frame.num_planes) {
+    if (current_frame.num_planes && previous_frame.num_planes && (previous_frame_concealed || plan.mix)) {
         const struct pl_frame *frames[] = { &previous_frame, &current_frame, };
-        const uint64_t sig = QDateTime::currentMSecsSinceEpoch();
-        const uint64_t signatures[] = { sig, sig + 1 };
-        const float timestamps[] = { -0.5, 0.5 };
+        const uint64_t signatures[] = { current_frame_signature - 1, current_frame_signature };
+        static const float concealed_timestamps[] = { -0.5, 0.5 };
         struct pl_frame_mix frame_mix = {
             .num_frames = 2,
             .frames = frames,
             .signatures = signatures,
-            .timestamps = timestamps,
+            .timestamps = previous_frame_concealed ? concealed_timestamps : plan.timestamps,
             .vsync_duration = 1.0,
         };
         struct pl_render_params params = *render_params;
-        params.frame_mixer = pl_find_filter_config("linear", PL_FILTER_FRAME_MIXING);
+        params.frame_mixer = pl_find_filter_config(previous_frame_concealed ? "linear" : "oversample", PL_FILTER_FRAME_MIXING);
         if (!pl_render_image_mix(placebo_renderer, &frame_mix, &target_frame, &params))
             qCWarning(chiakiGui) << "Failed to render Placebo frame!";
     } else {
@@ -910,8 +1068,19 @@ void QmlMainWindow::render()
 
     if (!pl_swapchain_submit_frame(placebo_swapchain))
         qCWarning(chiakiGui) << "Failed to submit Placebo frame!";
+    chiaki_metric_observe(metric_render_us, FrameQueue::nowUs() - render_start_us);
 
     pl_swapchain_swap_buffers(placebo_swapchain);
+    // with a single swapchain image in flight, a render right after the last one waits for its vsync
+    presentation_scheduler.presented(FrameQueue::nowUs(), new_frame, swapchain_fifo && chained);
+    if (new_frame)
+        chiaki_metric_inc(metric_frames_presented);
+
+    // paced frames wait for their vsync and blends change every vsync, come back for them
+    if (frame_queue.depth() || plan.mix) {
+        render_chained = true;
+        QMetaObject::invokeMethod(this, std::bind(&QmlMainWindow::update, this));
+    }
 }
 
 bool QmlMainWindow::handleShortcut(QKeyEvent *event)
@@ -948,6 +1117,21 @@ bool QmlMainWindow::handleShortcut(QKeyEvent *event)
     case Qt::Key_O:
         emit menuRequested();
         return true;
+    case Qt::Key_I:
+        emit metricsRequested();
+        return true;
+    case Qt::Key_1:
+        setVideoPreset(VideoPreset::Fast);
+        return true;
+    case Qt::Key_2:
+        setVideoPreset(VideoPreset::Default);
+        return true;
+    case Qt::Key_3:
+        setVideoPreset(VideoPreset::HighQuality);
+        return true;
+    case Qt::Key_4:
+        setVideoPreset(VideoPreset::Custom);
+        return true;
     case Qt::Key_Q:
         close();
         return true;
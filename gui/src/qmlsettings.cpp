@@ -450,6 +450,17 @@ void QmlSettings::setVideoPreset(int preset)
     emit videoPresetChanged();
 }
 
+int QmlSettings::presentationPolicy() const
+{
+    return static_cast<int>(settings->GetPresentationPolicy());
+}
+
+void QmlSettings::setPresentationPolicy(int policy)
+{
+    settings->SetPresentationPolicy(static_cast<PresentationPolicy>(policy));
+    emit presentationPolicyChanged();
+}
+
 QString QmlSettings::autoConnectMac() const
 {
     return settings->GetAutoConnectHost().GetServerMAC().ToString();
@@ -1412,6 +1423,7 @@ void QmlSettings::refreshAllKeys()
     emit customResolutionHeightChanged();
     emit sZoomFactorChanged();
     emit videoPresetChanged();
+    emit presentationPolicyChanged();
     emit autoConnectMacChanged();
     emit audioDevicesChanged();
     emit registeredHostsChanged();
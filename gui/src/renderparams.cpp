@@ -0,0 +1,22 @@
+#include "renderparams.h"
+
+RenderParamsSnapshot::RenderParamsSnapshot(const struct pl_render_params *params)
+    : render_params(params)
+{
+}
+
+RenderParamsSnapshot::RenderParamsSnapshot(pl_log log, const struct pl_render_params *base, const QMap<QString, QString> &values, QStringList *invalid)
+{
+    opts = pl_options_alloc(log);
+    pl_options_reset(opts, base);
+    for (auto i = values.constBegin(); i != values.constEnd(); ++i) {
+        if (!pl_options_set_str(opts, i.key().toUtf8().constData(), i.value().toUtf8().constData()) && invalid)
+            invalid->append(i.key() + "=" + i.value());
+    }
+    render_params = &opts->params;
+}
+
+RenderParamsSnapshot::~RenderParamsSnapshot()
+{
+    pl_options_free(&opts);
+}
@@ -11,6 +11,8 @@
 
 #define SETTINGS_VERSION 2
 
+#define CONNECT_PROFILE_MAX_AGE_SECONDS (24 * 60 * 60)
+
 static void MigrateSettingsTo2(QSettings *settings)
 {
 	QList<QMap<QString, QVariant>> hosts;
@@ -196,6 +198,7 @@ Settings::Settings(const QString &conf, QObject *parent) : QObject(parent),
 	LoadHiddenHosts();
 	LoadManualHosts();
 	LoadControllerMappings();
+	LoadConnectProfiles();
 	default_settings.setFallbacksEnabled(false);
 	MigrateSettings(&default_settings);
 	MigrateVideoProfile(&default_settings);
@@ -583,6 +586,24 @@ void Settings::SetPlaceboPreset(PlaceboPreset preset)
 	settings.setValue("settings/placebo_preset", placebo_preset_values[preset]);
 }
 
+static const QMap<PresentationPolicy, QString> presentation_policy_values = {
+	{ PresentationPolicy::LowestLatency, "lowest_latency" },
+	{ PresentationPolicy::Smoothest, "smoothest" }
+};
+
+static const PresentationPolicy presentation_policy_default = PresentationPolicy::LowestLatency;
+
+PresentationPolicy Settings::GetPresentationPolicy() const
+{
+	auto v = settings.value("settings/presentation_policy", presentation_policy_values[presentation_policy_default]).toString();
+	return presentation_policy_values.key(v, presentation_policy_default);
+}
+
+void Settings::SetPresentationPolicy(PresentationPolicy policy)
+{
+	settings.setValue("settings/presentation_policy", presentation_policy_values[policy]);
+}
+
 float Settings::GetZoomFactor() const
 {
 	return settings.value("settings/zoom_factor", -1).toFloat();
@@ -603,6 +624,27 @@ void Settings::SetPacketLossMax(float packet_loss_max)
 	settings.setValue("settings/packet_loss_max", QString("%1").arg(packet_loss_max, 0, 'f', 2));
 }
 
+ChiakiSocketTuning Settings::GetSocketTuning() const
+{
+	ChiakiSocketTuning r = {};
+	r.rcvbuf = settings.value("socket/rcvbuf", 0).toInt();
+	r.sndbuf = settings.value("socket/sndbuf", 0).toInt();
+	r.dscp_input = (uint8_t)(settings.value("socket/dscp_input", 0).toUInt() & 0x3f);
+	r.busy_poll_us = settings.value("socket/busy_poll_us", 0).toUInt();
+	r.prefer_busy_poll = settings.value("socket/prefer_busy_poll", false).toBool();
+	r.rx_timestamps = settings.value("socket/rx_timestamps", false).toBool();
+	return r;
+}
+
+ChiakiThreadProfile Settings::GetThreadProfile() const
+{
+	ChiakiThreadProfile r;
+	chiaki_thread_profile_default(&r);
+	if(settings.value("threads/realtime_network", false).toBool())
+		r.network.priority = CHIAKI_THREAD_PRIORITY_REALTIME;
+	return r;
+}
+
 static const QMap<WindowType, QString> window_type_values = {
 	{ WindowType::SelectedResolution, "Selected Resolution" },
 	{ WindowType::CustomResolution, "Custom Resolution"},
@@ -1918,6 +1960,61 @@ void Settings::RemoveHiddenHost(const HostMAC &mac)
 	emit HiddenHostsUpdated();
 }
 
+void Settings::LoadConnectProfiles()
+{
+	connect_profiles.clear();
+	int count = settings.beginReadArray("connect_profiles");
+	for(int i=0; i<count; i++)
+	{
+		settings.setArrayIndex(i);
+		ConnectProfile profile = ConnectProfile::LoadFromSettings(&settings);
+		if(profile.GetProfile().valid)
+			connect_profiles[profile.GetKey()] = profile;
+	}
+	settings.endArray();
+}
+
+void Settings::SaveConnectProfiles()
+{
+	settings.remove("connect_profiles");
+	settings.beginWriteArray("connect_profiles");
+	int i=0;
+	for(const auto &profile : connect_profiles)
+	{
+		settings.setArrayIndex(i);
+		profile.SaveToSettings(&settings);
+		i++;
+	}
+	settings.endArray();
+}
+
+ChiakiConnectProfile Settings::GetConnectProfile(const QString &key) const
+{
+	ChiakiConnectProfile r = {};
+	auto it = connect_profiles.constFind(key);
+	if(it == connect_profiles.constEnd())
+		return r;
+	// MTU and RTT are only probed when there is no profile, redo it every now and then
+	if(it->GetValidated().secsTo(QDateTime::currentDateTimeUtc()) > CONNECT_PROFILE_MAX_AGE_SECONDS)
+		return r;
+	return it->GetProfile();
+}
+
+void Settings::SetConnectProfile(const ConnectProfile &profile)
+{
+	if(profile.GetKey().isEmpty())
+		return;
+	connect_profiles[profile.GetKey()] = profile;
+	SaveConnectProfiles();
+}
+
+void Settings::RemoveConnectProfile(const QString &key)
+{
+	if(!connect_profiles.remove(key))
+		return;
+	SaveConnectProfiles();
+}
+
 void Settings::LoadManualHosts(QSettings *qsettings)
 {
 	if(!qsettings)
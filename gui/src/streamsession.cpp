@@ -21,7 +21,8 @@
 #define NEW_DPAD_TOUCH_INTERVAL_MS 500
 #define DPAD_TOUCH_UPDATE_INTERVAL_MS 10
 #define STEAMDECK_HAPTIC_PACKETS_PER_ANALYSIS 4 // send packets every interval * packets per analysis
-#define STEAMDECK_HAPTIC_SAMPLING_RATE 3000
+#define STEAMDECK_HAPTIC_SAMPLING_RATE CHIAKI_HAPTICS_SAMPLE_RATE
+#define HAPTICS_FRAMES_MAX 30 // frames in one 10ms haptics packet
 // DualShock4 touchpad is 1920 x 942
 #define PS4_TOUCHPAD_MAX_X 1920.0f
 #define PS4_TOUCHPAD_MAX_Y 942.0f
@@ -31,6 +32,7 @@
 #define SESSION_RETRY_SECONDS 20
 
 #define MICROPHONE_SAMPLES 480
+#define MIC_CAPTURE_FRAMES_MAX 16
 #ifdef Q_OS_LINUX
 #define DUALSENSE_AUDIO_DEVICE_NEEDLE "DualSense"
 #else
@@ -108,6 +110,8 @@ StreamSessionConnectInfo::StreamSessionConnectInfo(
 	this->buttons_by_pos = settings->GetButtonsByPosition();
 	this->start_mic_unmuted = settings->GetStartMicUnmuted();
 	this->packet_loss_max = settings->GetPacketLossMax();
+	this->socket_tuning = settings->GetSocketTuning();
+	this->thread_profile = settings->GetThreadProfile();
 #if CHIAKI_GUI_ENABLE_STEAMDECK_NATIVE
 	this->enable_steamdeck_haptics = settings->GetSteamDeckHapticsEnabled();
 	this->vertical_sdeck = settings->GetVerticalDeckEnabled();
@@ -175,7 +179,8 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 	haptics_resampler_buf(nullptr),
 	holepunch_session(nullptr)
 {
-	mic_buf.buf = nullptr;
+	mic_capture_started = false;
+	mic_frame_size_bytes = 0;
 	connected = false;
 	muted = true;
 	mic_connected = false;
@@ -225,6 +230,8 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 	chiaki_opus_encoder_init(&opus_encoder, log.GetChiakiLog());
 #if CHIAKI_GUI_ENABLE_SPEEX
 	speech_processing_enabled = connect_info.speech_processing_enabled;
+	echo_to_cancel_init = false;
+	echo_buf = nullptr;
 	if(speech_processing_enabled)
 	{
 		echo_state = speex_echo_state_init(MICROPHONE_SAMPLES, MICROPHONE_SAMPLES * 10);
@@ -244,6 +251,7 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 	audio_buffer_size = connect_info.audio_buffer_size;
 
 	host = connect_info.host;
+	settings = connect_info.settings;
 	QByteArray host_str = connect_info.host.toUtf8();
 
 	ChiakiConnectInfo chiaki_connect_info = {};
@@ -254,6 +262,12 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 	chiaki_connect_info.enable_keyboard = false;
 	chiaki_connect_info.enable_dualsense = connect_info.enable_dualsense;
 	chiaki_connect_info.packet_loss_max = connect_info.packet_loss_max;
+	chiaki_connect_info.socket_tuning = &connect_info.socket_tuning;
+	chiaki_connect_info.thread_profile = &connect_info.thread_profile;
+	connect_profile_key = connect_info.connect_profile_key;
+	if(!connect_profile_key.isEmpty())
+		chiaki_connect_info.profile = settings->GetConnectProfile(connect_profile_key);
+	connect_profile_used = chiaki_connect_info.profile.valid;
 
 	dpad_touch_shortcut1 = connect_info.dpad_touch_shortcut1;
 	dpad_touch_shortcut2 = connect_info.dpad_touch_shortcut2;
@@ -436,21 +450,68 @@ StreamSession::StreamSession(const StreamSessionConnectInfo &connect_info, QObje
 	}
 	UpdateGamepads();
 
-	QTimer *packet_loss_timer = new QTimer(this);
-	packet_loss_timer->setInterval(200);
-	packet_loss_timer->start();
-	connect(packet_loss_timer, &QTimer::timeout, this, [this]() {
-		if(packet_loss_history.size() > 10)
-			packet_loss_history.takeFirst();
-		packet_loss_history.append(session.stream_connection.congestion_control.packet_loss);
-		double packet_loss = 0;
-		for(auto v : std::as_const(packet_loss_history))
-			packet_loss += v / packet_loss_history.size();
+	// the lib keeps these up to date from its own threads, the overlay only needs to look once per second
+	ChiakiMetrics *metrics = chiaki_metrics_default();
+	metric_bitrate_kbps = chiaki_metrics_register_gauge(metrics, "stream.bitrate_kbps");
+	metric_packet_loss_avg_ppm = chiaki_metrics_register_gauge(metrics, "stream.packet_loss_avg_ppm");
+	QTimer *stats_timer = new QTimer(this);
+	stats_timer->setInterval(1000);
+	stats_timer->start();
+	connect(stats_timer, &QTimer::timeout, this, [this]() {
+		double bitrate = chiaki_metric_get(metric_bitrate_kbps) / 1000.0;
+		if(bitrate != measured_bitrate)
+		{
+			measured_bitrate = bitrate;
+			emit MeasuredBitrateChanged();
+		}
+		double packet_loss = chiaki_metric_get(metric_packet_loss_avg_ppm) / 1000000.0;
 		if(packet_loss != average_packet_loss)
 		{
 			average_packet_loss = packet_loss;
 			emit AveragePacketLossChanged();
 		}
+		if(mic_capture_started)
+		{
+			ChiakiMicCaptureStats mic_stats;
+			chiaki_mic_capture_get_stats(&mic_capture, &mic_stats);
+			double latency = mic_stats.latency_avg_us / 1000.0;
+			if(latency != mic_latency)
+			{
+				mic_latency = latency;
+				emit MicLatencyChanged();
+			}
+		}
+		ChiakiLinkQualityStats link_stats;
+		chiaki_session_get_link_quality(&session, &link_stats);
+		QVariantMap quality;
+		quality["rttMs"] = link_stats.srtt_us / 1000.0;
+		quality["rttVarMs"] = link_stats.rttvar_us / 1000.0;
+		quality["resendTimeoutMs"] = (qulonglong)link_stats.resend_timeout_ms;
+		quality["loss"] = link_stats.loss;
+		quality["resent"] = (qulonglong)link_stats.data_resent;
+		quality["givenUp"] = (qulonglong)link_stats.data_given_up;
+		quality["recoveries"] = (qulonglong)link_stats.video_recoveries;
+		quality["recoveryMs"] = link_stats.video_recovery_last_us / 1000.0;
+		quality["sendInputMs"] = link_stats.send_queue_avg_us[CHIAKI_TAKION_SEND_CLASS_INPUT] / 1000.0;
+		quality["sendControlMs"] = link_stats.send_queue_avg_us[CHIAKI_TAKION_SEND_CLASS_CONTROL] / 1000.0;
+		quality["sendBulkMs"] = link_stats.send_queue_avg_us[CHIAKI_TAKION_SEND_CLASS_BULK] / 1000.0;
+		uint64_t send_dropped = 0;
+		for(size_t i=0; i<CHIAKI_LINK_QUALITY_SEND_CLASSES; i++)
+			send_dropped += link_stats.send_dropped[i];
+		quality["sendDropped"] = (qulonglong)send_dropped;
+		quality["frameSpreadMs"] = link_stats.video_timing.spread_avg_us / 1000.0;
+		quality["frameJitterMs"] = link_stats.video_timing.jitter_us / 1000.0;
+		quality["queueDelayMs"] = link_stats.video_timing.queue_delay_us / 1000.0;
+		quality["rcvbuf"] = link_stats.socket.rcvbuf;
+		quality["sndbuf"] = link_stats.socket.sndbuf;
+		quality["dscp"] = link_stats.socket.dscp_input;
+		quality["busyPollUs"] = link_stats.socket.busy_poll_us;
+		quality["rxTimestamps"] = link_stats.socket.rx_timestamps;
+		if(quality != link_quality)
+		{
+			link_quality = quality;
+			emit LinkQualityChanged();
+		}
 	});
 }
 
@@ -458,8 +519,8 @@ StreamSession::~StreamSession()
 {
 	if(audio_out)
 		SDL_CloseAudioDevice(audio_out);
-	if(audio_in)
-		SDL_CloseAudioDevice(audio_in);
+	// the mic encode thread sends through the session, stop it first
+	StopMic();
 	if(session_started)
 		chiaki_session_join(&session);
 	chiaki_session_fini(&session);
@@ -526,11 +587,6 @@ StreamSession::~StreamSession()
 		sdeck_haptics_senderr = nullptr;
 	}
 #endif
-	if(mic_buf.buf)
-	{
-		free(mic_buf.buf);
-		mic_buf.buf = nullptr;
-	}
 #if CHIAKI_GUI_ENABLE_SPEEX
 	if(speech_processing_enabled)
 	{
@@ -544,6 +600,16 @@ StreamSession::~StreamSession()
 			free(echo_resampler_buf);
 			echo_resampler_buf = nullptr;
 		}
+		if(echo_buf)
+		{
+			free(echo_buf);
+			echo_buf = nullptr;
+		}
+		if(echo_to_cancel_init)
+		{
+			chiaki_ring_buffer_fini(&echo_to_cancel);
+			echo_to_cancel_init = false;
+		}
 	}
 #endif
 }
@@ -552,7 +618,13 @@ void StreamSession::Start()
 {
 	if(!connect_timer.isValid())
 		connect_timer.start();
+	if(!first_frame_timer.isValid())
+		first_frame_timer.start();
 	ChiakiErrorCode err = chiaki_session_start(&session);
+	// Opening the audio device can take a while, so do it while the session is negotiating instead of
+	// once the stream has started. The console always sends stereo at 48 kHz, InitAudio() reopens otherwise.
+	if(err == CHIAKI_ERR_SUCCESS && !audio_out)
+		OpenAudioOut(2, 48000);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		session_started = true;
@@ -1067,8 +1139,19 @@ void StreamSession::InitAudio(unsigned int channels, unsigned int rate)
 	allow_unmute = true;
 	if(start_mic_unmuted)
 		ToggleMute();
+	// usually already opened by Start()
+	if(audio_out && audio_out_channels == channels && audio_out_rate == rate)
+		return;
+	OpenAudioOut(channels, rate);
+}
+
+void StreamSession::OpenAudioOut(unsigned int channels, unsigned int rate)
+{
 	if(audio_out)
+	{
 		SDL_CloseAudioDevice(audio_out);
+		audio_out = 0;
+	}
 
 	SDL_AudioSpec spec = {0};
 	spec.freq = rate;
@@ -1095,6 +1178,8 @@ void StreamSession::InitAudio(unsigned int channels, unsigned int rate)
 	if(audio_out_device_name.isEmpty())
 		audio_out_device_name = "Auto";
 
+	audio_out_channels = channels;
+	audio_out_rate = rate;
 	audio_out_drain_queue = false;
 
 	SDL_PauseAudioDevice(audio_out, 0);
@@ -1105,31 +1190,16 @@ void StreamSession::InitAudio(unsigned int channels, unsigned int rate)
 
 void StreamSession::InitMic(unsigned int channels, unsigned int rate)
 {
-	if(audio_in)
-		SDL_CloseAudioDevice(audio_in);
-
-	mic_buf.buf = nullptr;
-#if CHIAKI_GUI_ENABLE_SPEEX
-	mic_resampler_buf = nullptr;
-	echo_resampler_buf = nullptr;
-#endif
+	StopMic();
 
-	mic_buf.current_byte = 0;
-	int16_t mic_buf_size = channels * MICROPHONE_SAMPLES;
-	mic_buf.size_bytes = mic_buf_size * sizeof(int16_t);
-	mic_buf.buf = (int16_t*) calloc(mic_buf_size, sizeof(int16_t));
-	if(!mic_buf.buf)
-	{
-		CHIAKI_LOGE(GetChiakiLog(), "Could not allocate memory for mic buf, aborting mic startup");
-		return;
-	}
+	mic_frame_size_bytes = channels * MICROPHONE_SAMPLES * sizeof(int16_t);
 
 #if CHIAKI_GUI_ENABLE_SPEEX
-	if(speech_processing_enabled)
+	if(speech_processing_enabled && !echo_to_cancel_init)
 	{
 		SDL_AudioCVT cvt;
 		SDL_BuildAudioCVT(&cvt, AUDIO_S16LSB, 1, 48000, AUDIO_S16LSB, 2, 48000);
-		cvt.len = mic_buf.size_bytes;
+		cvt.len = mic_frame_size_bytes;
 		mic_resampler_buf = (uint8_t*) calloc(cvt.len * cvt.len_mult, sizeof(uint8_t));
 		if(!mic_resampler_buf)
 		{
@@ -1146,9 +1216,34 @@ void StreamSession::InitMic(unsigned int channels, unsigned int rate)
 			CHIAKI_LOGE(GetChiakiLog(), "Echo resampler buf could not be created, aborting mic startup");
 			return;
 		}
+
+		echo_buf = (int16_t*) calloc(mic_frame_size_bytes, 1);
+		if(!echo_buf)
+		{
+			CHIAKI_LOGE(GetChiakiLog(), "Echo buf could not be created, aborting mic startup");
+			return;
+		}
+
+		if(chiaki_ring_buffer_init(&echo_to_cancel, ECHO_QUEUE_MAX * mic_frame_size_bytes) != CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_LOGE(GetChiakiLog(), "Echo queue could not be created, aborting mic startup");
+			return;
+		}
+		echo_to_cancel_init = true;
 	}
 #endif
 
+	ChiakiErrorCode err = chiaki_mic_capture_init(&mic_capture, GetChiakiLog(), channels * MICROPHONE_SAMPLES, MIC_CAPTURE_FRAMES_MAX,
+			[](int16_t *buf, size_t samples_count, void *user) {
+				static_cast<StreamSession *>(user)->EncodeMicFrame(buf, samples_count);
+			}, this, &session.connect_info.thread_profile.audio);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(GetChiakiLog(), "Failed to start mic encode thread, aborting mic startup");
+		return;
+	}
+	mic_capture_started = true;
+
 	SDL_AudioSpec spec = {0};
 	spec.freq = rate;
 	spec.channels = channels;
@@ -1156,8 +1251,10 @@ void StreamSession::InitMic(unsigned int channels, unsigned int rate)
 	spec.samples = audio_buffer_size / 4;
 	spec.callback = [](void *userdata, Uint8 *stream, int len) {
 		auto s = static_cast<StreamSession*>(userdata);
-		QByteArray data(reinterpret_cast<char*>(stream), len);
-		QMetaObject::invokeMethod(s, std::bind(&StreamSession::ReadMic, s, data));
+		// Don't send mic data if muted
+		if(s->muted)
+			return;
+		chiaki_mic_capture_push(&s->mic_capture, reinterpret_cast<const int16_t *>(stream), len / sizeof(int16_t));
 	};
 	spec.userdata = this;
 
@@ -1184,110 +1281,55 @@ void StreamSession::InitMic(unsigned int channels, unsigned int rate)
 			qPrintable(audio_in_device_name), obtained.channels, obtained.freq, obtained.size);
 }
 
-void StreamSession::ReadMic(const QByteArray &micdata)
+void StreamSession::StopMic()
 {
-#if CHIAKI_GUI_ENABLE_SPEEX
-	int16_t echo_buf[mic_buf.size_bytes / sizeof(int16_t)];
-#endif
-	uint32_t mic_bytes_left = mic_buf.size_bytes - mic_buf.current_byte;
-	// Don't send mic data if muted
-	if(muted)
-		return;
-	qint64 bytes_read = micdata.size();
-	const char * micdataread = micdata.constData();
-	if(bytes_read == 0)
-		return;
-	if(bytes_read < mic_bytes_left)
+	// closing the device waits for a running capture callback, so nothing is pushed afterwards
+	if(audio_in)
 	{
-		memcpy((uint8_t *)mic_buf.buf + mic_buf.current_byte, (uint8_t *)micdataread, bytes_read);
-		mic_buf.current_byte += bytes_read;
+		SDL_CloseAudioDevice(audio_in);
+		audio_in = 0;
 	}
-	else
+	if(mic_capture_started)
 	{
-		memcpy((uint8_t *)mic_buf.buf + mic_buf.current_byte, (uint8_t *)micdataread, mic_bytes_left);
+		chiaki_mic_capture_fini(&mic_capture);
+		mic_capture_started = false;
+	}
+}
+
+// Runs on the mic encode thread for every frame of MICROPHONE_SAMPLES
+void StreamSession::EncodeMicFrame(int16_t *buf, size_t samples_count)
+{
 #if CHIAKI_GUI_ENABLE_SPEEX
+	if(speech_processing_enabled && echo_to_cancel_init)
+	{
+		// change samples to stereo after processing with SPEEX
 		SDL_AudioCVT cvt;
-		if(speech_processing_enabled)
+		SDL_BuildAudioCVT(&cvt, AUDIO_S16LSB, 1, 48000, AUDIO_S16LSB, 2, 48000);
+		cvt.len = mic_frame_size_bytes;
+		cvt.buf = mic_resampler_buf;
+		if(chiaki_ring_buffer_available(&echo_to_cancel) >= mic_frame_size_bytes)
 		{
-			// change samples to stereo after processing with SPEEX
-			SDL_BuildAudioCVT(&cvt, AUDIO_S16LSB, 1, 48000, AUDIO_S16LSB, 2, 48000);
-			cvt.len = mic_buf.size_bytes;
-			cvt.buf = mic_resampler_buf;
-			if(!echo_to_cancel.isEmpty())
-			{
-				int16_t *echo = echo_to_cancel.dequeue();
-				speex_echo_cancellation(echo_state, mic_buf.buf, echo, echo_buf);
-				speex_preprocess_run(preprocess_state, echo_buf);
-				memcpy((uint8_t *)mic_resampler_buf, (uint8_t *)echo_buf, mic_buf.size_bytes);
-				if(SDL_ConvertAudio(&cvt) != 0)
-				{
-					CHIAKI_LOGE(log.GetChiakiLog(), "Failed to resample mic audio: %s", SDL_GetError());
-					return;
-				}
-				chiaki_opus_encoder_frame((int16_t *)mic_resampler_buf, &opus_encoder);
-			}
-			else
-			{
-				speex_preprocess_run(preprocess_state, (int16_t *)mic_buf.buf);
-				memcpy((uint8_t *)mic_resampler_buf, (uint8_t *)mic_buf.buf, mic_buf.size_bytes);
-				if(SDL_ConvertAudio(&cvt) != 0)
-				{
-					CHIAKI_LOGE(log.GetChiakiLog(), "Failed to resample mic audio: %s", SDL_GetError());
-					return;
-				}
-				chiaki_opus_encoder_frame((int16_t *)mic_resampler_buf, &opus_encoder);
-			}
+			chiaki_ring_buffer_read(&echo_to_cancel, echo_buf, mic_frame_size_bytes);
+			speex_echo_cancellation(echo_state, buf, echo_buf, (int16_t *)mic_resampler_buf);
+			speex_preprocess_run(preprocess_state, (int16_t *)mic_resampler_buf);
 		}
 		else
-			chiaki_opus_encoder_frame(mic_buf.buf, &opus_encoder);
-#else
-	    chiaki_opus_encoder_frame(mic_buf.buf, &opus_encoder);
-#endif
-		bytes_read -= mic_bytes_left;
-		uint32_t frames = bytes_read / mic_buf.size_bytes;
-		for (int i = 0; i < frames; i++)
 		{
-			memcpy((uint8_t *)mic_buf.buf, (uint8_t *)micdataread + mic_bytes_left + i * mic_buf.size_bytes, mic_buf.size_bytes);
-#if CHIAKI_GUI_ENABLE_SPEEX
-		if(speech_processing_enabled)
-		{
-			if(!echo_to_cancel.isEmpty())
-			{
-				int16_t *echo = echo_to_cancel.dequeue();
-				speex_echo_cancellation(echo_state, mic_buf.buf, echo, echo_buf);
-				speex_preprocess_run(preprocess_state, echo_buf);
-				memcpy((uint8_t *)mic_resampler_buf, (uint8_t *)echo_buf, mic_buf.size_bytes);
-				if(SDL_ConvertAudio(&cvt) != 0)
-				{
-					CHIAKI_LOGE(log.GetChiakiLog(), "Failed to resample mic audio: %s", SDL_GetError());
-					return;
-				}
-				chiaki_opus_encoder_frame((int16_t *)mic_resampler_buf, &opus_encoder);
-			}
-			else
-			{
-				speex_preprocess_run(preprocess_state, (int16_t *)mic_buf.buf);
-				memcpy((uint8_t *)mic_resampler_buf, (uint8_t *)mic_buf.buf, mic_buf.size_bytes);
-				if(SDL_ConvertAudio(&cvt) != 0)
-				{
-					CHIAKI_LOGE(log.GetChiakiLog(), "Failed to resample mic audio: %s", SDL_GetError());
-					return;
-				}
-				chiaki_opus_encoder_frame((int16_t *)mic_resampler_buf, &opus_encoder);
-			}
+			speex_preprocess_run(preprocess_state, buf);
+			memcpy(mic_resampler_buf, buf, mic_frame_size_bytes);
 		}
-		else
-			chiaki_opus_encoder_frame(mic_buf.buf, &opus_encoder);
-#else
-	    chiaki_opus_encoder_frame(mic_buf.buf, &opus_encoder);
-#endif
-		}
-		mic_buf.current_byte = bytes_read % mic_buf.size_bytes;
-		if(mic_buf.current_byte == 0)
+		if(SDL_ConvertAudio(&cvt) != 0)
+		{
+			CHIAKI_LOGE(log.GetChiakiLog(), "Failed to resample mic audio: %s", SDL_GetError());
 			return;
-		memcpy((uint8_t *)mic_buf.buf, (uint8_t *)micdataread + mic_bytes_left + frames * mic_buf.size_bytes, mic_buf.current_byte);
+		}
+		chiaki_opus_encoder_frame((int16_t *)mic_resampler_buf, &opus_encoder);
+		return;
 	}
+#endif
+	chiaki_opus_encoder_frame(buf, &opus_encoder);
 }
+
 void StreamSession::InitHaptics()
 {
 	haptics_output = 0;
@@ -1311,10 +1353,8 @@ void StreamSession::InitHaptics()
 	}
 #endif
 
-	SDL_AudioCVT cvt;
-	SDL_BuildAudioCVT(&cvt, AUDIO_S16LSB, 4, 3000, AUDIO_S16LSB, 4, 48000);
-	cvt.len = 240;  // 10 16bit stereo samples
-	haptics_resampler_buf = (uint8_t*) calloc(cvt.len * cvt.len_mult, sizeof(uint8_t));
+	chiaki_haptics_resampler_init(&haptics_resampler);
+	haptics_resampler_buf = (int16_t *) calloc(chiaki_haptics_resampler_dualsense_samples(HAPTICS_FRAMES_MAX), sizeof(int16_t));
 	if(!haptics_resampler_buf)
 		CHIAKI_LOGE(log.GetChiakiLog(),"Haptics resampler buf could not be allocated");
 }
@@ -1387,13 +1427,17 @@ void StreamSession::ConnectSdeckHaptics()
 		CHIAKI_LOGE(log.GetChiakiLog(), "Steam Deck Haptics Audio could not be connected :(");
 		return;
 	}
+	// frequency analysis and hid writes run on the sdeck haptic worker thread
+	if (sdeck_haptic_worker_start(sdeck, STEAMDECK_HAPTIC_SAMPLING_RATE) < 0)
+	{
+		CHIAKI_LOGE(log.GetChiakiLog(), "Steam Deck Haptics worker could not be started :(");
+		return;
+	}
 	CHIAKI_LOGI(log.GetChiakiLog(), "Steam Deck Haptics Audio opened with %d channels @ %d Hz with %u samples per audio analysis.", num_channels, STEAMDECK_HAPTIC_SAMPLING_RATE, sdeck_queue_segment);
 	sdeck_hapticl = {};
 	sdeck_hapticl.reserve(20);
 	sdeck_hapticr = {};
 	sdeck_hapticr.reserve(20);
-	sdeck_skipl = false;
-	sdeck_skipr = false;
 	sdeck_haptics_senderl = (int16_t *) calloc(sdeck_queue_segment, sizeof(uint16_t));
 	if(!sdeck_haptics_senderl)
 	{
@@ -1451,26 +1495,10 @@ void StreamSession::ConnectSdeckHaptics()
 				memset(sdeck_haptics_senderr + 30 * i, 0, 30);
 		}
 
-		if(!changedl || sdeck_skipl)
-			sdeck_skipl = false;
-		else
-		{
-			int intervals = play_pcm_haptic(sdeck, TRACKPAD_LEFT, sdeck_haptics_senderl, sdeck_queue_segment, STEAMDECK_HAPTIC_SAMPLING_RATE);
-			if (intervals < 0)
-				CHIAKI_LOGE(log.GetChiakiLog(), "Failed to submit haptics audio to SteamDeck");
-			else if (intervals == 2)
-				sdeck_skipl = true;
-		}
-		if(!changedr || sdeck_skipr)
-			sdeck_skipr = false;
-		else
-		{
-			int intervals = play_pcm_haptic(sdeck, TRACKPAD_RIGHT, sdeck_haptics_senderr, sdeck_queue_segment, STEAMDECK_HAPTIC_SAMPLING_RATE);
-			if (intervals < 0)
-				CHIAKI_LOGE(log.GetChiakiLog(), "Failed to submit haptics audio to SteamDeck");
-			else if (intervals == 2)
-				sdeck_skipr = true;
-		}
+		if(sdeck_haptic_submit(sdeck, TRACKPAD_LEFT, changedl ? sdeck_haptics_senderl : nullptr, sdeck_queue_segment) < 0)
+			CHIAKI_LOGE(log.GetChiakiLog(), "Failed to submit haptics audio to SteamDeck");
+		if(sdeck_haptic_submit(sdeck, TRACKPAD_RIGHT, changedr ? sdeck_haptics_senderr : nullptr, sdeck_queue_segment) < 0)
+			CHIAKI_LOGE(log.GetChiakiLog(), "Failed to submit haptics audio to SteamDeck");
 		sdeck_last_haptic = chiaki_time_now_monotonic_ms();
 	});
 	sdeck_haptic_timer->start(sdeck_haptic_interval);
@@ -1499,21 +1527,22 @@ void StreamSession::PushAudioFrame(int16_t *buf, size_t samples_count)
 
 #if CHIAKI_GUI_ENABLE_SPEEX
 	// change samples to mono for processing with SPEEX
-	if(echo_resampler_buf && speech_processing_enabled && !muted)
+	if(echo_to_cancel_init && speech_processing_enabled && !muted)
 	{
 		SDL_AudioCVT cvt;
 		SDL_BuildAudioCVT(&cvt, AUDIO_S16LSB, 2, 48000, AUDIO_S16LSB, 1, 48000);
-		cvt.len = mic_buf.size_bytes * 2;
+		cvt.len = mic_frame_size_bytes * 2;
 		cvt.buf = echo_resampler_buf;
-		memcpy(echo_resampler_buf, buf, mic_buf.size_bytes * 2);
+		memcpy(echo_resampler_buf, buf, mic_frame_size_bytes * 2);
 		if(SDL_ConvertAudio(&cvt) != 0)
 		{
 			CHIAKI_LOGE(log.GetChiakiLog(), "Failed to resample echo audio: %s", SDL_GetError());
 			return;
 		}
-		if(echo_to_cancel.size() >= ECHO_QUEUE_MAX)
-			echo_to_cancel.dequeue();
-		echo_to_cancel.enqueue((int16_t *)echo_resampler_buf);
+		// the mic fell behind, the oldest reference is the least useful for cancelling the echo
+		if(chiaki_ring_buffer_free(&echo_to_cancel) < mic_frame_size_bytes)
+			chiaki_ring_buffer_drop_oldest(&echo_to_cancel, mic_frame_size_bytes);
+		chiaki_ring_buffer_write(&echo_to_cancel, echo_resampler_buf, mic_frame_size_bytes);
 	}
 #endif
 	SDL_QueueAudio(audio_out, buf, samples_count * audio_out_sample_size);
@@ -1548,43 +1577,22 @@ void StreamSession::PushHapticsFrame(uint8_t *buf, size_t buf_size)
 			CHIAKI_LOGE(log.GetChiakiLog(), "Haptic audio of incompatible size: %zu", buf_size);
 			return;
 		}
-		int16_t amplitudel = 0, amplituder = 0;
-		const size_t sample_size = 2 * sizeof(int16_t); // stereo samples
 		haptic_packet_t packetl = {0}, packetr = {0};
 		uint64_t timestamp = chiaki_time_now_monotonic_ms();
 		packetl.timestamp = timestamp;
 		packetr.timestamp = timestamp;
-		size_t buf_count = buf_size / sample_size;
-		for (size_t i = 0; i < buf_count; i++)
-		{
-			size_t cur = i * sample_size;
-			memcpy(&amplitudel, buf + cur, sizeof(int16_t));
-			packetl.haptic_packet[i] = amplitudel;
-			memcpy(&amplituder, buf + cur + sizeof(int16_t), sizeof(int16_t));
-			packetr.haptic_packet[i] = amplituder;
-		}
+		chiaki_haptics_deinterleave(buf, buf_size / CHIAKI_HAPTICS_FRAME_SIZE, packetl.haptic_packet, packetr.haptic_packet);
 		emit SdeckHapticPushed(packetl, packetr);
 		return;
 	}
 #endif
 	if((rumble_haptics_intensity != RumbleHapticsIntensity::Off) && haptics_output == 0)
 	{
-		int16_t amplitudel = 0, amplituder = 0;
-		int32_t suml = 0, sumr = 0;
-		const size_t sample_size = 2 * sizeof(int16_t); // stereo samples
-
-		size_t buf_count = buf_size / sample_size;
-		for (size_t i = 0; i < buf_count; i++){
-			size_t cur = i * sample_size;
-
-			memcpy(&amplitudel, buf + cur, sizeof(int16_t));
-			memcpy(&amplituder, buf + cur + sizeof(int16_t), sizeof(int16_t));
-			suml += amplitudel;
-			sumr += amplituder;
-		}
+		ChiakiHapticsEnvelope envelope;
+		chiaki_haptics_envelope(buf, buf_size / CHIAKI_HAPTICS_FRAME_SIZE, &envelope);
 		uint16_t left = 0, right = 0;
-		left = suml / buf_count;
-		right = sumr / buf_count;
+		left = envelope.mean_left > 0 ? envelope.mean_left : 0;
+		right = envelope.mean_right > 0 ? envelope.mean_right : 0;
 		uint32_t temp_left = 0;
 		uint32_t temp_right = 0;
 		switch(rumble_haptics_intensity)
@@ -1639,25 +1647,16 @@ void StreamSession::PushHapticsFrame(uint8_t *buf, size_t buf_size)
 	}
 	if(haptics_output == 0)
 		return;
-	SDL_AudioCVT cvt;
-	// Haptics samples are coming in at 3KHZ, but the DualSense expects 48KHZ
-	SDL_BuildAudioCVT(&cvt, AUDIO_S16LSB, 4, 3000, AUDIO_S16LSB, 4, 48000);
-	cvt.len = buf_size * 2;
-	cvt.buf = haptics_resampler_buf;
-	// Remix to 4 channels
-	for (int i=0; i < buf_size; i+=4)
-	{
-		SDL_memset(haptics_resampler_buf + i * 2, 0, 4);
-		SDL_memcpy(haptics_resampler_buf + (i * 2) + 4, buf + i, 4);
-	}
-	// Resample to 48kHZ
-	if (SDL_ConvertAudio(&cvt) != 0)
+	size_t frames_count = buf_size / CHIAKI_HAPTICS_FRAME_SIZE;
+	if(frames_count > HAPTICS_FRAMES_MAX)
 	{
-		CHIAKI_LOGE(log.GetChiakiLog(), "Failed to resample haptics audio: %s", SDL_GetError());
+		CHIAKI_LOGE(log.GetChiakiLog(), "Haptic audio of incompatible size: %zu", buf_size);
 		return;
 	}
+	// Haptics samples are coming in at 3KHZ, but the DualSense expects 48KHZ on 4 channels
+	size_t out_frames = chiaki_haptics_resampler_dualsense(&haptics_resampler, buf, frames_count, haptics_resampler_buf);
 
-	if (SDL_QueueAudio(haptics_output, cvt.buf, cvt.len_cvt) < 0)
+	if (SDL_QueueAudio(haptics_output, haptics_resampler_buf, out_frames * CHIAKI_HAPTICS_DUALSENSE_CHANNELS * sizeof(int16_t)) < 0)
 	{
 		CHIAKI_LOGE(log.GetChiakiLog(), "Failed to submit haptics audio to device: %s", SDL_GetError());
 		return;
@@ -1677,11 +1676,34 @@ void StreamSession::Event(ChiakiEvent *event)
 	switch(event->type)
 	{
 		case CHIAKI_EVENT_CONNECTED:
+		{
 			connect_timer.invalidate();
 			connected = true;
+			// only store freshly negotiated parameters, a cached profile keeps its age so it gets probed again eventually
+			if(!connect_profile_key.isEmpty() && !session.connect_info.profile.valid)
+			{
+				ChiakiConnectProfile profile;
+				chiaki_session_get_connect_profile(&session, &profile);
+				if(profile.valid)
+				{
+					ConnectProfile connect_profile(connect_profile_key, profile);
+					QMetaObject::invokeMethod(this, [this, connect_profile]() {
+						settings->SetConnectProfile(connect_profile);
+					});
+				}
+			}
 			emit ConnectedChanged();
 			break;
+		}
 		case CHIAKI_EVENT_QUIT:
+			if(!connected && connect_profile_used)
+			{
+				QString key = connect_profile_key;
+				QMetaObject::invokeMethod(this, [this, key]() {
+					settings->RemoveConnectProfile(key);
+				});
+				connect_profile_used = false;
+			}
 			if(!connected && !holepunch_session && chiaki_quit_reason_is_error(event->quit.reason) && connect_timer.elapsed() < SESSION_RETRY_SECONDS * 1000)
 			{
 				QTimer::singleShot(1000, this, &StreamSession::Start);
@@ -1700,6 +1722,9 @@ void StreamSession::Event(ChiakiEvent *event)
 		case CHIAKI_EVENT_NICKNAME_RECEIVED:
 			emit NicknameReceived(event->server_nickname);
 			break;
+		case CHIAKI_EVENT_STARTUP_TIMELINE:
+			startup_ms = event->startup_timeline.total_ms;
+			break;
 		case CHIAKI_EVENT_RUMBLE: {
 			uint8_t left = event->rumble.left;
 			uint8_t right = event->rumble.right;
@@ -1995,12 +2020,13 @@ void StreamSession::CancelPsnConnection(bool stop_thread)
 
 void StreamSession::TriggerFfmpegFrameAvailable()
 {
-	emit FfmpegFrameAvailable();
-	if(measured_bitrate != session.stream_connection.measured_bitrate)
+	if(first_frame_timer.isValid())
 	{
-		measured_bitrate = session.stream_connection.measured_bitrate;
-		emit MeasuredBitrateChanged();
+		CHIAKI_LOGI(GetChiakiLog(), "Time to first frame: %lld ms, session startup %llu ms%s", (long long)first_frame_timer.elapsed(),
+			(unsigned long long)startup_ms, connect_profile_used ? " (cached connection profile)" : "");
+		first_frame_timer.invalidate();
 	}
+	emit FfmpegFrameAvailable();
 }
 
 class StreamSessionPrivate
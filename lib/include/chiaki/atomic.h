@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_ATOMIC_H
+#define CHIAKI_ATOMIC_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Minimal set of atomic operations on 32 and 64 bit values shared between threads.
+ * Loads have acquire and stores have release semantics, read-modify-write operations are sequentially consistent.
+ *
+ * C11 <stdatomic.h> is not available with every compiler the lib is built with, so these wrap the
+ * compiler builtins instead. The values are plain integers and must only be accessed through these functions.
+ */
+
+#if defined(_MSC_VER) && !defined(__clang__)
+
+static inline uint32_t chiaki_atomic_load_u32(volatile uint32_t *p) { return (uint32_t)_InterlockedOr((volatile long *)p, 0); }
+static inline void chiaki_atomic_store_u32(volatile uint32_t *p, uint32_t v) { _InterlockedExchange((volatile long *)p, (long)v); }
+static inline uint32_t chiaki_atomic_fetch_add_u32(volatile uint32_t *p, uint32_t v) { return (uint32_t)_InterlockedExchangeAdd((volatile long *)p, (long)v); }
+static inline bool chiaki_atomic_cas_u32(volatile uint32_t *p, uint32_t *expected, uint32_t desired)
+{
+	uint32_t prev = (uint32_t)_InterlockedCompareExchange((volatile long *)p, (long)desired, (long)*expected);
+	if(prev == *expected)
+		return true;
+	*expected = prev;
+	return false;
+}
+
+static inline uint64_t chiaki_atomic_load_u64(volatile uint64_t *p) { return (uint64_t)_InterlockedOr64((volatile __int64 *)p, 0); }
+static inline void chiaki_atomic_store_u64(volatile uint64_t *p, uint64_t v) { _InterlockedExchange64((volatile __int64 *)p, (__int64)v); }
+static inline uint64_t chiaki_atomic_fetch_add_u64(volatile uint64_t *p, uint64_t v) { return (uint64_t)_InterlockedExchangeAdd64((volatile __int64 *)p, (__int64)v); }
+static inline bool chiaki_atomic_cas_u64(volatile uint64_t *p, uint64_t *expected, uint64_t desired)
+{
+	uint64_t prev = (uint64_t)_InterlockedCompareExchange64((volatile __int64 *)p, (__int64)desired, (__int64)*expected);
+	if(prev == *expected)
+		return true;
+	*expected = prev;
+	return false;
+}
+
+#else
+
+static inline uint32_t chiaki_atomic_load_u32(volatile uint32_t *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+static inline void chiaki_atomic_store_u32(volatile uint32_t *p, uint32_t v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+static inline uint32_t chiaki_atomic_fetch_add_u32(volatile uint32_t *p, uint32_t v) { return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST); }
+static inline bool chiaki_atomic_cas_u32(volatile uint32_t *p, uint32_t *expected, uint32_t desired)
+{
+	return __atomic_compare_exchange_n(p, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline uint64_t chiaki_atomic_load_u64(volatile uint64_t *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+static inline void chiaki_atomic_store_u64(volatile uint64_t *p, uint64_t v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+static inline uint64_t chiaki_atomic_fetch_add_u64(volatile uint64_t *p, uint64_t v) { return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST); }
+static inline bool chiaki_atomic_cas_u64(volatile uint64_t *p, uint64_t *expected, uint64_t desired)
+{
+	return __atomic_compare_exchange_n(p, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_ATOMIC_H
@@ -9,6 +9,8 @@
 #include "takion.h"
 #include "thread.h"
 #include "packetstats.h"
+#include "seqnum.h"
+#include "metrics.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -27,27 +29,71 @@ typedef struct chiaki_audio_sink_t
 	ChiakiAudioSinkFrame frame_cb;
 } ChiakiAudioSink;
 
+/**
+ * Number of frames ahead of the next expected one that can be held back until the gap before them is filled.
+ */
+#define CHIAKI_AUDIO_RECEIVER_WINDOW 32
+#define CHIAKI_AUDIO_RECEIVER_UNIT_SIZE_MAX 0xff
+
+/**
+ * How many frames beyond what the fec units of the newest packet could still recover
+ * are waited for before a gap is given up, to tolerate packets arriving out of order.
+ */
+#define CHIAKI_AUDIO_RECEIVER_REORDER_FRAMES_DEFAULT 1
+
 typedef struct chiaki_audio_receiver_t
 {
 	struct chiaki_session_t *session;
 	ChiakiLog *log;
 	ChiakiMutex mutex;
-	ChiakiSeqNum16 frame_index_prev;
-	bool frame_index_startup; // whether frame_index_prev has definitely not wrapped yet
+	bool frame_index_startup; // whether frame indices have definitely not wrapped yet
 	ChiakiPacketStats *packet_stats;
+
+	/**
+	 * Frames are passed to the sink strictly in order of their index.
+	 * Everything before frame_index_next has been delivered or given up,
+	 * bit i of window_received is set if frame frame_index_next + i is held in the window.
+	 */
+	bool frame_index_next_valid;
+	ChiakiSeqNum16 frame_index_next;
+	uint32_t window_received;
+	uint32_t window_fec; // bit i set if the held frame came from a fec unit
+	uint8_t window_size[CHIAKI_AUDIO_RECEIVER_WINDOW];
+	uint8_t window[CHIAKI_AUDIO_RECEIVER_WINDOW][CHIAKI_AUDIO_RECEIVER_UNIT_SIZE_MAX];
+	uint8_t reorder_frames;
+
+	uint64_t frames_delivered;
+	uint64_t frames_recovered; // delivered from a fec unit because the packet carrying it as source was missing
+	uint64_t frames_lost;
+
+	struct
+	{
+		ChiakiMetric *frames_delivered;
+		ChiakiMetric *frames_recovered;
+		ChiakiMetric *frames_lost;
+	} metrics;
 } ChiakiAudioReceiver;
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_receiver_init(ChiakiAudioReceiver *audio_receiver, struct chiaki_session_t *session, ChiakiPacketStats *packet_stats);
+/**
+ * @param metrics_name subsystem the frame counters are registered under, e.g. "audio" or "haptics",
+ * so receivers for different streams don't add up in the same metrics
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_receiver_init(ChiakiAudioReceiver *audio_receiver, struct chiaki_session_t *session, ChiakiPacketStats *packet_stats, const char *metrics_name);
 CHIAKI_EXPORT void chiaki_audio_receiver_fini(ChiakiAudioReceiver *audio_receiver);
 CHIAKI_EXPORT void chiaki_audio_receiver_stream_info(ChiakiAudioReceiver *audio_receiver, ChiakiAudioHeader *audio_header);
+
+/**
+ * Must only be called from one thread at a time, so the frames reach the sink in order.
+ * The sink is called without holding the receiver's mutex.
+ */
 CHIAKI_EXPORT void chiaki_audio_receiver_av_packet(ChiakiAudioReceiver *audio_receiver, ChiakiTakionAVPacket *packet);
 
-static inline ChiakiAudioReceiver *chiaki_audio_receiver_new(struct chiaki_session_t *session, ChiakiPacketStats *packet_stats)
+static inline ChiakiAudioReceiver *chiaki_audio_receiver_new(struct chiaki_session_t *session, ChiakiPacketStats *packet_stats, const char *metrics_name)
 {
 	ChiakiAudioReceiver *audio_receiver = CHIAKI_NEW(ChiakiAudioReceiver);
 	if(!audio_receiver)
 		return NULL;
-	ChiakiErrorCode err = chiaki_audio_receiver_init(audio_receiver, session, packet_stats);
+	ChiakiErrorCode err = chiaki_audio_receiver_init(audio_receiver, session, packet_stats, metrics_name);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		free(audio_receiver);
@@ -14,6 +14,7 @@
 extern "C" {
 #endif
 
+#define CHIAKI_AUDIO_SENDER_UNITS 3
 
 typedef struct chiaki_audio_sender_t
 {
@@ -23,11 +24,15 @@ typedef struct chiaki_audio_sender_t
 	ChiakiTakion *takion;
 	uint16_t buf_size_per_unit;
 	uint16_t buf_stride_per_unit;
-	uint8_t *frame_buf;
-	uint8_t *framea;
-	uint8_t *frameb;
-	size_t frame_buf_size;
+	/**
+	 * The last CHIAKI_AUDIO_SENDER_UNITS encoded frames, slots[slot_cur] is the newest.
+	 * Every packet carries the newest frame as source unit followed by the two before it as redundancy.
+	 */
+	uint8_t *slots;
+	uint8_t slot_cur;
+	uint8_t slots_filled;
 	uint8_t *filled_packet_buf;
+	size_t filled_packet_size;
 	ChiakiSeqNum16 frame_index;
 } ChiakiAudioSender;
 
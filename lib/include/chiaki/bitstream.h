@@ -16,6 +16,7 @@ typedef struct chiaki_bitstream_t
 {
 	ChiakiLog *log;
 	ChiakiCodec codec;
+	bool header_valid; // whether the fields below have been parsed from the current header
 	union
 	{
 		struct
@@ -31,7 +32,14 @@ typedef struct chiaki_bitstream_t
 			struct
 			{
 				uint32_t log2_max_pic_order_cnt_lsb_minus4;
+				bool separate_colour_plane_flag;
 			} sps;
+			struct
+			{
+				bool dependent_slice_segments_enabled_flag;
+				bool output_flag_present_flag;
+				uint32_t num_extra_slice_header_bits;
+			} pps;
 		} h265;
 	};
 } ChiakiBitstream;
@@ -47,11 +55,23 @@ typedef struct chiaki_bitstream_slice_t
 {
 	ChiakiBitstreamSliceType slice_type;
 	unsigned reference_frame;
+	unsigned offset; // of the start code of the slice NAL in the parsed data
 } ChiakiBitstreamSlice;
 
 CHIAKI_EXPORT void chiaki_bitstream_init(ChiakiBitstream *bitstream, ChiakiLog *log, ChiakiCodec codec);
 CHIAKI_EXPORT bool chiaki_bitstream_header(ChiakiBitstream *bitstream, uint8_t *data, unsigned size);
+
+/**
+ * Parse the header of the slice NAL at the start of data.
+ * Only the first NAL is looked at, so data can be cut off right after the slice header,
+ * e.g. passing just the first unit of a frame avoids walking the whole frame.
+ */
 CHIAKI_EXPORT bool chiaki_bitstream_slice(ChiakiBitstream *bitstream, uint8_t *data, unsigned size, ChiakiBitstreamSlice *slice);
+
+/**
+ * Rewrite the reference frame of a P slice in place.
+ * Pass data + slice->offset from a previous chiaki_bitstream_slice() to skip searching for the NAL again.
+ */
 CHIAKI_EXPORT bool chiaki_bitstream_slice_set_reference_frame(ChiakiBitstream *bitstream, uint8_t *data, unsigned size, unsigned reference_frame);
 
 #ifdef __cplusplus
@@ -6,28 +6,52 @@
 #include "takion.h"
 #include "thread.h"
 #include "packetstats.h"
+#include "linkquality.h"
+#include "metrics.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#define CHIAKI_CONGESTION_CONTROL_LOSS_HISTORY 10
+
 typedef struct chiaki_congestion_control_t
 {
 	ChiakiTakion *takion;
 	ChiakiPacketStats *stats;
+	ChiakiLinkQuality *link_quality;
 	ChiakiThread thread;
 	ChiakiBoolPredCond stop_cond;
 	double packet_loss;
 	double packet_loss_max;
+	uint64_t interval_ms; // current report interval, from chiaki_congestion_control_tune()
+	ChiakiMetric *metric_packet_loss_ppm; // of the last interval
+	ChiakiMetric *metric_packet_loss_avg_ppm; // of the last CHIAKI_CONGESTION_CONTROL_LOSS_HISTORY intervals
 } ChiakiCongestionControl;
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_start(ChiakiCongestionControl *control, ChiakiTakion *takion, ChiakiPacketStats *stats, double packet_loss_max);
+/**
+ * @param link_quality optional, receives the loss of every interval and provides the RTT estimates the reports are tuned with
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_start(ChiakiCongestionControl *control, ChiakiTakion *takion, ChiakiPacketStats *stats, ChiakiLinkQuality *link_quality, double packet_loss_max);
 
 /**
  * Stop control and join the thread
  */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_stop(ChiakiCongestionControl *control);
 
+/**
+ * Adapt the reports to the current link estimates.
+ *
+ * The interval follows the resend timeout, so packets that are merely late or reordered are not yet counted as lost.
+ * The loss that may be hidden from the console shrinks by rtt_min / srtt, so once queues build up
+ * the console sees the real loss and lowers the bitrate.
+ *
+ * @param stats may be NULL, in which case the defaults are used
+ * @param interval_ms time until the next report
+ * @param packet_loss_max_out highest loss to report
+ */
+CHIAKI_EXPORT void chiaki_congestion_control_tune(const ChiakiLinkQualityStats *stats, double packet_loss_max, uint64_t *interval_ms, double *packet_loss_max_out);
+
 #ifdef __cplusplus
 }
 #endif
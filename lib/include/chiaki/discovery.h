@@ -79,6 +79,12 @@ CHIAKI_EXPORT ChiakiTarget chiaki_discovery_host_system_version_target(ChiakiDis
 
 CHIAKI_EXPORT int chiaki_discovery_packet_fmt(char *buf, size_t buf_size, ChiakiDiscoveryPacket *packet);
 
+/**
+ * Parse the answer to a CHIAKI_DISCOVERY_CMD_SRCH packet received from addr.
+ * The strings in response point into buf and addr_buf afterwards.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_srch_response_parse(ChiakiDiscoveryHost *response, struct sockaddr *addr, char *addr_buf, size_t addr_buf_size, char *buf, size_t buf_size);
+
 typedef struct chiaki_discovery_t
 {
 	ChiakiLog *log;
@@ -12,45 +12,110 @@ extern "C" {
 
 typedef void (*ChiakiDiscoveryServiceCb)(ChiakiDiscoveryHost *hosts, size_t hosts_count, void *user);
 
+typedef enum chiaki_discovery_service_host_event_t
+{
+	CHIAKI_DISCOVERY_SERVICE_HOST_ADDED,
+	CHIAKI_DISCOVERY_SERVICE_HOST_CHANGED,
+	CHIAKI_DISCOVERY_SERVICE_HOST_REMOVED
+} ChiakiDiscoveryServiceHostEvent;
+
+/**
+ * Called once for every host that appeared, changed or disappeared.
+ * host is only valid during the call.
+ */
+typedef void (*ChiakiDiscoveryServiceHostCb)(ChiakiDiscoveryServiceHostEvent event, ChiakiDiscoveryHost *host, void *user);
+
 typedef struct chiaki_discovery_service_options_t
 {
 	size_t hosts_max;
 	uint64_t host_drop_pings;
 	uint64_t ping_ms;
+	/**
+	 * If not 0, the interval right after hosts changed, doubled after every ping without changes until it reaches ping_ms.
+	 * If 0, pings are always ping_ms apart.
+	 */
+	uint64_t ping_fast_ms;
 	uint64_t ping_initial_ms;
 	struct sockaddr_storage *send_addr;
 	size_t send_addr_size;
+	/**
+	 * If not NULL, pings are also sent here from a second, IPv6 socket that is served by the same thread.
+	 */
+	struct sockaddr_storage *send_addr_ipv6;
+	size_t send_addr_ipv6_size;
 	struct sockaddr_storage *broadcast_addrs;
 	size_t broadcast_num;
 	char *send_host;
-	ChiakiDiscoveryServiceCb cb;
-	void *cb_user;
+	ChiakiDiscoveryServiceCb cb; // the whole list of hosts after every change, may be NULL
+	ChiakiDiscoveryServiceHostCb host_cb; // may be NULL
+	void *cb_user; // for both cb and host_cb
 } ChiakiDiscoveryServiceOptions;
 
 typedef struct chiaki_discovery_service_host_discovery_info_t
 {
 	uint64_t last_ping_index;
+	uint64_t last_primary_ping_index; // last answer on the send_addr socket, only valid if primary
+	bool primary;
+	uint32_t host_id_hash;
 } ChiakiDiscoveryServiceHostDiscoveryInfo;
 
+typedef struct chiaki_discovery_service_manual_host_t
+{
+	char *host;
+	struct sockaddr_storage addr;
+	size_t addr_size; // 0 until host is resolved
+	uint64_t resolve_next_ms; // earliest time to try resolving again after a failure
+	unsigned int resolve_failures;
+} ChiakiDiscoveryServiceManualHost;
+
 typedef struct chiaki_discovery_service_t
 {
 	ChiakiLog *log;
 	ChiakiDiscoveryServiceOptions options;
 	ChiakiDiscovery discovery;
+	ChiakiDiscovery discovery_ipv6;
+	bool discovery_ipv6_active;
 
 	uint64_t ping_index;
 	ChiakiDiscoveryHost *hosts;
 	ChiakiDiscoveryServiceHostDiscoveryInfo *host_discovery_infos;
 	size_t hosts_count;
+	size_t *host_index; // open addressing by host_id_hash, holds index into hosts + 1, 0 for empty buckets
+	size_t host_index_size; // power of 2
+	uint64_t ping_cur_ms;
+	bool hosts_changed; // since the last ping
+	ChiakiDiscoveryServiceManualHost *manual_hosts;
+	size_t manual_hosts_count;
 	ChiakiMutex state_mutex;
 
+	// a single thread sends the pings and waits on all sockets at once
 	ChiakiThread thread;
-	ChiakiBoolPredCond stop_cond;
+	ChiakiStopPipe stop_pipe;
+
+	// manual hosts are resolved on their own thread, started with the first manual host,
+	// so a dead name server never holds up pinging and receiving
+	ChiakiThread resolve_thread;
+	bool resolve_thread_active;
+	bool resolve_stop;
+	ChiakiCond resolve_cond; // with state_mutex
 } ChiakiDiscoveryService;
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_service_init(ChiakiDiscoveryService *service, ChiakiDiscoveryServiceOptions *options, ChiakiLog *log);
 CHIAKI_EXPORT void chiaki_discovery_service_fini(ChiakiDiscoveryService *service);
 
+/**
+ * Replace the hosts that are pinged directly in addition to send_addr, e.g. consoles outside of the local network.
+ * Names are resolved in the background and retried with a growing delay if that fails,
+ * hosts are pinged once they are resolved and their answers are reported like any other host.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_service_set_manual_hosts(ChiakiDiscoveryService *service, const char **hosts, size_t hosts_count);
+
+/**
+ * Send a wakeup packet from the service socket matching the family of host and ping faster afterwards
+ * to pick up the console as soon as it is up.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_service_wakeup(ChiakiDiscoveryService *service, const char *host, uint64_t user_credential, bool ps5);
+
 #ifdef __cplusplus
 }
 #endif
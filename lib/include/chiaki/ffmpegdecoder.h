@@ -4,6 +4,7 @@
 #include <chiaki/config.h>
 #include <chiaki/log.h>
 #include <chiaki/thread.h>
+#include <chiaki/metrics.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -30,6 +31,16 @@ struct chiaki_ffmpeg_decoder_t
 	int32_t frames_lost;
 	bool frame_recovered;
 	int32_t session_bitrate_kbps;
+
+	struct
+	{
+		ChiakiMetric *packets;
+		ChiakiMetric *errors;
+		ChiakiMetric *frames_decoded;
+		ChiakiMetric *frames_skipped; // decoded, but superseded by a newer one before being pulled
+		ChiakiMetric *frames_lost; // reported by the video receiver, never reached the decoder
+		ChiakiMetric *submit_us;
+	} metrics;
 };
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_ffmpeg_decoder_init(ChiakiFfmpegDecoder *decoder, ChiakiLog *log,
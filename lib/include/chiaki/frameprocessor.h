@@ -6,6 +6,7 @@
 #include "common.h"
 #include "takion.h"
 #include "packetstats.h"
+#include "metrics.h"
 
 #include <stdint.h>
 #include <stdbool.h>
@@ -42,6 +43,14 @@ typedef struct chiaki_frame_processor_t
 	size_t unit_slots_size;
 	bool flushed; // whether we have already flushed the current frame, i.e. are only interested in stats, not data.
 	ChiakiStreamStats stream_stats;
+
+	struct
+	{
+		ChiakiMetric *frames_recovered;
+		ChiakiMetric *frames_failed;
+		ChiakiMetric *units_erased;
+		ChiakiMetric *decode_us;
+	} metrics;
 } ChiakiFrameProcessor;
 
 typedef enum chiaki_frame_flush_result_t {
@@ -64,6 +73,12 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_put_unit(ChiakiFrameProcess
  */
 CHIAKI_EXPORT ChiakiFrameProcessorFlushResult chiaki_frame_processor_flush(ChiakiFrameProcessor *frame_processor, uint8_t **frame, size_t *frame_size);
 
+/**
+ * @return the number of bytes at the start of the last flushed frame that came from its first unit,
+ * which is where the slice header lives. 0 if the first unit was missing.
+ */
+CHIAKI_EXPORT size_t chiaki_frame_processor_first_unit_size(ChiakiFrameProcessor *frame_processor);
+
 static inline bool chiaki_frame_processor_flush_possible(ChiakiFrameProcessor *frame_processor)
 {
 	return frame_processor->units_source_received + frame_processor->units_fec_received
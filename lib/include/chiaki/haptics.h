@@ -0,0 +1,101 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_HAPTICS_H
+#define CHIAKI_HAPTICS_H
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Haptics audio as delivered by the console through the haptics sink:
+ * interleaved little-endian int16 stereo (left, right) at 3 kHz.
+ */
+#define CHIAKI_HAPTICS_SAMPLE_RATE 3000
+#define CHIAKI_HAPTICS_CHANNELS 2
+#define CHIAKI_HAPTICS_FRAME_SIZE (CHIAKI_HAPTICS_CHANNELS * sizeof(int16_t))
+
+/**
+ * The DualSense haptics audio device expects 4 channels at 48 kHz,
+ * with the actuators on channels 3 and 4.
+ */
+#define CHIAKI_HAPTICS_DUALSENSE_SAMPLE_RATE 48000
+#define CHIAKI_HAPTICS_DUALSENSE_CHANNELS 4
+#define CHIAKI_HAPTICS_UPSAMPLE_FACTOR (CHIAKI_HAPTICS_DUALSENSE_SAMPLE_RATE / CHIAKI_HAPTICS_SAMPLE_RATE)
+
+/**
+ * Split a buffer of interleaved haptics frames into separate left and right channels.
+ *
+ * @param buf interleaved stereo frames, does not need to be aligned
+ * @param frames_count number of stereo frames in buf
+ * @param left output for frames_count samples
+ * @param right output for frames_count samples
+ */
+CHIAKI_EXPORT void chiaki_haptics_deinterleave(const uint8_t *buf, size_t frames_count, int16_t *left, int16_t *right);
+
+typedef struct chiaki_haptics_envelope_t
+{
+	/**
+	 * Arithmetic mean of the signed samples per channel
+	 */
+	int32_t mean_left;
+	int32_t mean_right;
+
+	/**
+	 * Root mean square per channel, in the range [0, 32768]
+	 */
+	uint16_t rms_left;
+	uint16_t rms_right;
+
+	/**
+	 * Largest absolute sample value per channel
+	 */
+	uint16_t peak_left;
+	uint16_t peak_right;
+} ChiakiHapticsEnvelope;
+
+/**
+ * Compute the per-channel envelope of a buffer of interleaved haptics frames,
+ * used to derive rumble strength for controllers without voice coil actuators.
+ */
+CHIAKI_EXPORT void chiaki_haptics_envelope(const uint8_t *buf, size_t frames_count, ChiakiHapticsEnvelope *envelope);
+
+/**
+ * Fixed-ratio polyphase upsampler from the 3 kHz haptics stream to the 48 kHz DualSense device.
+ * Each phase linearly interpolates between two consecutive input frames.
+ * The last input frame is kept between calls so consecutive buffers join without discontinuity.
+ */
+typedef struct chiaki_haptics_resampler_t
+{
+	int16_t prev_left;
+	int16_t prev_right;
+} ChiakiHapticsResampler;
+
+CHIAKI_EXPORT void chiaki_haptics_resampler_init(ChiakiHapticsResampler *resampler);
+
+/**
+ * @return the number of int16 samples written to out by chiaki_haptics_resampler_dualsense() for frames_count input frames
+ */
+static inline size_t chiaki_haptics_resampler_dualsense_samples(size_t frames_count)
+{
+	return frames_count * CHIAKI_HAPTICS_UPSAMPLE_FACTOR * CHIAKI_HAPTICS_DUALSENSE_CHANNELS;
+}
+
+/**
+ * Upsample interleaved stereo haptics frames to the 4 channel 48 kHz layout of the DualSense,
+ * with channels 1 and 2 silent.
+ *
+ * @param buf interleaved stereo frames, does not need to be aligned
+ * @param frames_count number of stereo frames in buf
+ * @param out output for chiaki_haptics_resampler_dualsense_samples(frames_count) samples
+ * @return number of output frames written
+ */
+CHIAKI_EXPORT size_t chiaki_haptics_resampler_dualsense(ChiakiHapticsResampler *resampler, const uint8_t *buf, size_t frames_count, int16_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_HAPTICS_H
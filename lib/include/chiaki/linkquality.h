@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_LINKQUALITY_H
+#define CHIAKI_LINKQUALITY_H
+
+#include "common.h"
+#include "thread.h"
+#include "sock.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// same as CHIAKI_TAKION_SEND_CLASS_COUNT: input, control, bulk
+#define CHIAKI_LINK_QUALITY_SEND_CLASSES 3
+
+typedef struct chiaki_link_quality_video_timing_t
+{
+	uint64_t spread_avg_us; // first to last unit of a frame
+	uint64_t spread_max_us;
+	uint64_t jitter_us; // of frame arrivals
+	uint64_t queue_delay_us; // one-way delay above the lowest seen
+	int64_t delay_trend_us; // change of the one-way delay per frame
+} ChiakiLinkQualityVideoTiming;
+
+typedef struct chiaki_link_quality_stats_t
+{
+	uint64_t srtt_us; // smoothed RTT
+	uint64_t rttvar_us; // RTT variation
+	uint64_t rtt_min_us;
+	uint64_t rtt_last_us;
+	uint64_t rtt_samples; // 0 while srtt is only the seed from before the session
+	uint64_t resend_timeout_ms; // currently used for reliable data
+	double loss; // smoothed loss of incoming AV packets
+	uint64_t data_sent; // reliable data packets, first transmissions only
+	uint64_t data_resent;
+	uint64_t data_given_up;
+	size_t datagram_size_max; // largest datagram received so far
+	uint64_t video_recoveries; // corrupt frame reports that were followed by a decodable frame
+	uint64_t video_recovery_last_us; // time from the first corrupt frame report to the next decodable frame
+	uint64_t video_recovery_max_us;
+	uint64_t send_packets[CHIAKI_LINK_QUALITY_SEND_CLASSES]; // per Takion send class
+	uint64_t send_dropped[CHIAKI_LINK_QUALITY_SEND_CLASSES]; // queue was full
+	uint64_t send_queue_avg_us[CHIAKI_LINK_QUALITY_SEND_CLASSES]; // smoothed time from push to send
+	uint64_t send_queue_max_us[CHIAKI_LINK_QUALITY_SEND_CLASSES];
+	ChiakiSocketTuningApplied socket; // of the Takion socket
+	ChiakiLinkQualityVideoTiming video_timing; // from the arrival times of video units
+} ChiakiLinkQualityStats;
+
+/**
+ * Live estimate of the link to the console, kept up to date from the traffic Takion exchanges anyway:
+ * RTT from acks of reliable data (which includes the heartbeats), loss from the congestion control intervals.
+ */
+typedef struct chiaki_link_quality_t
+{
+	ChiakiMutex mutex;
+	ChiakiLinkQualityStats stats;
+} ChiakiLinkQuality;
+
+/**
+ * @param rtt_us initial RTT estimate, e.g. from Senkusha, 0 if unknown.
+ * It is replaced entirely by the first real sample.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_link_quality_init(ChiakiLinkQuality *quality, uint64_t rtt_us);
+CHIAKI_EXPORT void chiaki_link_quality_fini(ChiakiLinkQuality *quality);
+
+/**
+ * Forget everything, e.g. when a new stream starts. Same as init for rtt_us.
+ */
+CHIAKI_EXPORT void chiaki_link_quality_reset(ChiakiLinkQuality *quality, uint64_t rtt_us);
+
+/**
+ * Feed one RTT measurement. Samples from retransmitted packets are ambiguous and must not be pushed.
+ */
+CHIAKI_EXPORT void chiaki_link_quality_push_rtt(ChiakiLinkQuality *quality, uint64_t rtt_us);
+
+/**
+ * Double the resend timeout after data sent with expired_timeout_ms was not acked in time (RFC 6298 5.5).
+ * The backed off timeout is kept for all new data until the next RTT sample (5.7), so an RTT above the
+ * current timeout still produces samples from packets that were only sent once.
+ */
+CHIAKI_EXPORT void chiaki_link_quality_back_off_resend_timeout(ChiakiLinkQuality *quality, uint64_t expired_timeout_ms);
+
+/**
+ * Feed the packet counts of one congestion control interval.
+ */
+CHIAKI_EXPORT void chiaki_link_quality_push_loss(ChiakiLinkQuality *quality, uint64_t received, uint64_t lost);
+
+CHIAKI_EXPORT void chiaki_link_quality_push_data_sent(ChiakiLinkQuality *quality);
+CHIAKI_EXPORT void chiaki_link_quality_push_data_resent(ChiakiLinkQuality *quality, bool given_up);
+CHIAKI_EXPORT void chiaki_link_quality_push_datagram(ChiakiLinkQuality *quality, size_t size);
+CHIAKI_EXPORT void chiaki_link_quality_push_video_recovery(ChiakiLinkQuality *quality, uint64_t recovery_us);
+
+/**
+ * Feed one batch of the Takion send scheduler.
+ * @param latency_sum_us sum of the times the packets spent queued
+ */
+CHIAKI_EXPORT void chiaki_link_quality_push_send_queue(ChiakiLinkQuality *quality, unsigned int send_class, uint64_t packets, uint64_t latency_sum_us, uint64_t latency_max_us);
+CHIAKI_EXPORT void chiaki_link_quality_push_send_dropped(ChiakiLinkQuality *quality, unsigned int send_class);
+
+CHIAKI_EXPORT void chiaki_link_quality_set_socket(ChiakiLinkQuality *quality, const ChiakiSocketTuningApplied *socket);
+CHIAKI_EXPORT void chiaki_link_quality_set_video_timing(ChiakiLinkQuality *quality, const ChiakiLinkQualityVideoTiming *video_timing);
+
+/**
+ * Timeout after which unacked reliable data should be sent again, derived from srtt and rttvar.
+ */
+CHIAKI_EXPORT uint64_t chiaki_link_quality_resend_timeout_ms(ChiakiLinkQuality *quality);
+
+CHIAKI_EXPORT void chiaki_link_quality_get_stats(ChiakiLinkQuality *quality, ChiakiLinkQualityStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_LINKQUALITY_H
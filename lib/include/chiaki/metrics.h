@@ -0,0 +1,147 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_METRICS_H
+#define CHIAKI_METRICS_H
+
+#include "common.h"
+#include "atomic.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Registry of counters, gauges and histograms that subsystems update from their own threads
+ * and any number of readers (stats overlay, file exporter) sample at their own rate.
+ *
+ * Metrics live in a fixed array and are never removed, so the pointers returned by registration stay valid
+ * for the lifetime of the registry. Registration is serialized by a spinlock and meant to happen at init time,
+ * updates and sampling only use atomics and never block.
+ */
+
+#define CHIAKI_METRICS_MAX 96
+#define CHIAKI_METRIC_NAME_SIZE 48
+#define CHIAKI_METRIC_BUCKETS_MAX 16
+
+typedef enum chiaki_metric_type_t
+{
+	CHIAKI_METRIC_TYPE_COUNTER, // only ever grows, e.g. packets received
+	CHIAKI_METRIC_TYPE_GAUGE, // current value, e.g. measured bitrate
+	CHIAKI_METRIC_TYPE_HISTOGRAM // samples counted into fixed buckets, e.g. decode times
+} ChiakiMetricType;
+
+typedef struct chiaki_metric_t
+{
+	char name[CHIAKI_METRIC_NAME_SIZE]; // "<subsystem>.<metric>[_<unit>]", e.g. "takion.bytes_received"
+	ChiakiMetricType type;
+	volatile uint64_t value; // counter total, gauge value (int64_t) or histogram sample count
+	volatile uint64_t sum; // histogram only, sum of all samples
+	size_t bounds_count;
+	uint64_t bounds[CHIAKI_METRIC_BUCKETS_MAX]; // inclusive upper bounds, ascending
+	volatile uint64_t buckets[CHIAKI_METRIC_BUCKETS_MAX + 1]; // the last one counts everything above the last bound
+} ChiakiMetric;
+
+typedef struct chiaki_metrics_t
+{
+	ChiakiMetric metrics[CHIAKI_METRICS_MAX];
+	volatile uint32_t count; // metrics published to readers
+	volatile uint32_t lock; // held while registering
+} ChiakiMetrics;
+
+/**
+ * Immutable copy of a metric, taken by chiaki_metrics_sample().
+ * Different metrics of one sample are not taken at exactly the same instant.
+ */
+typedef struct chiaki_metric_sample_t
+{
+	const char *name; // points into the registry
+	ChiakiMetricType type;
+	int64_t value;
+	uint64_t sum;
+	size_t bounds_count;
+	const uint64_t *bounds; // points into the registry
+	uint64_t buckets[CHIAKI_METRIC_BUCKETS_MAX + 1];
+} ChiakiMetricSample;
+
+typedef enum chiaki_metrics_format_t
+{
+	CHIAKI_METRICS_FORMAT_CSV, // one "timestamp_ms,name,value" row per metric, histograms as name.count, name.sum and name.le_<bound>
+	CHIAKI_METRICS_FORMAT_JSONL // one {"timestamp_ms":...,"metrics":{...}} object per line
+} ChiakiMetricsFormat;
+
+/**
+ * Zero-initialized registries are ready to use, this is only needed for ones that are reused.
+ */
+CHIAKI_EXPORT void chiaki_metrics_init(ChiakiMetrics *metrics);
+
+/**
+ * Registry that the lib's subsystems register their metrics with, shared by all sessions of the process.
+ */
+CHIAKI_EXPORT ChiakiMetrics *chiaki_metrics_default(void);
+
+/**
+ * Registering a name again returns the metric that already exists, so subsystems that are created
+ * once per session keep adding up to the same totals.
+ *
+ * @return the metric or NULL if the registry is full or the name is taken by a metric of another type.
+ * All update functions accept NULL, so a failed registration only means the metric is missing from the stats.
+ */
+CHIAKI_EXPORT ChiakiMetric *chiaki_metrics_register_counter(ChiakiMetrics *metrics, const char *name);
+CHIAKI_EXPORT ChiakiMetric *chiaki_metrics_register_gauge(ChiakiMetrics *metrics, const char *name);
+
+/**
+ * @param bounds inclusive upper bounds of the buckets, ascending, at most CHIAKI_METRIC_BUCKETS_MAX
+ */
+CHIAKI_EXPORT ChiakiMetric *chiaki_metrics_register_histogram(ChiakiMetrics *metrics, const char *name, const uint64_t *bounds, size_t bounds_count);
+
+/**
+ * @return the metric registered under name or NULL
+ */
+CHIAKI_EXPORT ChiakiMetric *chiaki_metrics_find(ChiakiMetrics *metrics, const char *name);
+
+static inline void chiaki_metric_add(ChiakiMetric *metric, uint64_t v)
+{
+	if(metric)
+		chiaki_atomic_fetch_add_u64(&metric->value, v);
+}
+
+static inline void chiaki_metric_inc(ChiakiMetric *metric)
+{
+	chiaki_metric_add(metric, 1);
+}
+
+static inline void chiaki_metric_set(ChiakiMetric *metric, int64_t v)
+{
+	if(metric)
+		chiaki_atomic_store_u64(&metric->value, (uint64_t)v);
+}
+
+static inline int64_t chiaki_metric_get(ChiakiMetric *metric)
+{
+	return metric ? (int64_t)chiaki_atomic_load_u64(&metric->value) : 0;
+}
+
+CHIAKI_EXPORT void chiaki_metric_observe(ChiakiMetric *metric, uint64_t v);
+
+/**
+ * Copy the current values of all registered metrics without blocking any writer.
+ * @return number of samples written, at most samples_max
+ */
+CHIAKI_EXPORT size_t chiaki_metrics_sample(ChiakiMetrics *metrics, ChiakiMetricSample *samples, size_t samples_max);
+
+/**
+ * Sample all metrics and append them to file.
+ * @param header for CSV, write the column names first
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_metrics_export(ChiakiMetrics *metrics, FILE *file, ChiakiMetricsFormat format, uint64_t timestamp_ms, bool header);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_METRICS_H
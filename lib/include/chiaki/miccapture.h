@@ -0,0 +1,105 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_MICCAPTURE_H
+#define CHIAKI_MICCAPTURE_H
+
+#include "common.h"
+#include "log.h"
+#include "thread.h"
+#include "ringbuffer.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Called on the encode thread for every complete frame of captured samples.
+ * The buffer may be modified in place (e.g. for echo cancellation) and is only valid during the call.
+ */
+typedef void (*ChiakiMicCaptureFrameCallback)(int16_t *buf, size_t samples_count, void *user);
+
+#define CHIAKI_MIC_CAPTURE_CHUNKS_MAX 64
+
+typedef struct chiaki_mic_capture_stats_t
+{
+	/**
+	 * Time from the capture callback delivering the last sample of a frame
+	 * until the frame callback (encode and send) returned, in microseconds.
+	 */
+	uint32_t latency_us;
+	uint32_t latency_avg_us;
+	uint32_t latency_max_us;
+	uint32_t frames;
+	uint32_t dropped_samples;
+} ChiakiMicCaptureStats;
+
+/**
+ * Moves microphone encoding off the thread that receives the captured audio.
+ *
+ * chiaki_mic_capture_push() never waits for encoding or a lock and can be called directly from an audio device callback.
+ * It only wakes the encode thread once a frame is complete and skips that if the mutex is taken.
+ * Samples are cut into frames of a fixed size and handed to the frame callback on a dedicated thread.
+ */
+typedef struct chiaki_mic_capture_t
+{
+	ChiakiLog *log;
+	size_t frame_samples;
+	int16_t *frame_buf;
+	ChiakiRingBuffer ring;
+
+	// ring head and capture time of the most recent pushes, written by the producer
+	volatile uint32_t chunk_end[CHIAKI_MIC_CAPTURE_CHUNKS_MAX];
+	volatile uint32_t chunk_time_us[CHIAKI_MIC_CAPTURE_CHUNKS_MAX];
+	volatile uint32_t chunks_pushed;
+	uint32_t chunks_consumed;
+
+	ChiakiMicCaptureFrameCallback frame_cb;
+	void *frame_cb_user;
+
+	ChiakiThread thread;
+	ChiakiThreadAttrs thread_attrs;
+	ChiakiMutex mutex;
+	ChiakiCond cond;
+	bool should_stop;
+
+	volatile uint32_t stats_latency_us;
+	volatile uint32_t stats_latency_avg_us;
+	volatile uint32_t stats_latency_max_us;
+	volatile uint32_t stats_frames;
+	volatile uint32_t stats_dropped_samples;
+} ChiakiMicCapture;
+
+/**
+ * Start the encode thread.
+ *
+ * @param frame_samples number of int16 samples (all channels) per frame passed to frame_cb
+ * @param buffer_frames number of frames that can be queued before newly captured samples are dropped
+ * @param thread_attrs optional, for the encode thread
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_mic_capture_init(ChiakiMicCapture *capture, ChiakiLog *log, size_t frame_samples, size_t buffer_frames,
+		ChiakiMicCaptureFrameCallback frame_cb, void *frame_cb_user, const ChiakiThreadAttrs *thread_attrs);
+
+/**
+ * Stop and join the encode thread. No more samples may be pushed once this is called.
+ */
+CHIAKI_EXPORT void chiaki_mic_capture_fini(ChiakiMicCapture *capture);
+
+/**
+ * Queue captured samples for encoding, never waits for the encode thread.
+ * Must only be called from one thread at a time.
+ */
+CHIAKI_EXPORT void chiaki_mic_capture_push(ChiakiMicCapture *capture, const int16_t *buf, size_t samples_count);
+
+/**
+ * Thread-safe snapshot of the capture-to-send statistics.
+ */
+CHIAKI_EXPORT void chiaki_mic_capture_get_stats(ChiakiMicCapture *capture, ChiakiMicCaptureStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_MICCAPTURE_H
@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_RINGBUFFER_H
+#define CHIAKI_RINGBUFFER_H
+
+#include "common.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Lock-free single producer, single consumer byte ring.
+ *
+ * Exactly one thread may write and exactly one (possibly different) thread may read at the same time,
+ * neither side ever blocks, so the producer may be a realtime audio callback.
+ * The producer may also discard the oldest bytes when the consumer falls behind, see chiaki_ring_buffer_drop_oldest().
+ */
+typedef struct chiaki_ring_buffer_t
+{
+	uint8_t *buf;
+	uint32_t size; // power of two
+	volatile uint32_t head; // total bytes written, only advanced by the producer
+	volatile uint32_t tail; // total bytes read or dropped, advanced by the consumer and by chiaki_ring_buffer_drop_oldest()
+} ChiakiRingBuffer;
+
+/**
+ * @param size minimum capacity in bytes, rounded up to the next power of two
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_ring_buffer_init(ChiakiRingBuffer *ring, size_t size);
+CHIAKI_EXPORT void chiaki_ring_buffer_fini(ChiakiRingBuffer *ring);
+
+/**
+ * Producer side. Copies as much of buf as currently fits.
+ * @return number of bytes written
+ */
+CHIAKI_EXPORT size_t chiaki_ring_buffer_write(ChiakiRingBuffer *ring, const void *buf, size_t buf_size);
+
+/**
+ * Consumer side. Copies at most buf_size bytes out of the ring.
+ * @return number of bytes read
+ */
+CHIAKI_EXPORT size_t chiaki_ring_buffer_read(ChiakiRingBuffer *ring, void *buf, size_t buf_size);
+
+/**
+ * Producer side. Discard up to size of the oldest readable bytes to make room for newer ones.
+ * A concurrent read of the discarded bytes is retried, so the consumer never returns overwritten data.
+ * @return number of bytes discarded
+ */
+CHIAKI_EXPORT size_t chiaki_ring_buffer_drop_oldest(ChiakiRingBuffer *ring, size_t size);
+
+/**
+ * @return number of bytes that can currently be read, exact for the consumer and a lower bound for the producer
+ */
+CHIAKI_EXPORT size_t chiaki_ring_buffer_available(ChiakiRingBuffer *ring);
+
+/**
+ * @return number of bytes that can currently be written, exact for the producer and a lower bound for the consumer
+ */
+CHIAKI_EXPORT size_t chiaki_ring_buffer_free(ChiakiRingBuffer *ring);
+
+/**
+ * Consumer side. Drop everything that is currently readable.
+ */
+CHIAKI_EXPORT void chiaki_ring_buffer_clear(ChiakiRingBuffer *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_RINGBUFFER_H
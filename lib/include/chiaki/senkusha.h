@@ -11,6 +11,20 @@ extern "C" {
 
 typedef struct chiaki_session_t ChiakiSession;
 
+#define CHIAKI_SENKUSHA_PROBES_MAX 16
+
+/**
+ * One outstanding ping or MTU request, several of them are in flight at once.
+ */
+typedef struct senkusha_probe_t
+{
+	uint16_t id; // unit index of a ping or id of an MTU command
+	uint32_t tag; // pings only
+	uint32_t size; // MTU probes only
+	uint64_t sent_us;
+	uint64_t ack_us; // 0 while outstanding
+} ChiakiSenkushaProbe;
+
 typedef struct senkusha_t
 {
 	ChiakiSession *session;
@@ -22,12 +36,17 @@ typedef struct senkusha_t
 	bool state_failed;
 	bool should_stop;
 	ChiakiSeqNum32 data_ack_seq_num_expected;
-	uint64_t pong_time_us;
 	uint16_t ping_test_index;
-	uint16_t ping_index;
-	uint32_t ping_tag;
 	uint32_t mtu_id;
 
+	/**
+	 * state_finished is set once all probes were acked
+	 */
+	ChiakiSenkushaProbe probes[CHIAKI_SENKUSHA_PROBES_MAX];
+	size_t probes_count;
+	size_t probes_acked;
+	uint16_t probe_id_next;
+
 	/**
 	 * signaled on change of state_finished or should_stop
 	 */
@@ -72,6 +72,19 @@ CHIAKI_EXPORT void chiaki_connect_video_profile_preset(ChiakiConnectVideoProfile
 
 #define CHIAKI_SESSION_AUTH_SIZE 0x10
 
+/**
+ * Parameters negotiated with a console, remembered between connections to skip
+ * the RP-Version retries and the Senkusha MTU/RTT probing on the next connect.
+ */
+typedef struct chiaki_connect_profile_t
+{
+	bool valid;
+	ChiakiTarget target; // RP-Version the server accepted
+	uint32_t mtu_in;
+	uint32_t mtu_out;
+	uint64_t rtt_us;
+} ChiakiConnectProfile;
+
 typedef struct chiaki_connect_info_t
 {
 	bool ps5;
@@ -86,6 +99,9 @@ typedef struct chiaki_connect_info_t
 	chiaki_socket_t *rudp_sock;
 	uint8_t psn_account_id[CHIAKI_PSN_ACCOUNT_ID_SIZE];
 	double packet_loss_max;
+	ChiakiConnectProfile profile; // from chiaki_session_get_connect_profile() of an earlier session to the same console, optional
+	const ChiakiThreadProfile *thread_profile; // optional, chiaki_thread_profile_default() if NULL
+	const ChiakiSocketTuning *socket_tuning; // optional, for the stream socket
 } ChiakiConnectInfo;
 
 
@@ -144,6 +160,29 @@ typedef struct chiaki_trigger_effects_event_t
 	uint8_t right[10];
 } ChiakiTriggerEffectsEvent;
 
+typedef enum {
+	CHIAKI_STARTUP_STEP_SESSION_REQUEST,
+	CHIAKI_STARTUP_STEP_CTRL, // until the session id was received, includes login pin entry
+	CHIAKI_STARTUP_STEP_HOLEPUNCH,
+	CHIAKI_STARTUP_STEP_SENKUSHA,
+	CHIAKI_STARTUP_STEP_KEYGEN, // handshake key and ECDH keys, runs concurrently with all of the above
+	CHIAKI_STARTUP_STEP_STREAM_CONNECTION, // takion connect, bang and streaminfo
+	CHIAKI_STARTUP_STEP_COUNT
+} ChiakiStartupStep;
+
+CHIAKI_EXPORT const char *chiaki_startup_step_string(ChiakiStartupStep step);
+
+/**
+ * When each step of the session startup began and ended, in ms since the session was started.
+ * Steps that did not run have begin_ms == end_ms == 0.
+ */
+typedef struct chiaki_startup_timeline_t
+{
+	uint64_t begin_ms[CHIAKI_STARTUP_STEP_COUNT];
+	uint64_t end_ms[CHIAKI_STARTUP_STEP_COUNT];
+	uint64_t total_ms;
+} ChiakiStartupTimeline;
+
 typedef enum {
 	CHIAKI_EVENT_CONNECTED,
 	CHIAKI_EVENT_LOGIN_PIN_REQUEST,
@@ -156,6 +195,7 @@ typedef enum {
 	CHIAKI_EVENT_QUIT,
 	CHIAKI_EVENT_TRIGGER_EFFECTS,
 	CHIAKI_EVENT_MOTION_RESET,
+	CHIAKI_EVENT_STARTUP_TIMELINE, // sent right after CHIAKI_EVENT_CONNECTED
 } ChiakiEventType;
 
 typedef struct chiaki_event_t
@@ -167,6 +207,7 @@ typedef struct chiaki_event_t
 		ChiakiKeyboardEvent keyboard;
 		ChiakiRumbleEvent rumble;
 		ChiakiTriggerEffectsEvent trigger_effects;
+		ChiakiStartupTimeline startup_timeline;
 		struct
 		{
 			bool pin_incorrect; // false on first request, true if the pin entered before was incorrect
@@ -209,6 +250,9 @@ typedef struct chiaki_session_t
 		bool enable_keyboard;
 		bool enable_dualsense;
 		uint8_t psn_account_id[CHIAKI_PSN_ACCOUNT_ID_SIZE];
+		ChiakiConnectProfile profile;
+		ChiakiThreadProfile thread_profile;
+		ChiakiSocketTuning socket_tuning;
 	} connect_info;
 
 	ChiakiTarget target;
@@ -220,7 +264,10 @@ typedef struct chiaki_session_t
 	uint32_t mtu_in;
 	uint32_t mtu_out;
 	uint64_t rtt_us;
+	bool mtu_measured; // mtu_in/out and rtt_us come from Senkusha or a cached profile, not the fallback values
 	ChiakiECDH ecdh;
+	uint64_t startup_start_ms;
+	ChiakiStartupTimeline startup_timeline;
 
 	ChiakiQuitReason quit_reason;
 	char *quit_reason_str; // additional reason string from remote
@@ -276,6 +323,18 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_session_keyboard_reject(ChiakiSession *sess
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_keyboard_accept(ChiakiSession *session);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_go_home(ChiakiSession *session);
 
+/**
+ * Get the parameters this session negotiated, valid after CHIAKI_EVENT_CONNECTED.
+ * profile->valid is false if Senkusha failed and the session runs on fallback values.
+ * Pass them as ChiakiConnectInfo.profile for the next connection to the same console.
+ */
+CHIAKI_EXPORT void chiaki_session_get_connect_profile(ChiakiSession *session, ChiakiConnectProfile *profile);
+
+/**
+ * Live RTT, loss and resend statistics of the stream connection, may be called at any time.
+ */
+CHIAKI_EXPORT void chiaki_session_get_link_quality(ChiakiSession *session, ChiakiLinkQualityStats *stats);
+
 static inline void chiaki_session_set_event_cb(ChiakiSession *session, ChiakiEventCallback cb, void *user)
 {
 	session->event_cb = cb;
@@ -4,8 +4,10 @@
 #define CHIAKI_SOCK_H
 
 #include "common.h"
+#include "log.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -36,6 +38,43 @@ typedef int chiaki_socket_t;
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_socket_set_nonblock(chiaki_socket_t sock, bool nonblock);
 
+/**
+ * Options for a stream socket. All zero means system defaults everywhere.
+ */
+typedef struct chiaki_socket_tuning_t
+{
+	int rcvbuf; // bytes, 0 for the default of the user
+	int sndbuf; // bytes, 0 for the system default
+	uint8_t dscp_input; // DSCP for input and feedback datagrams, 0 to leave them unmarked
+	unsigned int busy_poll_us; // SO_BUSY_POLL, 0 to disable
+	bool prefer_busy_poll; // SO_PREFER_BUSY_POLL, only with busy_poll_us
+	bool rx_timestamps; // kernel receive timestamps
+} ChiakiSocketTuning;
+
+/**
+ * What a socket actually ended up with after chiaki_socket_tuning_apply().
+ */
+typedef struct chiaki_socket_tuning_applied_t
+{
+	int family; // AF_INET or AF_INET6
+	int rcvbuf; // as reported by the kernel, Linux doubles the requested size for its bookkeeping
+	int sndbuf;
+	uint8_t dscp_input; // 0 if marking failed
+	bool dscp_per_packet; // if false, dscp_input is set on the whole socket instead of input datagrams only
+	unsigned int busy_poll_us;
+	bool prefer_busy_poll;
+	bool rx_timestamps;
+} ChiakiSocketTuningApplied;
+
+/**
+ * Apply tuning to a socket. Only failing to set the receive buffer is an error,
+ * everything else is best effort and only logged.
+ *
+ * @param rcvbuf_default used if tuning->rcvbuf is 0, 0 to keep the system default
+ * @param applied optional
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_socket_tuning_apply(chiaki_socket_t sock, const ChiakiSocketTuning *tuning, int rcvbuf_default, ChiakiSocketTuningApplied *applied, ChiakiLog *log);
+
 #ifdef __cplusplus
 }
 #endif
@@ -4,6 +4,7 @@
 #define CHIAKI_STOPPIPE_H
 
 #include "sock.h"
+#include "thread.h"
 
 #include <stdint.h>
 #include <stddef.h>
@@ -19,6 +20,16 @@
 extern "C" {
 #endif
 
+#define CHIAKI_STOP_PIPE_SELECT_MULTI_MAX 16
+
+#if defined(__linux__)
+typedef struct chiaki_stop_pipe_epoll_fd_t
+{
+	int fd;
+	uint32_t events;
+} ChiakiStopPipeEpollFd;
+#endif
+
 typedef struct chiaki_stop_pipe_t
 {
 #ifdef _WIN32
@@ -32,6 +43,17 @@ typedef struct chiaki_stop_pipe_t
 	// this fd is audited by 'select' as
 	// fd_set *readfds
 	int fd;
+#elif defined(__linux__)
+	int event_fd; // readable once stopped
+	int epoll_fd;
+
+	/**
+	 * Sockets currently in the epoll set, they stay registered from one wait to the next.
+	 * Only one thread can wait with the epoll set at a time, concurrent waits fall back to poll().
+	 */
+	ChiakiMutex epoll_mutex;
+	ChiakiStopPipeEpollFd epoll_fds[CHIAKI_STOP_PIPE_SELECT_MULTI_MAX];
+	size_t epoll_fds_count;
 #else
 	int fds[2];
 #endif
@@ -43,6 +65,14 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_init(ChiakiStopPipe *stop_pipe);
 CHIAKI_EXPORT void chiaki_stop_pipe_fini(ChiakiStopPipe *stop_pipe);
 CHIAKI_EXPORT void chiaki_stop_pipe_stop(ChiakiStopPipe *stop_pipe);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_select_single(ChiakiStopPipe *stop_pipe, chiaki_socket_t fd, bool write, uint64_t timeout_ms);
+
+/**
+ * Wait until any of fds can be read from, the stop pipe is stopped or timeout_ms passed.
+ * @param fds_count at most CHIAKI_STOP_PIPE_SELECT_MULTI_MAX
+ * @param readable if not NULL, set for every fd whether it can be read from
+ * @return CHIAKI_ERR_SUCCESS if any fd can be read from, CHIAKI_ERR_CANCELED or CHIAKI_ERR_TIMEOUT otherwise
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_select_multi(ChiakiStopPipe *stop_pipe, chiaki_socket_t *fds, size_t fds_count, uint64_t timeout_ms, bool *readable);
 /**
  * Like connect(), but can be canceled by the stop pipe. Only makes sense with a non-blocking socket.
  */
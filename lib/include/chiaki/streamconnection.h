@@ -11,6 +11,7 @@
 #include "audioreceiver.h"
 #include "videoreceiver.h"
 #include "congestioncontrol.h"
+#include "metrics.h"
 
 #include <stdbool.h>
 
@@ -37,6 +38,7 @@ typedef struct chiaki_stream_connection_t
 	uint32_t motion_counter;
 	ChiakiFeedbackSender feedback_sender;
 	ChiakiCongestionControl congestion_control;
+	ChiakiLinkQuality link_quality;
 	/**
 	 * whether feedback_sender is initialized
 	 * only if this is true, feedback_sender may be accessed!
@@ -65,6 +67,7 @@ typedef struct chiaki_stream_connection_t
 	char *remote_disconnect_reason;
 
 	double measured_bitrate;
+	ChiakiMetric *metric_bitrate_kbps; // measured_bitrate for readers on other threads
 } ChiakiStreamConnection;
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_init(ChiakiStreamConnection *stream_connection, ChiakiSession *session, double packet_loss_max);
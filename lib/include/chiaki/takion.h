@@ -12,6 +12,9 @@
 #include "reorderqueue.h"
 #include "feedback.h"
 #include "takionsendbuffer.h"
+#include "takionsendscheduler.h"
+#include "linkquality.h"
+#include "metrics.h"
 
 #include <stdbool.h>
 
@@ -48,6 +51,8 @@ typedef struct chiaki_takion_av_packet_t
 
 	uint64_t key_pos;
 
+	uint64_t arrival_us; // when the datagram was received, in chiaki_time_now_monotonic_us(), from the kernel if available
+
 	uint8_t *data; // not owned
 	size_t data_size;
 } ChiakiTakionAVPacket;
@@ -109,6 +114,9 @@ typedef struct chiaki_takion_connect_info_t
 	bool enable_dualsense;
 	uint8_t protocol_version;
 	bool close_socket; // close socket when finishing takion
+	ChiakiLinkQuality *link_quality; // optional, fed with RTT samples and used for resend timeouts
+	const ChiakiThreadAttrs *thread_attrs; // optional, for the receive and send threads
+	const ChiakiSocketTuning *socket_tuning; // optional, also applied to a socket passed to chiaki_takion_connect()
 } ChiakiTakionConnectInfo;
 
 
@@ -144,11 +152,15 @@ typedef struct chiaki_takion_t
 
 	ChiakiReorderQueue data_queue;
 	ChiakiTakionSendBuffer send_buffer;
+	ChiakiTakionSendScheduler send_scheduler; // everything after the handshake goes out through here
+	ChiakiLinkQuality *link_quality;
 
 	ChiakiTakionCallback cb;
 	void *cb_user;
 	chiaki_socket_t sock;
+	ChiakiSocketTuningApplied socket_tuning;
 	ChiakiThread thread;
+	ChiakiThreadAttrs thread_attrs;
 	ChiakiStopPipe stop_pipe;
 	uint32_t tag_local;
 	uint32_t tag_remote;
@@ -167,6 +179,14 @@ typedef struct chiaki_takion_t
 	ChiakiKeyState key_state;
 
 	bool enable_dualsense;
+
+	struct
+	{
+		ChiakiMetric *packets_received;
+		ChiakiMetric *bytes_received;
+		ChiakiMetric *mac_failures;
+		ChiakiMetric *postponed_packets;
+	} metrics;
 } ChiakiTakion;
 
 
@@ -175,11 +195,14 @@ CHIAKI_EXPORT void chiaki_takion_close(ChiakiTakion *takion);
 
 /**
  * Must be called from within the Takion thread, i.e. inside the callback!
+ * gkcrypt_local is also used by the send scheduler thread, hence the lock.
  */
 static inline void chiaki_takion_set_crypt(ChiakiTakion *takion, ChiakiGKCrypt *gkcrypt_local, ChiakiGKCrypt *gkcrypt_remote)
 {
+	chiaki_mutex_lock(&takion->gkcrypt_local_mutex);
 	takion->gkcrypt_local = gkcrypt_local;
 	takion->gkcrypt_remote = gkcrypt_remote;
+	chiaki_mutex_unlock(&takion->gkcrypt_local_mutex);
 }
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_packet_mac(ChiakiGKCrypt *crypt, uint8_t *buf, size_t buf_size, uint64_t key_pos, uint8_t *mac_out, uint8_t *mac_old_out);
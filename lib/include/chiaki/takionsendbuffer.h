@@ -26,10 +26,12 @@ typedef struct chiaki_takion_send_buffer_t
 	ChiakiTakionSendBufferPacket *packets;
 	size_t packets_size; // allocated size
 	size_t packets_count; // current count
+	size_t packets_reserved; // slots kept for packets that are still queued for their first transmission
 
 	ChiakiMutex mutex;
 	ChiakiCond cond;
 	bool should_stop;
+	bool wakeup; // resend deadlines changed
 	ChiakiThread thread;
 } ChiakiTakionSendBuffer;
 
@@ -37,6 +39,10 @@ typedef struct chiaki_takion_send_buffer_t
 /**
  * Init a Send Buffer and start a thread that automatically re-sends packets on takion.
  *
+ * Packets are re-sent after the RTO of takion's link quality estimate, backing off exponentially per packet.
+ * A packet is re-sent immediately once if the cumulative ack right before it is repeated a few times,
+ * i.e. later packets arrived but it did not (fast retransmit).
+ *
  * @param takion if NULL, the Send Buffer thread will effectively do nothing (for unit testing)
  * @param size number of packet slots
  */
@@ -44,6 +50,17 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_init(ChiakiTakionSendBuf
 CHIAKI_EXPORT void chiaki_takion_send_buffer_fini(ChiakiTakionSendBuffer *send_buffer);
 
 /**
+ * Keep a slot for a packet that is pushed later, so it can't be dropped between giving it a seq num and sending it.
+ * Every reservation is either used up by chiaki_takion_send_buffer_push() or given back with chiaki_takion_send_buffer_unreserve().
+ *
+ * @return CHIAKI_ERR_OVERFLOW if all slots are taken
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_reserve(ChiakiTakionSendBuffer *send_buffer);
+CHIAKI_EXPORT void chiaki_takion_send_buffer_unreserve(ChiakiTakionSendBuffer *send_buffer);
+
+/**
+ * Uses up a reservation if there is one.
+ *
  * @param buf ownership of this is taken by the ChiakiTakionSendBuffer, which will free it automatically later!
  * On error, buf is freed immediately.
  */
@@ -54,6 +71,12 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_push(ChiakiTakionSendBuf
  */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_ack(ChiakiTakionSendBuffer *send_buffer, ChiakiSeqNum32 seq_num, ChiakiSeqNum32 *acked_seq_nums, size_t *acked_seq_nums_count);
 
+/**
+ * Mark the packets from seq_num_first to seq_num_last (inclusive) as received, but not yet cumulatively acked.
+ * They are not re-sent anymore. Call after chiaki_takion_send_buffer_ack() for the same ack.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_gap_ack(ChiakiTakionSendBuffer *send_buffer, ChiakiSeqNum32 seq_num_first, ChiakiSeqNum32 seq_num_last);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_TAKIONSENDSCHEDULER_H
+#define CHIAKI_TAKIONSENDSCHEDULER_H
+
+#include "common.h"
+#include "log.h"
+#include "thread.h"
+#include "seqnum.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct chiaki_takion_t ChiakiTakion;
+
+/**
+ * Within one batch, packets are taken from the classes in this order.
+ * Must have as many entries as CHIAKI_LINK_QUALITY_SEND_CLASSES.
+ */
+typedef enum chiaki_takion_send_class_t
+{
+	CHIAKI_TAKION_SEND_CLASS_INPUT, // feedback and mic, any delay is noticed right away
+	CHIAKI_TAKION_SEND_CLASS_CONTROL, // messages, acks and congestion reports
+	CHIAKI_TAKION_SEND_CLASS_BULK, // resends of reliable data
+	CHIAKI_TAKION_SEND_CLASS_COUNT
+} ChiakiTakionSendClass;
+
+typedef enum chiaki_takion_send_crypt_t
+{
+	/**
+	 * Sent as is
+	 */
+	CHIAKI_TAKION_SEND_CRYPT_NONE,
+
+	/**
+	 * Advance the key pos by key_pos_advance, write it at key_pos_offset and calculate the MAC with chiaki_takion_packet_mac()
+	 */
+	CHIAKI_TAKION_SEND_CRYPT_MAC,
+
+	/**
+	 * Encrypt everything from payload_offset, then write the key pos at key_pos_offset and the GMAC at mac_offset
+	 */
+	CHIAKI_TAKION_SEND_CRYPT_ENCRYPT
+} ChiakiTakionSendCrypt;
+
+typedef struct chiaki_takion_send_packet_t
+{
+	ChiakiTakionSendCrypt crypt;
+	size_t key_pos_advance;
+	size_t key_pos_offset;
+	size_t payload_offset;
+	size_t mac_offset;
+
+	/**
+	 * If true, the packet is pushed into the Takion send buffer with seq_num once it is sent.
+	 * A slot must have been reserved with chiaki_takion_send_buffer_reserve() before.
+	 */
+	bool reliable;
+	ChiakiSeqNum32 seq_num;
+} ChiakiTakionSendPacket;
+
+// packets up to this size are copied into the queue itself, bigger ones are allocated
+#define CHIAKI_TAKION_SEND_INLINE_SIZE 512
+
+typedef struct chiaki_takion_send_item_t
+{
+	volatile uint32_t sequence; // position this slot can be written (== pos) or read (== pos + 1) at
+	ChiakiTakionSendPacket packet;
+	uint8_t *buf; // either inline_buf or allocated
+	size_t buf_size;
+	uint64_t queued_us;
+	uint8_t inline_buf[CHIAKI_TAKION_SEND_INLINE_SIZE];
+} ChiakiTakionSendItem;
+
+/**
+ * Bounded queue for any number of producers and a single consumer.
+ */
+typedef struct chiaki_takion_send_queue_t
+{
+	ChiakiTakionSendItem *items;
+	uint32_t size; // power of 2
+	volatile uint32_t enqueue_pos;
+	uint32_t dequeue_pos; // only touched by the consumer
+	volatile uint32_t drops_unlogged; // dropped because the queue was full, since drop_log_ms
+	volatile uint64_t drop_log_ms;
+} ChiakiTakionSendQueue;
+
+/**
+ * Single thread that sends everything Takion sends after the handshake.
+ *
+ * Any thread can push packets without locking. The scheduler thread assigns key positions in the order packets
+ * actually go out, calculates MACs, and sends as many packets as are queued with as few syscalls as possible
+ * (sendmmsg() where available).
+ */
+typedef struct chiaki_takion_send_scheduler_t
+{
+	ChiakiLog *log;
+	ChiakiTakion *takion;
+	ChiakiTakionSendQueue queues[CHIAKI_TAKION_SEND_CLASS_COUNT];
+
+	/**
+	 * Packets pushed but not yet taken, as int32_t.
+	 * Can be briefly negative if the scheduler takes a packet before its producer counted it.
+	 */
+	volatile uint32_t pending;
+
+	ChiakiMutex mutex;
+	ChiakiCond cond;
+	bool should_stop;
+	bool running;
+	ChiakiThread thread;
+} ChiakiTakionSendScheduler;
+
+/**
+ * Packets can be pushed right away, they are sent once the scheduler is started.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_scheduler_init(ChiakiTakionSendScheduler *scheduler, ChiakiTakion *takion, size_t queue_size);
+
+/**
+ * Frees everything that is still queued. The scheduler must be stopped.
+ */
+CHIAKI_EXPORT void chiaki_takion_send_scheduler_fini(ChiakiTakionSendScheduler *scheduler);
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_scheduler_start(ChiakiTakionSendScheduler *scheduler);
+
+/**
+ * Send what is still queued and stop the thread. Packets pushed afterwards are not sent anymore. Does nothing if not started.
+ */
+CHIAKI_EXPORT void chiaki_takion_send_scheduler_stop(ChiakiTakionSendScheduler *scheduler);
+
+/**
+ * Queue a packet to be sent. Thread-safe and never blocks.
+ *
+ * @param buf copied if packet->reliable is false. Otherwise ownership is taken, like chiaki_takion_send_buffer_push(),
+ * and buf is freed immediately on error.
+ * @return CHIAKI_ERR_OVERFLOW if the queue of send_class is full
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_scheduler_push(ChiakiTakionSendScheduler *scheduler, ChiakiTakionSendClass send_class, const ChiakiTakionSendPacket *packet, uint8_t *buf, size_t buf_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_TAKIONSENDSCHEDULER_H
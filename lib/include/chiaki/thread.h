@@ -37,6 +37,69 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_join(ChiakiThread *thread, void **re
 CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_timedjoin(ChiakiThread *thread, void **retval, uint64_t timeout_ms);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_set_name(ChiakiThread *thread, const char *name);
 
+typedef enum chiaki_thread_priority_t
+{
+	CHIAKI_THREAD_PRIORITY_NORMAL,
+
+	/**
+	 * Raised within the regular scheduler (negative nice on Linux)
+	 */
+	CHIAKI_THREAD_PRIORITY_HIGH,
+
+	/**
+	 * Real-time scheduling (SCHED_RR) where permitted, otherwise HIGH
+	 */
+	CHIAKI_THREAD_PRIORITY_REALTIME
+} ChiakiThreadPriority;
+
+CHIAKI_EXPORT const char *chiaki_thread_priority_string(ChiakiThreadPriority priority);
+
+typedef struct chiaki_thread_attrs_t
+{
+	ChiakiThreadPriority priority;
+	uint64_t cpu_mask; // bit n for CPU n, 0 to run anywhere
+	bool lock_memory; // mlockall() for the whole process, so the thread never waits for pages to be swapped in
+} ChiakiThreadAttrs;
+
+/**
+ * Apply attrs to the calling thread, as far as the platform and the process' limits allow.
+ * Thread functions call this first thing, which also covers threads not created by Chiaki (e.g. audio callbacks).
+ *
+ * @param applied optional, set to what actually took effect
+ * @return CHIAKI_ERR_THREAD if anything could not be applied as requested, the rest is still applied
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_set_attrs_self(const ChiakiThreadAttrs *attrs, ChiakiThreadAttrs *applied);
+
+/**
+ * Undo chiaki_thread_set_attrs_self() for threads that outlive a session, e.g. frontend threads.
+ * Priority and affinity go back to those of the process' main thread, memory stays locked.
+ */
+CHIAKI_EXPORT void chiaki_thread_reset_attrs_self(void);
+
+/**
+ * What can't be applied is usually the same for every session (e.g. no permission for realtime),
+ * so it should only be warned about once.
+ * @return true the first time in this process that attrs with this priority could not be applied
+ */
+CHIAKI_EXPORT bool chiaki_thread_attrs_failure_first(const ChiakiThreadAttrs *attrs);
+
+/**
+ * Attributes for the threads of a session that sit on the path from the network to the screen and speakers.
+ */
+typedef struct chiaki_thread_profile_t
+{
+	ChiakiThreadAttrs network; // Takion receive, which also decodes video, and send
+	ChiakiThreadAttrs crypt; // GKCrypt key stream generation
+	ChiakiThreadAttrs decoder; // frontend thread taking decoded frames, applied by the frontend
+	ChiakiThreadAttrs audio; // microphone encoding
+} ChiakiThreadProfile;
+
+/**
+ * Everything HIGH. REALTIME is opt-in: video decoding runs on the network thread,
+ * and a CPU-heavy SCHED_RR thread can starve the compositor and the UI.
+ */
+CHIAKI_EXPORT void chiaki_thread_profile_default(ChiakiThreadProfile *profile);
+
 
 typedef struct chiaki_mutex_t
 {
@@ -16,6 +16,106 @@ extern "C" {
 
 #define CHIAKI_VIDEO_PROFILES_MAX 8
 
+#define CHIAKI_REF_FRAMES_WINDOW 64
+
+/**
+ * Which of the most recent frames have been decoded and may be referenced, as bitmaps over a window of frame indices.
+ */
+typedef struct chiaki_ref_frames_t
+{
+	bool empty;
+	ChiakiSeqNum16 head; // newest frame in the window
+	uint64_t decoded; // bit i: frame head - i was decoded
+	uint64_t tainted; // bit i: frame head - i was decoded, but from a substituted or tainted reference, so it shows artifacts
+} ChiakiRefFrames;
+
+CHIAKI_EXPORT void chiaki_ref_frames_init(ChiakiRefFrames *ref_frames);
+CHIAKI_EXPORT void chiaki_ref_frames_add(ChiakiRefFrames *ref_frames, ChiakiSeqNum16 frame, bool tainted);
+
+static inline bool chiaki_ref_frames_bit(ChiakiRefFrames *ref_frames, uint64_t bits, ChiakiSeqNum16 frame)
+{
+	if(ref_frames->empty || chiaki_seq_num_16_gt(frame, ref_frames->head))
+		return false;
+	ChiakiSeqNum16 d = ref_frames->head - frame;
+	return d < CHIAKI_REF_FRAMES_WINDOW && (bits & ((uint64_t)1 << d));
+}
+
+/**
+ * @return whether frame was decoded and can be referenced
+ */
+static inline bool chiaki_ref_frames_have(ChiakiRefFrames *ref_frames, ChiakiSeqNum16 frame)
+{
+	return chiaki_ref_frames_bit(ref_frames, ref_frames->decoded, frame);
+}
+
+static inline bool chiaki_ref_frames_tainted(ChiakiRefFrames *ref_frames, ChiakiSeqNum16 frame)
+{
+	return chiaki_ref_frames_bit(ref_frames, ref_frames->tainted, frame);
+}
+
+/**
+ * Tracks the frames reported as corrupt to the console until a frame after them decodes again,
+ * or until that took so long that the next problem should be reported again.
+ */
+typedef struct chiaki_video_recovery_t
+{
+	bool active;
+	ChiakiSeqNum16 start; // merged range of all frames reported since the last recovery
+	ChiakiSeqNum16 end;
+	uint64_t since_us; // first report, chiaki_time_now_monotonic_us()
+	unsigned int copies_left; // redundant copies of the current report still to be sent
+	uint64_t reports_sent;
+	uint64_t reports_merged; // detections that were covered by or merged into an earlier report
+	uint64_t timeouts; // recoveries given up on because no clean frame followed in time
+} ChiakiVideoRecovery;
+
+/**
+ * Arrival timing of frames, from the arrival times of their units.
+ *
+ * The console sends no clock, so the delay is relative: every frame is expected one nominal interval
+ * after the previous one and the delay is how late it is compared to that. It drifts with the clock of the console,
+ * so only its changes and its distance to the minimum are meaningful.
+ */
+typedef struct chiaki_video_timing_t
+{
+	uint64_t interval_us; // nominal time between frames
+
+	bool frame_active;
+	ChiakiSeqNum16 frame_index;
+	uint64_t frame_first_us; // first unit of frame_index
+	uint64_t frame_last_us;
+
+	bool prev_valid;
+	ChiakiSeqNum16 prev_index; // last frame that delay and jitter were updated for
+	uint64_t prev_first_us;
+
+	uint64_t frames;
+	uint64_t spread_last_us; // first to last unit of the last finished frame
+	uint64_t spread_avg_us;
+	uint64_t spread_max_us;
+	uint64_t jitter_us; // smoothed deviation of frame arrivals from the nominal interval, like RFC 3550
+	int64_t delay_us; // relative one-way delay of the last frame
+	int64_t delay_min_us; // lowest delay, slowly following delay_us to make up for clock drift
+	int64_t delay_trend_us; // smoothed change of the delay per frame, > 0 while a queue builds up
+} ChiakiVideoTiming;
+
+/**
+ * @param fps nominal frame rate of the stream, 0 for 60
+ */
+CHIAKI_EXPORT void chiaki_video_timing_init(ChiakiVideoTiming *timing, unsigned int fps);
+
+/**
+ * Feed the arrival of one unit. Units of frames older than the current one are ignored.
+ *
+ * @return whether this unit started a new frame, which is when the stats change
+ */
+CHIAKI_EXPORT bool chiaki_video_timing_unit(ChiakiVideoTiming *timing, ChiakiSeqNum16 frame_index, uint64_t arrival_us);
+
+static inline uint64_t chiaki_video_timing_queue_delay_us(ChiakiVideoTiming *timing)
+{
+	return (uint64_t)(timing->delay_us - timing->delay_min_us);
+}
+
 typedef struct chiaki_video_receiver_t
 {
 	struct chiaki_session_t *session;
@@ -31,8 +131,10 @@ typedef struct chiaki_video_receiver_t
 	ChiakiPacketStats *packet_stats;
 
 	int32_t frames_lost;
-	int32_t reference_frames[16];
+	ChiakiRefFrames ref_frames;
 	ChiakiBitstream bitstream;
+	ChiakiVideoRecovery recovery;
+	ChiakiVideoTiming timing;
 } ChiakiVideoReceiver;
 
 CHIAKI_EXPORT void chiaki_video_receiver_init(ChiakiVideoReceiver *video_receiver, struct chiaki_session_t *session, ChiakiPacketStats *packet_stats);
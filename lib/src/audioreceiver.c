@@ -3,18 +3,35 @@
 #include <chiaki/audioreceiver.h>
 #include <chiaki/session.h>
 
+#include <stdio.h>
 #include <string.h>
 
-static void chiaki_audio_receiver_frame(ChiakiAudioReceiver *audio_receiver, ChiakiSeqNum16 frame_index, bool is_haptics, uint8_t *buf, size_t buf_size);
+static void audio_receiver_window_insert(ChiakiAudioReceiver *audio_receiver, ChiakiSeqNum16 frame_index, uint8_t *buf, size_t buf_size, bool fec);
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_receiver_init(ChiakiAudioReceiver *audio_receiver, ChiakiSession *session, ChiakiPacketStats *packet_stats)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_audio_receiver_init(ChiakiAudioReceiver *audio_receiver, ChiakiSession *session, ChiakiPacketStats *packet_stats, const char *metrics_name)
 {
 	audio_receiver->session = session;
 	audio_receiver->log = session->log;
 	audio_receiver->packet_stats = packet_stats;
 
-	audio_receiver->frame_index_prev = 0;
 	audio_receiver->frame_index_startup = true;
+	audio_receiver->frame_index_next_valid = false;
+	audio_receiver->frame_index_next = 0;
+	audio_receiver->window_received = 0;
+	audio_receiver->window_fec = 0;
+	audio_receiver->reorder_frames = CHIAKI_AUDIO_RECEIVER_REORDER_FRAMES_DEFAULT;
+	audio_receiver->frames_delivered = 0;
+	audio_receiver->frames_recovered = 0;
+	audio_receiver->frames_lost = 0;
+
+	ChiakiMetrics *metrics = chiaki_metrics_default();
+	char name[CHIAKI_METRIC_NAME_SIZE];
+	snprintf(name, sizeof(name), "%s.frames_delivered", metrics_name);
+	audio_receiver->metrics.frames_delivered = chiaki_metrics_register_counter(metrics, name);
+	snprintf(name, sizeof(name), "%s.frames_recovered", metrics_name);
+	audio_receiver->metrics.frames_recovered = chiaki_metrics_register_counter(metrics, name);
+	snprintf(name, sizeof(name), "%s.frames_lost", metrics_name);
+	audio_receiver->metrics.frames_lost = chiaki_metrics_register_counter(metrics, name);
 
 	ChiakiErrorCode err = chiaki_mutex_init(&audio_receiver->mutex, false);
 	if(err != CHIAKI_ERR_SUCCESS)
@@ -85,6 +102,29 @@ CHIAKI_EXPORT void chiaki_audio_receiver_av_packet(ChiakiAudioReceiver *audio_re
 	if(packet->frame_index > (1 << 15))
 		audio_receiver->frame_index_startup = false;
 
+	chiaki_mutex_lock(&audio_receiver->mutex);
+
+	// make room for the newest frame of the packet, anything this far behind is not worth waiting for anymore
+	ChiakiSeqNum16 frame_index_last = packet->frame_index + source_units_count - 1;
+	if(!audio_receiver->frame_index_next_valid)
+	{
+		audio_receiver->frame_index_next = packet->frame_index - fec_units_count;
+		// the fec units skipped below during startup would leave a gap that is never filled
+		if(audio_receiver->frame_index_startup && packet->frame_index < fec_units_count + 1)
+			audio_receiver->frame_index_next = packet->frame_index ? 1 : 0;
+		audio_receiver->frame_index_next_valid = true;
+	}
+	int16_t ahead = (int16_t)(frame_index_last - audio_receiver->frame_index_next);
+	if(ahead >= CHIAKI_AUDIO_RECEIVER_WINDOW)
+	{
+		uint16_t shift = ahead - CHIAKI_AUDIO_RECEIVER_WINDOW + 1;
+		audio_receiver->frames_lost += shift;
+		chiaki_metric_add(audio_receiver->metrics.frames_lost, shift);
+		audio_receiver->window_received = shift >= 32 ? 0 : audio_receiver->window_received >> shift;
+		audio_receiver->window_fec = shift >= 32 ? 0 : audio_receiver->window_fec >> shift;
+		audio_receiver->frame_index_next += shift;
+	}
+
 	for(size_t i = 0; i < source_units_count + fec_units_count; i++)
 	{
 		ChiakiSeqNum16 frame_index;
@@ -102,26 +142,70 @@ CHIAKI_EXPORT void chiaki_audio_receiver_av_packet(ChiakiAudioReceiver *audio_re
 			frame_index = packet->frame_index - fec_units_count + fec_index;
 		}
 
-		chiaki_audio_receiver_frame(audio_receiver, frame_index, packet->is_haptics, packet->data + unit_size * i, unit_size);
+		audio_receiver_window_insert(audio_receiver, frame_index, packet->data + unit_size * i, unit_size, i >= source_units_count);
+	}
+
+	// Pass on everything that is complete. Gaps before what the fec units of later packets
+	// can still fill in are only waited for reorder_frames longer, then given up.
+	ChiakiSeqNum16 give_up_before = packet->frame_index - fec_units_count - audio_receiver->reorder_frames;
+	uint8_t deliver[CHIAKI_AUDIO_RECEIVER_WINDOW];
+	size_t deliver_count = 0;
+	while(audio_receiver->window_received & 1 || chiaki_seq_num_16_lt(audio_receiver->frame_index_next, give_up_before))
+	{
+		if(audio_receiver->window_received & 1)
+		{
+			deliver[deliver_count++] = audio_receiver->frame_index_next % CHIAKI_AUDIO_RECEIVER_WINDOW;
+			audio_receiver->frames_delivered++;
+			chiaki_metric_inc(audio_receiver->metrics.frames_delivered);
+			if(audio_receiver->window_fec & 1)
+			{
+				audio_receiver->frames_recovered++;
+				chiaki_metric_inc(audio_receiver->metrics.frames_recovered);
+			}
+		}
+		else
+		{
+			audio_receiver->frames_lost++;
+			chiaki_metric_inc(audio_receiver->metrics.frames_lost);
+		}
+		audio_receiver->window_received >>= 1;
+		audio_receiver->window_fec >>= 1;
+		audio_receiver->frame_index_next++;
+	}
+
+	ChiakiAudioSink *sink = packet->is_haptics ? &audio_receiver->session->haptics_sink : &audio_receiver->session->audio_sink;
+	ChiakiAudioSinkFrame frame_cb = sink->frame_cb;
+	void *frame_cb_user = sink->user;
+
+	chiaki_mutex_unlock(&audio_receiver->mutex);
+
+	// Delivered slots are only reused by the next packet, which the caller does not pass in concurrently,
+	// so the sink can run without blocking anyone waiting on the mutex.
+	if(frame_cb)
+	{
+		for(size_t i = 0; i < deliver_count; i++)
+			frame_cb(audio_receiver->window[deliver[i]], audio_receiver->window_size[deliver[i]], frame_cb_user);
 	}
 
 	if(audio_receiver->packet_stats)
 		chiaki_packet_stats_push_seq(audio_receiver->packet_stats, packet->frame_index);
 }
 
-static void chiaki_audio_receiver_frame(ChiakiAudioReceiver *audio_receiver, ChiakiSeqNum16 frame_index, bool is_haptics, uint8_t *buf, size_t buf_size)
+static void audio_receiver_window_insert(ChiakiAudioReceiver *audio_receiver, ChiakiSeqNum16 frame_index, uint8_t *buf, size_t buf_size, bool fec)
 {
-	chiaki_mutex_lock(&audio_receiver->mutex);
-
-	if(!chiaki_seq_num_16_gt(frame_index, audio_receiver->frame_index_prev))
-		goto beach;
-	audio_receiver->frame_index_prev = frame_index;
-
-	if(is_haptics && audio_receiver->session->haptics_sink.frame_cb)
-		audio_receiver->session->haptics_sink.frame_cb(buf, buf_size, audio_receiver->session->haptics_sink.user);
-	else if(!is_haptics && audio_receiver->session->audio_sink.frame_cb)
-		audio_receiver->session->audio_sink.frame_cb(buf, buf_size, audio_receiver->session->audio_sink.user);
-
-beach:
-	chiaki_mutex_unlock(&audio_receiver->mutex);
+	int16_t offset = (int16_t)(frame_index - audio_receiver->frame_index_next);
+	// already delivered or given up
+	if(offset < 0 || offset >= CHIAKI_AUDIO_RECEIVER_WINDOW)
+		return;
+	uint32_t bit = (uint32_t)1 << offset;
+	if(audio_receiver->window_received & bit)
+		return;
+	size_t slot = frame_index % CHIAKI_AUDIO_RECEIVER_WINDOW;
+	memcpy(audio_receiver->window[slot], buf, buf_size);
+	audio_receiver->window_size[slot] = (uint8_t)buf_size;
+	audio_receiver->window_received |= bit;
+	if(fec)
+		audio_receiver->window_fec |= bit;
+	else
+		audio_receiver->window_fec &= ~bit;
 }
@@ -6,10 +6,11 @@
 
 #include "vl_rbsp.h"
 
-static bool skip_startcode(struct vl_vlc *vlc)
+static bool skip_startcode(struct vl_vlc *vlc, unsigned *offset)
 {
+	unsigned i;
 	vl_vlc_fillbits(vlc);
-	for(unsigned i=0; i<64 && vl_vlc_bits_left(vlc)>=32; i++)
+	for(i=0; i<64 && vl_vlc_bits_left(vlc)>=32; i++)
 	{
 		if (vl_vlc_peekbits(vlc, 32) == 1)
 			break;
@@ -20,6 +21,8 @@ static bool skip_startcode(struct vl_vlc *vlc)
 		return false;
 	vl_vlc_eatbits(vlc, 32);
 	vl_vlc_fillbits(vlc);
+	if(offset)
+		*offset = i;
 	return true;
 }
 
@@ -27,7 +30,7 @@ static bool header_h264(ChiakiBitstream *bitstream, uint8_t *data, unsigned size
 {
 	struct vl_vlc vlc = {0};
 	vl_vlc_init(&vlc, data, size);
-	if(!skip_startcode(&vlc))
+	if(!skip_startcode(&vlc, NULL))
 	{
 		CHIAKI_LOGW(bitstream->log, "parse_sps_h264: No startcode found");
 		return false;
@@ -86,7 +89,7 @@ static bool header_h265(ChiakiBitstream *bitstream, uint8_t *data, unsigned size
 	struct vl_vlc vlc = {0};
 	vl_vlc_init(&vlc, data, size);
 sps_start:
-	if(!skip_startcode(&vlc))
+	if(!skip_startcode(&vlc, NULL))
 	{
 		CHIAKI_LOGW(bitstream->log, "parse_sps_h265: No startcode found");
 		return false;
@@ -127,7 +130,7 @@ sps_start:
 
 	vl_rbsp_ue(&rbsp); // sps_seq_parameter_set_id
 	if(vl_rbsp_ue(&rbsp) == 3) // chroma_format_idc
-		vl_rbsp_u(&rbsp, 1); // separate_colour_plane_flag
+		bitstream->h265.sps.separate_colour_plane_flag = vl_rbsp_u(&rbsp, 1);
 
 	vl_rbsp_ue(&rbsp); // pic_width_in_luma_samples
 	vl_rbsp_ue(&rbsp); // pic_height_in_luma_samples
@@ -150,6 +153,64 @@ sps_start:
 		return false;
 	}
 
+	// vl_rbsp_init() left vlc at the start of the next NAL
+	if(!skip_startcode(&vlc, NULL))
+	{
+		CHIAKI_LOGW(bitstream->log, "parse_pps_h265: No startcode found, assuming defaults");
+		return true;
+	}
+
+	vl_vlc_eatbits(&vlc, 1); // forbidden_zero_bit
+	nal_unit_type = vl_vlc_get_uimsbf(&vlc, 6);
+	vl_vlc_eatbits(&vlc, 6); // nuh_layer_id
+	vl_vlc_eatbits(&vlc, 3); // nuh_temporal_id_plus1
+
+	if(nal_unit_type != 34)
+	{
+		CHIAKI_LOGW(bitstream->log, "parse_pps_h265: Unexpected NAL unit type %u, assuming defaults", nal_unit_type);
+		return true;
+	}
+
+	vl_rbsp_init(&rbsp, &vlc, ~0);
+	vl_rbsp_ue(&rbsp); // pps_pic_parameter_set_id
+	vl_rbsp_ue(&rbsp); // pps_seq_parameter_set_id
+	bitstream->h265.pps.dependent_slice_segments_enabled_flag = vl_rbsp_u(&rbsp, 1);
+	bitstream->h265.pps.output_flag_present_flag = vl_rbsp_u(&rbsp, 1);
+	bitstream->h265.pps.num_extra_slice_header_bits = vl_rbsp_u(&rbsp, 3);
+
+	return true;
+}
+
+/**
+ * Parse an h265 slice segment header up to and including slice_type,
+ * using the fields cached from the SPS and PPS.
+ *
+ * @return false for dependent slice segments, which do not carry the fields after slice_segment_address
+ */
+static bool slice_header_begin_h265(ChiakiBitstream *bitstream, struct vl_rbsp *rbsp, unsigned nal_unit_type, unsigned *slice_type)
+{
+	unsigned first_slice_segment_in_pic_flag = vl_rbsp_u(rbsp, 1);
+	if(nal_unit_type == 20)
+		vl_rbsp_u(rbsp, 1); // no_output_of_prior_pics_flag
+
+	vl_rbsp_ue(rbsp); // slice_pic_parameter_set_id
+	if(!first_slice_segment_in_pic_flag)
+	{
+		if(bitstream->h265.pps.dependent_slice_segments_enabled_flag && vl_rbsp_u(rbsp, 1)) // dependent_slice_segment_flag
+			return false;
+		vl_rbsp_ue(rbsp); // slice_segment_address
+	}
+
+	for(unsigned i=0; i<bitstream->h265.pps.num_extra_slice_header_bits; i++)
+		vl_rbsp_u(rbsp, 1); // slice_reserved_flag[i]
+
+	*slice_type = vl_rbsp_ue(rbsp);
+
+	if(bitstream->h265.pps.output_flag_present_flag)
+		vl_rbsp_u(rbsp, 1); // pic_output_flag
+	if(bitstream->h265.sps.separate_colour_plane_flag)
+		vl_rbsp_u(rbsp, 2); // colour_plane_id
+
 	return true;
 }
 
@@ -157,7 +218,7 @@ static bool slice_h264(ChiakiBitstream *bitstream, uint8_t *data, unsigned size,
 {
 	struct vl_vlc vlc = {0};
 	vl_vlc_init(&vlc, data, size);
-	if(!skip_startcode(&vlc))
+	if(!skip_startcode(&vlc, &slice->offset))
 	{
 		CHIAKI_LOGW(bitstream->log, "parse_slice_h264: No startcode found");
 		return false;
@@ -229,7 +290,7 @@ static bool slice_h265(ChiakiBitstream *bitstream, uint8_t *data, unsigned size,
 	struct vl_vlc vlc = {0};
 	vl_vlc_init(&vlc, data, size);
 
-	if(!skip_startcode(&vlc))
+	if(!skip_startcode(&vlc, &slice->offset))
 	{
 		CHIAKI_LOGW(bitstream->log, "parse_slice_h265: No startcode found");
 		return false;
@@ -248,15 +309,14 @@ static bool slice_h265(ChiakiBitstream *bitstream, uint8_t *data, unsigned size,
 
 	struct vl_rbsp rbsp;
 	vl_rbsp_init(&rbsp, &vlc, ~0);
-	unsigned first_slice_segment_in_pic_flag = vl_rbsp_u(&rbsp, 1);
-	if(nal_unit_type == 20)
-		vl_rbsp_u(&rbsp, 1); // no_output_of_prior_pics_flag
-
-	vl_rbsp_ue(&rbsp); // slice_pic_parameter_set_id
-	if(!first_slice_segment_in_pic_flag)
-		vl_rbsp_ue(&rbsp); // slice_segment_address
+	unsigned slice_type;
+	if(!slice_header_begin_h265(bitstream, &rbsp, nal_unit_type, &slice_type))
+	{
+		CHIAKI_LOGW(bitstream->log, "parse_slice_h265: Unexpected dependent slice segment");
+		return false;
+	}
 
-	switch(vl_rbsp_ue(&rbsp))
+	switch(slice_type)
 	{
 		case 1:
 			slice->slice_type = CHIAKI_BITSTREAM_SLICE_P;
@@ -303,7 +363,7 @@ static bool slice_set_reference_frame_h265(ChiakiBitstream *bitstream, uint8_t *
 {
 	struct vl_vlc vlc = {0};
 	vl_vlc_init(&vlc, data, size);
-	if(!skip_startcode(&vlc))
+	if(!skip_startcode(&vlc, NULL))
 	{
 		CHIAKI_LOGW(bitstream->log, "slice_set_reference_frame_h265: No startcode found");
 		return false;
@@ -322,13 +382,8 @@ static bool slice_set_reference_frame_h265(ChiakiBitstream *bitstream, uint8_t *
 
 	struct vl_rbsp rbsp;
 	vl_rbsp_init(&rbsp, &vlc, ~0);
-	unsigned first_slice_segment_in_pic_flag = vl_rbsp_u(&rbsp, 1);
-
-	vl_rbsp_ue(&rbsp); // slice_pic_parameter_set_id
-	if(!first_slice_segment_in_pic_flag)
-		vl_rbsp_ue(&rbsp); // slice_segment_address
-
-	if(vl_rbsp_ue(&rbsp) != 1)
+	unsigned slice_type;
+	if(!slice_header_begin_h265(bitstream, &rbsp, nal_unit_type, &slice_type) || slice_type != 1)
 	{
 		CHIAKI_LOGW(bitstream->log, "slice_set_reference_frame_h265: Not P slice");
 		return false;
@@ -373,24 +428,29 @@ void chiaki_bitstream_init(ChiakiBitstream *bitstream, ChiakiLog *log, ChiakiCod
 {
 	bitstream->log = log;
 	bitstream->codec = codec;
+	bitstream->header_valid = false;
 }
 
 bool chiaki_bitstream_header(ChiakiBitstream *bitstream, uint8_t *data, unsigned size)
 {
+	// everything derived from the header is kept until the next one, slices only read it
 	if(bitstream->codec == CHIAKI_CODEC_H264)
 	{
 		memset(&bitstream->h264, 0, sizeof(bitstream->h264));
-		return header_h264(bitstream, data, size);
+		bitstream->header_valid = header_h264(bitstream, data, size);
 	}
 	else
 	{
 		memset(&bitstream->h265, 0, sizeof(bitstream->h265));
-		return header_h265(bitstream, data, size);
+		bitstream->header_valid = header_h265(bitstream, data, size);
 	}
+	return bitstream->header_valid;
 }
 
 bool chiaki_bitstream_slice(ChiakiBitstream *bitstream, uint8_t *data, unsigned size, ChiakiBitstreamSlice *slice)
 {
+	if(!bitstream->header_valid)
+		return false;
 	if(bitstream->codec == CHIAKI_CODEC_H264)
 		return slice_h264(bitstream, data, size, slice);
 	else
@@ -399,6 +459,8 @@ bool chiaki_bitstream_slice(ChiakiBitstream *bitstream, uint8_t *data, unsigned
 
 bool chiaki_bitstream_slice_set_reference_frame(ChiakiBitstream *bitstream, uint8_t *data, unsigned size, unsigned reference_frame)
 {
+	if(!bitstream->header_valid)
+		return false;
 	if(bitstream->codec == CHIAKI_CODEC_H264)
 		return false;
 	else
@@ -3,6 +3,7 @@
 #include <chiaki/congestioncontrol.h>
 
 #define CONGESTION_CONTROL_INTERVAL_MS 200
+#define CONGESTION_CONTROL_INTERVAL_MAX_MS 500
 
 static void *congestion_control_thread_func(void *user)
 {
@@ -12,9 +13,13 @@ static void *congestion_control_thread_func(void *user)
 	if(err != CHIAKI_ERR_SUCCESS)
 		return NULL;
 
+	double loss_history[CHIAKI_CONGESTION_CONTROL_LOSS_HISTORY];
+	size_t loss_history_count = 0;
+
+	double packet_loss_max = control->packet_loss_max;
 	while(true)
 	{
-		err = chiaki_bool_pred_cond_timedwait(&control->stop_cond, CONGESTION_CONTROL_INTERVAL_MS);
+		err = chiaki_bool_pred_cond_timedwait(&control->stop_cond, control->interval_ms);
 		if(err != CHIAKI_ERR_TIMEOUT)
 			break;
 
@@ -24,10 +29,24 @@ static void *congestion_control_thread_func(void *user)
 		ChiakiTakionCongestionPacket packet = { 0 };
 		uint64_t total = received + lost;
 		control->packet_loss = total > 0 ? (double)lost / total : 0;
-		if(control->packet_loss > control->packet_loss_max)
+		loss_history[loss_history_count++ % CHIAKI_CONGESTION_CONTROL_LOSS_HISTORY] = control->packet_loss;
+		size_t loss_history_size = loss_history_count < CHIAKI_CONGESTION_CONTROL_LOSS_HISTORY ? loss_history_count : CHIAKI_CONGESTION_CONTROL_LOSS_HISTORY;
+		double packet_loss_avg = 0;
+		for(size_t i=0; i<loss_history_size; i++)
+			packet_loss_avg += loss_history[i] / loss_history_size;
+		chiaki_metric_set(control->metric_packet_loss_ppm, (int64_t)(control->packet_loss * 1000000.0));
+		chiaki_metric_set(control->metric_packet_loss_avg_ppm, (int64_t)(packet_loss_avg * 1000000.0));
+		if(control->link_quality)
+		{
+			chiaki_link_quality_push_loss(control->link_quality, received, lost);
+			ChiakiLinkQualityStats link_stats;
+			chiaki_link_quality_get_stats(control->link_quality, &link_stats);
+			chiaki_congestion_control_tune(&link_stats, control->packet_loss_max, &control->interval_ms, &packet_loss_max);
+		}
+		if(control->packet_loss > packet_loss_max)
 		{
 			CHIAKI_LOGW(control->takion->log, "Increasing received packets to reduce hit on stream quality");
-			lost = total * control->packet_loss_max;
+			lost = total * packet_loss_max;
 			received = total - lost;
 		}
 		packet.received = (uint16_t)received;
@@ -41,12 +60,19 @@ static void *congestion_control_thread_func(void *user)
 	return NULL;
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_start(ChiakiCongestionControl *control, ChiakiTakion *takion, ChiakiPacketStats *stats, double packet_loss_max)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_start(ChiakiCongestionControl *control, ChiakiTakion *takion, ChiakiPacketStats *stats, ChiakiLinkQuality *link_quality, double packet_loss_max)
 {
 	control->takion = takion;
 	control->stats = stats;
+	control->link_quality = link_quality;
 	control->packet_loss_max = packet_loss_max;
 	control->packet_loss = 0;
+	control->interval_ms = CONGESTION_CONTROL_INTERVAL_MS;
+	ChiakiMetrics *metrics = chiaki_metrics_default();
+	control->metric_packet_loss_ppm = chiaki_metrics_register_gauge(metrics, "stream.packet_loss_ppm");
+	control->metric_packet_loss_avg_ppm = chiaki_metrics_register_gauge(metrics, "stream.packet_loss_avg_ppm");
+	chiaki_metric_set(control->metric_packet_loss_ppm, 0);
+	chiaki_metric_set(control->metric_packet_loss_avg_ppm, 0);
 
 	ChiakiErrorCode err = chiaki_bool_pred_cond_init(&control->stop_cond);
 	if(err != CHIAKI_ERR_SUCCESS)
@@ -77,3 +103,18 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_stop(ChiakiCongestionCon
 
 	return chiaki_bool_pred_cond_fini(&control->stop_cond);
 }
+
+CHIAKI_EXPORT void chiaki_congestion_control_tune(const ChiakiLinkQualityStats *stats, double packet_loss_max, uint64_t *interval_ms, double *packet_loss_max_out)
+{
+	*interval_ms = CONGESTION_CONTROL_INTERVAL_MS;
+	*packet_loss_max_out = packet_loss_max;
+	if(!stats || !stats->rtt_samples)
+		return;
+
+	if(stats->resend_timeout_ms > *interval_ms)
+		*interval_ms = stats->resend_timeout_ms < CONGESTION_CONTROL_INTERVAL_MAX_MS ? stats->resend_timeout_ms : CONGESTION_CONTROL_INTERVAL_MAX_MS;
+
+	// srtt growing above the lowest RTT means packets are queueing somewhere on the way
+	if(stats->rtt_min_us && stats->srtt_us > stats->rtt_min_us)
+		*packet_loss_max_out = packet_loss_max * (double)stats->rtt_min_us / stats->srtt_us;
+}
@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
 
 #include <chiaki/discoveryservice.h>
+#include <chiaki/time.h>
 
 #include <string.h>
 #include <assert.h>
@@ -14,11 +15,27 @@
 #include <netinet/in.h>
 #endif
 
+#define RESOLVE_RETRY_MIN_MS 1000
+#define RESOLVE_RETRY_MAX_MS 60000
+
 static void *discovery_service_thread_func(void *user);
+static void *discovery_service_resolve_thread_func(void *user);
+static void discovery_service_receive(ChiakiDiscoveryService *service, ChiakiDiscovery *discovery, bool primary);
 static void discovery_service_ping(ChiakiDiscoveryService *service);
+static void discovery_service_ping_manual_hosts(ChiakiDiscoveryService *service);
+static void discovery_service_send_srch(ChiakiDiscoveryService *service, ChiakiDiscovery *discovery, struct sockaddr_storage *addr, size_t addr_size);
+static bool discovery_service_resolve(ChiakiDiscoveryService *service, const char *host, sa_family_t family, struct sockaddr_storage *addr, size_t *addr_size);
+static ChiakiDiscovery *discovery_service_discovery_for_family(ChiakiDiscoveryService *service, sa_family_t family);
+static void discovery_service_manual_hosts_free(ChiakiDiscoveryServiceManualHost *hosts, size_t hosts_count);
 static void discovery_service_drop_old_hosts(ChiakiDiscoveryService *service);
-static void discovery_service_host_received(ChiakiDiscoveryHost *host, void *user);
+static void discovery_service_host_received(ChiakiDiscoveryService *service, ChiakiDiscoveryHost *host, bool primary);
 static void discovery_service_report_state(ChiakiDiscoveryService *service);
+static uint64_t discovery_service_next_ping_ms(ChiakiDiscoveryService *service);
+static uint32_t discovery_service_host_id_hash(const char *host_id);
+static size_t discovery_service_host_find(ChiakiDiscoveryService *service, const char *host_id, uint32_t hash);
+static void discovery_service_host_index_insert(ChiakiDiscoveryService *service, size_t index);
+static void discovery_service_host_index_rebuild(ChiakiDiscoveryService *service);
+static void discovery_service_host_event(ChiakiDiscoveryService *service, ChiakiDiscoveryServiceHostEvent event, ChiakiDiscoveryHost *host);
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_service_init(ChiakiDiscoveryService *service, ChiakiDiscoveryServiceOptions *options, ChiakiLog *log)
 {
@@ -39,35 +56,69 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_service_init(ChiakiDiscoveryServi
 	}
 
 	service->hosts_count = 0;
+	service->ping_cur_ms = service->options.ping_ms;
+	service->hosts_changed = false;
+	service->manual_hosts = NULL;
+	service->manual_hosts_count = 0;
+	service->resolve_thread_active = false;
+	service->resolve_stop = false;
+
+	service->host_index_size = 4;
+	while(service->host_index_size < service->options.hosts_max * 2)
+		service->host_index_size <<= 1;
+	service->host_index = calloc(service->host_index_size, sizeof(size_t));
+	if(!service->host_index)
+	{
+		err = CHIAKI_ERR_MEMORY;
+		goto error_host_discovery_infos;
+	}
 
 	err = chiaki_mutex_init(&service->state_mutex, false);
 	if(err != CHIAKI_ERR_SUCCESS)
-		goto error_host_discovery_infos;
+		goto error_host_index;
+
+	err = chiaki_cond_init(&service->resolve_cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_state_mutex;
 
 	service->options.send_addr = malloc(service->options.send_addr_size);
 	if(!service->options.send_addr)
 	{
 		err = CHIAKI_ERR_MEMORY;
-		goto error_state_mutex;
+		goto error_resolve_cond;
 	}
 	memcpy(service->options.send_addr, options->send_addr, service->options.send_addr_size);
 
+	// everything below is owned by the service, so nothing of the caller is freed on error
+	service->options.send_addr_ipv6 = NULL;
 	service->options.broadcast_addrs = NULL;
-	service->options.broadcast_num = options->broadcast_num;
+	service->options.send_host = NULL;
+
+	if(options->send_addr_ipv6)
+	{
+		service->options.send_addr_ipv6 = malloc(service->options.send_addr_ipv6_size);
+		if(!service->options.send_addr_ipv6)
+		{
+			err = CHIAKI_ERR_MEMORY;
+			goto error_send_addr;
+		}
+		memcpy(service->options.send_addr_ipv6, options->send_addr_ipv6, service->options.send_addr_ipv6_size);
+	}
+
 	if(options->broadcast_num > 0)
 	{
 		service->options.broadcast_addrs = malloc(service->options.broadcast_num * sizeof(struct sockaddr_storage));
 		if(!service->options.broadcast_addrs)
 		{
 			err = CHIAKI_ERR_MEMORY;
-			goto error_state_mutex;
+			goto error_send_addr;
 		}
 		memcpy(service->options.broadcast_addrs, options->broadcast_addrs, service->options.broadcast_num * sizeof(struct sockaddr_storage));
 	}
 
-	if(service->options.send_host)
+	if(options->send_host)
 	{
-		service->options.send_host = strdup(service->options.send_host);
+		service->options.send_host = strdup(options->send_host);
 		if(!service->options.send_host)
 		{
 			err = CHIAKI_ERR_MEMORY;
@@ -79,27 +130,45 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_service_init(ChiakiDiscoveryServi
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_send_addr;
 
-	err = chiaki_bool_pred_cond_init(&service->stop_cond);
+	service->discovery_ipv6_active = false;
+	if(service->options.send_addr_ipv6)
+	{
+		// IPv4 discovery still works without it
+		err = chiaki_discovery_init(&service->discovery_ipv6, log, AF_INET6);
+		if(err == CHIAKI_ERR_SUCCESS)
+			service->discovery_ipv6_active = true;
+		else
+			CHIAKI_LOGW(service->log, "Discovery Service failed to init IPv6 socket, only using IPv4");
+	}
+
+	err = chiaki_stop_pipe_init(&service->stop_pipe);
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_discovery;
 
 	err = chiaki_thread_create(&service->thread, discovery_service_thread_func, service);
 	if(err != CHIAKI_ERR_SUCCESS)
-		goto error_stop_cond;
+		goto error_stop_pipe;
 
 	chiaki_thread_set_name(&service->thread, "Chiaki Discovery Service");
 
 	return CHIAKI_ERR_SUCCESS;
-error_stop_cond:
-	chiaki_bool_pred_cond_fini(&service->stop_cond);
+error_stop_pipe:
+	chiaki_stop_pipe_fini(&service->stop_pipe);
 error_discovery:
+	if(service->discovery_ipv6_active)
+		chiaki_discovery_fini(&service->discovery_ipv6);
 	chiaki_discovery_fini(&service->discovery);
 error_send_addr:
 	free(service->options.broadcast_addrs);
+	free(service->options.send_addr_ipv6);
 	free(service->options.send_addr);
 	free(service->options.send_host);
+error_resolve_cond:
+	chiaki_cond_fini(&service->resolve_cond);
 error_state_mutex:
 	chiaki_mutex_fini(&service->state_mutex);
+error_host_index:
+	free(service->host_index);
 error_host_discovery_infos:
 	free(service->host_discovery_infos);
 error_hosts:
@@ -109,15 +178,30 @@ error_hosts:
 
 CHIAKI_EXPORT void chiaki_discovery_service_fini(ChiakiDiscoveryService *service)
 {
-	chiaki_bool_pred_cond_signal(&service->stop_cond);
+	chiaki_stop_pipe_stop(&service->stop_pipe);
 	chiaki_thread_join(&service->thread, NULL);
-	chiaki_bool_pred_cond_fini(&service->stop_cond);
+	chiaki_stop_pipe_fini(&service->stop_pipe);
+	if(service->resolve_thread_active)
+	{
+		// a lookup that is already running can't be canceled, so this may take until it times out
+		ChiakiErrorCode err = chiaki_mutex_lock(&service->state_mutex);
+		assert(err == CHIAKI_ERR_SUCCESS);
+		service->resolve_stop = true;
+		chiaki_cond_signal(&service->resolve_cond);
+		chiaki_mutex_unlock(&service->state_mutex);
+		chiaki_thread_join(&service->resolve_thread, NULL);
+	}
+	if(service->discovery_ipv6_active)
+		chiaki_discovery_fini(&service->discovery_ipv6);
 	chiaki_discovery_fini(&service->discovery);
+	chiaki_cond_fini(&service->resolve_cond);
 	chiaki_mutex_fini(&service->state_mutex);
 	free(service->options.send_addr);
+	free(service->options.send_addr_ipv6);
 	free(service->options.send_host);
 	if(service->options.broadcast_addrs)
 		free(service->options.broadcast_addrs);
+	discovery_service_manual_hosts_free(service->manual_hosts, service->manual_hosts_count);
 
 	for(size_t i=0; i<service->hosts_count; i++)
 	{
@@ -127,184 +211,434 @@ CHIAKI_EXPORT void chiaki_discovery_service_fini(ChiakiDiscoveryService *service
 #undef FREE_STRING
 	}
 
+	free(service->host_index);
 	free(service->host_discovery_infos);
 	free(service->hosts);
 }
 
-static void *discovery_service_thread_func(void *user)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_service_set_manual_hosts(ChiakiDiscoveryService *service, const char **hosts, size_t hosts_count)
 {
-	ChiakiDiscoveryService *service = user;
+	ChiakiDiscoveryServiceManualHost *manual_hosts = NULL;
+	if(hosts_count)
+	{
+		manual_hosts = calloc(hosts_count, sizeof(ChiakiDiscoveryServiceManualHost));
+		if(!manual_hosts)
+			return CHIAKI_ERR_MEMORY;
+	}
 
-	ChiakiErrorCode err = chiaki_bool_pred_cond_lock(&service->stop_cond);
-	if(err != CHIAKI_ERR_SUCCESS)
-		return NULL;
+	for(size_t i=0; i<hosts_count; i++)
+	{
+		manual_hosts[i].host = strdup(hosts[i]);
+		if(!manual_hosts[i].host)
+		{
+			discovery_service_manual_hosts_free(manual_hosts, i);
+			return CHIAKI_ERR_MEMORY;
+		}
+	}
 
-	ChiakiDiscoveryThread discovery_thread;
-	err = chiaki_discovery_thread_start(&discovery_thread, &service->discovery, discovery_service_host_received, service);
-	if(err != CHIAKI_ERR_SUCCESS)
-		goto beach;
+	ChiakiErrorCode err = chiaki_mutex_lock(&service->state_mutex);
+	assert(err == CHIAKI_ERR_SUCCESS);
 
-	err = chiaki_bool_pred_cond_timedwait(&service->stop_cond, service->options.ping_initial_ms);
+	if(hosts_count && !service->resolve_thread_active)
+	{
+		err = chiaki_thread_create(&service->resolve_thread, discovery_service_resolve_thread_func, service);
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			chiaki_mutex_unlock(&service->state_mutex);
+			discovery_service_manual_hosts_free(manual_hosts, hosts_count);
+			return err;
+		}
+		chiaki_thread_set_name(&service->resolve_thread, "Chiaki Discovery Resolve");
+		service->resolve_thread_active = true;
+	}
 
-	while(err == CHIAKI_ERR_TIMEOUT)
+	// keep what was already resolved and the retry delay of failed ones for hosts that stay
+	for(size_t i=0; i<hosts_count; i++)
 	{
-		discovery_service_ping(service);
-		err = chiaki_bool_pred_cond_timedwait(&service->stop_cond, service->options.ping_ms);
+		for(size_t j=0; j<service->manual_hosts_count; j++)
+		{
+			if(strcmp(manual_hosts[i].host, service->manual_hosts[j].host) != 0)
+				continue;
+			char *host = manual_hosts[i].host;
+			manual_hosts[i] = service->manual_hosts[j];
+			manual_hosts[i].host = host;
+			break;
+		}
 	}
 
-	chiaki_discovery_thread_stop(&discovery_thread);
+	ChiakiDiscoveryServiceManualHost *old_hosts = service->manual_hosts;
+	size_t old_hosts_count = service->manual_hosts_count;
+	service->manual_hosts = manual_hosts;
+	service->manual_hosts_count = hosts_count;
 
-beach:
-	chiaki_bool_pred_cond_unlock(&service->stop_cond);
-	return NULL;
+	chiaki_cond_signal(&service->resolve_cond);
+	chiaki_mutex_unlock(&service->state_mutex);
+
+	discovery_service_manual_hosts_free(old_hosts, old_hosts_count);
+	return CHIAKI_ERR_SUCCESS;
 }
 
-static void discovery_service_ping(ChiakiDiscoveryService *service)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_service_wakeup(ChiakiDiscoveryService *service, const char *host, uint64_t user_credential, bool ps5)
 {
-	ChiakiErrorCode err = chiaki_mutex_lock(&service->state_mutex);
+	// same guess as chiaki_discovery_wakeup()
+	sa_family_t family = strchr(host, ':') ? AF_INET6 : AF_INET;
+	ChiakiErrorCode err = chiaki_discovery_wakeup(service->log, discovery_service_discovery_for_family(service, family), host, user_credential, ps5);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+
+	err = chiaki_mutex_lock(&service->state_mutex);
 	assert(err == CHIAKI_ERR_SUCCESS);
+	service->hosts_changed = true;
+	chiaki_mutex_unlock(&service->state_mutex);
+	return CHIAKI_ERR_SUCCESS;
+}
 
-	service->ping_index++;
-	discovery_service_drop_old_hosts(service);
+static void *discovery_service_thread_func(void *user)
+{
+	ChiakiDiscoveryService *service = user;
 
-	chiaki_mutex_unlock(&service->state_mutex);
+	ChiakiDiscovery *discoveries[2] = { &service->discovery, &service->discovery_ipv6 };
+	chiaki_socket_t fds[2] = { service->discovery.socket, CHIAKI_INVALID_SOCKET };
+	size_t fds_count = 1;
+	if(service->discovery_ipv6_active)
+		fds[fds_count++] = service->discovery_ipv6.socket;
 
-	if(service->options.send_host)
+	uint64_t next_ping_ms = chiaki_time_now_monotonic_ms() + service->options.ping_initial_ms;
+	while(true)
 	{
-		struct addrinfo *host_addrinfos;
-		struct addrinfo hints;
-		memset(&hints, 0, sizeof(hints));
-		hints.ai_socktype = SOCK_DGRAM;
-		hints.ai_family = ((struct sockaddr *)service->options.send_addr)->sa_family;
-		int r = getaddrinfo(service->options.send_host, NULL, &hints, &host_addrinfos);
-		if(r != 0)
+		uint64_t now_ms = chiaki_time_now_monotonic_ms();
+		if(now_ms >= next_ping_ms)
 		{
-			CHIAKI_LOGE(service->log, "getaddrinfo failed");
-			return;
+			discovery_service_ping(service);
+			next_ping_ms = now_ms + discovery_service_next_ping_ms(service);
+			continue;
 		}
 
-		bool ok = false;
-		for(struct addrinfo *ai=host_addrinfos; ai; ai=ai->ai_next)
+		bool readable[2];
+		ChiakiErrorCode err = chiaki_stop_pipe_select_multi(&service->stop_pipe, fds, fds_count, next_ping_ms - now_ms, readable);
+		if(err == CHIAKI_ERR_CANCELED)
+			break;
+		if(err == CHIAKI_ERR_TIMEOUT)
+			continue;
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_LOGE(service->log, "Discovery Service failed to select");
+			break;
+		}
+
+		for(size_t i=0; i<fds_count; i++)
+		{
+			if(readable[i])
+				discovery_service_receive(service, discoveries[i], i == 0);
+		}
+	}
+
+	return NULL;
+}
+
+static void *discovery_service_resolve_thread_func(void *user)
+{
+	ChiakiDiscoveryService *service = user;
+
+	ChiakiErrorCode err = chiaki_mutex_lock(&service->state_mutex);
+	assert(err == CHIAKI_ERR_SUCCESS);
+
+	while(!service->resolve_stop)
+	{
+		uint64_t now_ms = chiaki_time_now_monotonic_ms();
+		ChiakiDiscoveryServiceManualHost *next = NULL;
+		uint64_t wait_ms = UINT64_MAX;
+		for(size_t i=0; i<service->manual_hosts_count; i++)
 		{
-			if(ai->ai_family != AF_INET && ai->ai_family != AF_INET6)
+			ChiakiDiscoveryServiceManualHost *host = &service->manual_hosts[i];
+			if(host->addr_size)
 				continue;
-			ok = true;
-			memcpy(service->options.send_addr, ai->ai_addr, ai->ai_addrlen);
+			if(host->resolve_next_ms <= now_ms)
+			{
+				next = host;
+				break;
+			}
+			if(host->resolve_next_ms - now_ms < wait_ms)
+				wait_ms = host->resolve_next_ms - now_ms;
 		}
-		freeaddrinfo(host_addrinfos);
 
-		if(!ok)
+		if(!next)
 		{
-			CHIAKI_LOGE(service->log, "Failed to get addr for hostname");
-			return;
+			if(wait_ms == UINT64_MAX)
+				chiaki_cond_wait(&service->resolve_cond, &service->state_mutex);
+			else
+				chiaki_cond_timedwait(&service->resolve_cond, &service->state_mutex, wait_ms);
+			continue;
 		}
 
-		free(service->options.send_host);
-		service->options.send_host = NULL;
+		// the list may be replaced while resolving, so only keep the name
+		char *name = strdup(next->host);
+		bool ok = false;
+		struct sockaddr_storage addr;
+		size_t addr_size = 0;
+		if(name)
+		{
+			chiaki_mutex_unlock(&service->state_mutex);
+			ok = discovery_service_resolve(service, name, strchr(name, ':') ? AF_INET6 : AF_INET, &addr, &addr_size);
+			err = chiaki_mutex_lock(&service->state_mutex);
+			assert(err == CHIAKI_ERR_SUCCESS);
+		}
+
+		now_ms = chiaki_time_now_monotonic_ms();
+		for(size_t i=0; i<service->manual_hosts_count; i++)
+		{
+			ChiakiDiscoveryServiceManualHost *host = &service->manual_hosts[i];
+			if(host->addr_size || (name && strcmp(host->host, name) != 0) || (!name && host != next))
+				continue;
+			if(ok)
+			{
+				host->addr = addr;
+				host->addr_size = addr_size;
+				host->resolve_failures = 0;
+			}
+			else
+			{
+				uint64_t delay_ms = RESOLVE_RETRY_MIN_MS;
+				for(unsigned int f=0; f<host->resolve_failures && delay_ms < RESOLVE_RETRY_MAX_MS; f++)
+					delay_ms *= 2;
+				if(delay_ms > RESOLVE_RETRY_MAX_MS)
+					delay_ms = RESOLVE_RETRY_MAX_MS;
+				host->resolve_failures++;
+				host->resolve_next_ms = now_ms + delay_ms;
+				CHIAKI_LOGV(service->log, "Discovery Service retrying to resolve %s in %llu ms", host->host, (unsigned long long)delay_ms);
+			}
+			break;
+		}
+		free(name);
 	}
 
-	CHIAKI_LOGV(service->log, "Discovery Service sending ping");
-	ChiakiDiscoveryPacket packet = { 0 };
-	bool send_extra_broadcast = false;
-	packet.cmd = CHIAKI_DISCOVERY_CMD_SRCH;
-	packet.protocol_version = CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS4;
-	if(((struct sockaddr *)service->options.send_addr)->sa_family == AF_INET)
-	{
-		((struct sockaddr_in *)service->options.send_addr)->sin_port = htons(CHIAKI_DISCOVERY_PORT_PS4);
-		if(((struct sockaddr_in *)service->options.send_addr)->sin_addr.s_addr == 0xffffffff)
-			send_extra_broadcast = true;
-	}
-	else if(((struct sockaddr *)service->options.send_addr)->sa_family == AF_INET6)
-		((struct sockaddr_in6 *)service->options.send_addr)->sin6_port = htons(CHIAKI_DISCOVERY_PORT_PS4);
-	else
+	chiaki_mutex_unlock(&service->state_mutex);
+	return NULL;
+}
+
+static void discovery_service_receive(ChiakiDiscoveryService *service, ChiakiDiscovery *discovery, bool primary)
+{
+	char buf[512];
+	struct sockaddr_storage client_addr;
+	socklen_t client_addr_size = sizeof(client_addr);
+	CHIAKI_SSIZET_TYPE n = recvfrom(discovery->socket, buf, sizeof(buf) - 1, 0, (struct sockaddr *)&client_addr, &client_addr_size);
+	if(n < 0)
 	{
-		CHIAKI_LOGE(service->log, "Discovery Service send_addr has unknown sa_family");
+		// e.g. an ICMP unreachable from a previous ping, the socket itself is still fine
+		CHIAKI_LOGV(service->log, "Discovery Service failed to read from socket");
 		return;
 	}
-	err = chiaki_discovery_send(&service->discovery, &packet, (struct sockaddr *)service->options.send_addr, service->options.send_addr_size);
+
+	if(n == 0)
+		return;
+
+	if(n > sizeof(buf) - 1)
+		n = sizeof(buf) - 1;
+
+	buf[n] = '\00';
+
+	char addr_buf[64];
+	ChiakiDiscoveryHost response;
+	ChiakiErrorCode err = chiaki_discovery_srch_response_parse(&response, (struct sockaddr *)&client_addr, addr_buf, sizeof(addr_buf), buf, n);
 	if(err != CHIAKI_ERR_SUCCESS)
-		CHIAKI_LOGE(service->log, "Discovery Service failed to send ping for PS4");
-	if(send_extra_broadcast)
 	{
-		for(int i = 0; i < service->options.broadcast_num; i++)
+		CHIAKI_LOGI(service->log, "Discovery Response invalid");
+		return;
+	}
+
+	discovery_service_host_received(service, &response, primary);
+}
+
+static void discovery_service_ping(ChiakiDiscoveryService *service)
+{
+	ChiakiErrorCode err = chiaki_mutex_lock(&service->state_mutex);
+	assert(err == CHIAKI_ERR_SUCCESS);
+
+	service->ping_index++;
+	discovery_service_drop_old_hosts(service);
+
+	chiaki_mutex_unlock(&service->state_mutex);
+
+	discovery_service_ping_manual_hosts(service);
+
+	if(service->options.send_host)
+	{
+		size_t addr_size;
+		if(!discovery_service_resolve(service, service->options.send_host, ((struct sockaddr *)service->options.send_addr)->sa_family, service->options.send_addr, &addr_size))
+			return;
+
+		free(service->options.send_host);
+		service->options.send_host = NULL;
+	}
+
+	CHIAKI_LOGV(service->log, "Discovery Service sending ping");
+	discovery_service_send_srch(service, &service->discovery, service->options.send_addr, service->options.send_addr_size);
+
+	if(service->discovery_ipv6_active)
+		discovery_service_send_srch(service, &service->discovery_ipv6, service->options.send_addr_ipv6, service->options.send_addr_ipv6_size);
+
+	if(((struct sockaddr *)service->options.send_addr)->sa_family == AF_INET
+		&& ((struct sockaddr_in *)service->options.send_addr)->sin_addr.s_addr == 0xffffffff)
+	{
+		for(size_t i = 0; i < service->options.broadcast_num; i++)
 		{
-			((struct sockaddr_in *)(&service->options.broadcast_addrs[i]))->sin_port = htons(CHIAKI_DISCOVERY_PORT_PS4);
-			err = chiaki_discovery_send(&service->discovery, &packet, (struct sockaddr *)&service->options.broadcast_addrs[i], service->options.send_addr_size);
-			if(err != CHIAKI_ERR_SUCCESS)
-				CHIAKI_LOGE(service->log, "Discovery Service failed to send extra broadcast ping for PS4");
+			discovery_service_send_srch(service, &service->discovery, &service->options.broadcast_addrs[i], service->options.send_addr_size);
+			char addr_string[INET_ADDRSTRLEN];
+			if (!inet_ntop(((struct sockaddr_in *)(&service->options.broadcast_addrs[i]))->sin_family, &(((struct sockaddr_in *)(&service->options.broadcast_addrs[i]))->sin_addr), addr_string, sizeof(addr_string)))
+				CHIAKI_LOGE(service->log, "Discovery Service error with inet_ntop");
 			else
-			{
-				char addr_string[INET_ADDRSTRLEN];
-				if (!inet_ntop(((struct sockaddr_in *)(&service->options.broadcast_addrs[i]))->sin_family, &(((struct sockaddr_in *)(&service->options.broadcast_addrs[i]))->sin_addr), addr_string, sizeof(addr_string)))
-					CHIAKI_LOGE(service->log, "Discovery Service error with inet_ntop");
-				else
-					CHIAKI_LOGV(service->log, "Discovery Service pinged %s", addr_string);
-			}
+				CHIAKI_LOGV(service->log, "Discovery Service pinged %s", addr_string);
 		}
 	}
-	packet.protocol_version = CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS5;
-	if(((struct sockaddr *)service->options.send_addr)->sa_family == AF_INET)
-		((struct sockaddr_in *)service->options.send_addr)->sin_port = htons(CHIAKI_DISCOVERY_PORT_PS5);
-	else if(((struct sockaddr *)service->options.send_addr)->sa_family == AF_INET6)
-		((struct sockaddr_in6 *)service->options.send_addr)->sin6_port = htons(CHIAKI_DISCOVERY_PORT_PS5);
-	err = chiaki_discovery_send(&service->discovery, &packet, (struct sockaddr *)service->options.send_addr, service->options.send_addr_size);
-	if(err != CHIAKI_ERR_SUCCESS)
-		CHIAKI_LOGE(service->log, "Discovery Service failed to send ping for PS5");
-	if(send_extra_broadcast)
+}
+
+static void discovery_service_ping_manual_hosts(ChiakiDiscoveryService *service)
+{
+	ChiakiErrorCode err = chiaki_mutex_lock(&service->state_mutex);
+	assert(err == CHIAKI_ERR_SUCCESS);
+
+	// hosts that are not resolved yet are left to the resolve thread
+	for(size_t i=0; i<service->manual_hosts_count; i++)
 	{
-		for(int i = 0; i < service->options.broadcast_num; i++)
+		ChiakiDiscoveryServiceManualHost *host = &service->manual_hosts[i];
+		if(!host->addr_size)
+			continue;
+
+		ChiakiDiscovery *discovery = discovery_service_discovery_for_family(service, host->addr.ss_family);
+		if(!discovery)
 		{
-			((struct sockaddr_in *)(&service->options.broadcast_addrs[i]))->sin_port = htons(CHIAKI_DISCOVERY_PORT_PS5);
-			err = chiaki_discovery_send(&service->discovery, &packet, (struct sockaddr *)&service->options.broadcast_addrs[i], service->options.send_addr_size);
-			if(err != CHIAKI_ERR_SUCCESS)
-				CHIAKI_LOGE(service->log, "Discovery Service failed to send extra broadcast ping for PS5");
+			CHIAKI_LOGV(service->log, "Discovery Service has no socket to ping %s", host->host);
+			continue;
+		}
+		discovery_service_send_srch(service, discovery, &host->addr, host->addr_size);
+	}
+
+	chiaki_mutex_unlock(&service->state_mutex);
+}
+
+static void discovery_service_send_srch(ChiakiDiscoveryService *service, ChiakiDiscovery *discovery, struct sockaddr_storage *addr, size_t addr_size)
+{
+	static const struct
+	{
+		uint16_t port;
+		char *protocol_version;
+		const char *name;
+	} targets[] = {
+		{ CHIAKI_DISCOVERY_PORT_PS4, CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS4, "PS4" },
+		{ CHIAKI_DISCOVERY_PORT_PS5, CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS5, "PS5" }
+	};
+
+	for(size_t i=0; i<sizeof(targets) / sizeof(targets[0]); i++)
+	{
+		if(addr->ss_family == AF_INET)
+			((struct sockaddr_in *)addr)->sin_port = htons(targets[i].port);
+		else if(addr->ss_family == AF_INET6)
+			((struct sockaddr_in6 *)addr)->sin6_port = htons(targets[i].port);
+		else
+		{
+			CHIAKI_LOGE(service->log, "Discovery Service send_addr has unknown sa_family");
+			return;
 		}
+
+		ChiakiDiscoveryPacket packet = { 0 };
+		packet.cmd = CHIAKI_DISCOVERY_CMD_SRCH;
+		packet.protocol_version = targets[i].protocol_version;
+		ChiakiErrorCode err = chiaki_discovery_send(discovery, &packet, (struct sockaddr *)addr, addr_size);
+		if(err != CHIAKI_ERR_SUCCESS)
+			CHIAKI_LOGE(service->log, "Discovery Service failed to send ping for %s", targets[i].name);
 	}
 }
 
+static bool discovery_service_resolve(ChiakiDiscoveryService *service, const char *host, sa_family_t family, struct sockaddr_storage *addr, size_t *addr_size)
+{
+	struct addrinfo *host_addrinfos;
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_family = family;
+	int r = getaddrinfo(host, NULL, &hints, &host_addrinfos);
+	if(r != 0)
+	{
+		CHIAKI_LOGE(service->log, "getaddrinfo failed");
+		return false;
+	}
+
+	bool ok = false;
+	for(struct addrinfo *ai=host_addrinfos; ai; ai=ai->ai_next)
+	{
+		if(ai->ai_family != AF_INET && ai->ai_family != AF_INET6)
+			continue;
+		if(ai->ai_addrlen > sizeof(*addr))
+			continue;
+		ok = true;
+		memcpy(addr, ai->ai_addr, ai->ai_addrlen);
+		*addr_size = ai->ai_addrlen;
+	}
+	freeaddrinfo(host_addrinfos);
+
+	if(!ok)
+		CHIAKI_LOGE(service->log, "Failed to get addr for hostname");
+	return ok;
+}
+
+static ChiakiDiscovery *discovery_service_discovery_for_family(ChiakiDiscoveryService *service, sa_family_t family)
+{
+	if(service->discovery.local_addr.ss_family == family)
+		return &service->discovery;
+	if(service->discovery_ipv6_active && family == AF_INET6)
+		return &service->discovery_ipv6;
+	return NULL;
+}
+
+static void discovery_service_manual_hosts_free(ChiakiDiscoveryServiceManualHost *hosts, size_t hosts_count)
+{
+	for(size_t i=0; i<hosts_count; i++)
+		free(hosts[i].host);
+	free(hosts);
+}
+
 static void discovery_service_drop_old_hosts(ChiakiDiscoveryService *service)
 {
 	// service->state_mutex must be locked
 
 	bool change = false;
 
-	for(size_t i=0; i<service->hosts_count; i++)
+	for(size_t i=0; i<service->hosts_count;)
 	{
 		if(service->host_discovery_infos[i].last_ping_index + service->options.host_drop_pings >= service->ping_index)
+		{
+			i++;
 			continue;
+		}
 
 		ChiakiDiscoveryHost *host = &service->hosts[i];
 		CHIAKI_LOGI(service->log, "Discovery Service: Host with id %s is no longer available", host->host_id ? host->host_id : "");
+		discovery_service_host_event(service, CHIAKI_DISCOVERY_SERVICE_HOST_REMOVED, host);
 
 #define FREE_STRING(name) do { free((char *)host->name); } while(0)
 		CHIAKI_DISCOVERY_HOST_STRING_FOREACH(FREE_STRING)
 #undef FREE_STRING
 
-		if(i < service->hosts_count - 1)
+		// order does not matter, so fill the gap with the last host instead of moving everything after it
+		service->hosts_count--;
+		if(i < service->hosts_count)
 		{
-			memmove(service->host_discovery_infos + i,
-					service->host_discovery_infos + i + 1,
-					sizeof(ChiakiDiscoveryServiceHostDiscoveryInfo) * (service->hosts_count - i - 1));
-
-			memmove(service->hosts + i,
-					service->hosts + i + 1,
-					sizeof(ChiakiDiscoveryHost) * (service->hosts_count - i - 1));
+			service->hosts[i] = service->hosts[service->hosts_count];
+			service->host_discovery_infos[i] = service->host_discovery_infos[service->hosts_count];
 		}
-
 		change = true;
-		if(i > 0)
-			i--;
-		service->hosts_count--;
 	}
 
 	if(change)
+	{
+		discovery_service_host_index_rebuild(service);
+		service->hosts_changed = true;
 		discovery_service_report_state(service);
+	}
 }
 
-static void discovery_service_host_received(ChiakiDiscoveryHost *host, void *user)
+static void discovery_service_host_received(ChiakiDiscoveryService *service, ChiakiDiscoveryHost *host, bool primary)
 {
-	ChiakiDiscoveryService *service = user;
-
 	ChiakiErrorCode err = chiaki_mutex_lock(&service->state_mutex);
 	assert(err == CHIAKI_ERR_SUCCESS);
 
@@ -317,20 +651,10 @@ static void discovery_service_host_received(ChiakiDiscoveryHost *host, void *use
 	CHIAKI_LOGV(service->log, "Discovery Service Received host with id %s", host->host_id);
 
 	bool change = false;
+	bool added = false;
 
-	size_t index = SIZE_MAX;
-	for(size_t i=0; i<service->hosts_count; i++)
-	{
-		if(!service->hosts[i].host_id)
-			continue;
-
-		if(strcmp(service->hosts[i].host_id, host->host_id) == 0)
-		{
-			index = i;
-			break;
-		}
-	}
-
+	uint32_t hash = discovery_service_host_id_hash(host->host_id);
+	size_t index = discovery_service_host_find(service, host->host_id, hash);
 	if(index == SIZE_MAX)
 	{
 		if(service->hosts_count == service->options.hosts_max)
@@ -342,11 +666,28 @@ static void discovery_service_host_received(ChiakiDiscoveryHost *host, void *use
 		CHIAKI_LOGI(service->log, "Discovery Service detected new host with id %s", host->host_id);
 
 		change = true;
+		added = true;
 		index = service->hosts_count++;
 		memset(&service->hosts[index], 0, sizeof(ChiakiDiscoveryHost));
+		memset(&service->host_discovery_infos[index], 0, sizeof(ChiakiDiscoveryServiceHostDiscoveryInfo));
+		service->host_discovery_infos[index].host_id_hash = hash;
+		discovery_service_host_index_insert(service, index);
 	}
 
-	service->host_discovery_infos[index].last_ping_index = service->ping_index;
+	ChiakiDiscoveryServiceHostDiscoveryInfo *info = &service->host_discovery_infos[index];
+	info->last_ping_index = service->ping_index;
+	if(primary)
+	{
+		info->primary = true;
+		info->last_primary_ping_index = service->ping_index;
+	}
+	else if(info->primary)
+	{
+		// also answering on the primary socket, stick to that instead of flipping between both
+		if(info->last_primary_ping_index + service->options.host_drop_pings >= service->ping_index)
+			goto rzcon;
+		info->primary = false;
+	}
 
 	ChiakiDiscoveryHost *host_slot = &service->hosts[index];
 
@@ -375,7 +716,11 @@ static void discovery_service_host_received(ChiakiDiscoveryHost *host, void *use
 #undef UPDATE_STRING
 
 	if(change)
+	{
+		service->hosts_changed = true;
+		discovery_service_host_event(service, added ? CHIAKI_DISCOVERY_SERVICE_HOST_ADDED : CHIAKI_DISCOVERY_SERVICE_HOST_CHANGED, host_slot);
 		discovery_service_report_state(service);
+	}
 
 rzcon:
 	chiaki_mutex_unlock(&service->state_mutex);
@@ -387,3 +732,82 @@ static void discovery_service_report_state(ChiakiDiscoveryService *service)
 	if(service->options.cb)
 		service->options.cb(service->hosts, service->hosts_count, service->options.cb_user);
 }
+
+static void discovery_service_host_event(ChiakiDiscoveryService *service, ChiakiDiscoveryServiceHostEvent event, ChiakiDiscoveryHost *host)
+{
+	// service->state_mutex must be locked
+	if(service->options.host_cb)
+		service->options.host_cb(event, host, service->options.cb_user);
+}
+
+static uint64_t discovery_service_next_ping_ms(ChiakiDiscoveryService *service)
+{
+	if(!service->options.ping_fast_ms)
+		return service->options.ping_ms;
+
+	ChiakiErrorCode err = chiaki_mutex_lock(&service->state_mutex);
+	assert(err == CHIAKI_ERR_SUCCESS);
+	if(service->hosts_changed)
+	{
+		// something is happening, e.g. a console is booting, so look again soon
+		service->ping_cur_ms = service->options.ping_fast_ms;
+		service->hosts_changed = false;
+	}
+	else
+	{
+		service->ping_cur_ms *= 2;
+		if(service->ping_cur_ms > service->options.ping_ms)
+			service->ping_cur_ms = service->options.ping_ms;
+	}
+	uint64_t r = service->ping_cur_ms;
+	chiaki_mutex_unlock(&service->state_mutex);
+	return r;
+}
+
+static uint32_t discovery_service_host_id_hash(const char *host_id)
+{
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for(const char *c = host_id; *c; c++)
+	{
+		hash ^= (uint8_t)*c;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static size_t discovery_service_host_find(ChiakiDiscoveryService *service, const char *host_id, uint32_t hash)
+{
+	// service->state_mutex must be locked
+	size_t mask = service->host_index_size - 1;
+	for(size_t bucket = hash & mask;; bucket = (bucket + 1) & mask)
+	{
+		size_t entry = service->host_index[bucket];
+		if(!entry)
+			return SIZE_MAX;
+		size_t index = entry - 1;
+		if(service->host_discovery_infos[index].host_id_hash == hash
+			&& service->hosts[index].host_id
+			&& strcmp(service->hosts[index].host_id, host_id) == 0)
+			return index;
+	}
+}
+
+static void discovery_service_host_index_insert(ChiakiDiscoveryService *service, size_t index)
+{
+	// service->state_mutex must be locked, the table is at least twice as big as hosts_max so there is always a free bucket
+	size_t mask = service->host_index_size - 1;
+	size_t bucket = service->host_discovery_infos[index].host_id_hash & mask;
+	while(service->host_index[bucket])
+		bucket = (bucket + 1) & mask;
+	service->host_index[bucket] = index + 1;
+}
+
+static void discovery_service_host_index_rebuild(ChiakiDiscoveryService *service)
+{
+	// service->state_mutex must be locked
+	// hosts only go away after several missed pings, so this is rare enough to not bother with deleting single buckets
+	memset(service->host_index, 0, service->host_index_size * sizeof(size_t));
+	for(size_t i=0; i<service->hosts_count; i++)
+		discovery_service_host_index_insert(service, i);
+}
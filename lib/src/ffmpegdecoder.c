@@ -1,9 +1,12 @@
 
 #include <chiaki/ffmpegdecoder.h>
+#include <chiaki/time.h>
 
 #include <libavcodec/avcodec.h>
 #include <libavutil/pixdesc.h>
 
+static const uint64_t decoder_submit_us_bounds[] = { 250, 500, 1000, 2000, 4000, 8000, 16000, 33000 };
+
 static enum AVCodecID chiaki_codec_av_codec_id(ChiakiCodec codec)
 {
 	switch(codec)
@@ -31,6 +34,15 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_ffmpeg_decoder_init(ChiakiFfmpegDecoder *de
 	decoder->frames_lost = 0;
 	decoder->frame_recovered = false;
 
+	ChiakiMetrics *metrics = chiaki_metrics_default();
+	decoder->metrics.packets = chiaki_metrics_register_counter(metrics, "decoder.packets");
+	decoder->metrics.errors = chiaki_metrics_register_counter(metrics, "decoder.errors");
+	decoder->metrics.frames_decoded = chiaki_metrics_register_counter(metrics, "decoder.frames_decoded");
+	decoder->metrics.frames_skipped = chiaki_metrics_register_counter(metrics, "decoder.frames_skipped");
+	decoder->metrics.frames_lost = chiaki_metrics_register_counter(metrics, "decoder.frames_lost");
+	decoder->metrics.submit_us = chiaki_metrics_register_histogram(metrics, "decoder.submit_us",
+			decoder_submit_us_bounds, sizeof(decoder_submit_us_bounds) / sizeof(decoder_submit_us_bounds[0]));
+
 	decoder->hw_device_ctx = hw_device_ctx ? av_buffer_ref(hw_device_ctx) : NULL;
 	decoder->hw_pix_fmt = AV_PIX_FMT_NONE;
 
@@ -120,6 +132,9 @@ CHIAKI_EXPORT bool chiaki_ffmpeg_decoder_video_sample_cb(uint8_t *buf, size_t bu
 	chiaki_mutex_lock(&decoder->mutex);
 	decoder->frames_lost += frames_lost;
 	decoder->frame_recovered = frame_recovered;
+	chiaki_metric_add(decoder->metrics.frames_lost, frames_lost > 0 ? frames_lost : 0);
+	chiaki_metric_inc(decoder->metrics.packets);
+	uint64_t submit_start_us = chiaki_time_now_monotonic_us();
 	AVPacket *packet = av_packet_alloc();
 	packet->data = buf;
 	packet->size = buf_size;
@@ -156,12 +171,14 @@ send_packet:
 	}
 	av_packet_free(&packet);
 	chiaki_mutex_unlock(&decoder->mutex);
+	chiaki_metric_observe(decoder->metrics.submit_us, chiaki_time_now_monotonic_us() - submit_start_us);
 
 	decoder->frame_available_cb(decoder, decoder->frame_available_cb_user);
 	return true;
 hell:
 	av_packet_free(&packet);
 	chiaki_mutex_unlock(&decoder->mutex);
+	chiaki_metric_inc(decoder->metrics.errors);
 	return false;
 }
 
@@ -191,11 +208,17 @@ CHIAKI_EXPORT AVFrame *chiaki_ffmpeg_decoder_pull_frame(ChiakiFfmpegDecoder *dec
 		if(r)
 		{
 			if(r != AVERROR(EAGAIN))
+			{
 				CHIAKI_LOGE(decoder->log, "Decoding with FFMPEG failed");
+				chiaki_metric_inc(decoder->metrics.errors);
+			}
 			av_frame_free(&frame);
 			frame = frame_last;
 			break;
 		}
+		chiaki_metric_inc(decoder->metrics.frames_decoded);
+		if(frame_last)
+			chiaki_metric_inc(decoder->metrics.frames_skipped);
 	}
 	*frames_lost = decoder->frames_lost;
 	if(frame && decoder->frame_recovered)
@@ -3,6 +3,7 @@
 #include <chiaki/frameprocessor.h>
 #include <chiaki/fec.h>
 #include <chiaki/video.h>
+#include <chiaki/time.h>
 
 #include <jerasure.h>
 
@@ -36,6 +37,8 @@ CHIAKI_EXPORT uint64_t chiaki_stream_stats_bitrate(ChiakiStreamStats *stats, uin
 
 #define UNIT_SLOTS_MAX 256
 
+static const uint64_t fec_decode_us_bounds[] = { 100, 250, 500, 1000, 2000, 4000, 8000 };
+
 struct chiaki_frame_unit_t
 {
 	size_t data_size;
@@ -56,6 +59,13 @@ CHIAKI_EXPORT void chiaki_frame_processor_init(ChiakiFrameProcessor *frame_proce
 	frame_processor->unit_slots_size = 0;
 	frame_processor->flushed = true;
 	chiaki_stream_stats_reset(&frame_processor->stream_stats);
+
+	ChiakiMetrics *metrics = chiaki_metrics_default();
+	frame_processor->metrics.frames_recovered = chiaki_metrics_register_counter(metrics, "fec.frames_recovered");
+	frame_processor->metrics.frames_failed = chiaki_metrics_register_counter(metrics, "fec.frames_failed");
+	frame_processor->metrics.units_erased = chiaki_metrics_register_counter(metrics, "fec.units_erased");
+	frame_processor->metrics.decode_us = chiaki_metrics_register_histogram(metrics, "fec.decode_us",
+			fec_decode_us_bounds, sizeof(fec_decode_us_bounds) / sizeof(fec_decode_us_bounds[0]));
 }
 
 CHIAKI_EXPORT void chiaki_frame_processor_fini(ChiakiFrameProcessor *frame_processor)
@@ -227,20 +237,25 @@ static ChiakiErrorCode chiaki_frame_processor_fec(ChiakiFrameProcessor *frame_pr
 		}
 	}
 	assert(erasure_index == erasures_count);
+	chiaki_metric_add(frame_processor->metrics.units_erased, erasures_count);
 
+	uint64_t decode_start_us = chiaki_time_now_monotonic_us();
 	ChiakiErrorCode err = chiaki_fec_decode(frame_processor->frame_buf,
 			frame_processor->buf_size_per_unit, frame_processor->buf_stride_per_unit,
 			frame_processor->units_source_expected, frame_processor->units_fec_expected,
 			erasures, erasures_count);
+	chiaki_metric_observe(frame_processor->metrics.decode_us, chiaki_time_now_monotonic_us() - decode_start_us);
 
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		err = CHIAKI_ERR_FEC_FAILED;
+		chiaki_metric_inc(frame_processor->metrics.frames_failed);
 		CHIAKI_LOGE(frame_processor->log, "FEC failed");
 	}
 	else
 	{
 		err = CHIAKI_ERR_SUCCESS;
+		chiaki_metric_inc(frame_processor->metrics.frames_recovered);
 		CHIAKI_LOGI(frame_processor->log, "FEC successful");
 
 		// restore unit sizes
@@ -310,3 +325,11 @@ CHIAKI_EXPORT ChiakiFrameProcessorFlushResult chiaki_frame_processor_flush(Chiak
 	*frame_size = cur;
 	return result;
 }
+
+CHIAKI_EXPORT size_t chiaki_frame_processor_first_unit_size(ChiakiFrameProcessor *frame_processor)
+{
+	if(!frame_processor->unit_slots || frame_processor->units_source_expected == 0)
+		return 0;
+	size_t data_size = frame_processor->unit_slots[0].data_size;
+	return data_size < 2 ? 0 : data_size - 2;
+}
@@ -25,7 +25,7 @@ static ChiakiErrorCode gkcrypt_gen_key_iv(ChiakiGKCrypt *gkcrypt, uint8_t index,
 
 static void *gkcrypt_thread_func(void *user);
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, ChiakiLog *log, size_t key_buf_chunks, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, ChiakiLog *log, size_t key_buf_chunks, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret, const ChiakiThreadAttrs *thread_attrs)
 {
 	gkcrypt->log = log;
 	gkcrypt->index = index;
@@ -36,6 +36,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, Chiaki
 	gkcrypt->key_buf_start_offset = 0;
 	gkcrypt->last_key_pos = 0;
 	gkcrypt->key_buf_thread_stop = false;
+	if(thread_attrs)
+		gkcrypt->key_buf_thread_attrs = *thread_attrs;
+	else
+		memset(&gkcrypt->key_buf_thread_attrs, 0, sizeof(gkcrypt->key_buf_thread_attrs));
 
 	ChiakiErrorCode err;
 	if(gkcrypt->key_buf_size)
@@ -502,6 +506,11 @@ static void *gkcrypt_thread_func(void *user)
 {
 	ChiakiGKCrypt *gkcrypt = user;
 	CHIAKI_LOGV(gkcrypt->log, "GKCrypt %d thread starting", (int)gkcrypt->index);
+	ChiakiThreadAttrs attrs_applied;
+	if(chiaki_thread_set_attrs_self(&gkcrypt->key_buf_thread_attrs, &attrs_applied) != CHIAKI_ERR_SUCCESS
+		&& chiaki_thread_attrs_failure_first(&gkcrypt->key_buf_thread_attrs))
+		CHIAKI_LOGW(gkcrypt->log, "GKCrypt %d thread runs with %s priority instead of %s", (int)gkcrypt->index,
+				chiaki_thread_priority_string(attrs_applied.priority), chiaki_thread_priority_string(gkcrypt->key_buf_thread_attrs.priority));
 
 	ChiakiErrorCode err = chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
 	assert(err == CHIAKI_ERR_SUCCESS);
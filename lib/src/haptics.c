@@ -0,0 +1,232 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/haptics.h>
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAPTICS_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAPTICS_NEON 1
+#include <arm_neon.h>
+#endif
+
+static inline int16_t load_sample(const uint8_t *buf)
+{
+	int16_t r;
+	memcpy(&r, buf, sizeof(r));
+	return r;
+}
+
+static inline uint16_t sample_abs(int16_t v)
+{
+	// saturate so all paths agree on -32768
+	return v == INT16_MIN ? INT16_MAX : (uint16_t)(v < 0 ? -v : v);
+}
+
+static uint32_t isqrt64(uint64_t v)
+{
+	uint64_t r = 0;
+	uint64_t bit = (uint64_t)1 << 62;
+	while(bit > v)
+		bit >>= 2;
+	while(bit)
+	{
+		if(v >= r + bit)
+		{
+			v -= r + bit;
+			r = (r >> 1) + bit;
+		}
+		else
+			r >>= 1;
+		bit >>= 2;
+	}
+	return (uint32_t)r;
+}
+
+CHIAKI_EXPORT void chiaki_haptics_deinterleave(const uint8_t *buf, size_t frames_count, int16_t *left, int16_t *right)
+{
+	size_t i = 0;
+#if HAPTICS_SSE2
+	for(; i + 8 <= frames_count; i += 8)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)(buf + i * CHIAKI_HAPTICS_FRAME_SIZE));
+		__m128i b = _mm_loadu_si128((const __m128i *)(buf + i * CHIAKI_HAPTICS_FRAME_SIZE + 16));
+		// sign-extend the even (left) lanes and arithmetic shift down the odd (right) lanes
+		__m128i al = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+		__m128i bl = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+		__m128i ar = _mm_srai_epi32(a, 16);
+		__m128i br = _mm_srai_epi32(b, 16);
+		_mm_storeu_si128((__m128i *)(left + i), _mm_packs_epi32(al, bl));
+		_mm_storeu_si128((__m128i *)(right + i), _mm_packs_epi32(ar, br));
+	}
+#elif HAPTICS_NEON
+	for(; i + 8 <= frames_count; i += 8)
+	{
+		int16x8x2_t v = vld2q_s16((const int16_t *)(buf + i * CHIAKI_HAPTICS_FRAME_SIZE));
+		vst1q_s16(left + i, v.val[0]);
+		vst1q_s16(right + i, v.val[1]);
+	}
+#endif
+	for(; i < frames_count; i++)
+	{
+		left[i] = load_sample(buf + i * CHIAKI_HAPTICS_FRAME_SIZE);
+		right[i] = load_sample(buf + i * CHIAKI_HAPTICS_FRAME_SIZE + sizeof(int16_t));
+	}
+}
+
+CHIAKI_EXPORT void chiaki_haptics_envelope(const uint8_t *buf, size_t frames_count, ChiakiHapticsEnvelope *envelope)
+{
+	memset(envelope, 0, sizeof(*envelope));
+	if(!frames_count)
+		return;
+
+	int64_t sum_left = 0, sum_right = 0;
+	uint64_t sq_left = 0, sq_right = 0;
+	uint16_t peak_left = 0, peak_right = 0;
+	size_t i = 0;
+
+#if HAPTICS_SSE2
+	const __m128i mask_left = _mm_set1_epi32(0x0000ffff);
+	const __m128i mask_right = _mm_set1_epi32((int)0xffff0000);
+	const __m128i ones_left = _mm_set1_epi32(0x00000001);
+	const __m128i ones_right = _mm_set1_epi32(0x00010000);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i peak = zero;
+	while(i + 4 <= frames_count)
+	{
+		// int32 lane sums of at most 0x7fff iterations can not overflow
+		size_t block_end = frames_count - ((frames_count - i) % 4);
+		if(block_end - i > 0x7fff * 4)
+			block_end = i + 0x7fff * 4;
+		__m128i acc_left = zero, acc_right = zero;
+		__m128i acc_sq_left = zero, acc_sq_right = zero;
+		for(; i < block_end; i += 4)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i *)(buf + i * CHIAKI_HAPTICS_FRAME_SIZE));
+			acc_left = _mm_add_epi32(acc_left, _mm_madd_epi16(v, ones_left));
+			acc_right = _mm_add_epi32(acc_right, _mm_madd_epi16(v, ones_right));
+			__m128i vl = _mm_and_si128(v, mask_left);
+			__m128i vr = _mm_and_si128(v, mask_right);
+			// squares are at most 2^30, widen to 64 bit right away
+			__m128i sql = _mm_madd_epi16(vl, vl);
+			__m128i sqr = _mm_madd_epi16(vr, vr);
+			acc_sq_left = _mm_add_epi64(acc_sq_left, _mm_add_epi64(_mm_unpacklo_epi32(sql, zero), _mm_unpackhi_epi32(sql, zero)));
+			acc_sq_right = _mm_add_epi64(acc_sq_right, _mm_add_epi64(_mm_unpacklo_epi32(sqr, zero), _mm_unpackhi_epi32(sqr, zero)));
+			peak = _mm_max_epi16(peak, _mm_max_epi16(v, _mm_subs_epi16(zero, v)));
+		}
+		int32_t lanes[4];
+		_mm_storeu_si128((__m128i *)lanes, acc_left);
+		sum_left += (int64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+		_mm_storeu_si128((__m128i *)lanes, acc_right);
+		sum_right += (int64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+		uint64_t lanes64[2];
+		_mm_storeu_si128((__m128i *)lanes64, acc_sq_left);
+		sq_left += lanes64[0] + lanes64[1];
+		_mm_storeu_si128((__m128i *)lanes64, acc_sq_right);
+		sq_right += lanes64[0] + lanes64[1];
+	}
+	int16_t peak_lanes[8];
+	_mm_storeu_si128((__m128i *)peak_lanes, peak);
+	for(size_t j = 0; j < 8; j += 2)
+	{
+		if((uint16_t)peak_lanes[j] > peak_left)
+			peak_left = (uint16_t)peak_lanes[j];
+		if((uint16_t)peak_lanes[j + 1] > peak_right)
+			peak_right = (uint16_t)peak_lanes[j + 1];
+	}
+#endif
+
+	for(; i < frames_count; i++)
+	{
+		int16_t l = load_sample(buf + i * CHIAKI_HAPTICS_FRAME_SIZE);
+		int16_t r = load_sample(buf + i * CHIAKI_HAPTICS_FRAME_SIZE + sizeof(int16_t));
+		sum_left += l;
+		sum_right += r;
+		sq_left += (uint64_t)((int32_t)l * l);
+		sq_right += (uint64_t)((int32_t)r * r);
+		uint16_t al = sample_abs(l), ar = sample_abs(r);
+		if(al > peak_left)
+			peak_left = al;
+		if(ar > peak_right)
+			peak_right = ar;
+	}
+
+	envelope->mean_left = (int32_t)(sum_left / (int64_t)frames_count);
+	envelope->mean_right = (int32_t)(sum_right / (int64_t)frames_count);
+	envelope->rms_left = (uint16_t)isqrt64(sq_left / frames_count);
+	envelope->rms_right = (uint16_t)isqrt64(sq_right / frames_count);
+	envelope->peak_left = peak_left;
+	envelope->peak_right = peak_right;
+}
+
+CHIAKI_EXPORT void chiaki_haptics_resampler_init(ChiakiHapticsResampler *resampler)
+{
+	resampler->prev_left = 0;
+	resampler->prev_right = 0;
+}
+
+#define UPSAMPLE_SHIFT 4
+#define UPSAMPLE_ROUND (1 << (UPSAMPLE_SHIFT - 1))
+
+#if CHIAKI_HAPTICS_UPSAMPLE_FACTOR != (1 << UPSAMPLE_SHIFT)
+#error "Haptics upsampler weights assume a factor of 16"
+#endif
+
+CHIAKI_EXPORT size_t chiaki_haptics_resampler_dualsense(ChiakiHapticsResampler *resampler, const uint8_t *buf, size_t frames_count, int16_t *out)
+{
+	int16_t prev_left = resampler->prev_left;
+	int16_t prev_right = resampler->prev_right;
+
+#if HAPTICS_SSE2
+	// Weights for two phases per register as (prev, cur) pairs for left and right,
+	// so _mm_madd_epi16 yields the interpolated int32 samples directly.
+	__m128i weights[CHIAKI_HAPTICS_UPSAMPLE_FACTOR / 2];
+	for(int p = 0; p < CHIAKI_HAPTICS_UPSAMPLE_FACTOR / 2; p++)
+	{
+		int16_t k0 = 2 * p + 1, k1 = 2 * p + 2;
+		weights[p] = _mm_setr_epi16(
+				CHIAKI_HAPTICS_UPSAMPLE_FACTOR - k0, k0, CHIAKI_HAPTICS_UPSAMPLE_FACTOR - k0, k0,
+				CHIAKI_HAPTICS_UPSAMPLE_FACTOR - k1, k1, CHIAKI_HAPTICS_UPSAMPLE_FACTOR - k1, k1);
+	}
+	const __m128i round = _mm_set1_epi32(UPSAMPLE_ROUND);
+	const __m128i zero = _mm_setzero_si128();
+#endif
+
+	for(size_t i = 0; i < frames_count; i++)
+	{
+		int16_t cur_left = load_sample(buf + i * CHIAKI_HAPTICS_FRAME_SIZE);
+		int16_t cur_right = load_sample(buf + i * CHIAKI_HAPTICS_FRAME_SIZE + sizeof(int16_t));
+		int16_t *o = out + i * CHIAKI_HAPTICS_UPSAMPLE_FACTOR * CHIAKI_HAPTICS_DUALSENSE_CHANNELS;
+#if HAPTICS_SSE2
+		__m128i pairs = _mm_setr_epi16(prev_left, cur_left, prev_right, cur_right, prev_left, cur_left, prev_right, cur_right);
+		for(int p = 0; p < CHIAKI_HAPTICS_UPSAMPLE_FACTOR / 2; p += 2)
+		{
+			__m128i s0 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(pairs, weights[p]), round), UPSAMPLE_SHIFT);
+			__m128i s1 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(pairs, weights[p + 1]), round), UPSAMPLE_SHIFT);
+			// s0, s1 hold (left, right) for two phases each as int32,
+			// pack them to int16 and put silence in front of every (left, right) pair.
+			__m128i packed = _mm_packs_epi32(s0, s1);
+			_mm_storeu_si128((__m128i *)(o + p * 8), _mm_unpacklo_epi32(zero, packed));
+			_mm_storeu_si128((__m128i *)(o + p * 8 + 8), _mm_unpackhi_epi32(zero, packed));
+		}
+#else
+		for(int k = 1; k <= CHIAKI_HAPTICS_UPSAMPLE_FACTOR; k++)
+		{
+			int32_t wp = CHIAKI_HAPTICS_UPSAMPLE_FACTOR - k;
+			o[0] = 0;
+			o[1] = 0;
+			o[2] = (int16_t)((prev_left * wp + cur_left * k + UPSAMPLE_ROUND) >> UPSAMPLE_SHIFT);
+			o[3] = (int16_t)((prev_right * wp + cur_right * k + UPSAMPLE_ROUND) >> UPSAMPLE_SHIFT);
+			o += CHIAKI_HAPTICS_DUALSENSE_CHANNELS;
+		}
+#endif
+		prev_left = cur_left;
+		prev_right = cur_right;
+	}
+
+	resampler->prev_left = prev_left;
+	resampler->prev_right = prev_right;
+	return frames_count * CHIAKI_HAPTICS_UPSAMPLE_FACTOR;
+}
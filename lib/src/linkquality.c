@@ -0,0 +1,197 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/linkquality.h>
+
+#include <string.h>
+
+// used until anything is known about the link
+#define LINK_QUALITY_RESEND_TIMEOUT_DEFAULT_MS 200
+#define LINK_QUALITY_RESEND_TIMEOUT_MIN_MS 20
+#define LINK_QUALITY_RESEND_TIMEOUT_MAX_MS 1000
+
+static void update_resend_timeout(ChiakiLinkQuality *quality)
+{
+	ChiakiLinkQualityStats *stats = &quality->stats;
+	if(!stats->srtt_us)
+	{
+		stats->resend_timeout_ms = LINK_QUALITY_RESEND_TIMEOUT_DEFAULT_MS;
+		return;
+	}
+	// RFC 6298: srtt + 4 * rttvar, rounded up to whole ms
+	uint64_t timeout_ms = (stats->srtt_us + 4 * stats->rttvar_us + 999) / 1000;
+	if(timeout_ms < LINK_QUALITY_RESEND_TIMEOUT_MIN_MS)
+		timeout_ms = LINK_QUALITY_RESEND_TIMEOUT_MIN_MS;
+	if(timeout_ms > LINK_QUALITY_RESEND_TIMEOUT_MAX_MS)
+		timeout_ms = LINK_QUALITY_RESEND_TIMEOUT_MAX_MS;
+	stats->resend_timeout_ms = timeout_ms;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_link_quality_init(ChiakiLinkQuality *quality, uint64_t rtt_us)
+{
+	ChiakiErrorCode err = chiaki_mutex_init(&quality->mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	chiaki_link_quality_reset(quality, rtt_us);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_link_quality_reset(ChiakiLinkQuality *quality, uint64_t rtt_us)
+{
+	chiaki_mutex_lock(&quality->mutex);
+	memset(&quality->stats, 0, sizeof(quality->stats));
+	if(rtt_us)
+	{
+		quality->stats.srtt_us = rtt_us;
+		quality->stats.rttvar_us = rtt_us / 2;
+		quality->stats.rtt_min_us = rtt_us;
+		quality->stats.rtt_last_us = rtt_us;
+	}
+	update_resend_timeout(quality);
+	chiaki_mutex_unlock(&quality->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_link_quality_fini(ChiakiLinkQuality *quality)
+{
+	chiaki_mutex_fini(&quality->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_link_quality_push_rtt(ChiakiLinkQuality *quality, uint64_t rtt_us)
+{
+	chiaki_mutex_lock(&quality->mutex);
+	ChiakiLinkQualityStats *stats = &quality->stats;
+	if(!stats->rtt_samples)
+	{
+		stats->srtt_us = rtt_us;
+		stats->rttvar_us = rtt_us / 2;
+		stats->rtt_min_us = rtt_us;
+	}
+	else
+	{
+		// alpha = 1/8, beta = 1/4
+		uint64_t err_us = rtt_us > stats->srtt_us ? rtt_us - stats->srtt_us : stats->srtt_us - rtt_us;
+		stats->rttvar_us = (3 * stats->rttvar_us + err_us) / 4;
+		stats->srtt_us = (7 * stats->srtt_us + rtt_us) / 8;
+		if(rtt_us < stats->rtt_min_us)
+			stats->rtt_min_us = rtt_us;
+	}
+	stats->rtt_last_us = rtt_us;
+	stats->rtt_samples++;
+	update_resend_timeout(quality);
+	chiaki_mutex_unlock(&quality->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_link_quality_back_off_resend_timeout(ChiakiLinkQuality *quality, uint64_t expired_timeout_ms)
+{
+	uint64_t timeout_ms = expired_timeout_ms * 2;
+	if(timeout_ms > LINK_QUALITY_RESEND_TIMEOUT_MAX_MS)
+		timeout_ms = LINK_QUALITY_RESEND_TIMEOUT_MAX_MS;
+	chiaki_mutex_lock(&quality->mutex);
+	// packets that expired together only back off once
+	if(timeout_ms > quality->stats.resend_timeout_ms)
+		quality->stats.resend_timeout_ms = timeout_ms;
+	chiaki_mutex_unlock(&quality->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_link_quality_push_loss(ChiakiLinkQuality *quality, uint64_t received, uint64_t lost)
+{
+	uint64_t total = received + lost;
+	if(!total)
+		return;
+	double loss = (double)lost / total;
+	chiaki_mutex_lock(&quality->mutex);
+	quality->stats.loss += (loss - quality->stats.loss) / 8.0;
+	chiaki_mutex_unlock(&quality->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_link_quality_push_data_sent(ChiakiLinkQuality *quality)
+{
+	chiaki_mutex_lock(&quality->mutex);
+	quality->stats.data_sent++;
+	chiaki_mutex_unlock(&quality->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_link_quality_push_data_resent(ChiakiLinkQuality *quality, bool given_up)
+{
+	chiaki_mutex_lock(&quality->mutex);
+	if(given_up)
+		quality->stats.data_given_up++;
+	else
+		quality->stats.data_resent++;
+	chiaki_mutex_unlock(&quality->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_link_quality_push_datagram(ChiakiLinkQuality *quality, size_t size)
+{
+	// only ever written from the Takion thread, so the unlocked check is fine
+	if(size <= quality->stats.datagram_size_max)
+		return;
+	chiaki_mutex_lock(&quality->mutex);
+	if(size > quality->stats.datagram_size_max)
+		quality->stats.datagram_size_max = size;
+	chiaki_mutex_unlock(&quality->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_link_quality_push_video_recovery(ChiakiLinkQuality *quality, uint64_t recovery_us)
+{
+	chiaki_mutex_lock(&quality->mutex);
+	quality->stats.video_recoveries++;
+	quality->stats.video_recovery_last_us = recovery_us;
+	if(recovery_us > quality->stats.video_recovery_max_us)
+		quality->stats.video_recovery_max_us = recovery_us;
+	chiaki_mutex_unlock(&quality->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_link_quality_push_send_queue(ChiakiLinkQuality *quality, unsigned int send_class, uint64_t packets, uint64_t latency_sum_us, uint64_t latency_max_us)
+{
+	if(send_class >= CHIAKI_LINK_QUALITY_SEND_CLASSES || !packets)
+		return;
+	uint64_t avg_us = latency_sum_us / packets;
+	chiaki_mutex_lock(&quality->mutex);
+	ChiakiLinkQualityStats *stats = &quality->stats;
+	if(!stats->send_packets[send_class])
+		stats->send_queue_avg_us[send_class] = avg_us;
+	else
+		stats->send_queue_avg_us[send_class] = (7 * stats->send_queue_avg_us[send_class] + avg_us) / 8;
+	stats->send_packets[send_class] += packets;
+	if(latency_max_us > stats->send_queue_max_us[send_class])
+		stats->send_queue_max_us[send_class] = latency_max_us;
+	chiaki_mutex_unlock(&quality->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_link_quality_push_send_dropped(ChiakiLinkQuality *quality, unsigned int send_class)
+{
+	if(send_class >= CHIAKI_LINK_QUALITY_SEND_CLASSES)
+		return;
+	chiaki_mutex_lock(&quality->mutex);
+	quality->stats.send_dropped[send_class]++;
+	chiaki_mutex_unlock(&quality->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_link_quality_set_socket(ChiakiLinkQuality *quality, const ChiakiSocketTuningApplied *socket)
+{
+	chiaki_mutex_lock(&quality->mutex);
+	quality->stats.socket = *socket;
+	chiaki_mutex_unlock(&quality->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_link_quality_set_video_timing(ChiakiLinkQuality *quality, const ChiakiLinkQualityVideoTiming *video_timing)
+{
+	chiaki_mutex_lock(&quality->mutex);
+	quality->stats.video_timing = *video_timing;
+	chiaki_mutex_unlock(&quality->mutex);
+}
+
+CHIAKI_EXPORT uint64_t chiaki_link_quality_resend_timeout_ms(ChiakiLinkQuality *quality)
+{
+	chiaki_mutex_lock(&quality->mutex);
+	uint64_t r = quality->stats.resend_timeout_ms;
+	chiaki_mutex_unlock(&quality->mutex);
+	return r;
+}
+
+CHIAKI_EXPORT void chiaki_link_quality_get_stats(ChiakiLinkQuality *quality, ChiakiLinkQualityStats *stats)
+{
+	chiaki_mutex_lock(&quality->mutex);
+	*stats = quality->stats;
+	chiaki_mutex_unlock(&quality->mutex);
+}
@@ -0,0 +1,206 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/metrics.h>
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+static ChiakiMetrics metrics_default;
+
+static void metrics_lock(ChiakiMetrics *metrics);
+static void metrics_unlock(ChiakiMetrics *metrics);
+static bool metric_name_valid(const char *name);
+static ChiakiMetric *metrics_find(ChiakiMetrics *metrics, uint32_t count, const char *name);
+static ChiakiMetric *metrics_register(ChiakiMetrics *metrics, const char *name, ChiakiMetricType type, const uint64_t *bounds, size_t bounds_count);
+
+CHIAKI_EXPORT void chiaki_metrics_init(ChiakiMetrics *metrics)
+{
+	memset(metrics, 0, sizeof(*metrics));
+}
+
+CHIAKI_EXPORT ChiakiMetrics *chiaki_metrics_default(void)
+{
+	return &metrics_default;
+}
+
+CHIAKI_EXPORT ChiakiMetric *chiaki_metrics_register_counter(ChiakiMetrics *metrics, const char *name)
+{
+	return metrics_register(metrics, name, CHIAKI_METRIC_TYPE_COUNTER, NULL, 0);
+}
+
+CHIAKI_EXPORT ChiakiMetric *chiaki_metrics_register_gauge(ChiakiMetrics *metrics, const char *name)
+{
+	return metrics_register(metrics, name, CHIAKI_METRIC_TYPE_GAUGE, NULL, 0);
+}
+
+CHIAKI_EXPORT ChiakiMetric *chiaki_metrics_register_histogram(ChiakiMetrics *metrics, const char *name, const uint64_t *bounds, size_t bounds_count)
+{
+	if(!bounds_count || bounds_count > CHIAKI_METRIC_BUCKETS_MAX)
+		return NULL;
+	for(size_t i=1; i<bounds_count; i++)
+	{
+		if(bounds[i] <= bounds[i-1])
+			return NULL;
+	}
+	return metrics_register(metrics, name, CHIAKI_METRIC_TYPE_HISTOGRAM, bounds, bounds_count);
+}
+
+CHIAKI_EXPORT ChiakiMetric *chiaki_metrics_find(ChiakiMetrics *metrics, const char *name)
+{
+	return metrics_find(metrics, chiaki_atomic_load_u32(&metrics->count), name);
+}
+
+CHIAKI_EXPORT void chiaki_metric_observe(ChiakiMetric *metric, uint64_t v)
+{
+	if(!metric)
+		return;
+	size_t bucket = 0;
+	while(bucket < metric->bounds_count && v > metric->bounds[bucket])
+		bucket++;
+	chiaki_atomic_fetch_add_u64(&metric->buckets[bucket], 1);
+	chiaki_atomic_fetch_add_u64(&metric->sum, v);
+	chiaki_atomic_fetch_add_u64(&metric->value, 1);
+}
+
+CHIAKI_EXPORT size_t chiaki_metrics_sample(ChiakiMetrics *metrics, ChiakiMetricSample *samples, size_t samples_max)
+{
+	// everything up to count was completely written before count was published
+	size_t count = chiaki_atomic_load_u32(&metrics->count);
+	if(count > samples_max)
+		count = samples_max;
+	for(size_t i=0; i<count; i++)
+	{
+		ChiakiMetric *metric = &metrics->metrics[i];
+		ChiakiMetricSample *sample = &samples[i];
+		sample->name = metric->name;
+		sample->type = metric->type;
+		sample->value = (int64_t)chiaki_atomic_load_u64(&metric->value);
+		sample->sum = chiaki_atomic_load_u64(&metric->sum);
+		sample->bounds_count = metric->bounds_count;
+		sample->bounds = metric->bounds;
+		for(size_t b=0; b<=metric->bounds_count; b++)
+			sample->buckets[b] = chiaki_atomic_load_u64(&metric->buckets[b]);
+	}
+	return count;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_metrics_export(ChiakiMetrics *metrics, FILE *file, ChiakiMetricsFormat format, uint64_t timestamp_ms, bool header)
+{
+	ChiakiMetricSample *samples = malloc(sizeof(ChiakiMetricSample) * CHIAKI_METRICS_MAX);
+	if(!samples)
+		return CHIAKI_ERR_MEMORY;
+	size_t count = chiaki_metrics_sample(metrics, samples, CHIAKI_METRICS_MAX);
+
+	if(format == CHIAKI_METRICS_FORMAT_CSV)
+	{
+		if(header)
+			fprintf(file, "timestamp_ms,name,value\n");
+		for(size_t i=0; i<count; i++)
+		{
+			ChiakiMetricSample *sample = &samples[i];
+			if(sample->type != CHIAKI_METRIC_TYPE_HISTOGRAM)
+			{
+				fprintf(file, "%"PRIu64",%s,%"PRId64"\n", timestamp_ms, sample->name, sample->value);
+				continue;
+			}
+			fprintf(file, "%"PRIu64",%s.count,%"PRId64"\n", timestamp_ms, sample->name, sample->value);
+			fprintf(file, "%"PRIu64",%s.sum,%"PRIu64"\n", timestamp_ms, sample->name, sample->sum);
+			for(size_t b=0; b<sample->bounds_count; b++)
+				fprintf(file, "%"PRIu64",%s.le_%"PRIu64",%"PRIu64"\n", timestamp_ms, sample->name, sample->bounds[b], sample->buckets[b]);
+			fprintf(file, "%"PRIu64",%s.le_inf,%"PRIu64"\n", timestamp_ms, sample->name, sample->buckets[sample->bounds_count]);
+		}
+	}
+	else
+	{
+		fprintf(file, "{\"timestamp_ms\":%"PRIu64",\"metrics\":{", timestamp_ms);
+		for(size_t i=0; i<count; i++)
+		{
+			ChiakiMetricSample *sample = &samples[i];
+			// names are restricted to characters that need no escaping
+			fprintf(file, "%s\"%s\":", i ? "," : "", sample->name);
+			if(sample->type != CHIAKI_METRIC_TYPE_HISTOGRAM)
+			{
+				fprintf(file, "%"PRId64, sample->value);
+				continue;
+			}
+			fprintf(file, "{\"count\":%"PRId64",\"sum\":%"PRIu64",\"buckets\":{", sample->value, sample->sum);
+			for(size_t b=0; b<sample->bounds_count; b++)
+				fprintf(file, "\"%"PRIu64"\":%"PRIu64",", sample->bounds[b], sample->buckets[b]);
+			fprintf(file, "\"inf\":%"PRIu64"}}", sample->buckets[sample->bounds_count]);
+		}
+		fprintf(file, "}}\n");
+	}
+
+	free(samples);
+	return ferror(file) ? CHIAKI_ERR_UNKNOWN : CHIAKI_ERR_SUCCESS;
+}
+
+static void metrics_lock(ChiakiMetrics *metrics)
+{
+	// only taken while registering, which is rare enough that spinning is fine
+	uint32_t expected = 0;
+	while(!chiaki_atomic_cas_u32(&metrics->lock, &expected, 1))
+		expected = 0;
+}
+
+static void metrics_unlock(ChiakiMetrics *metrics)
+{
+	chiaki_atomic_store_u32(&metrics->lock, 0);
+}
+
+static bool metric_name_valid(const char *name)
+{
+	size_t len = strlen(name);
+	if(!len || len >= CHIAKI_METRIC_NAME_SIZE)
+		return false;
+	for(size_t i=0; i<len; i++)
+	{
+		char c = name[i];
+		if(!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_' || c == '.'))
+			return false;
+	}
+	return true;
+}
+
+static ChiakiMetric *metrics_find(ChiakiMetrics *metrics, uint32_t count, const char *name)
+{
+	for(uint32_t i=0; i<count; i++)
+	{
+		if(!strcmp(metrics->metrics[i].name, name))
+			return &metrics->metrics[i];
+	}
+	return NULL;
+}
+
+static ChiakiMetric *metrics_register(ChiakiMetrics *metrics, const char *name, ChiakiMetricType type, const uint64_t *bounds, size_t bounds_count)
+{
+	if(!metric_name_valid(name))
+		return NULL;
+
+	metrics_lock(metrics);
+	uint32_t count = chiaki_atomic_load_u32(&metrics->count);
+	ChiakiMetric *metric = metrics_find(metrics, count, name);
+	if(metric)
+	{
+		if(metric->type != type || metric->bounds_count != bounds_count
+			|| (bounds_count && memcmp(metric->bounds, bounds, sizeof(uint64_t) * bounds_count)))
+			metric = NULL;
+		goto beach;
+	}
+	if(count >= CHIAKI_METRICS_MAX)
+		goto beach;
+
+	metric = &metrics->metrics[count];
+	memset(metric, 0, sizeof(*metric));
+	strcpy(metric->name, name);
+	metric->type = type;
+	metric->bounds_count = bounds_count;
+	if(bounds_count)
+		memcpy(metric->bounds, bounds, sizeof(uint64_t) * bounds_count);
+	chiaki_atomic_store_u32(&metrics->count, count + 1);
+
+beach:
+	metrics_unlock(metrics);
+	return metric;
+}
@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/miccapture.h>
+#include <chiaki/atomic.h>
+#include <chiaki/time.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+// the capture callback skips its wakeup if the encode thread holds the mutex,
+// so the encode thread never sleeps longer than this without looking at the ring
+#define MIC_CAPTURE_WAIT_MS 10
+
+static void *mic_capture_thread_func(void *user);
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_mic_capture_init(ChiakiMicCapture *capture, ChiakiLog *log, size_t frame_samples, size_t buffer_frames,
+		ChiakiMicCaptureFrameCallback frame_cb, void *frame_cb_user, const ChiakiThreadAttrs *thread_attrs)
+{
+	if(!frame_samples || !buffer_frames)
+		return CHIAKI_ERR_INVALID_DATA;
+	memset(capture, 0, sizeof(*capture));
+	capture->log = log;
+	capture->frame_samples = frame_samples;
+	capture->frame_cb = frame_cb;
+	capture->frame_cb_user = frame_cb_user;
+	if(thread_attrs)
+		capture->thread_attrs = *thread_attrs;
+
+	capture->frame_buf = malloc(frame_samples * sizeof(int16_t));
+	if(!capture->frame_buf)
+		return CHIAKI_ERR_MEMORY;
+
+	ChiakiErrorCode err = chiaki_ring_buffer_init(&capture->ring, frame_samples * buffer_frames * sizeof(int16_t));
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_frame_buf;
+
+	err = chiaki_mutex_init(&capture->mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_ring;
+
+	err = chiaki_cond_init(&capture->cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_mutex;
+
+	err = chiaki_thread_create(&capture->thread, mic_capture_thread_func, capture);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_cond;
+	chiaki_thread_set_name(&capture->thread, "Chiaki Mic Encode");
+
+	return CHIAKI_ERR_SUCCESS;
+error_cond:
+	chiaki_cond_fini(&capture->cond);
+error_mutex:
+	chiaki_mutex_fini(&capture->mutex);
+error_ring:
+	chiaki_ring_buffer_fini(&capture->ring);
+error_frame_buf:
+	free(capture->frame_buf);
+	capture->frame_buf = NULL;
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_mic_capture_fini(ChiakiMicCapture *capture)
+{
+	chiaki_mutex_lock(&capture->mutex);
+	capture->should_stop = true;
+	chiaki_cond_signal(&capture->cond);
+	chiaki_mutex_unlock(&capture->mutex);
+	chiaki_thread_join(&capture->thread, NULL);
+
+	chiaki_cond_fini(&capture->cond);
+	chiaki_mutex_fini(&capture->mutex);
+	chiaki_ring_buffer_fini(&capture->ring);
+	free(capture->frame_buf);
+	capture->frame_buf = NULL;
+}
+
+CHIAKI_EXPORT void chiaki_mic_capture_push(ChiakiMicCapture *capture, const int16_t *buf, size_t samples_count)
+{
+	size_t written = chiaki_ring_buffer_write(&capture->ring, buf, samples_count * sizeof(int16_t));
+	if(written < samples_count * sizeof(int16_t))
+		chiaki_atomic_fetch_add_u32(&capture->stats_dropped_samples, (uint32_t)(samples_count - written / sizeof(int16_t)));
+	if(!written)
+		return;
+
+	uint32_t pushed = capture->chunks_pushed;
+	size_t index = pushed % CHIAKI_MIC_CAPTURE_CHUNKS_MAX;
+	chiaki_atomic_store_u32(&capture->chunk_end[index], capture->ring.head);
+	chiaki_atomic_store_u32(&capture->chunk_time_us[index], (uint32_t)chiaki_time_now_monotonic_us());
+	chiaki_atomic_store_u32(&capture->chunks_pushed, pushed + 1);
+
+	// never wait in the audio callback, the encode thread only holds the mutex while checking the ring
+	// and finds the samples on its next timed wait if this wakeup is skipped
+	if(chiaki_ring_buffer_available(&capture->ring) < capture->frame_samples * sizeof(int16_t))
+		return;
+	if(chiaki_mutex_trylock(&capture->mutex) != CHIAKI_ERR_SUCCESS)
+		return;
+	chiaki_cond_signal(&capture->cond);
+	chiaki_mutex_unlock(&capture->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_mic_capture_get_stats(ChiakiMicCapture *capture, ChiakiMicCaptureStats *stats)
+{
+	stats->latency_us = chiaki_atomic_load_u32(&capture->stats_latency_us);
+	stats->latency_avg_us = chiaki_atomic_load_u32(&capture->stats_latency_avg_us);
+	stats->latency_max_us = chiaki_atomic_load_u32(&capture->stats_latency_max_us);
+	stats->frames = chiaki_atomic_load_u32(&capture->stats_frames);
+	stats->dropped_samples = chiaki_atomic_load_u32(&capture->stats_dropped_samples);
+}
+
+/**
+ * Find the capture time of the push that delivered the sample just before ring position end.
+ */
+static bool mic_capture_frame_time(ChiakiMicCapture *capture, uint32_t end, uint32_t *time_us)
+{
+	uint32_t pushed = chiaki_atomic_load_u32(&capture->chunks_pushed);
+	if(pushed - capture->chunks_consumed > CHIAKI_MIC_CAPTURE_CHUNKS_MAX)
+		capture->chunks_consumed = pushed - CHIAKI_MIC_CAPTURE_CHUNKS_MAX;
+	for(; capture->chunks_consumed != pushed; capture->chunks_consumed++)
+	{
+		size_t index = capture->chunks_consumed % CHIAKI_MIC_CAPTURE_CHUNKS_MAX;
+		uint32_t chunk_end = chiaki_atomic_load_u32(&capture->chunk_end[index]);
+		if((int32_t)(chunk_end - end) >= 0)
+		{
+			// keep this chunk, it may also contain the start of the next frame
+			*time_us = chiaki_atomic_load_u32(&capture->chunk_time_us[index]);
+			return true;
+		}
+	}
+	return false;
+}
+
+static void mic_capture_update_stats(ChiakiMicCapture *capture, uint32_t latency_us)
+{
+	uint32_t avg = capture->stats_latency_avg_us;
+	if(!capture->stats_frames)
+		avg = latency_us;
+	else
+		avg = (uint32_t)((int64_t)avg + ((int64_t)latency_us - (int64_t)avg) / 8);
+	chiaki_atomic_store_u32(&capture->stats_latency_us, latency_us);
+	chiaki_atomic_store_u32(&capture->stats_latency_avg_us, avg);
+	if(latency_us > capture->stats_latency_max_us)
+		chiaki_atomic_store_u32(&capture->stats_latency_max_us, latency_us);
+}
+
+static void *mic_capture_thread_func(void *user)
+{
+	ChiakiMicCapture *capture = user;
+	const size_t frame_size = capture->frame_samples * sizeof(int16_t);
+
+	ChiakiThreadAttrs attrs_applied;
+	if(chiaki_thread_set_attrs_self(&capture->thread_attrs, &attrs_applied) != CHIAKI_ERR_SUCCESS
+		&& chiaki_thread_attrs_failure_first(&capture->thread_attrs))
+		CHIAKI_LOGW(capture->log, "Mic encode thread runs with %s priority instead of %s",
+				chiaki_thread_priority_string(attrs_applied.priority), chiaki_thread_priority_string(capture->thread_attrs.priority));
+
+	chiaki_mutex_lock(&capture->mutex);
+	while(!capture->should_stop)
+	{
+		if(chiaki_ring_buffer_available(&capture->ring) < frame_size)
+		{
+			chiaki_cond_timedwait(&capture->cond, &capture->mutex, MIC_CAPTURE_WAIT_MS);
+			continue;
+		}
+		chiaki_mutex_unlock(&capture->mutex);
+
+		chiaki_ring_buffer_read(&capture->ring, capture->frame_buf, frame_size);
+		uint32_t captured_us;
+		bool have_time = mic_capture_frame_time(capture, capture->ring.tail, &captured_us);
+
+		if(capture->frame_cb)
+			capture->frame_cb(capture->frame_buf, capture->frame_samples, capture->frame_cb_user);
+
+		if(have_time)
+			mic_capture_update_stats(capture, (uint32_t)chiaki_time_now_monotonic_us() - captured_us);
+		chiaki_atomic_fetch_add_u32(&capture->stats_frames, 1);
+
+		chiaki_mutex_lock(&capture->mutex);
+	}
+	chiaki_mutex_unlock(&capture->mutex);
+	return NULL;
+}
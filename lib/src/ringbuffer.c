@@ -0,0 +1,105 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/ringbuffer.h>
+#include <chiaki/atomic.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_ring_buffer_init(ChiakiRingBuffer *ring, size_t size)
+{
+	// head and tail wrap around at 2^32, so the capacity must stay below that
+	if(!size || size > ((size_t)1 << 30))
+		return CHIAKI_ERR_INVALID_DATA;
+	uint32_t pot = 1;
+	while(pot < size)
+		pot <<= 1;
+	ring->buf = malloc(pot);
+	if(!ring->buf)
+		return CHIAKI_ERR_MEMORY;
+	ring->size = pot;
+	ring->head = 0;
+	ring->tail = 0;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_ring_buffer_fini(ChiakiRingBuffer *ring)
+{
+	free(ring->buf);
+	ring->buf = NULL;
+}
+
+CHIAKI_EXPORT size_t chiaki_ring_buffer_write(ChiakiRingBuffer *ring, const void *buf, size_t buf_size)
+{
+	uint32_t head = ring->head;
+	uint32_t tail = chiaki_atomic_load_u32(&ring->tail);
+	size_t free_size = ring->size - (head - tail);
+	if(buf_size > free_size)
+		buf_size = free_size;
+	if(!buf_size)
+		return 0;
+
+	uint32_t offset = head & (ring->size - 1);
+	size_t first = ring->size - offset;
+	if(first > buf_size)
+		first = buf_size;
+	memcpy(ring->buf + offset, buf, first);
+	memcpy(ring->buf, (const uint8_t *)buf + first, buf_size - first);
+
+	chiaki_atomic_store_u32(&ring->head, head + (uint32_t)buf_size);
+	return buf_size;
+}
+
+CHIAKI_EXPORT size_t chiaki_ring_buffer_read(ChiakiRingBuffer *ring, void *buf, size_t buf_size)
+{
+	uint32_t tail = chiaki_atomic_load_u32(&ring->tail);
+	while(true)
+	{
+		uint32_t head = chiaki_atomic_load_u32(&ring->head);
+		size_t available = head - tail;
+		size_t size = buf_size > available ? available : buf_size;
+		if(!size)
+			return 0;
+
+		uint32_t offset = tail & (ring->size - 1);
+		size_t first = ring->size - offset;
+		if(first > size)
+			first = size;
+		memcpy(buf, ring->buf + offset, first);
+		memcpy((uint8_t *)buf + first, ring->buf, size - first);
+
+		// fails if the producer dropped the bytes meanwhile, they may have been overwritten so copy again
+		if(chiaki_atomic_cas_u32(&ring->tail, &tail, tail + (uint32_t)size))
+			return size;
+	}
+}
+
+CHIAKI_EXPORT size_t chiaki_ring_buffer_drop_oldest(ChiakiRingBuffer *ring, size_t size)
+{
+	uint32_t tail = chiaki_atomic_load_u32(&ring->tail);
+	while(true)
+	{
+		size_t available = ring->head - tail;
+		if(size > available)
+			size = available;
+		if(!size)
+			return 0;
+		if(chiaki_atomic_cas_u32(&ring->tail, &tail, tail + (uint32_t)size))
+			return size;
+	}
+}
+
+CHIAKI_EXPORT size_t chiaki_ring_buffer_available(ChiakiRingBuffer *ring)
+{
+	return chiaki_atomic_load_u32(&ring->head) - chiaki_atomic_load_u32(&ring->tail);
+}
+
+CHIAKI_EXPORT size_t chiaki_ring_buffer_free(ChiakiRingBuffer *ring)
+{
+	return ring->size - (chiaki_atomic_load_u32(&ring->head) - chiaki_atomic_load_u32(&ring->tail));
+}
+
+CHIAKI_EXPORT void chiaki_ring_buffer_clear(ChiakiRingBuffer *ring)
+{
+	chiaki_atomic_store_u32(&ring->tail, chiaki_atomic_load_u32(&ring->head));
+}
@@ -31,6 +31,8 @@
 #define EXPECT_TIMEOUT_MS 5000
 
 #define SENKUSHA_PING_COUNT_DEFAULT 10
+// MTU sizes probed at once per round
+#define SENKUSHA_MTU_PROBES 8
 #define EXPECT_PONG_TIMEOUT_MS 1000
 
 // Assuming IPv4, sizeof(ip header) + sizeof(udp header)
@@ -86,8 +88,9 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_senkusha_init(ChiakiSenkusha *senkusha, Chi
 	senkusha->state_failed = false;
 	senkusha->should_stop = false;
 	senkusha->data_ack_seq_num_expected = 0;
-	senkusha->ping_tag = 0;
-	senkusha->pong_time_us = 0;
+	senkusha->probes_count = 0;
+	senkusha->probes_acked = 0;
+	senkusha->probe_id_next = 0;
 
 	chiaki_key_state_init(&senkusha->takion.key_state);
 
@@ -154,6 +157,9 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_senkusha_run(ChiakiSenkusha *senkusha, uint
 	takion_info.enable_crypt = false;
 	takion_info.enable_dualsense = session->connect_info.enable_dualsense;
 	takion_info.protocol_version = 7;
+	takion_info.link_quality = NULL;
+	takion_info.thread_attrs = NULL; // only measures, nothing latency critical
+	takion_info.socket_tuning = NULL;
 
 	takion_info.cb = senkusha_takion_cb;
 	takion_info.cb_user = senkusha;
@@ -287,8 +293,90 @@ quit:
 	return err;
 }
 
+static void senkusha_probes_reset(ChiakiSenkusha *senkusha, SenkushaState state)
+{
+	senkusha->state = state;
+	senkusha->state_finished = false;
+	senkusha->state_failed = false;
+	senkusha->probes_count = 0;
+	senkusha->probes_acked = 0;
+}
+
+static ChiakiSenkushaProbe *senkusha_probe_add(ChiakiSenkusha *senkusha)
+{
+	assert(senkusha->probes_count < CHIAKI_SENKUSHA_PROBES_MAX);
+	ChiakiSenkushaProbe *probe = &senkusha->probes[senkusha->probes_count++];
+	memset(probe, 0, sizeof(*probe));
+	// ids are never reused within a run, so late answers from an earlier round can't be mistaken for new ones
+	probe->id = ++senkusha->probe_id_next;
+	return probe;
+}
+
+static ChiakiSenkushaProbe *senkusha_probe_find(ChiakiSenkusha *senkusha, uint16_t id)
+{
+	for(size_t i=0; i<senkusha->probes_count; i++)
+	{
+		if(senkusha->probes[i].id == id)
+			return &senkusha->probes[i];
+	}
+	return NULL;
+}
+
+/**
+ * Must be called with state_mutex locked
+ */
+static void senkusha_probe_ack(ChiakiSenkusha *senkusha, ChiakiSenkushaProbe *probe, uint64_t time_us)
+{
+	if(probe->ack_us)
+		return;
+	probe->ack_us = time_us;
+	senkusha->probes_acked++;
+	if(senkusha->probes_acked == senkusha->probes_count)
+	{
+		senkusha->state_finished = true;
+		chiaki_cond_signal(&senkusha->state_cond);
+	}
+}
+
+static ChiakiErrorCode senkusha_send_ping(ChiakiSenkusha *senkusha, ChiakiSenkushaProbe *probe, uint8_t *buf, size_t buf_size, size_t send_size)
+{
+	ChiakiTakionAVPacket av_packet = { 0 };
+	av_packet.codec = 0xff;
+	av_packet.is_video = false;
+	av_packet.frame_index = senkusha->ping_test_index;
+	av_packet.unit_index = probe->id;
+	av_packet.units_in_frame_total = 0x800; // or 0
+
+	size_t header_size;
+	ChiakiErrorCode err = chiaki_takion_v7_av_packet_format_header(buf, buf_size, &header_size, &av_packet);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(senkusha->log, "Senkusha failed to format AV Header");
+		return err;
+	}
+
+	probe->tag = chiaki_random_32();
+	*((chiaki_unaligned_uint32_t *)(buf + header_size)) = 0;
+	*((chiaki_unaligned_uint32_t *)(buf + header_size + 4)) = htonl(probe->tag);
+
+	probe->sent_us = chiaki_time_now_monotonic_us();
+	return chiaki_takion_send_raw(&senkusha->takion, buf, send_size);
+}
+
+static ChiakiErrorCode senkusha_wait_probes(ChiakiSenkusha *senkusha, uint64_t timeout_ms)
+{
+	ChiakiErrorCode err = chiaki_cond_timedwait_pred(&senkusha->state_cond, &senkusha->state_mutex, timeout_ms, state_finished_cond_check, senkusha);
+	assert(err == CHIAKI_ERR_SUCCESS || err == CHIAKI_ERR_TIMEOUT);
+	if(senkusha->should_stop)
+		return CHIAKI_ERR_CANCELED;
+	return CHIAKI_ERR_SUCCESS;
+}
+
 static ChiakiErrorCode senkusha_run_rtt_test(ChiakiSenkusha *senkusha, uint16_t ping_test_index, uint16_t ping_count, uint64_t *rtt_us)
 {
+	if(ping_count > CHIAKI_SENKUSHA_PROBES_MAX)
+		ping_count = CHIAKI_SENKUSHA_PROBES_MAX;
+
 	CHIAKI_LOGI(senkusha->log, "Senkusha Ping Test with count %u starting", (unsigned int)ping_count);
 
 	ChiakiErrorCode err = senkusha_send_echo_command(senkusha, true);
@@ -300,69 +388,40 @@ static ChiakiErrorCode senkusha_run_rtt_test(ChiakiSenkusha *senkusha, uint16_t
 
 	CHIAKI_LOGI(senkusha->log, "Senkusha enabled echo");
 
-	uint64_t rtt_us_acc = 0;
-	uint64_t pings_successful = 0;
-	for(uint16_t ping_index=0; ping_index<ping_count; ping_index++)
+	// all pings go out back to back, so a lost pong costs one timeout in total instead of one each
+	senkusha_probes_reset(senkusha, STATE_EXPECT_PONG);
+	senkusha->ping_test_index = ping_test_index;
+	for(uint16_t i=0; i<ping_count; i++)
 	{
-		CHIAKI_LOGI(senkusha->log, "Senkusha sending Ping %u of test index %u", (unsigned int)ping_index, (unsigned int)ping_test_index);
-
-		ChiakiTakionAVPacket av_packet = { 0 };
-		av_packet.codec = 0xff;
-		av_packet.is_video = false;
-		av_packet.frame_index = ping_test_index;
-		av_packet.unit_index = ping_index;
-		av_packet.units_in_frame_total = 0x800; // or 0
-
 		uint8_t data[0x224];
 		memset(data, 0, sizeof(data));
-
-		size_t header_size;
-		err = chiaki_takion_v7_av_packet_format_header(data, sizeof(data), &header_size, &av_packet);
-		if(err != CHIAKI_ERR_SUCCESS)
-		{
-			CHIAKI_LOGE(senkusha->log, "Senkusha failed to format AV Header");
-			return err;
-		}
-
-		uint32_t tag = chiaki_random_32();
-		*((chiaki_unaligned_uint32_t *)(data + header_size + 4)) = htonl(tag);
-
-		senkusha->state = STATE_EXPECT_PONG;
-		senkusha->state_finished = false;
-		senkusha->state_failed = false;
-		senkusha->ping_test_index = ping_test_index;
-		senkusha->ping_index = ping_index;
-		senkusha->ping_tag = tag;
-
-		uint64_t time_start_us = chiaki_time_now_monotonic_us();
-
-		err = chiaki_takion_send_raw(&senkusha->takion, data, sizeof(data));
+		ChiakiSenkushaProbe *probe = senkusha_probe_add(senkusha);
+		err = senkusha_send_ping(senkusha, probe, data, sizeof(data), sizeof(data));
 		if(err != CHIAKI_ERR_SUCCESS)
 		{
 			CHIAKI_LOGE(senkusha->log, "Senkusha failed to send ping");
 			return err;
 		}
+	}
 
-		err = chiaki_cond_timedwait_pred(&senkusha->state_cond, &senkusha->state_mutex, EXPECT_PONG_TIMEOUT_MS, state_finished_cond_check, senkusha);
-		assert(err == CHIAKI_ERR_SUCCESS || err == CHIAKI_ERR_TIMEOUT);
+	err = senkusha_wait_probes(senkusha, EXPECT_PONG_TIMEOUT_MS);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
 
-		if(!senkusha->state_finished)
+	uint64_t rtt_us_acc = 0;
+	uint64_t pings_successful = 0;
+	for(size_t i=0; i<senkusha->probes_count; i++)
+	{
+		ChiakiSenkushaProbe *probe = &senkusha->probes[i];
+		if(!probe->ack_us)
 		{
-			if(err == CHIAKI_ERR_TIMEOUT)
-				CHIAKI_LOGE(senkusha->log, "Senkusha pong receive timeout");
-
-			if(senkusha->should_stop)
-				return CHIAKI_ERR_CANCELED;
-			else
-				CHIAKI_LOGE(senkusha->log, "Senkusha failed to receive pong");
-
+			CHIAKI_LOGI(senkusha->log, "Senkusha Ping %u timeout", (unsigned int)probe->id);
 			continue;
 		}
-
-		uint64_t delta_us = senkusha->pong_time_us - time_start_us;
+		uint64_t delta_us = probe->ack_us - probe->sent_us;
 		rtt_us_acc += delta_us;
 		pings_successful += 1;
-		CHIAKI_LOGI(senkusha->log, "Senkusha received Pong, RTT = %.3f ms", (float)delta_us * 0.001f);
+		CHIAKI_LOGI(senkusha->log, "Senkusha received Pong %u, RTT = %.3f ms", (unsigned int)probe->id, (float)delta_us * 0.001f);
 	}
 
 	err = senkusha_send_echo_command(senkusha, false);
@@ -386,69 +445,143 @@ static ChiakiErrorCode senkusha_run_rtt_test(ChiakiSenkusha *senkusha, uint16_t
 	return CHIAKI_ERR_SUCCESS;
 }
 
-static ChiakiErrorCode senkusha_run_mtu_in_test(ChiakiSenkusha *senkusha, uint32_t min, uint32_t max, uint32_t retries, uint64_t timeout_ms, uint32_t *mtu)
+typedef ChiakiErrorCode (*SenkushaMtuProbeSend)(ChiakiSenkusha *senkusha, ChiakiSenkushaProbe *probe, void *user);
+
+/**
+ * Sizes to probe strictly between good and bad.
+ * In the first round bad is one above the max, which is probed as well since it usually just works.
+ */
+static size_t senkusha_mtu_candidates(uint32_t good, uint32_t bad, bool first, uint32_t *sizes, size_t sizes_max)
 {
-	CHIAKI_LOGI(senkusha->log, "Senkusha starting MTU in test with min %u, max %u, retries %u, timeout %llu ms",
-			(unsigned int)min, (unsigned int)max, (unsigned int)retries, (unsigned long long)timeout_ms);
+	uint32_t count = bad - good - 1;
+	if(count <= sizes_max)
+	{
+		for(uint32_t i=0; i<count; i++)
+			sizes[i] = good + 1 + i;
+		return count;
+	}
+	for(size_t i=0; i<sizes_max; i++)
+	{
+		if(first)
+			sizes[i] = good + (uint32_t)(((uint64_t)(bad - 1 - good) * (i + 1)) / sizes_max);
+		else
+			sizes[i] = good + (uint32_t)(((uint64_t)(bad - good) * (i + 1)) / (sizes_max + 1));
+	}
+	return sizes_max;
+}
 
-	uint32_t cur = max;
-	uint32_t request_id = 0;
-	while((max - min) > 1)
+/**
+ * Find the largest working size in [min, max] by sending a batch of differently sized probes per round
+ * and narrowing the range down to between the largest acked and the smallest lost one.
+ * Probes above the largest acked size are resent up to retries times per round.
+ */
+static ChiakiErrorCode senkusha_mtu_search(ChiakiSenkusha *senkusha, const char *name, SenkushaState state,
+		uint32_t min, uint32_t max, uint32_t retries, uint64_t timeout_ms,
+		SenkushaMtuProbeSend send, void *send_user, uint32_t *mtu)
+{
+	uint32_t good = min;
+	uint32_t bad = max + 1;
+	bool first = true;
+	while(bad - good > 1)
 	{
-		bool success = false;
+		uint32_t sizes[SENKUSHA_MTU_PROBES];
+		size_t sizes_count = senkusha_mtu_candidates(good, bad, first, sizes, SENKUSHA_MTU_PROBES);
+		first = false;
+
+		uint32_t acked_max = good;
 		for(uint32_t attempt=0; attempt<retries; attempt++)
 		{
-			senkusha->state = STATE_EXPECT_MTU;
-			senkusha->state_finished = false;
-			senkusha->state_failed = false;
-			senkusha->mtu_id = ++request_id;
-
-			tkproto_SenkushaMtuCommand mtu_cmd = { 0 };
-			mtu_cmd.id = request_id;
-			mtu_cmd.mtu_req = cur;
-			mtu_cmd.num = 1;
-			ChiakiErrorCode err = senkusha_send_mtu_command(senkusha, &mtu_cmd);
-			if(err != CHIAKI_ERR_SUCCESS)
+			senkusha_probes_reset(senkusha, state);
+			for(size_t i=0; i<sizes_count; i++)
 			{
-				CHIAKI_LOGE(senkusha->log, "Senkusha failed to send MTU command");
-				return err;
+				if(sizes[i] <= acked_max)
+					continue;
+				ChiakiSenkushaProbe *probe = senkusha_probe_add(senkusha);
+				probe->size = sizes[i];
+				ChiakiErrorCode err = send(senkusha, probe, send_user);
+				if(err != CHIAKI_ERR_SUCCESS)
+					return err;
 			}
+			if(!senkusha->probes_count)
+				break;
 
-			CHIAKI_LOGI(senkusha->log, "Senkusha MTU request %u (min %u, max %u), id %u, attempt %u",
-					(unsigned int)cur, (unsigned int)min, (unsigned int)max, (unsigned int)request_id, (unsigned int)attempt);
+			CHIAKI_LOGI(senkusha->log, "Senkusha MTU %s sent %u probes from %u to %u, attempt %u",
+					name, (unsigned int)senkusha->probes_count, (unsigned int)senkusha->probes[0].size,
+					(unsigned int)senkusha->probes[senkusha->probes_count - 1].size, (unsigned int)attempt);
 
-			err = chiaki_cond_timedwait_pred(&senkusha->state_cond, &senkusha->state_mutex, timeout_ms, state_finished_cond_check, senkusha);
-			assert(err == CHIAKI_ERR_SUCCESS || err == CHIAKI_ERR_TIMEOUT);
+			ChiakiErrorCode err = senkusha_wait_probes(senkusha, timeout_ms);
+			if(err != CHIAKI_ERR_SUCCESS)
+				return err;
 
-			if(!senkusha->state_finished)
+			for(size_t i=0; i<senkusha->probes_count; i++)
 			{
-				if(err == CHIAKI_ERR_TIMEOUT)
-				{
-					CHIAKI_LOGI(senkusha->log, "Senkusha MTU %u timeout", (unsigned int)cur);
-					continue;
-				}
-
-				if(senkusha->should_stop)
-					return CHIAKI_ERR_CANCELED;
-				else
-					CHIAKI_LOGE(senkusha->log, "Senkusha failed to receive MTU response");
+				if(senkusha->probes[i].ack_us && senkusha->probes[i].size > acked_max)
+					acked_max = senkusha->probes[i].size;
 			}
-
-			CHIAKI_LOGI(senkusha->log, "Senkusha MTU %u success", (unsigned int)cur);
-			success = true;
-			break;
+			if(senkusha->probes_acked == senkusha->probes_count)
+				break;
 		}
 
-		if(success)
-			min = cur;
-		else
-			max = cur;
-		cur = min + (max - min) / 2;
+		good = acked_max;
+		for(size_t i=0; i<sizes_count; i++)
+		{
+			if(sizes[i] > acked_max)
+			{
+				bad = sizes[i];
+				break;
+			}
+		}
+		CHIAKI_LOGI(senkusha->log, "Senkusha MTU %s between %u and %u", name, (unsigned int)good, (unsigned int)bad);
 	}
 
-	CHIAKI_LOGI(senkusha->log, "Senkusha determined inbound MTU %u", (unsigned int)min);
-	*mtu = min;
+	*mtu = good;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static ChiakiErrorCode senkusha_mtu_in_probe_send(ChiakiSenkusha *senkusha, ChiakiSenkushaProbe *probe, void *user)
+{
+	tkproto_SenkushaMtuCommand mtu_cmd = { 0 };
+	mtu_cmd.id = probe->id;
+	mtu_cmd.mtu_req = probe->size;
+	mtu_cmd.num = 1;
+	probe->sent_us = chiaki_time_now_monotonic_us();
+	ChiakiErrorCode err = senkusha_send_mtu_command(senkusha, &mtu_cmd);
+	if(err != CHIAKI_ERR_SUCCESS)
+		CHIAKI_LOGE(senkusha->log, "Senkusha failed to send MTU command");
+	return err;
+}
+
+static ChiakiErrorCode senkusha_run_mtu_in_test(ChiakiSenkusha *senkusha, uint32_t min, uint32_t max, uint32_t retries, uint64_t timeout_ms, uint32_t *mtu)
+{
+	CHIAKI_LOGI(senkusha->log, "Senkusha starting MTU in test with min %u, max %u, retries %u, timeout %llu ms",
+			(unsigned int)min, (unsigned int)max, (unsigned int)retries, (unsigned long long)timeout_ms);
+
+	ChiakiErrorCode err = senkusha_mtu_search(senkusha, "in", STATE_EXPECT_MTU, min, max, retries, timeout_ms,
+			senkusha_mtu_in_probe_send, NULL, mtu);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+
+	CHIAKI_LOGI(senkusha->log, "Senkusha determined inbound MTU %u", (unsigned int)*mtu);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+typedef struct senkusha_mtu_out_buf_t
+{
+	uint8_t *buf;
+	size_t size;
+} SenkushaMtuOutBuf;
 
+static ChiakiErrorCode senkusha_mtu_out_probe_send(ChiakiSenkusha *senkusha, ChiakiSenkushaProbe *probe, void *user)
+{
+	SenkushaMtuOutBuf *buf = user;
+	ChiakiErrorCode err = senkusha_send_ping(senkusha, probe, buf->buf, buf->size, probe->size - MTU_UDP_PACKET_ADD);
+	if(err == CHIAKI_ERR_INVALID_DATA)
+		return err;
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		// probably too big to be sent at all, it will simply never be acked
+		CHIAKI_LOGI(senkusha->log, "Senkusha failed to send MTU %u ping", (unsigned int)probe->size);
+	}
 	return CHIAKI_ERR_SUCCESS;
 }
 
@@ -499,102 +632,28 @@ static ChiakiErrorCode senkusha_run_mtu_out_test(ChiakiSenkusha *senkusha, uint3
 		return CHIAKI_ERR_UNKNOWN;
 	}
 
-	size_t packet_buf_size = max - MTU_UDP_PACKET_ADD;
-	uint8_t *packet_buf = malloc(packet_buf_size);
-	if(!packet_buf)
+	SenkushaMtuOutBuf packet_buf;
+	packet_buf.size = max - MTU_UDP_PACKET_ADD;
+	packet_buf.buf = malloc(packet_buf.size);
+	if(!packet_buf.buf)
 		return CHIAKI_ERR_MEMORY;
-	memset(packet_buf, 0, MTU_AV_PACKET_ADD + 8);
+	memset(packet_buf.buf, 0, MTU_AV_PACKET_ADD + 8);
 	static const char padding[] = { 'C', 'H', 'I', 'A', 'K', 'I' };
-	for(size_t i=0; i<packet_buf_size - (MTU_AV_PACKET_ADD + 8); i++)
-		packet_buf[i + (MTU_AV_PACKET_ADD + 8)] = padding[i % sizeof(padding)];
-
-	err = CHIAKI_ERR_SUCCESS;
-
-	uint32_t cur = mtu_in;
-	while((max - min) > 1)
-	{
-		bool success = false;
-		for(uint32_t attempt=0; attempt<retries; attempt++)
-		{
-			uint32_t tag = chiaki_random_32();
-
-			senkusha->state = STATE_EXPECT_PONG;
-			senkusha->state_finished = false;
-			senkusha->state_failed = false;
-			senkusha->ping_tag = tag;
-			senkusha->ping_test_index = 0;
-			senkusha->ping_index = (uint16_t)attempt;
-
-			ChiakiTakionAVPacket av_packet = { 0 };
-			av_packet.codec = 0xff;
-			av_packet.is_video = false;
-			av_packet.frame_index = senkusha->ping_test_index;
-			av_packet.unit_index = senkusha->ping_index;
-			av_packet.units_in_frame_total = 0x800;
-
-			size_t header_size;
-			err = chiaki_takion_v7_av_packet_format_header(packet_buf, packet_buf_size, &header_size, &av_packet);
-			if(err != CHIAKI_ERR_SUCCESS)
-			{
-				CHIAKI_LOGE(senkusha->log, "Senkusha failed to format AV Header");
-				goto beach;
-			}
-			assert(header_size == MTU_AV_PACKET_ADD);
-
-			*((chiaki_unaligned_uint32_t *)(packet_buf + MTU_AV_PACKET_ADD)) = 0;
-			*((chiaki_unaligned_uint32_t *)(packet_buf + MTU_AV_PACKET_ADD + 4)) = htonl(tag);
-
-			CHIAKI_LOGI(senkusha->log, "Senkusha MTU %u out ping attempt %u", (unsigned int)cur, (unsigned int)attempt);
-
-			err = chiaki_takion_send_raw(&senkusha->takion, packet_buf, cur - MTU_UDP_PACKET_ADD);
-			if(err != CHIAKI_ERR_SUCCESS)
-			{
-				CHIAKI_LOGE(senkusha->log, "Senkusha failed to send ping");
-				err = CHIAKI_ERR_TIMEOUT;
-			}
-			else
-			{
-				err = chiaki_cond_timedwait_pred(&senkusha->state_cond, &senkusha->state_mutex, timeout_ms, state_finished_cond_check, senkusha);
-			}
-
-			assert(err == CHIAKI_ERR_SUCCESS || err == CHIAKI_ERR_TIMEOUT);
+	for(size_t i=0; i<packet_buf.size - (MTU_AV_PACKET_ADD + 8); i++)
+		packet_buf.buf[i + (MTU_AV_PACKET_ADD + 8)] = padding[i % sizeof(padding)];
 
-			if(!senkusha->state_finished)
-			{
-				if(err == CHIAKI_ERR_TIMEOUT)
-				{
-					CHIAKI_LOGI(senkusha->log, "Senkusha MTU pong %u timeout", (unsigned int)cur);
-					continue;
-				}
-
-				if(senkusha->should_stop)
-				{
-					err = CHIAKI_ERR_CANCELED;
-					goto beach;
-				}
-				else
-					CHIAKI_LOGE(senkusha->log, "Senkusha failed to receive MTU pong");
-			}
-
-			CHIAKI_LOGI(senkusha->log, "Senkusha MTU ping %u success", (unsigned int)cur);
-			success = true;
-			break;
-		}
-
-		if(success)
-			min = cur;
-		else
-			max = cur;
-		cur = min + (max - min) / 2;
-	}
+	senkusha->ping_test_index = 0;
+	err = senkusha_mtu_search(senkusha, "out", STATE_EXPECT_PONG, min, max, retries, timeout_ms,
+			senkusha_mtu_out_probe_send, &packet_buf, mtu);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto beach;
 
-	CHIAKI_LOGI(senkusha->log, "Senkusha determined outbound MTU %u", (unsigned int)min);
-	*mtu = min;
+	CHIAKI_LOGI(senkusha->log, "Senkusha determined outbound MTU %u", (unsigned int)*mtu);
 
 	CHIAKI_LOGI(senkusha->log, "Senkusha sending final Client MTU Command");
 	client_mtu_cmd.id = 2;
 	client_mtu_cmd.state = false;
-	client_mtu_cmd.mtu_req = max;
+	client_mtu_cmd.mtu_req = *mtu < max ? *mtu + 1 : max;
 	client_mtu_cmd.has_mtu_down = true;
 	client_mtu_cmd.mtu_down = mtu_in;
 	err = senkusha_send_client_mtu_command(senkusha, &client_mtu_cmd, true);
@@ -602,7 +661,7 @@ static ChiakiErrorCode senkusha_run_mtu_out_test(ChiakiSenkusha *senkusha, uint3
 		CHIAKI_LOGE(senkusha->log, "Senkusha failed to send client MTU command");
 
 beach:
-	free(packet_buf);
+	free(packet_buf.buf);
 	return err;
 }
 
@@ -725,28 +784,24 @@ static void senkusha_takion_av(ChiakiSenkusha *senkusha, ChiakiTakionAVPacket *p
 
 	if(senkusha->state == STATE_EXPECT_PONG)
 	{
-		if(packet->is_video
-			|| packet->frame_index != senkusha->ping_test_index
-			|| packet->unit_index != senkusha->ping_index
-			|| packet->data_size < 8)
+		ChiakiSenkushaProbe *probe = NULL;
+		if(!packet->is_video && packet->frame_index == senkusha->ping_test_index && packet->data_size >= 8)
+			probe = senkusha_probe_find(senkusha, packet->unit_index);
+		if(!probe)
 		{
 			CHIAKI_LOGW(senkusha->log, "Senkusha received invalid Pong %u/%u, size: %#llx",
 					(unsigned int)packet->frame_index, (unsigned int)packet->unit_index, (unsigned long long)packet->data_size);
 			goto beach;
 		}
 
-		uint32_t tag = ntohl(*((uint32_t *)(packet->data + 4)));
-		if(tag != senkusha->ping_tag)
+		uint32_t tag = ntohl(*((chiaki_unaligned_uint32_t *)(packet->data + 4)));
+		if(tag != probe->tag)
 		{
 			CHIAKI_LOGW(senkusha->log, "Senkusha received Pong with invalid tag");
 			goto beach;
 		}
 
-		senkusha->pong_time_us = time_us;
-		senkusha->state_finished = true;
-		chiaki_mutex_unlock(&senkusha->state_mutex);
-		chiaki_cond_signal(&senkusha->state_cond);
-		return;
+		senkusha_probe_ack(senkusha, probe, time_us);
 	}
 	else if(senkusha->state == STATE_EXPECT_MTU)
 	{
@@ -754,18 +809,15 @@ static void senkusha_takion_av(ChiakiSenkusha *senkusha, ChiakiTakionAVPacket *p
 		//chiaki_log_hexdump(senkusha->log, CHIAKI_LOG_DEBUG, packet->data, packet->data_size);
 		//CHIAKI_LOGD(senkusha->log, "packet index: %u, frame index: %u, unit index: %u, units in frame: %u", packet->packet_index, packet->frame_index, packet->unit_index, packet->units_in_frame_total);
 
-		if(!packet->is_video
-			|| packet->frame_index != senkusha->mtu_id)
+		ChiakiSenkushaProbe *probe = packet->is_video ? senkusha_probe_find(senkusha, packet->frame_index) : NULL;
+		if(!probe)
 		{
 			CHIAKI_LOGW(senkusha->log, "Senkusha received invalid MTU response %u, size: %#llx, is video: %d",
 					(unsigned int)packet->frame_index, (unsigned long long)packet->data_size, packet->is_video ? 1 : 0);
 			goto beach;
 		}
 
-		senkusha->state_finished = true;
-		chiaki_mutex_unlock(&senkusha->state_mutex);
-		chiaki_cond_signal(&senkusha->state_cond);
-		return;
+		senkusha_probe_ack(senkusha, probe, time_us);
 	}
 
 beach:
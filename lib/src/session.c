@@ -6,6 +6,7 @@
 #include <chiaki/http.h>
 #include <chiaki/base64.h>
 #include <chiaki/random.h>
+#include <chiaki/time.h>
 
 #include <stdlib.h>
 #include <string.h>
@@ -175,6 +176,27 @@ CHIAKI_EXPORT const char *chiaki_quit_reason_string(ChiakiQuitReason reason)
 	}
 }
 
+CHIAKI_EXPORT const char *chiaki_startup_step_string(ChiakiStartupStep step)
+{
+	switch(step)
+	{
+		case CHIAKI_STARTUP_STEP_SESSION_REQUEST:
+			return "Session Request";
+		case CHIAKI_STARTUP_STEP_CTRL:
+			return "Ctrl";
+		case CHIAKI_STARTUP_STEP_HOLEPUNCH:
+			return "Holepunch";
+		case CHIAKI_STARTUP_STEP_SENKUSHA:
+			return "Senkusha";
+		case CHIAKI_STARTUP_STEP_KEYGEN:
+			return "Key Generation";
+		case CHIAKI_STARTUP_STEP_STREAM_CONNECTION:
+			return "Stream Connection";
+		default:
+			return "Unknown";
+	}
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_init(ChiakiSession *session, ChiakiConnectInfo *connect_info,
 	ChiakiLog *log)
 {
@@ -261,6 +283,23 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_session_init(ChiakiSession *session, Chiaki
 	session->connect_info.video_profile_auto_downgrade = connect_info->video_profile_auto_downgrade;
 	session->connect_info.enable_keyboard = connect_info->enable_keyboard;
 	session->connect_info.enable_dualsense = connect_info->enable_dualsense;
+	if(connect_info->thread_profile)
+		session->connect_info.thread_profile = *connect_info->thread_profile;
+	else
+		chiaki_thread_profile_default(&session->connect_info.thread_profile);
+	if(connect_info->socket_tuning)
+		session->connect_info.socket_tuning = *connect_info->socket_tuning;
+	else
+		memset(&session->connect_info.socket_tuning, 0, sizeof(session->connect_info.socket_tuning));
+
+	const ChiakiConnectProfile *profile = &connect_info->profile;
+	if(profile->valid
+		&& !chiaki_target_is_unknown(profile->target)
+		&& chiaki_target_is_ps5(profile->target) == connect_info->ps5
+		&& profile->mtu_in && profile->mtu_out)
+	{
+		session->connect_info.profile = *profile;
+	}
 
 	return CHIAKI_ERR_SUCCESS;
 
@@ -376,6 +415,120 @@ void chiaki_session_send_event(ChiakiSession *session, ChiakiEvent *event)
 	session->event_cb(event, session->event_cb_user);
 }
 
+static void session_startup_step(ChiakiSession *session, ChiakiStartupStep step, bool finished)
+{
+	uint64_t t = chiaki_time_now_monotonic_ms() - session->startup_start_ms;
+	if(finished)
+		session->startup_timeline.end_ms[step] = t;
+	else
+		session->startup_timeline.begin_ms[step] = t;
+}
+
+/**
+ * Called by the StreamConnection once it is connected, finishes and reports the startup timeline.
+ */
+void chiaki_session_startup_finished(ChiakiSession *session)
+{
+	session_startup_step(session, CHIAKI_STARTUP_STEP_STREAM_CONNECTION, true);
+	ChiakiStartupTimeline *timeline = &session->startup_timeline;
+	timeline->total_ms = timeline->end_ms[CHIAKI_STARTUP_STEP_STREAM_CONNECTION];
+	CHIAKI_LOGI(session->log, "Session startup took %llu ms", (unsigned long long)timeline->total_ms);
+	for(int i = 0; i < CHIAKI_STARTUP_STEP_COUNT; i++)
+	{
+		if(!timeline->end_ms[i])
+			continue;
+		CHIAKI_LOGV(session->log, "  %s: %llu - %llu ms", chiaki_startup_step_string((ChiakiStartupStep)i),
+			(unsigned long long)timeline->begin_ms[i], (unsigned long long)timeline->end_ms[i]);
+	}
+
+	ChiakiEvent event = { 0 };
+	event.type = CHIAKI_EVENT_STARTUP_TIMELINE;
+	event.startup_timeline = *timeline;
+	chiaki_session_send_event(session, &event);
+}
+
+/**
+ * The handshake key and ECDH keys are only needed by the StreamConnection,
+ * so they are generated on their own thread while the session request and ctrl are running.
+ */
+typedef struct session_keygen_t
+{
+	ChiakiSession *session;
+	ChiakiThread thread;
+	bool joined;
+	ChiakiErrorCode err;
+} SessionKeygen;
+
+static void *session_keygen_thread_func(void *user)
+{
+	SessionKeygen *keygen = user;
+	ChiakiSession *session = keygen->session;
+
+	session_startup_step(session, CHIAKI_STARTUP_STEP_KEYGEN, false);
+	keygen->err = chiaki_random_bytes_crypt(session->handshake_key, sizeof(session->handshake_key));
+	if(keygen->err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(session->log, "Session failed to generate handshake key");
+		return NULL;
+	}
+
+	keygen->err = chiaki_ecdh_init(&session->ecdh);
+	if(keygen->err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(session->log, "Session failed to initialize ECDH");
+		return NULL;
+	}
+	session_startup_step(session, CHIAKI_STARTUP_STEP_KEYGEN, true);
+	return NULL;
+}
+
+static void session_keygen_start(SessionKeygen *keygen, ChiakiSession *session)
+{
+	keygen->session = session;
+	keygen->joined = false;
+	keygen->err = CHIAKI_ERR_UNKNOWN;
+	if(chiaki_thread_create(&keygen->thread, session_keygen_thread_func, keygen) == CHIAKI_ERR_SUCCESS)
+	{
+		chiaki_thread_set_name(&keygen->thread, "Chiaki Keygen");
+		return;
+	}
+	// not worth failing over, just do it right here
+	session_keygen_thread_func(keygen);
+	keygen->joined = true;
+}
+
+static ChiakiErrorCode session_keygen_join(SessionKeygen *keygen)
+{
+	if(!keygen->joined)
+	{
+		chiaki_thread_join(&keygen->thread, NULL);
+		keygen->joined = true;
+	}
+	return keygen->err;
+}
+
+
+CHIAKI_EXPORT void chiaki_session_get_connect_profile(ChiakiSession *session, ChiakiConnectProfile *profile)
+{
+	chiaki_mutex_lock(&session->state_mutex);
+	profile->valid = session->mtu_measured && !chiaki_target_is_unknown(session->target) && session->mtu_in && session->mtu_out;
+	profile->target = session->target;
+	profile->mtu_in = session->mtu_in;
+	profile->mtu_out = session->mtu_out;
+	profile->rtt_us = session->rtt_us;
+	chiaki_mutex_unlock(&session->state_mutex);
+
+	// prefer what was measured during the stream over the single Senkusha measurement
+	ChiakiLinkQualityStats stats;
+	chiaki_link_quality_get_stats(&session->stream_connection.link_quality, &stats);
+	if(stats.rtt_samples)
+		profile->rtt_us = stats.srtt_us;
+}
+
+CHIAKI_EXPORT void chiaki_session_get_link_quality(ChiakiSession *session, ChiakiLinkQualityStats *stats)
+{
+	chiaki_link_quality_get_stats(&session->stream_connection.link_quality, stats);
+}
 
 static bool session_check_state_pred(void *user)
 {
@@ -423,6 +576,12 @@ static void *session_thread_func(void *arg)
 {
 	ChiakiSession *session = (ChiakiSession *)arg;
 
+	memset(&session->startup_timeline, 0, sizeof(session->startup_timeline));
+	session->startup_start_ms = chiaki_time_now_monotonic_ms();
+
+	SessionKeygen keygen;
+	session_keygen_start(&keygen, session);
+
 	chiaki_mutex_lock(&session->state_mutex);
 
 #define QUIT(quit_label) do { \
@@ -470,6 +629,14 @@ static void *session_thread_func(void *arg)
 		CHECK_STOP(quit);
 	}
 	CHIAKI_LOGI(session->log, "Starting session request for %s", session->connect_info.ps5 ? "PS5" : "PS4");
+	session_startup_step(session, CHIAKI_STARTUP_STEP_SESSION_REQUEST, false);
+
+	// start with the RP-Version that worked last time instead of finding it through mismatch retries
+	if(session->connect_info.profile.valid)
+	{
+		CHIAKI_LOGI(session->log, "Using cached connection profile with RP-Version %s", chiaki_rp_version_string(session->connect_info.profile.target));
+		session->target = session->connect_info.profile.target;
+	}
 
 	ChiakiTarget server_target = CHIAKI_TARGET_PS4_UNKNOWN;
 	ChiakiErrorCode err = session_thread_request_session(session, &server_target);
@@ -496,13 +663,17 @@ static void *session_thread_func(void *arg)
 		QUIT(quit);
 
 	CHIAKI_LOGI(session->log, "Session request successful");
+	session_startup_step(session, CHIAKI_STARTUP_STEP_SESSION_REQUEST, true);
 
 	chiaki_rpcrypt_init_auth(&session->rpcrypt, session->target, session->nonce, session->connect_info.morning);
 
 	// PS4 doesn't always react right away, sleep a bit
-	chiaki_cond_timedwait_pred(&session->state_cond, &session->state_mutex, 10, session_check_state_pred, session);
+	// PS5 with a cached profile already went through this before and does not need it
+	if(!session->connect_info.ps5 || !session->connect_info.profile.valid)
+		chiaki_cond_timedwait_pred(&session->state_cond, &session->state_mutex, 10, session_check_state_pred, session);
 
 	CHIAKI_LOGI(session->log, "Starting ctrl");
+	session_startup_step(session, CHIAKI_STARTUP_STEP_CTRL, false);
 
 	err = chiaki_ctrl_start(&session->ctrl);
 	if(err != CHIAKI_ERR_SUCCESS)
@@ -550,9 +721,12 @@ static void *session_thread_func(void *arg)
 		CHECK_STOP(quit_ctrl);
 	}
 
+	session_startup_step(session, CHIAKI_STARTUP_STEP_CTRL, true);
+
 	chiaki_socket_t *data_sock = NULL;
 	if(session->rudp)
 	{
+		session_startup_step(session, CHIAKI_STARTUP_STEP_HOLEPUNCH, false);
 		ChiakiErrorCode err = holepunch_session_create_offer(session->holepunch_session);
 		if (err != CHIAKI_ERR_SUCCESS)
 		{
@@ -576,6 +750,7 @@ static void *session_thread_func(void *arg)
 		event_finish.type = CHIAKI_EVENT_HOLEPUNCH;
 		event_finish.data_holepunch.finished = true;
 		chiaki_session_send_event(session, &event_finish);
+		session_startup_step(session, CHIAKI_STARTUP_STEP_HOLEPUNCH, true);
 		err = chiaki_cond_timedwait_pred(&session->state_cond, &session->state_mutex, SESSION_EXPECT_TIMEOUT_MS, session_check_state_pred_ctrl_start, session);
 		CHECK_STOP(quit_ctrl);
 	}
@@ -601,7 +776,20 @@ ctrl_failed:
 	}
 
 #ifdef ENABLE_SENKUSHA
+	if(session->connect_info.profile.valid)
+	{
+		CHIAKI_LOGI(session->log, "Skipping Senkusha, using cached MTU in %u / out %u and RTT %llu us",
+			(unsigned int)session->connect_info.profile.mtu_in, (unsigned int)session->connect_info.profile.mtu_out,
+			(unsigned long long)session->connect_info.profile.rtt_us);
+		session->mtu_in = session->connect_info.profile.mtu_in;
+		session->mtu_out = session->connect_info.profile.mtu_out;
+		session->rtt_us = session->connect_info.profile.rtt_us;
+		session->mtu_measured = true;
+		goto senkusha_done;
+	}
+
 	CHIAKI_LOGI(session->log, "Starting Senkusha");
+	session_startup_step(session, CHIAKI_STARTUP_STEP_SENKUSHA, false);
 
 	ChiakiSenkusha senkusha;
 	err = chiaki_senkusha_init(&senkusha, session);
@@ -612,16 +800,22 @@ ctrl_failed:
 	chiaki_senkusha_fini(&senkusha);
 
 	if(err == CHIAKI_ERR_SUCCESS)
+	{
 		CHIAKI_LOGI(session->log, "Senkusha completed successfully");
+		session->mtu_measured = true;
+	}
 	else if(err == CHIAKI_ERR_CANCELED)
 		QUIT(quit_ctrl);
 	else
 	{
+		// guessed, so not reported by chiaki_session_get_connect_profile() for caching
 		CHIAKI_LOGE(session->log, "Senkusha failed, but we still try to connect with fallback values");
 		session->mtu_in = 1454;
 		session->mtu_out = 1454;
 		session->rtt_us = 1000;
 	}
+	session_startup_step(session, CHIAKI_STARTUP_STEP_SENKUSHA, true);
+senkusha_done:
 #endif
 	if(session->rudp)
 	{
@@ -642,20 +836,12 @@ ctrl_failed:
 		CHIAKI_LOGI(session->log, "Received Switch to Stream Connection Ack... Switching to Stream Connection now");
 	}
 
-	err = chiaki_random_bytes_crypt(session->handshake_key, sizeof(session->handshake_key));
-	if(err != CHIAKI_ERR_SUCCESS)
-	{
-		CHIAKI_LOGE(session->log, "Session failed to generate handshake key");
-		QUIT(quit_ctrl);
-	}
-
-	err = chiaki_ecdh_init(&session->ecdh);
+	// usually long done by now
+	err = session_keygen_join(&keygen);
 	if(err != CHIAKI_ERR_SUCCESS)
-	{
-		CHIAKI_LOGE(session->log, "Session failed to initialize ECDH");
 		QUIT(quit_ctrl);
-	}
 
+	session_startup_step(session, CHIAKI_STARTUP_STEP_STREAM_CONNECTION, false);
 	chiaki_mutex_unlock(&session->state_mutex);
 	err = chiaki_stream_connection_run(&session->stream_connection, data_sock);
 	chiaki_mutex_lock(&session->state_mutex);
@@ -680,7 +866,6 @@ ctrl_failed:
 	}
 
 	chiaki_mutex_unlock(&session->state_mutex);
-	chiaki_ecdh_fini(&session->ecdh);
 
 quit_ctrl:
 	chiaki_ctrl_stop(&session->ctrl);
@@ -689,9 +874,17 @@ quit_ctrl:
 
 	ChiakiEvent quit_event;
 quit:
+	if(session_keygen_join(&keygen) == CHIAKI_ERR_SUCCESS)
+		chiaki_ecdh_fini(&session->ecdh);
 
 	CHIAKI_LOGI(session->log, "Session has quit");
 	chiaki_mutex_lock(&session->state_mutex);
+	if(session->connect_info.profile.valid && chiaki_quit_reason_is_error(session->quit_reason))
+	{
+		// the console may have been updated or the network changed, negotiate everything again if restarted
+		CHIAKI_LOGW(session->log, "Session with cached connection profile failed, dropping the profile");
+		session->connect_info.profile.valid = false;
+	}
 	quit_event.type = CHIAKI_EVENT_QUIT;
 	quit_event.quit.reason = session->quit_reason;
 	quit_event.quit.reason_str = session->quit_reason_str;
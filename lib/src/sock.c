@@ -2,6 +2,18 @@
 
 #include <chiaki/sock.h>
 #include <fcntl.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#elif defined(__SWITCH__)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#endif
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_socket_set_nonblock(chiaki_socket_t sock, bool nonblock)
 {
@@ -18,4 +30,115 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_socket_set_nonblock(chiaki_socket_t sock, b
 		return CHIAKI_ERR_UNKNOWN;
 #endif
 	return CHIAKI_ERR_SUCCESS;
-}
\ No newline at end of file
+}
+
+static int socket_get_int(chiaki_socket_t sock, int level, int name)
+{
+	int val = 0;
+	socklen_t len = sizeof(val);
+	if(getsockopt(sock, level, name, (CHIAKI_SOCKET_BUF_TYPE)&val, &len) < 0)
+		return 0;
+	return val;
+}
+
+static bool socket_set_int(chiaki_socket_t sock, int level, int name, int val)
+{
+	return setsockopt(sock, level, name, (const CHIAKI_SOCKET_BUF_TYPE)&val, sizeof(val)) == 0;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_socket_tuning_apply(chiaki_socket_t sock, const ChiakiSocketTuning *tuning, int rcvbuf_default, ChiakiSocketTuningApplied *applied, ChiakiLog *log)
+{
+	static const ChiakiSocketTuning tuning_default = { 0 };
+	if(!tuning)
+		tuning = &tuning_default;
+	ChiakiSocketTuningApplied r = { 0 };
+
+	struct sockaddr_storage addr;
+	socklen_t addr_len = sizeof(addr);
+	memset(&addr, 0, sizeof(addr));
+	r.family = getsockname(sock, (struct sockaddr *)&addr, &addr_len) == 0 ? addr.ss_family : AF_INET;
+
+	int rcvbuf = tuning->rcvbuf ? tuning->rcvbuf : rcvbuf_default;
+	if(rcvbuf && !socket_set_int(sock, SOL_SOCKET, SO_RCVBUF, rcvbuf))
+	{
+		CHIAKI_LOGE(log, "Failed to setsockopt SO_RCVBUF: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+		return CHIAKI_ERR_NETWORK;
+	}
+	r.rcvbuf = socket_get_int(sock, SOL_SOCKET, SO_RCVBUF);
+	if(tuning->rcvbuf && r.rcvbuf < tuning->rcvbuf)
+		CHIAKI_LOGW(log, "Socket receive buffer is %d bytes instead of %d, the system limit is lower", r.rcvbuf, tuning->rcvbuf);
+
+	if(tuning->sndbuf && !socket_set_int(sock, SOL_SOCKET, SO_SNDBUF, tuning->sndbuf))
+		CHIAKI_LOGW(log, "Failed to setsockopt SO_SNDBUF: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+	r.sndbuf = socket_get_int(sock, SOL_SOCKET, SO_SNDBUF);
+	if(tuning->sndbuf && r.sndbuf < tuning->sndbuf)
+		CHIAKI_LOGW(log, "Socket send buffer is %d bytes instead of %d, the system limit is lower", r.sndbuf, tuning->sndbuf);
+
+	if(tuning->dscp_input)
+	{
+		int tos = (tuning->dscp_input & 0x3f) << 2;
+#if defined(__linux__)
+		// marked per datagram when sending, nothing to set here
+		r.dscp_input = tuning->dscp_input & 0x3f;
+		r.dscp_per_packet = true;
+		(void)tos;
+#elif defined(_WIN32) || defined(__SWITCH__)
+		(void)tos;
+		CHIAKI_LOGW(log, "DSCP marking is not supported on this platform");
+#else
+		// no per datagram marking, so everything on the socket gets it
+		bool ok = r.family == AF_INET6
+			? socket_set_int(sock, IPPROTO_IPV6, IPV6_TCLASS, tos)
+			: socket_set_int(sock, IPPROTO_IP, IP_TOS, tos);
+		if(ok)
+			r.dscp_input = tuning->dscp_input & 0x3f;
+		else
+			CHIAKI_LOGW(log, "Failed to set DSCP: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+#endif
+	}
+
+	if(tuning->busy_poll_us)
+	{
+#ifdef SO_BUSY_POLL
+		if(socket_set_int(sock, SOL_SOCKET, SO_BUSY_POLL, (int)tuning->busy_poll_us))
+			r.busy_poll_us = (unsigned int)socket_get_int(sock, SOL_SOCKET, SO_BUSY_POLL);
+		else
+			CHIAKI_LOGW(log, "Failed to setsockopt SO_BUSY_POLL, raising it above net.core.busy_read needs CAP_NET_ADMIN: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+#else
+		CHIAKI_LOGW(log, "Busy polling is not supported on this platform");
+#endif
+	}
+
+	if(tuning->prefer_busy_poll && r.busy_poll_us)
+	{
+#ifdef SO_PREFER_BUSY_POLL
+		if(socket_set_int(sock, SOL_SOCKET, SO_PREFER_BUSY_POLL, 1))
+			r.prefer_busy_poll = true;
+		else
+			CHIAKI_LOGW(log, "Failed to setsockopt SO_PREFER_BUSY_POLL: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+#else
+		CHIAKI_LOGW(log, "SO_PREFER_BUSY_POLL is not supported by this build");
+#endif
+	}
+
+	if(tuning->rx_timestamps)
+	{
+#if defined(SO_TIMESTAMPNS)
+		r.rx_timestamps = socket_set_int(sock, SOL_SOCKET, SO_TIMESTAMPNS, 1);
+#elif defined(SO_TIMESTAMP) && !defined(_WIN32) && !defined(__SWITCH__)
+		r.rx_timestamps = socket_set_int(sock, SOL_SOCKET, SO_TIMESTAMP, 1);
+#endif
+		if(!r.rx_timestamps)
+			CHIAKI_LOGW(log, "Kernel receive timestamps are not available");
+	}
+
+	CHIAKI_LOGI(log, "Socket buffers rcv %d snd %d, DSCP %u%s, busy poll %u us%s, rx timestamps %s",
+			r.rcvbuf, r.sndbuf,
+			(unsigned int)r.dscp_input, r.dscp_input ? (r.dscp_per_packet ? " (input)" : " (all)") : "",
+			r.busy_poll_us, r.prefer_busy_poll ? " preferred" : "",
+			r.rx_timestamps ? "on" : "off");
+
+	if(applied)
+		*applied = r;
+	return CHIAKI_ERR_SUCCESS;
+}
@@ -11,6 +11,21 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <poll.h>
+#include <limits.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+#ifndef _WIN32
+static int stop_pipe_poll_timeout(uint64_t timeout_ms);
+static ChiakiErrorCode stop_pipe_poll(int stop_fd, const chiaki_socket_t *fds, size_t fds_count, short events, uint64_t timeout_ms, bool *ready);
+#endif
+#if defined(__linux__)
+static ChiakiErrorCode stop_pipe_epoll_wait(ChiakiStopPipe *stop_pipe, const chiaki_socket_t *fds, size_t fds_count, uint32_t events, uint64_t timeout_ms, bool *ready);
 #endif
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_init(ChiakiStopPipe *stop_pipe)
@@ -44,6 +59,27 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_init(ChiakiStopPipe *stop_pipe)
 		close(stop_pipe->fd);
 		return CHIAKI_ERR_UNKNOWN;
 	}
+#elif defined(__linux__)
+	stop_pipe->epoll_fds_count = 0;
+	stop_pipe->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(stop_pipe->event_fd < 0)
+		return CHIAKI_ERR_UNKNOWN;
+	stop_pipe->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(stop_pipe->epoll_fd < 0)
+		goto error_event_fd;
+	struct epoll_event event = { 0 };
+	event.events = EPOLLIN;
+	event.data.fd = stop_pipe->event_fd;
+	if(epoll_ctl(stop_pipe->epoll_fd, EPOLL_CTL_ADD, stop_pipe->event_fd, &event) < 0)
+		goto error_epoll_fd;
+	if(chiaki_mutex_init(&stop_pipe->epoll_mutex, false) != CHIAKI_ERR_SUCCESS)
+		goto error_epoll_fd;
+	return CHIAKI_ERR_SUCCESS;
+error_epoll_fd:
+	close(stop_pipe->epoll_fd);
+error_event_fd:
+	close(stop_pipe->event_fd);
+	return CHIAKI_ERR_UNKNOWN;
 #else
 	int r = pipe(stop_pipe->fds);
 	if(r < 0)
@@ -65,6 +101,10 @@ CHIAKI_EXPORT void chiaki_stop_pipe_fini(ChiakiStopPipe *stop_pipe)
 	WSACloseEvent(stop_pipe->event);
 #elif defined(__SWITCH__)
 	close(stop_pipe->fd);
+#elif defined(__linux__)
+	chiaki_mutex_fini(&stop_pipe->epoll_mutex);
+	close(stop_pipe->epoll_fd);
+	close(stop_pipe->event_fd);
 #else
 	close(stop_pipe->fds[0]);
 	close(stop_pipe->fds[1]);
@@ -79,6 +119,9 @@ CHIAKI_EXPORT void chiaki_stop_pipe_stop(ChiakiStopPipe *stop_pipe)
 	// send to local socket (FIXME MSG_CONFIRM)
 	sendto(stop_pipe->fd, "\x00", 1, 0,
 		(struct sockaddr*)&stop_pipe->addr, sizeof(struct sockaddr_in));
+#elif defined(__linux__)
+	uint64_t v = 1;
+	write(stop_pipe->event_fd, &v, sizeof(v));
 #else
 	write(stop_pipe->fds[1], "\x00", 1);
 #endif
@@ -116,6 +159,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_select_single(ChiakiStopPipe *sto
 		default:
 			return CHIAKI_ERR_UNKNOWN;
 	}
+#elif defined(__linux__)
+	if(CHIAKI_SOCKET_IS_INVALID(fd))
+		return stop_pipe_epoll_wait(stop_pipe, NULL, 0, EPOLLIN, timeout_ms, NULL);
+	return stop_pipe_epoll_wait(stop_pipe, &fd, 1, write ? EPOLLOUT : EPOLLIN, timeout_ms, NULL);
 #else
 	fd_set rfds;
 	FD_ZERO(&rfds);
@@ -170,6 +217,233 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_select_single(ChiakiStopPipe *sto
 #endif
 }
 
+CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_select_multi(ChiakiStopPipe *stop_pipe, chiaki_socket_t *fds, size_t fds_count, uint64_t timeout_ms, bool *readable)
+{
+	if(fds_count > CHIAKI_STOP_PIPE_SELECT_MULTI_MAX)
+		return CHIAKI_ERR_INVALID_DATA;
+
+	if(readable)
+	{
+		for(size_t i=0; i<fds_count; i++)
+			readable[i] = false;
+	}
+
+#ifdef _WIN32
+	WSAEVENT events[CHIAKI_STOP_PIPE_SELECT_MULTI_MAX + 1];
+	DWORD events_count = 1;
+	events[0] = stop_pipe->event;
+
+	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+	for(size_t i=0; i<fds_count; i++)
+	{
+		events[events_count] = WSACreateEvent();
+		if(events[events_count] == WSA_INVALID_EVENT)
+		{
+			err = CHIAKI_ERR_UNKNOWN;
+			goto beach;
+		}
+		WSAEventSelect(fds[i], events[events_count], FD_READ);
+		events_count++;
+	}
+
+	DWORD r = WSAWaitForMultipleEvents(events_count, events, FALSE, timeout_ms == UINT64_MAX ? WSA_INFINITE : (DWORD)timeout_ms, FALSE);
+	if(r == WSA_WAIT_EVENT_0)
+		err = CHIAKI_ERR_CANCELED;
+	else if(r > WSA_WAIT_EVENT_0 && r < WSA_WAIT_EVENT_0 + events_count)
+	{
+		// only the first signaled event is returned, so look at the others too
+		if(readable)
+		{
+			for(size_t i=0; i<fds_count; i++)
+				readable[i] = WSAWaitForMultipleEvents(1, &events[i + 1], FALSE, 0, FALSE) == WSA_WAIT_EVENT_0;
+		}
+	}
+	else if(r == WSA_WAIT_TIMEOUT)
+		err = CHIAKI_ERR_TIMEOUT;
+	else
+		err = CHIAKI_ERR_UNKNOWN;
+
+beach:
+	for(DWORD i=1; i<events_count; i++)
+		WSACloseEvent(events[i]);
+	return err;
+#elif defined(__linux__)
+	return stop_pipe_epoll_wait(stop_pipe, fds, fds_count, EPOLLIN, timeout_ms, readable);
+#elif defined(__SWITCH__)
+	return stop_pipe_poll(stop_pipe->fd, fds, fds_count, POLLIN, timeout_ms, readable);
+#else
+	return stop_pipe_poll(stop_pipe->fds[0], fds, fds_count, POLLIN, timeout_ms, readable);
+#endif
+}
+
+#ifndef _WIN32
+static int stop_pipe_poll_timeout(uint64_t timeout_ms)
+{
+	if(timeout_ms == UINT64_MAX)
+		return -1;
+	return timeout_ms > INT_MAX ? INT_MAX : (int)timeout_ms;
+}
+
+static ChiakiErrorCode stop_pipe_poll(int stop_fd, const chiaki_socket_t *fds, size_t fds_count, short events, uint64_t timeout_ms, bool *ready)
+{
+	struct pollfd pfds[CHIAKI_STOP_PIPE_SELECT_MULTI_MAX + 1];
+	pfds[0].fd = stop_fd;
+	pfds[0].events = POLLIN;
+	for(size_t i=0; i<fds_count; i++)
+	{
+		pfds[i + 1].fd = fds[i];
+		pfds[i + 1].events = events;
+	}
+
+	int timeout = stop_pipe_poll_timeout(timeout_ms);
+	int r;
+	do
+	{
+		r = poll(pfds, (nfds_t)(fds_count + 1), timeout);
+	} while(r < 0 && errno == EINTR);
+
+	if(r < 0)
+		return CHIAKI_ERR_UNKNOWN;
+
+	if(pfds[0].revents & POLLIN)
+		return CHIAKI_ERR_CANCELED;
+
+	bool any = false;
+	for(size_t i=0; i<fds_count; i++)
+	{
+		// errors are reported as ready so the caller's recv picks them up
+		bool fd_ready = (pfds[i + 1].revents & (events | POLLERR | POLLHUP)) != 0;
+		if(ready)
+			ready[i] = fd_ready;
+		any = any || fd_ready;
+	}
+
+	return any ? CHIAKI_ERR_SUCCESS : CHIAKI_ERR_TIMEOUT;
+}
+#endif
+
+#if defined(__linux__)
+/**
+ * Bring the epoll set in line with fds, which should usually be a no-op because the same sockets are waited on every time.
+ * Must be called with epoll_mutex locked.
+ */
+static ChiakiErrorCode stop_pipe_epoll_update(ChiakiStopPipe *stop_pipe, const chiaki_socket_t *fds, size_t fds_count, uint32_t events)
+{
+	// sockets from earlier waits would wake up every wait if they stayed registered
+	for(size_t i=0; i<stop_pipe->epoll_fds_count;)
+	{
+		bool wanted = false;
+		for(size_t j=0; j<fds_count; j++)
+			wanted = wanted || fds[j] == stop_pipe->epoll_fds[i].fd;
+		if(wanted)
+		{
+			i++;
+			continue;
+		}
+		// fails harmlessly if the socket has been closed in the meantime, which already removed it
+		epoll_ctl(stop_pipe->epoll_fd, EPOLL_CTL_DEL, stop_pipe->epoll_fds[i].fd, NULL);
+		stop_pipe->epoll_fds[i] = stop_pipe->epoll_fds[--stop_pipe->epoll_fds_count];
+	}
+
+	for(size_t i=0; i<fds_count; i++)
+	{
+		ChiakiStopPipeEpollFd *entry = NULL;
+		for(size_t j=0; j<stop_pipe->epoll_fds_count; j++)
+		{
+			if(stop_pipe->epoll_fds[j].fd == fds[i])
+			{
+				entry = &stop_pipe->epoll_fds[j];
+				break;
+			}
+		}
+
+		struct epoll_event event = { 0 };
+		event.events = events;
+		event.data.fd = fds[i];
+		// Always try to add: if the socket was closed and its fd reused since the last wait,
+		// the kernel has dropped it from the set even though it is still in epoll_fds.
+		if(epoll_ctl(stop_pipe->epoll_fd, EPOLL_CTL_ADD, fds[i], &event) < 0)
+		{
+			if(errno != EEXIST)
+				return CHIAKI_ERR_UNKNOWN;
+			if(entry && entry->events == events)
+				continue;
+			if(epoll_ctl(stop_pipe->epoll_fd, EPOLL_CTL_MOD, fds[i], &event) < 0)
+				return CHIAKI_ERR_UNKNOWN;
+		}
+
+		if(!entry)
+		{
+			// fds_count is limited, and everything not in fds was removed above
+			entry = &stop_pipe->epoll_fds[stop_pipe->epoll_fds_count++];
+			entry->fd = fds[i];
+		}
+		entry->events = events;
+	}
+
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static ChiakiErrorCode stop_pipe_epoll_wait(ChiakiStopPipe *stop_pipe, const chiaki_socket_t *fds, size_t fds_count, uint32_t events, uint64_t timeout_ms, bool *ready)
+{
+	if(chiaki_mutex_trylock(&stop_pipe->epoll_mutex) != CHIAKI_ERR_SUCCESS)
+	{
+		// another thread is waiting on its own sockets with the same stop pipe
+		return stop_pipe_poll(stop_pipe->event_fd, fds, fds_count, events == EPOLLOUT ? POLLOUT : POLLIN, timeout_ms, ready);
+	}
+
+	ChiakiErrorCode err = stop_pipe_epoll_update(stop_pipe, fds, fds_count, events);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto beach;
+
+	struct epoll_event ready_events[CHIAKI_STOP_PIPE_SELECT_MULTI_MAX + 1];
+	int timeout = stop_pipe_poll_timeout(timeout_ms);
+	int r;
+	do
+	{
+		r = epoll_wait(stop_pipe->epoll_fd, ready_events, (int)(fds_count + 1), timeout);
+	} while(r < 0 && errno == EINTR);
+
+	if(r < 0)
+	{
+		err = CHIAKI_ERR_UNKNOWN;
+		goto beach;
+	}
+
+	if(ready)
+	{
+		for(size_t i=0; i<fds_count; i++)
+			ready[i] = false;
+	}
+
+	err = CHIAKI_ERR_TIMEOUT;
+	for(int i=0; i<r; i++)
+	{
+		if(ready_events[i].data.fd == stop_pipe->event_fd)
+		{
+			err = CHIAKI_ERR_CANCELED;
+			break;
+		}
+		// errors are reported as ready so the caller's recv picks them up
+		if(!(ready_events[i].events & (events | EPOLLERR | EPOLLHUP)))
+			continue;
+		err = CHIAKI_ERR_SUCCESS;
+		if(ready)
+		{
+			for(size_t j=0; j<fds_count; j++)
+			{
+				if(fds[j] == ready_events[i].data.fd)
+					ready[j] = true;
+			}
+		}
+	}
+
+beach:
+	chiaki_mutex_unlock(&stop_pipe->epoll_mutex);
+	return err;
+}
+#endif
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_connect(ChiakiStopPipe *stop_pipe, chiaki_socket_t fd, struct sockaddr *addr, size_t addrlen)
 {
 	int r = connect(fd, addr, (socklen_t)addrlen);
@@ -260,6 +534,12 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stop_pipe_reset(ChiakiStopPipe *stop_pipe)
 	int r;
 	while((r = read(stop_pipe->fd, &v, sizeof(v))) > 0);
 	return r < 0 ? CHIAKI_ERR_UNKNOWN : CHIAKI_ERR_SUCCESS;
+#elif defined(__linux__)
+	// reading an eventfd resets its counter at once
+	uint64_t v;
+	if(read(stop_pipe->event_fd, &v, sizeof(v)) < 0 && errno != EAGAIN)
+		return CHIAKI_ERR_UNKNOWN;
+	return CHIAKI_ERR_SUCCESS;
 #else
 	uint8_t v;
 	int r;
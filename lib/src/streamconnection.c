@@ -43,6 +43,7 @@ typedef enum {
 } StreamConnectionState;
 
 void chiaki_session_send_event(ChiakiSession *session, ChiakiEvent *event);
+void chiaki_session_startup_finished(ChiakiSession *session);
 
 static void stream_connection_takion_cb(ChiakiTakionEvent *event, void *user);
 static void stream_connection_takion_data(ChiakiStreamConnection *stream_connection, ChiakiTakionMessageDataType data_type, uint8_t *buf, size_t buf_size);
@@ -71,6 +72,9 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_init(ChiakiStreamConnecti
 	stream_connection->gkcrypt_remote = NULL;
 	stream_connection->gkcrypt_local = NULL;
 	stream_connection->motion_counter = 0;
+	stream_connection->measured_bitrate = 0;
+	stream_connection->metric_bitrate_kbps = chiaki_metrics_register_gauge(chiaki_metrics_default(), "stream.bitrate_kbps");
+	chiaki_metric_set(stream_connection->metric_bitrate_kbps, 0);
 
 	ChiakiErrorCode err = chiaki_mutex_init(&stream_connection->state_mutex, false);
 	if(err != CHIAKI_ERR_SUCCESS)
@@ -92,6 +96,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_init(ChiakiStreamConnecti
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_packet_stats;
 
+	err = chiaki_link_quality_init(&stream_connection->link_quality, 0);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_feedback_sender_mutex;
+
 	stream_connection->state = STATE_IDLE;
 	stream_connection->state_finished = false;
 	stream_connection->state_failed = false;
@@ -101,6 +109,8 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_init(ChiakiStreamConnecti
 
 	return CHIAKI_ERR_SUCCESS;
 
+error_feedback_sender_mutex:
+	chiaki_mutex_fini(&stream_connection->feedback_sender_mutex);
 error_packet_stats:
 	chiaki_packet_stats_fini(&stream_connection->packet_stats);
 error_state_cond:
@@ -125,6 +135,7 @@ CHIAKI_EXPORT void chiaki_stream_connection_fini(ChiakiStreamConnection *stream_
 	chiaki_packet_stats_fini(&stream_connection->packet_stats);
 
 	chiaki_mutex_fini(&stream_connection->feedback_sender_mutex);
+	chiaki_link_quality_fini(&stream_connection->link_quality);
 
 	chiaki_cond_fini(&stream_connection->state_cond);
 	chiaki_mutex_fini(&stream_connection->state_mutex);
@@ -163,6 +174,13 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 	takion_info.cb = stream_connection_takion_cb;
 	takion_info.cb_user = stream_connection;
 
+	// Senkusha's RTT is only a seed, the estimate follows the link from the first acked packet on.
+	// Its fallback is no measurement at all, so the default timeout applies instead.
+	chiaki_link_quality_reset(&stream_connection->link_quality, session->mtu_measured ? session->rtt_us : 0);
+	takion_info.link_quality = &stream_connection->link_quality;
+	takion_info.thread_attrs = &session->connect_info.thread_profile.network;
+	takion_info.socket_tuning = &session->connect_info.socket_tuning;
+
 	err = chiaki_mutex_lock(&stream_connection->state_mutex);
 	assert(err == CHIAKI_ERR_SUCCESS);
 
@@ -172,7 +190,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 		goto quit_label; \
 	} } while(0)
 
-	stream_connection->audio_receiver = chiaki_audio_receiver_new(session, &stream_connection->packet_stats);
+	stream_connection->audio_receiver = chiaki_audio_receiver_new(session, &stream_connection->packet_stats, "audio");
 	if(!stream_connection->audio_receiver)
 	{
 		CHIAKI_LOGE(session->log, "StreamConnection failed to initialize Audio Receiver");
@@ -182,7 +200,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 		return CHIAKI_ERR_UNKNOWN;
 	}
 
-	stream_connection->haptics_receiver = chiaki_audio_receiver_new(session, NULL);
+	stream_connection->haptics_receiver = chiaki_audio_receiver_new(session, NULL, "haptics");
 	if(!stream_connection->haptics_receiver)
 	{
 		CHIAKI_LOGE(session->log, "StreamConnection failed to initialize Haptics Receiver");
@@ -212,7 +230,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 		goto err_video_receiver;
 	}
 
-	err = chiaki_congestion_control_start(&stream_connection->congestion_control, &stream_connection->takion, &stream_connection->packet_stats, stream_connection->packet_loss_max);
+	err = chiaki_congestion_control_start(&stream_connection->congestion_control, &stream_connection->takion, &stream_connection->packet_stats, &stream_connection->link_quality, stream_connection->packet_loss_max);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		CHIAKI_LOGE(session->log, "StreamConnection failed to start Congestion Control");
@@ -296,6 +314,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 	event.type = CHIAKI_EVENT_CONNECTED;
 	chiaki_mutex_unlock(&stream_connection->state_mutex);
 	chiaki_session_send_event(session, &event);
+	chiaki_session_startup_finished(session);
 	err = chiaki_mutex_lock(&stream_connection->state_mutex);
 	assert(err == CHIAKI_ERR_SUCCESS);
 
@@ -614,6 +633,7 @@ static void stream_connection_takion_data_idle(ChiakiStreamConnection *stream_co
 			 q.disable_upstream_audio, q.rtt, q.loss);
 		stream_connection->measured_bitrate = chiaki_stream_stats_bitrate(&stream_connection->video_receiver->frame_processor.stream_stats, stream_connection->session->connect_info.video_profile.max_fps) / 1000000.0;
 		CHIAKI_LOGV(stream_connection->log, "StreamConnection measured bitrate: %.4f MBit/s", stream_connection->measured_bitrate);
+		chiaki_metric_set(stream_connection->metric_bitrate_kbps, (int64_t)(stream_connection->measured_bitrate * 1000.0));
 		chiaki_stream_stats_reset(&stream_connection->video_receiver->frame_processor.stream_stats);
 		break;
 	}
@@ -633,13 +653,13 @@ static ChiakiErrorCode stream_connection_init_crypt(ChiakiStreamConnection *stre
 {
 	ChiakiSession *session = stream_connection->session;
 
-	stream_connection->gkcrypt_local = chiaki_gkcrypt_new(stream_connection->log, CHIAKI_GKCRYPT_KEY_BUF_BLOCKS_DEFAULT, 2, session->handshake_key, stream_connection->ecdh_secret);
+	stream_connection->gkcrypt_local = chiaki_gkcrypt_new(stream_connection->log, CHIAKI_GKCRYPT_KEY_BUF_BLOCKS_DEFAULT, 2, session->handshake_key, stream_connection->ecdh_secret, &session->connect_info.thread_profile.crypt);
 	if(!stream_connection->gkcrypt_local)
 	{
 		CHIAKI_LOGE(stream_connection->log, "StreamConnection failed to initialize local GKCrypt with index 2");
 		return CHIAKI_ERR_UNKNOWN;
 	}
-	stream_connection->gkcrypt_remote = chiaki_gkcrypt_new(stream_connection->log, CHIAKI_GKCRYPT_KEY_BUF_BLOCKS_DEFAULT, 3, session->handshake_key, stream_connection->ecdh_secret);
+	stream_connection->gkcrypt_remote = chiaki_gkcrypt_new(stream_connection->log, CHIAKI_GKCRYPT_KEY_BUF_BLOCKS_DEFAULT, 3, session->handshake_key, stream_connection->ecdh_secret, &session->connect_info.thread_profile.crypt);
 	if(!stream_connection->gkcrypt_remote)
 	{
 		CHIAKI_LOGE(stream_connection->log, "StreamConnection failed to initialize remote GKCrypt with index 3");
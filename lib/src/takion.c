@@ -30,6 +30,13 @@
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#endif
+
+#if defined(SO_TIMESTAMPNS) || (defined(SO_TIMESTAMP) && !defined(_WIN32) && !defined(__SWITCH__))
+// chiaki_socket_tuning_apply() enables the same option
+#define TAKION_RECV_TIMESTAMPS
 #endif
 
 
@@ -41,6 +48,7 @@
 
 #define TAKION_REORDER_QUEUE_SIZE_EXP 4 // => 16 entries
 #define TAKION_SEND_BUFFER_SIZE 16
+#define TAKION_SEND_SCHEDULER_QUEUE_SIZE 64
 
 #define TAKION_POSTPONE_PACKETS_SIZE 32
 
@@ -158,10 +166,11 @@ typedef struct chiaki_takion_postponed_packet_t
 {
 	uint8_t *buf;
 	size_t buf_size;
+	uint64_t arrival_us;
 } ChiakiTakionPostponedPacket;
 
 static void *takion_thread_func(void *user);
-static void takion_handle_packet(ChiakiTakion *takion, uint8_t *buf, size_t buf_size);
+static void takion_handle_packet(ChiakiTakion *takion, uint8_t *buf, size_t buf_size, uint64_t arrival_us);
 static ChiakiErrorCode takion_handle_packet_mac(ChiakiTakion *takion, uint8_t base_type, uint8_t *buf, size_t buf_size);
 static void takion_handle_packet_message(ChiakiTakion *takion, uint8_t *buf, size_t buf_size);
 static void takion_handle_packet_message_data(ChiakiTakion *takion, uint8_t *packet_buf, size_t packet_buf_size, uint8_t type_b, uint8_t *payload, size_t payload_size);
@@ -170,10 +179,13 @@ static ChiakiErrorCode takion_parse_message(ChiakiTakion *takion, uint8_t *buf,
 static void takion_write_message_header(uint8_t *buf, uint32_t tag, uint64_t key_pos, uint8_t chunk_type, uint8_t chunk_flags, size_t payload_data_size);
 static ChiakiErrorCode takion_send_message_init(ChiakiTakion *takion, TakionMessagePayloadInit *payload);
 static ChiakiErrorCode takion_send_message_cookie(ChiakiTakion *takion, uint8_t *cookie);
-static ChiakiErrorCode takion_recv(ChiakiTakion *takion, uint8_t *buf, size_t *buf_size, uint64_t timeout_ms);
+static ChiakiErrorCode takion_recv(ChiakiTakion *takion, uint8_t *buf, size_t *buf_size, uint64_t *arrival_us, uint64_t timeout_ms);
+#ifdef TAKION_RECV_TIMESTAMPS
+static CHIAKI_SSIZET_TYPE takion_recv_timestamped(ChiakiTakion *takion, uint8_t *buf, size_t buf_size, uint64_t *arrival_us);
+#endif
 static ChiakiErrorCode takion_recv_message_init_ack(ChiakiTakion *takion, TakionMessagePayloadInitAck *payload);
 static ChiakiErrorCode takion_recv_message_cookie_ack(ChiakiTakion *takion);
-static void takion_handle_packet_av(ChiakiTakion *takion, uint8_t base_type, uint8_t *buf, size_t buf_size);
+static void takion_handle_packet_av(ChiakiTakion *takion, uint8_t base_type, uint8_t *buf, size_t buf_size, uint64_t arrival_us);
 static ChiakiErrorCode takion_read_extra_sock_messages(ChiakiTakion *takion);
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_connect(ChiakiTakion *takion, ChiakiTakionConnectInfo *info, chiaki_socket_t *sock)
@@ -182,6 +194,12 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_connect(ChiakiTakion *takion, Chiaki
 
 	takion->log = info->log;
 	takion->close_socket = info->close_socket;
+
+	ChiakiMetrics *metrics = chiaki_metrics_default();
+	takion->metrics.packets_received = chiaki_metrics_register_counter(metrics, "takion.packets_received");
+	takion->metrics.bytes_received = chiaki_metrics_register_counter(metrics, "takion.bytes_received");
+	takion->metrics.mac_failures = chiaki_metrics_register_counter(metrics, "takion.mac_failures");
+	takion->metrics.postponed_packets = chiaki_metrics_register_counter(metrics, "takion.postponed_packets");
 	takion->version = info->protocol_version;
 
 	switch(takion->version)
@@ -222,6 +240,11 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_connect(ChiakiTakion *takion, Chiaki
 	takion->postponed_packets_size = 0;
 	takion->postponed_packets_count = 0;
 	takion->enable_dualsense = info->enable_dualsense;
+	takion->link_quality = info->link_quality;
+	if(info->thread_attrs)
+		takion->thread_attrs = *info->thread_attrs;
+	else
+		memset(&takion->thread_attrs, 0, sizeof(takion->thread_attrs));
 
 	CHIAKI_LOGI(takion->log, "Takion connecting (version %u)", (unsigned int)info->protocol_version);
 	bool mac_dontfrag = true;
@@ -242,14 +265,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_connect(ChiakiTakion *takion, Chiaki
 			CHIAKI_LOGE(takion->log, "Takion had problem reading extra messages from socket using PSN Connection with error: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
 			goto error_sock;
 		}
-		const int rcvbuf_val = takion->a_rwnd;
-		int r = setsockopt(takion->sock, SOL_SOCKET, SO_RCVBUF, (const CHIAKI_SOCKET_BUF_TYPE)&rcvbuf_val, sizeof(rcvbuf_val));
-		if(r < 0)
-		{
-			CHIAKI_LOGE(takion->log, "Takion failed to setsockopt SO_RCVBUF: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-			ret = CHIAKI_ERR_NETWORK;
+		ret = chiaki_socket_tuning_apply(takion->sock, info->socket_tuning, (int)takion->a_rwnd, &takion->socket_tuning, takion->log);
+		if(ret != CHIAKI_ERR_SUCCESS)
 			goto error_sock;
-		}
+		int r = 0;
 
 #if defined(__APPLE__)
 		SInt32 majorVersion;
@@ -330,14 +349,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_connect(ChiakiTakion *takion, Chiaki
 			ret = CHIAKI_ERR_NETWORK;
 			goto error_pipe;
 		}
-		const int rcvbuf_val = takion->a_rwnd;
-		int r = setsockopt(takion->sock, SOL_SOCKET, SO_RCVBUF, (const CHIAKI_SOCKET_BUF_TYPE)&rcvbuf_val, sizeof(rcvbuf_val));
-		if(r < 0)
-		{
-			CHIAKI_LOGE(takion->log, "Takion failed to setsockopt SO_RCVBUF: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
-			ret = CHIAKI_ERR_NETWORK;
+		ret = chiaki_socket_tuning_apply(takion->sock, info->socket_tuning, (int)takion->a_rwnd, &takion->socket_tuning, takion->log);
+		if(ret != CHIAKI_ERR_SUCCESS)
 			goto error_sock;
-		}
+		int r = 0;
 		if(info->ip_dontfrag)
 		{
 #if defined(__APPLE__)
@@ -393,6 +408,16 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_connect(ChiakiTakion *takion, Chiaki
 		}
 	}
 
+	if(takion->link_quality)
+		chiaki_link_quality_set_socket(takion->link_quality, &takion->socket_tuning);
+
+	ret = chiaki_takion_send_scheduler_init(&takion->send_scheduler, takion, TAKION_SEND_SCHEDULER_QUEUE_SIZE);
+	if(ret != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(takion->log, "Takion failed to init send scheduler");
+		goto error_sock;
+	}
+
 	err = chiaki_thread_create(&takion->thread, takion_thread_func, takion);
 
 	chiaki_thread_set_name(&takion->thread, "Chiaki Takion");
@@ -418,6 +443,7 @@ CHIAKI_EXPORT void chiaki_takion_close(ChiakiTakion *takion)
 {
 	chiaki_stop_pipe_stop(&takion->stop_pipe);
 	chiaki_thread_join(&takion->thread, NULL);
+	chiaki_takion_send_scheduler_fini(&takion->send_scheduler);
 	chiaki_stop_pipe_fini(&takion->stop_pipe);
 	chiaki_mutex_fini(&takion->seq_num_local_mutex);
 	chiaki_mutex_fini(&takion->gkcrypt_local_mutex);
@@ -541,26 +567,33 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_message_data(ChiakiTakion *taki
 	// TODO: can we make this more memory-efficient?
 	// TODO: split packet if necessary?
 
-	uint64_t key_pos;
-	ChiakiErrorCode err = chiaki_takion_crypt_advance_key_pos(takion, buf_size, &key_pos);
-	if(err != CHIAKI_ERR_SUCCESS)
-		return err;
-
 	size_t packet_size = 1 + TAKION_MESSAGE_HEADER_SIZE + 9 + buf_size;
 	uint8_t *packet_buf = malloc(packet_size);
 	if(!packet_buf)
 		return CHIAKI_ERR_MEMORY;
 	packet_buf[0] = TAKION_PACKET_TYPE_CONTROL;
 
-	takion_write_message_header(packet_buf + 1, takion->tag_remote, key_pos, TAKION_CHUNK_TYPE_DATA, chunk_flags, 9 + buf_size);
+	takion_write_message_header(packet_buf + 1, takion->tag_remote, 0, TAKION_CHUNK_TYPE_DATA, chunk_flags, 9 + buf_size); // key pos is set when sent
 
 	uint8_t *msg_payload = packet_buf + 1 + TAKION_MESSAGE_HEADER_SIZE;
 
-	err = chiaki_mutex_lock(&takion->seq_num_local_mutex);
+	ChiakiErrorCode err = chiaki_mutex_lock(&takion->seq_num_local_mutex);
 	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		free(packet_buf);
 		return err;
-	ChiakiSeqNum32 seq_num_val = takion->seq_num_local++;
-	chiaki_mutex_unlock(&takion->seq_num_local_mutex);
+	}
+	// a seq num is only used up once the packet is sure to be sent and tracked,
+	// the console would wait forever for one that is dropped on the way
+	err = chiaki_takion_send_buffer_reserve(&takion->send_buffer);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		chiaki_mutex_unlock(&takion->seq_num_local_mutex);
+		free(packet_buf);
+		CHIAKI_LOGE(takion->log, "Takion failed to send data packet, send buffer is full");
+		return err;
+	}
+	ChiakiSeqNum32 seq_num_val = takion->seq_num_local;
 
 	*((chiaki_unaligned_uint32_t *)(msg_payload + 0)) = htonl(seq_num_val);
 	*((chiaki_unaligned_uint16_t *)(msg_payload + 4)) = htons(channel);
@@ -568,16 +601,24 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_message_data(ChiakiTakion *taki
 	*(msg_payload + 8) = 0;
 	memcpy(msg_payload + 9, buf, buf_size);
 
-	err = chiaki_takion_send(takion, packet_buf, packet_size, key_pos); // will alter packet_buf with gmac
+	ChiakiTakionSendPacket send_packet = { 0 };
+	send_packet.crypt = CHIAKI_TAKION_SEND_CRYPT_MAC;
+	send_packet.key_pos_advance = buf_size;
+	send_packet.key_pos_offset = takion_packet_type_key_pos_offset(TAKION_PACKET_TYPE_CONTROL);
+	send_packet.reliable = true;
+	send_packet.seq_num = seq_num_val;
+	err = chiaki_takion_send_scheduler_push(&takion->send_scheduler, CHIAKI_TAKION_SEND_CLASS_CONTROL, &send_packet, packet_buf, packet_size); // takes packet_buf
+	if(err == CHIAKI_ERR_SUCCESS)
+		takion->seq_num_local++;
+	else
+		chiaki_takion_send_buffer_unreserve(&takion->send_buffer);
+	chiaki_mutex_unlock(&takion->seq_num_local_mutex);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		CHIAKI_LOGE(takion->log, "Takion failed to send data packet: %s", chiaki_error_string(err));
-		free(packet_buf);
 		return err;
 	}
 
-	chiaki_takion_send_buffer_push(&takion->send_buffer, seq_num_val, packet_buf, packet_size);
-
 	if(seq_num)
 		*seq_num = seq_num_val;
 
@@ -589,42 +630,57 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_message_data_cont(ChiakiTakion
 	// TODO: can we make this more memory-efficient?
 	// TODO: split packet if necessary?
 
-	uint64_t key_pos;
-	ChiakiErrorCode err = chiaki_takion_crypt_advance_key_pos(takion, buf_size, &key_pos);
-	if(err != CHIAKI_ERR_SUCCESS)
-		return err;
-
 	size_t packet_size = 1 + TAKION_MESSAGE_HEADER_SIZE + 8 + buf_size;
 	uint8_t *packet_buf = malloc(packet_size);
 	if(!packet_buf)
 		return CHIAKI_ERR_MEMORY;
 	packet_buf[0] = TAKION_PACKET_TYPE_CONTROL;
 
-	takion_write_message_header(packet_buf + 1, takion->tag_remote, key_pos, TAKION_CHUNK_TYPE_DATA, chunk_flags, 8 + buf_size);
+	takion_write_message_header(packet_buf + 1, takion->tag_remote, 0, TAKION_CHUNK_TYPE_DATA, chunk_flags, 8 + buf_size); // key pos is set when sent
 
 	uint8_t *msg_payload = packet_buf + 1 + TAKION_MESSAGE_HEADER_SIZE;
 
-	err = chiaki_mutex_lock(&takion->seq_num_local_mutex);
+	ChiakiErrorCode err = chiaki_mutex_lock(&takion->seq_num_local_mutex);
 	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		free(packet_buf);
 		return err;
-	ChiakiSeqNum32 seq_num_val = takion->seq_num_local++;
-	chiaki_mutex_unlock(&takion->seq_num_local_mutex);
+	}
+	// a seq num is only used up once the packet is sure to be sent and tracked,
+	// the console would wait forever for one that is dropped on the way
+	err = chiaki_takion_send_buffer_reserve(&takion->send_buffer);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		chiaki_mutex_unlock(&takion->seq_num_local_mutex);
+		free(packet_buf);
+		CHIAKI_LOGE(takion->log, "Takion failed to send data packet, send buffer is full");
+		return err;
+	}
+	ChiakiSeqNum32 seq_num_val = takion->seq_num_local;
 
 	*((chiaki_unaligned_uint32_t *)(msg_payload + 0)) = htonl(seq_num_val);
 	*((chiaki_unaligned_uint16_t *)(msg_payload + 4)) = htons(channel);
 	*((chiaki_unaligned_uint16_t *)(msg_payload + 6)) = 0;
 	memcpy(msg_payload + 8, buf, buf_size);
 
-	err = chiaki_takion_send(takion, packet_buf, packet_size, key_pos); // will alter packet_buf with gmac
+	ChiakiTakionSendPacket send_packet = { 0 };
+	send_packet.crypt = CHIAKI_TAKION_SEND_CRYPT_MAC;
+	send_packet.key_pos_advance = buf_size;
+	send_packet.key_pos_offset = takion_packet_type_key_pos_offset(TAKION_PACKET_TYPE_CONTROL);
+	send_packet.reliable = true;
+	send_packet.seq_num = seq_num_val;
+	err = chiaki_takion_send_scheduler_push(&takion->send_scheduler, CHIAKI_TAKION_SEND_CLASS_CONTROL, &send_packet, packet_buf, packet_size); // takes packet_buf
+	if(err == CHIAKI_ERR_SUCCESS)
+		takion->seq_num_local++;
+	else
+		chiaki_takion_send_buffer_unreserve(&takion->send_buffer);
+	chiaki_mutex_unlock(&takion->seq_num_local_mutex);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		CHIAKI_LOGE(takion->log, "Takion failed to send data packet: %s", chiaki_error_string(err));
-		free(packet_buf);
 		return err;
 	}
 
-	chiaki_takion_send_buffer_push(&takion->send_buffer, seq_num_val, packet_buf, packet_size);
-
 	if(seq_num)
 		*seq_num = seq_num_val;
 
@@ -636,12 +692,7 @@ static ChiakiErrorCode chiaki_takion_send_message_data_ack(ChiakiTakion *takion,
 	uint8_t buf[1 + TAKION_MESSAGE_HEADER_SIZE + 0xc];
 	buf[0] = TAKION_PACKET_TYPE_CONTROL;
 
-	uint64_t key_pos;
-	ChiakiErrorCode err = chiaki_takion_crypt_advance_key_pos(takion, sizeof(buf), &key_pos);
-	if(err != CHIAKI_ERR_SUCCESS)
-		return err;
-
-	takion_write_message_header(buf + 1, takion->tag_remote, key_pos, TAKION_CHUNK_TYPE_DATA_ACK, 0, 0xc);
+	takion_write_message_header(buf + 1, takion->tag_remote, 0, TAKION_CHUNK_TYPE_DATA_ACK, 0, 0xc);
 
 	uint8_t *data_ack = buf + 1 + TAKION_MESSAGE_HEADER_SIZE;
 	*((chiaki_unaligned_uint32_t *)(data_ack + 0)) = htonl(seq_num);
@@ -649,7 +700,11 @@ static ChiakiErrorCode chiaki_takion_send_message_data_ack(ChiakiTakion *takion,
 	*((chiaki_unaligned_uint16_t *)(data_ack + 8)) = 0;
 	*((chiaki_unaligned_uint16_t *)(data_ack + 0xa)) = 0;
 
-	return chiaki_takion_send(takion, buf, sizeof(buf), key_pos);
+	ChiakiTakionSendPacket send_packet = { 0 };
+	send_packet.crypt = CHIAKI_TAKION_SEND_CRYPT_MAC;
+	send_packet.key_pos_advance = sizeof(buf);
+	send_packet.key_pos_offset = takion_packet_type_key_pos_offset(TAKION_PACKET_TYPE_CONTROL);
+	return chiaki_takion_send_scheduler_push(&takion->send_scheduler, CHIAKI_TAKION_SEND_CLASS_CONTROL, &send_packet, buf, sizeof(buf));
 }
 
 CHIAKI_EXPORT void chiaki_takion_format_congestion(uint8_t *buf, ChiakiTakionCongestionPacket *packet, uint64_t key_pos)
@@ -664,46 +719,26 @@ CHIAKI_EXPORT void chiaki_takion_format_congestion(uint8_t *buf, ChiakiTakionCon
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_congestion(ChiakiTakion *takion, ChiakiTakionCongestionPacket *packet)
 {
-	uint64_t key_pos;
-	ChiakiErrorCode err = chiaki_takion_crypt_advance_key_pos(takion, CHIAKI_TAKION_CONGESTION_PACKET_SIZE, &key_pos);
-	if(err != CHIAKI_ERR_SUCCESS)
-		return err;
-
 	uint8_t buf[CHIAKI_TAKION_CONGESTION_PACKET_SIZE];
-	chiaki_takion_format_congestion(buf, packet, key_pos);
-	return chiaki_takion_send(takion, buf, sizeof(buf), key_pos);
+	chiaki_takion_format_congestion(buf, packet, 0);
+
+	ChiakiTakionSendPacket send_packet = { 0 };
+	send_packet.crypt = CHIAKI_TAKION_SEND_CRYPT_MAC;
+	send_packet.key_pos_advance = CHIAKI_TAKION_CONGESTION_PACKET_SIZE;
+	send_packet.key_pos_offset = takion_packet_type_key_pos_offset(TAKION_PACKET_TYPE_CONGESTION);
+	return chiaki_takion_send_scheduler_push(&takion->send_scheduler, CHIAKI_TAKION_SEND_CLASS_CONTROL, &send_packet, buf, sizeof(buf));
 }
 
 static ChiakiErrorCode takion_send_feedback_packet(ChiakiTakion *takion, uint8_t *buf, size_t buf_size)
 {
 	assert(buf_size >= 0xc);
 
-	size_t payload_size = buf_size - 0xc;
-
-	ChiakiErrorCode err = chiaki_mutex_lock(&takion->gkcrypt_local_mutex);
-	if(err != CHIAKI_ERR_SUCCESS)
-		return err;
-
-	uint64_t key_pos;
-	err = chiaki_takion_crypt_advance_key_pos(takion, payload_size + CHIAKI_GKCRYPT_BLOCK_SIZE, &key_pos);
-	if(err != CHIAKI_ERR_SUCCESS)
-		goto beach;
-
-	err = chiaki_gkcrypt_encrypt(takion->gkcrypt_local, key_pos + CHIAKI_GKCRYPT_BLOCK_SIZE, buf + 0xc, payload_size);
-	if(err != CHIAKI_ERR_SUCCESS)
-		goto beach;
-
-	*((chiaki_unaligned_uint32_t *)(buf + 4)) = htonl((uint32_t)key_pos);
-
-	err = chiaki_gkcrypt_gmac(takion->gkcrypt_local, key_pos, buf, buf_size, buf + 8);
-	if(err != CHIAKI_ERR_SUCCESS)
-		goto beach;
-
-	chiaki_takion_send_raw(takion, buf, buf_size);
-
-beach:
-	chiaki_mutex_unlock(&takion->gkcrypt_local_mutex);
-	return err;
+	ChiakiTakionSendPacket send_packet = { 0 };
+	send_packet.crypt = CHIAKI_TAKION_SEND_CRYPT_ENCRYPT;
+	send_packet.payload_offset = 0xc;
+	send_packet.key_pos_offset = 4;
+	send_packet.mac_offset = 8;
+	return chiaki_takion_send_scheduler_push(&takion->send_scheduler, CHIAKI_TAKION_SEND_CLASS_INPUT, &send_packet, buf, buf_size);
 }
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_feedback_state(ChiakiTakion *takion, ChiakiSeqNum16 seq_num, ChiakiFeedbackState *feedback_state)
@@ -733,31 +768,15 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_mic_packet(ChiakiTakion *takion
 	uint8_t ps5_packet = 0;
 	if(ps5)
 		ps5_packet = 1;
-	size_t payload_size = buf_size - 19 - ps5_packet;
-
-	ChiakiErrorCode err = chiaki_mutex_lock(&takion->gkcrypt_local_mutex);
-	if(err != CHIAKI_ERR_SUCCESS)
-		return err;
-	uint64_t key_pos;
-	err = chiaki_takion_crypt_advance_key_pos(takion, payload_size + CHIAKI_GKCRYPT_BLOCK_SIZE, &key_pos);
-	if(err != CHIAKI_ERR_SUCCESS)
-		goto beach;
-
-	err = chiaki_gkcrypt_encrypt(takion->gkcrypt_local, key_pos + CHIAKI_GKCRYPT_BLOCK_SIZE, buf + 19 + ps5_packet, payload_size);
-	if(err != CHIAKI_ERR_SUCCESS)
-		goto beach;
-
-	*((chiaki_unaligned_uint32_t *)(buf + 14)) = htonl((uint32_t)key_pos);
-
-	err = chiaki_gkcrypt_gmac(takion->gkcrypt_local, key_pos, buf, buf_size, buf + 10);
-
-	if(err != CHIAKI_ERR_SUCCESS)
-		goto beach;
+	if(buf_size < 19 + ps5_packet)
+		return CHIAKI_ERR_BUF_TOO_SMALL;
 
-	chiaki_takion_send_raw(takion, buf, buf_size);
-beach:
-	chiaki_mutex_unlock(&takion->gkcrypt_local_mutex);
-	return err;
+	ChiakiTakionSendPacket send_packet = { 0 };
+	send_packet.crypt = CHIAKI_TAKION_SEND_CRYPT_ENCRYPT;
+	send_packet.payload_offset = 19 + ps5_packet;
+	send_packet.key_pos_offset = 14;
+	send_packet.mac_offset = 10;
+	return chiaki_takion_send_scheduler_push(&takion->send_scheduler, CHIAKI_TAKION_SEND_CLASS_INPUT, &send_packet, buf, buf_size);
 }
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_feedback_history(ChiakiTakion *takion, ChiakiSeqNum16 seq_num, uint8_t *payload, size_t payload_size)
@@ -870,6 +889,12 @@ static void *takion_thread_func(void *user)
 {
 	ChiakiTakion *takion = user;
 
+	ChiakiThreadAttrs attrs_applied;
+	if(chiaki_thread_set_attrs_self(&takion->thread_attrs, &attrs_applied) != CHIAKI_ERR_SUCCESS
+		&& chiaki_thread_attrs_failure_first(&takion->thread_attrs))
+		CHIAKI_LOGW(takion->log, "Takion thread runs with %s priority instead of %s",
+				chiaki_thread_priority_string(attrs_applied.priority), chiaki_thread_priority_string(takion->thread_attrs.priority));
+
 	uint32_t seq_num_remote_initial;
 	if(takion_handshake(takion, &seq_num_remote_initial) != CHIAKI_ERR_SUCCESS)
 		goto beach;
@@ -883,6 +908,12 @@ static void *takion_thread_func(void *user)
 	if(chiaki_takion_send_buffer_init(&takion->send_buffer, takion, TAKION_SEND_BUFFER_SIZE) != CHIAKI_ERR_SUCCESS)
 		goto error_reoder_queue;
 
+	if(chiaki_takion_send_scheduler_start(&takion->send_scheduler) != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(takion->log, "Takion failed to start send scheduler");
+		goto error_send_buffer;
+	}
+
 
 	if(takion->cb)
 	{
@@ -926,7 +957,7 @@ static void *takion_thread_func(void *user)
 			for(size_t i=0; i<takion->postponed_packets_count; i++)
 			{
 				ChiakiTakionPostponedPacket *packet = &takion->postponed_packets[i];
-				takion_handle_packet(takion, packet->buf, packet->buf_size);
+				takion_handle_packet(takion, packet->buf, packet->buf_size, packet->arrival_us);
 			}
 			free(takion->postponed_packets);
 			takion->postponed_packets = NULL;
@@ -938,21 +969,30 @@ static void *takion_thread_func(void *user)
 		uint8_t *buf = malloc(received_size); // TODO: no malloc?
 		if(!buf)
 			break;
-		ChiakiErrorCode err = takion_recv(takion, buf, &received_size, UINT64_MAX);
+		uint64_t arrival_us;
+		ChiakiErrorCode err = takion_recv(takion, buf, &received_size, &arrival_us, UINT64_MAX);
 		if(err != CHIAKI_ERR_SUCCESS)
 		{
 			free(buf);
 			break;
 		}
+		if(takion->link_quality)
+			chiaki_link_quality_push_datagram(takion->link_quality, received_size);
+		chiaki_metric_inc(takion->metrics.packets_received);
+		chiaki_metric_add(takion->metrics.bytes_received, received_size);
 		uint8_t *resized_buf = realloc(buf, received_size);
 		if(!resized_buf)
 		{
 			free(buf);
 			continue;
 		}
-		takion_handle_packet(takion, resized_buf, received_size);
+		takion_handle_packet(takion, resized_buf, received_size, arrival_us);
 	}
 
+	// stop before the send buffer goes away, the scheduler hands reliable packets to it
+	chiaki_takion_send_scheduler_stop(&takion->send_scheduler);
+
+error_send_buffer:
 	chiaki_takion_send_buffer_fini(&takion->send_buffer);
 
 error_reoder_queue:
@@ -976,7 +1016,71 @@ beach:
 	return NULL;
 }
 
-static ChiakiErrorCode takion_recv(ChiakiTakion *takion, uint8_t *buf, size_t *buf_size, uint64_t timeout_ms)
+#ifdef TAKION_RECV_TIMESTAMPS
+/**
+ * recv() that also takes the kernel receive timestamp, converted to chiaki_time_now_monotonic_us().
+ * The kernel stamps with the realtime clock, so this is off by whatever the clock was stepped in between.
+ */
+static CHIAKI_SSIZET_TYPE takion_recv_timestamped(ChiakiTakion *takion, uint8_t *buf, size_t buf_size, uint64_t *arrival_us)
+{
+	struct iovec iov = { buf, buf_size };
+	union
+	{
+		char buf[CMSG_SPACE(sizeof(struct timespec))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	CHIAKI_SSIZET_TYPE r = recvmsg(takion->sock, &msg, 0);
+
+	uint64_t now_us = chiaki_time_now_monotonic_us();
+	*arrival_us = now_us;
+	if(r <= 0)
+		return r;
+
+	uint64_t stamp_us = 0;
+	for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if(cmsg->cmsg_level != SOL_SOCKET)
+			continue;
+#ifdef SO_TIMESTAMPNS
+		if(cmsg->cmsg_type == SCM_TIMESTAMPNS)
+		{
+			struct timespec ts;
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			stamp_us = (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+		}
+#else
+		if(cmsg->cmsg_type == SCM_TIMESTAMP)
+		{
+			struct timeval tv;
+			memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+			stamp_us = (uint64_t)tv.tv_sec * 1000000 + (uint64_t)tv.tv_usec;
+		}
+#endif
+	}
+	if(!stamp_us)
+		return r;
+
+	struct timespec realtime;
+	clock_gettime(CLOCK_REALTIME, &realtime);
+	uint64_t realtime_us = (uint64_t)realtime.tv_sec * 1000000 + (uint64_t)realtime.tv_nsec / 1000;
+	// anything older than a second means the clock was stepped, the time of the recv is better than that
+	if(stamp_us <= realtime_us && realtime_us - stamp_us < 1000000 && realtime_us - stamp_us < now_us)
+		*arrival_us = now_us - (realtime_us - stamp_us);
+	return r;
+}
+#endif
+
+/**
+ * @param arrival_us optional, set to the time the datagram arrived in chiaki_time_now_monotonic_us(),
+ * taken from the kernel if the socket has receive timestamps enabled
+ */
+static ChiakiErrorCode takion_recv(ChiakiTakion *takion, uint8_t *buf, size_t *buf_size, uint64_t *arrival_us, uint64_t timeout_ms)
 {
 	ChiakiErrorCode err = chiaki_stop_pipe_select_single(&takion->stop_pipe, takion->sock, false, timeout_ms);
 	if(err == CHIAKI_ERR_TIMEOUT || err == CHIAKI_ERR_CANCELED)
@@ -987,7 +1091,17 @@ static ChiakiErrorCode takion_recv(ChiakiTakion *takion, uint8_t *buf, size_t *b
 		return err;
 	}
 
-	CHIAKI_SSIZET_TYPE received_sz = recv(takion->sock, buf, *buf_size, 0);
+	CHIAKI_SSIZET_TYPE received_sz;
+#ifdef TAKION_RECV_TIMESTAMPS
+	if(arrival_us && takion->socket_tuning.rx_timestamps)
+		received_sz = takion_recv_timestamped(takion, buf, *buf_size, arrival_us);
+	else
+#endif
+	{
+		received_sz = recv(takion->sock, buf, *buf_size, 0);
+		if(arrival_us)
+			*arrival_us = chiaki_time_now_monotonic_us();
+	}
 	if(received_sz <= 0)
 	{
 		if(received_sz < 0)
@@ -1037,7 +1151,7 @@ static ChiakiErrorCode takion_handle_packet_mac(ChiakiTakion *takion, uint8_t ba
 	return CHIAKI_ERR_SUCCESS;
 }
 
-static void takion_postpone_packet(ChiakiTakion *takion, uint8_t *buf, size_t buf_size)
+static void takion_postpone_packet(ChiakiTakion *takion, uint8_t *buf, size_t buf_size, uint64_t arrival_us)
 {
 	if(!takion->postponed_packets)
 	{
@@ -1058,18 +1172,20 @@ static void takion_postpone_packet(ChiakiTakion *takion, uint8_t *buf, size_t bu
 	ChiakiTakionPostponedPacket *packet = &takion->postponed_packets[takion->postponed_packets_count++];
 	packet->buf = buf;
 	packet->buf_size = buf_size;
+	packet->arrival_us = arrival_us;
 }
 
 /**
  * @param buf ownership of this buf is taken.
  */
-static void takion_handle_packet(ChiakiTakion *takion, uint8_t *buf, size_t buf_size)
+static void takion_handle_packet(ChiakiTakion *takion, uint8_t *buf, size_t buf_size, uint64_t arrival_us)
 {
 	assert(buf_size > 0);
 	uint8_t base_type = (uint8_t)(buf[0] & TAKION_PACKET_BASE_TYPE_MASK);
 
 	if(takion_handle_packet_mac(takion, base_type, buf, buf_size) != CHIAKI_ERR_SUCCESS)
 	{
+		chiaki_metric_inc(takion->metrics.mac_failures);
 		free(buf);
 		return;
 	}
@@ -1082,10 +1198,13 @@ static void takion_handle_packet(ChiakiTakion *takion, uint8_t *buf, size_t buf_
 		case TAKION_PACKET_TYPE_VIDEO:
 		case TAKION_PACKET_TYPE_AUDIO:
 			if(takion->enable_crypt && !takion->gkcrypt_remote)
-				takion_postpone_packet(takion, buf, buf_size);
+			{
+				chiaki_metric_inc(takion->metrics.postponed_packets);
+				takion_postpone_packet(takion, buf, buf_size, arrival_us);
+			}
 			else
 			{
-				takion_handle_packet_av(takion, base_type, buf, buf_size);
+				takion_handle_packet_av(takion, base_type, buf, buf_size, arrival_us);
 				free(buf);
 			}
 			break;
@@ -1207,9 +1326,9 @@ static void takion_handle_packet_message_data(ChiakiTakion *takion, uint8_t *pac
 
 static void takion_handle_packet_message_data_ack(ChiakiTakion *takion, uint8_t flags, uint8_t *buf, size_t buf_size)
 {
-	if(buf_size != 0xc)
+	if(buf_size < 0xc)
 	{
-		CHIAKI_LOGE(takion->log, "Takion received data ack with size %zx != %#x", buf_size, 0xc);
+		CHIAKI_LOGE(takion->log, "Takion received data ack with size %zx < %#x", buf_size, 0xc);
 		return;
 	}
 
@@ -1234,6 +1353,16 @@ static void takion_handle_packet_message_data_ack(ChiakiTakion *takion, uint8_t
 	size_t acked_seq_nums_count = 0;
 	chiaki_takion_send_buffer_ack(&takion->send_buffer, cumulative_seq_num, acked_seq_nums, &acked_seq_nums_count);
 
+	// gap ack blocks as in SCTP, start and end offsets relative to cumulative_seq_num
+	for(uint16_t i=0; i<gap_ack_blocks_count; i++)
+	{
+		uint16_t gap_start = ntohs(*((chiaki_unaligned_uint16_t *)(buf + 0xc + i * 4)));
+		uint16_t gap_end = ntohs(*((chiaki_unaligned_uint16_t *)(buf + 0xc + i * 4 + 2)));
+		if(!gap_start || gap_end < gap_start)
+			continue;
+		chiaki_takion_send_buffer_gap_ack(&takion->send_buffer, cumulative_seq_num + gap_start, cumulative_seq_num + gap_end);
+	}
+
 	for(size_t i=0; i<acked_seq_nums_count; i++)
 	{
 		ChiakiTakionEvent event = { 0 };
@@ -1326,7 +1455,7 @@ static ChiakiErrorCode takion_recv_message_init_ack(ChiakiTakion *takion, Takion
 {
 	uint8_t message[1 + TAKION_MESSAGE_HEADER_SIZE + 0x10 + TAKION_COOKIE_SIZE];
 	size_t received_size = sizeof(message);
-	ChiakiErrorCode err = takion_recv(takion, message, &received_size, TAKION_EXPECT_TIMEOUT_MS);
+	ChiakiErrorCode err = takion_recv(takion, message, &received_size, NULL, TAKION_EXPECT_TIMEOUT_MS);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return err;
 
@@ -1373,14 +1502,14 @@ static ChiakiErrorCode takion_recv_message_cookie_ack(ChiakiTakion *takion)
 {
 	uint8_t message[1 + TAKION_MESSAGE_HEADER_SIZE];
 	size_t received_size = sizeof(message);
-	ChiakiErrorCode err = takion_recv(takion, message, &received_size, TAKION_EXPECT_TIMEOUT_MS);
+	ChiakiErrorCode err = takion_recv(takion, message, &received_size, NULL, TAKION_EXPECT_TIMEOUT_MS);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return err;
 
 	if(message[0xd] == TAKION_CHUNK_TYPE_INIT_ACK)
 	{
 		CHIAKI_LOGI(takion->log, "Received second init ack, looking for cookie ack in next message");
-		err = takion_recv(takion, message, &received_size, TAKION_EXPECT_TIMEOUT_MS);
+		err = takion_recv(takion, message, &received_size, NULL, TAKION_EXPECT_TIMEOUT_MS);
 		if(err != CHIAKI_ERR_SUCCESS)
 			return err;
 	}
@@ -1416,7 +1545,7 @@ static ChiakiErrorCode takion_recv_message_cookie_ack(ChiakiTakion *takion)
 	return CHIAKI_ERR_SUCCESS;
 }
 
-static void takion_handle_packet_av(ChiakiTakion *takion, uint8_t base_type, uint8_t *buf, size_t buf_size)
+static void takion_handle_packet_av(ChiakiTakion *takion, uint8_t base_type, uint8_t *buf, size_t buf_size, uint64_t arrival_us)
 {
 	// HHIxIIx
 
@@ -1430,6 +1559,7 @@ static void takion_handle_packet_av(ChiakiTakion *takion, uint8_t base_type, uin
 			CHIAKI_LOGE(takion->log, "Takion received AV packet that was too small");
 		return;
 	}
+	packet.arrival_us = arrival_us;
 
 	if(takion->cb)
 	{
@@ -9,9 +9,13 @@
 #include <string.h>
 #include <assert.h>
 
+// used when the Takion instance has no link quality estimate
 #define TAKION_DATA_RESEND_TIMEOUT_MS 200
-#define TAKION_DATA_RESEND_WAKEUP_TIMEOUT_MS (TAKION_DATA_RESEND_TIMEOUT_MS/2)
+// upper bound for the exponential backoff of a single packet
+#define TAKION_DATA_RESEND_TIMEOUT_MAX_MS 1000
 #define TAKION_DATA_RESEND_TRIES_MAX 10
+// acks that report a packet as missing before it is resent without waiting for its timeout
+#define TAKION_DATA_FAST_RETRANSMIT_MISSES 3
 #define TAKION_SEND_BUFFER_SIZE 16
 
 #endif
@@ -21,6 +25,11 @@ struct chiaki_takion_send_buffer_packet_t
 	ChiakiSeqNum32 seq_num;
 	uint64_t tries;
 	uint64_t last_send_ms; // chiaki_time_now_monotonic_ms()
+	uint64_t first_send_us; // chiaki_time_now_monotonic_us(), for RTT samples
+	uint64_t resend_timeout_ms; // doubled on every timeout
+	uint64_t misses; // acks that indicated this packet did not arrive
+	bool fast_retransmitted;
+	bool gap_acked; // arrived according to a gap ack block, only waiting for the cumulative ack
 	uint8_t *buf;
 	size_t buf_size;
 }; // ChiakiTakionSendBufferPacket
@@ -29,6 +38,26 @@ struct chiaki_takion_send_buffer_packet_t
 
 static void *takion_send_buffer_thread_func(void *user);
 
+static ChiakiLinkQuality *takion_send_buffer_link_quality(ChiakiTakionSendBuffer *send_buffer)
+{
+	return send_buffer->takion ? send_buffer->takion->link_quality : NULL;
+}
+
+static uint64_t takion_send_buffer_resend_timeout_ms(ChiakiTakionSendBuffer *send_buffer)
+{
+	ChiakiLinkQuality *link_quality = takion_send_buffer_link_quality(send_buffer);
+	return link_quality ? chiaki_link_quality_resend_timeout_ms(link_quality) : TAKION_DATA_RESEND_TIMEOUT_MS;
+}
+
+/**
+ * Must be called with mutex locked
+ */
+static void takion_send_buffer_wakeup(ChiakiTakionSendBuffer *send_buffer)
+{
+	send_buffer->wakeup = true;
+	chiaki_cond_signal(&send_buffer->cond);
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_init(ChiakiTakionSendBuffer *send_buffer, ChiakiTakion *takion, size_t size)
 {
 	send_buffer->takion = takion;
@@ -39,8 +68,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_init(ChiakiTakionSendBuf
 		return CHIAKI_ERR_MEMORY;
 	send_buffer->packets_size = size;
 	send_buffer->packets_count = 0;
+	send_buffer->packets_reserved = 0;
 
 	send_buffer->should_stop = false;
+	send_buffer->wakeup = false;
 
 	ChiakiErrorCode err = chiaki_mutex_init(&send_buffer->mutex, false);
 	if(err != CHIAKI_ERR_SUCCESS)
@@ -82,13 +113,38 @@ CHIAKI_EXPORT void chiaki_takion_send_buffer_fini(ChiakiTakionSendBuffer *send_b
 	free(send_buffer->packets);
 }
 
+CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_reserve(ChiakiTakionSendBuffer *send_buffer)
+{
+	ChiakiErrorCode err = chiaki_mutex_lock(&send_buffer->mutex);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	if(send_buffer->packets_count + send_buffer->packets_reserved >= send_buffer->packets_size)
+		err = CHIAKI_ERR_OVERFLOW;
+	else
+		send_buffer->packets_reserved++;
+	chiaki_mutex_unlock(&send_buffer->mutex);
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_takion_send_buffer_unreserve(ChiakiTakionSendBuffer *send_buffer)
+{
+	chiaki_mutex_lock(&send_buffer->mutex);
+	assert(send_buffer->packets_reserved);
+	send_buffer->packets_reserved--;
+	chiaki_mutex_unlock(&send_buffer->mutex);
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_push(ChiakiTakionSendBuffer *send_buffer, ChiakiSeqNum32 seq_num, uint8_t *buf, size_t buf_size)
 {
 	ChiakiErrorCode err = chiaki_mutex_lock(&send_buffer->mutex);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return err;
 
-	if(send_buffer->packets_count >= send_buffer->packets_size)
+	// the reservation is used up even on error, the packet is gone either way
+	if(send_buffer->packets_reserved)
+		send_buffer->packets_reserved--;
+
+	if(send_buffer->packets_count + send_buffer->packets_reserved >= send_buffer->packets_size)
 	{
 		CHIAKI_LOGE(send_buffer->log, "Takion Send Buffer overflow");
 		err = CHIAKI_ERR_OVERFLOW;
@@ -108,17 +164,23 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_push(ChiakiTakionSendBuf
 	ChiakiTakionSendBufferPacket *packet = &send_buffer->packets[send_buffer->packets_count++];
 	packet->seq_num = seq_num;
 	packet->tries = 0;
-	packet->last_send_ms = chiaki_time_now_monotonic_ms();
+	packet->first_send_us = chiaki_time_now_monotonic_us();
+	packet->last_send_ms = packet->first_send_us / 1000;
+	packet->resend_timeout_ms = takion_send_buffer_resend_timeout_ms(send_buffer);
+	packet->misses = 0;
+	packet->fast_retransmitted = false;
+	packet->gap_acked = false;
 	packet->buf = buf;
 	packet->buf_size = buf_size;
 
 	CHIAKI_LOGV(send_buffer->log, "Pushed seq num %#llx into Takion Send Buffer", (unsigned long long)seq_num);
 
-	if(send_buffer->packets_count == 1)
-	{
-		// buffer was empty before, so it will sleep without timeout => WAKE UP!!
-		chiaki_cond_signal(&send_buffer->cond);
-	}
+	ChiakiLinkQuality *link_quality = takion_send_buffer_link_quality(send_buffer);
+	if(link_quality)
+		chiaki_link_quality_push_data_sent(link_quality);
+
+	// the thread sleeps until the earliest deadline, which may be this packet's now
+	takion_send_buffer_wakeup(send_buffer);
 
 beach:
 	if(err != CHIAKI_ERR_SUCCESS)
@@ -127,14 +189,51 @@ beach:
 	return err;
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_ack(ChiakiTakionSendBuffer *send_buffer, ChiakiSeqNum32 seq_num, ChiakiSeqNum32 *acked_seq_nums, size_t *acked_seq_nums_count)
+/**
+ * Send packet again right now and schedule its next timeout.
+ * Must be called with mutex locked.
+ */
+static void takion_send_buffer_resend_packet(ChiakiTakionSendBuffer *send_buffer, ChiakiTakionSendBufferPacket *packet, uint64_t now_ms)
 {
-	ChiakiErrorCode err = chiaki_mutex_lock(&send_buffer->mutex);
-	if(err != CHIAKI_ERR_SUCCESS)
-		return err;
+	packet->last_send_ms = now_ms;
+	packet->tries++;
+	packet->misses = 0;
+	if(!send_buffer->takion)
+		return;
+	// already carries its key pos and MAC from the first transmission
+	ChiakiTakionSendPacket send_packet = { 0 };
+	send_packet.crypt = CHIAKI_TAKION_SEND_CRYPT_NONE;
+	chiaki_takion_send_scheduler_push(&send_buffer->takion->send_scheduler, CHIAKI_TAKION_SEND_CLASS_BULK, &send_packet, packet->buf, packet->buf_size);
+	ChiakiLinkQuality *link_quality = takion_send_buffer_link_quality(send_buffer);
+	if(link_quality)
+		chiaki_link_quality_push_data_resent(link_quality, false);
+}
 
-	if(acked_seq_nums_count)
-		*acked_seq_nums_count = 0;
+/**
+ * Must be called with mutex locked
+ */
+static void takion_send_buffer_packet_missed(ChiakiTakionSendBuffer *send_buffer, ChiakiTakionSendBufferPacket *packet)
+{
+	if(packet->gap_acked || packet->fast_retransmitted)
+		return;
+	if(++packet->misses < TAKION_DATA_FAST_RETRANSMIT_MISSES)
+		return;
+	CHIAKI_LOGI(send_buffer->log, "Takion Send Buffer fast re-sending packet with seqnum %#llx", (unsigned long long)packet->seq_num);
+	packet->fast_retransmitted = true;
+	takion_send_buffer_resend_packet(send_buffer, packet, chiaki_time_now_monotonic_ms());
+}
+
+/**
+ * Remove all packets up to and including seq_num.
+ * Must be called with mutex locked.
+ *
+ * @param sample_rtt whether this is a real ack that the RTT may be measured from
+ * @return number of removed packets
+ */
+static size_t takion_send_buffer_remove(ChiakiTakionSendBuffer *send_buffer, ChiakiSeqNum32 seq_num, bool sample_rtt, ChiakiSeqNum32 *acked_seq_nums, size_t *acked_seq_nums_count)
+{
+	ChiakiLinkQuality *link_quality = sample_rtt ? takion_send_buffer_link_quality(send_buffer) : NULL;
+	uint64_t now_us = link_quality ? chiaki_time_now_monotonic_us() : 0;
 
 	size_t i;
 	size_t shift = 0; // amount to shift back
@@ -146,6 +245,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_ack(ChiakiTakionSendBuff
 			if(acked_seq_nums && acked_seq_nums_count)
 				acked_seq_nums[(*acked_seq_nums_count)++] = send_buffer->packets[i].seq_num;
 
+			// Karn's algorithm: the ack of a resent packet may belong to any of its copies
+			if(link_quality && send_buffer->packets[i].tries == 0)
+				chiaki_link_quality_push_rtt(link_quality, now_us - send_buffer->packets[i].first_send_us);
+
 			free(send_buffer->packets[i].buf);
 			if(shift_start == SIZE_MAX)
 			{
@@ -183,24 +286,86 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_ack(ChiakiTakionSendBuff
 		send_buffer->packets_count -= shift;
 	}
 
+	return shift;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_ack(ChiakiTakionSendBuffer *send_buffer, ChiakiSeqNum32 seq_num, ChiakiSeqNum32 *acked_seq_nums, size_t *acked_seq_nums_count)
+{
+	ChiakiErrorCode err = chiaki_mutex_lock(&send_buffer->mutex);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+
+	if(acked_seq_nums_count)
+		*acked_seq_nums_count = 0;
+
+	size_t removed = takion_send_buffer_remove(send_buffer, seq_num, true, acked_seq_nums, acked_seq_nums_count);
+
+	// A duplicate cumulative ack means something after seq_num arrived, but not the packet right after it.
+	if(!removed && send_buffer->packets_count)
+	{
+		ChiakiTakionSendBufferPacket *first = &send_buffer->packets[0];
+		for(size_t i=1; i<send_buffer->packets_count; i++)
+		{
+			if(chiaki_seq_num_32_lt(send_buffer->packets[i].seq_num, first->seq_num))
+				first = &send_buffer->packets[i];
+		}
+		if(first->seq_num == seq_num + 1)
+			takion_send_buffer_packet_missed(send_buffer, first);
+	}
+
 	CHIAKI_LOGV(send_buffer->log, "Acked seq num %#llx from Takion Send Buffer", (unsigned long long)seq_num);
 
 	chiaki_mutex_unlock(&send_buffer->mutex);
 	return err;
 }
 
+CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_gap_ack(ChiakiTakionSendBuffer *send_buffer, ChiakiSeqNum32 seq_num_first, ChiakiSeqNum32 seq_num_last)
+{
+	ChiakiErrorCode err = chiaki_mutex_lock(&send_buffer->mutex);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+
+	for(size_t i=0; i<send_buffer->packets_count; i++)
+	{
+		ChiakiTakionSendBufferPacket *packet = &send_buffer->packets[i];
+		if(!chiaki_seq_num_32_lt(packet->seq_num, seq_num_first) && !chiaki_seq_num_32_gt(packet->seq_num, seq_num_last))
+			packet->gap_acked = true;
+	}
+
+	CHIAKI_LOGV(send_buffer->log, "Gap acked seq nums %#llx to %#llx from Takion Send Buffer",
+			(unsigned long long)seq_num_first, (unsigned long long)seq_num_last);
+
+	chiaki_mutex_unlock(&send_buffer->mutex);
+	return err;
+}
+
 static void takion_send_buffer_resend(ChiakiTakionSendBuffer *send_buffer);
 
-static bool takion_send_buffer_check_pred_packets(void *user)
+static bool takion_send_buffer_check_pred(void *user)
 {
 	ChiakiTakionSendBuffer *send_buffer = user;
-	return send_buffer->should_stop;
+	return send_buffer->should_stop || send_buffer->wakeup;
 }
 
-static bool takion_send_buffer_check_pred_no_packets(void *user)
+/**
+ * Must be called with mutex locked
+ *
+ * @return time until the earliest resend deadline, UINT64_MAX if there is none
+ */
+static uint64_t takion_send_buffer_next_timeout_ms(ChiakiTakionSendBuffer *send_buffer, uint64_t now)
 {
-	ChiakiTakionSendBuffer *send_buffer = user;
-	return send_buffer->should_stop || send_buffer->packets_count;
+	uint64_t r = UINT64_MAX;
+	for(size_t i=0; i<send_buffer->packets_count; i++)
+	{
+		ChiakiTakionSendBufferPacket *packet = &send_buffer->packets[i];
+		if(packet->gap_acked)
+			continue;
+		uint64_t deadline = packet->last_send_ms + packet->resend_timeout_ms;
+		uint64_t timeout = deadline > now ? deadline - now : 0;
+		if(timeout < r)
+			r = timeout;
+	}
+	return r;
 }
 
 static void *takion_send_buffer_thread_func(void *user)
@@ -213,10 +378,14 @@ static void *takion_send_buffer_thread_func(void *user)
 
 	while(true)
 	{
-		if(send_buffer->packets_count) // if there are packets, wait with timeout
-			err = chiaki_cond_timedwait_pred(&send_buffer->cond, &send_buffer->mutex, TAKION_DATA_RESEND_WAKEUP_TIMEOUT_MS, takion_send_buffer_check_pred_packets, send_buffer);
-		else // if not, wait without timeout, but also wakeup if packets become available
-			err = chiaki_cond_wait_pred(&send_buffer->cond, &send_buffer->mutex, takion_send_buffer_check_pred_no_packets, send_buffer);
+		// sleep exactly until the next packet is due, or until a push or stop changes that
+		uint64_t timeout_ms = send_buffer->takion
+			? takion_send_buffer_next_timeout_ms(send_buffer, chiaki_time_now_monotonic_ms())
+			: UINT64_MAX; // nothing will ever be re-sent
+		if(timeout_ms == UINT64_MAX)
+			err = chiaki_cond_wait_pred(&send_buffer->cond, &send_buffer->mutex, takion_send_buffer_check_pred, send_buffer);
+		else
+			err = chiaki_cond_timedwait_pred(&send_buffer->cond, &send_buffer->mutex, timeout_ms, takion_send_buffer_check_pred, send_buffer);
 
 		if(err != CHIAKI_ERR_SUCCESS && err != CHIAKI_ERR_TIMEOUT)
 			break;
@@ -224,6 +393,7 @@ static void *takion_send_buffer_thread_func(void *user)
 		if(send_buffer->should_stop)
 			break;
 
+		send_buffer->wakeup = false;
 		takion_send_buffer_resend(send_buffer);
 	}
 	chiaki_mutex_unlock(&send_buffer->mutex);
@@ -237,29 +407,34 @@ static void takion_send_buffer_resend(ChiakiTakionSendBuffer *send_buffer)
 		return;
 
 	uint64_t now = chiaki_time_now_monotonic_ms();
+	ChiakiLinkQuality *link_quality = takion_send_buffer_link_quality(send_buffer);
 
 	for(size_t i=0; i<send_buffer->packets_count; i++)
 	{
 		ChiakiTakionSendBufferPacket *packet = &send_buffer->packets[i];
-		if(now - packet->last_send_ms > TAKION_DATA_RESEND_TIMEOUT_MS)
+		if(packet->gap_acked || now - packet->last_send_ms < packet->resend_timeout_ms)
+			continue;
+
+		if(packet->tries >= TAKION_DATA_RESEND_TRIES_MAX)
 		{
-			if(packet->tries >= TAKION_DATA_RESEND_TRIES_MAX)
-			{
-				CHIAKI_LOGI(send_buffer->log, "Hit max retries of %d tries... giving up on packet with seqnum %#llx", TAKION_DATA_RESEND_TRIES_MAX, (unsigned long long)packet->seq_num);
-				ChiakiSeqNum32 ack_seq_nums[TAKION_SEND_BUFFER_SIZE];
-				size_t ack_seq_nums_count;
-				chiaki_mutex_unlock(&send_buffer->mutex);
-				chiaki_takion_send_buffer_ack(send_buffer, packet->seq_num, ack_seq_nums, &ack_seq_nums_count);
-				chiaki_mutex_lock(&send_buffer->mutex);
-				if(i > 0)
-					i-= 1;
-				continue;
-			}
-			CHIAKI_LOGI(send_buffer->log, "Takion Send Buffer re-sending packet with seqnum %#llx, tries: %llu", (unsigned long long)packet->seq_num, (unsigned long long)packet->tries);
-			packet->last_send_ms = now;
-			chiaki_takion_send_raw(send_buffer->takion, packet->buf, packet->buf_size);
-			packet->tries++;
+			if(link_quality)
+				chiaki_link_quality_push_data_resent(link_quality, true);
+			CHIAKI_LOGI(send_buffer->log, "Hit max retries of %d tries... giving up on packet with seqnum %#llx", TAKION_DATA_RESEND_TRIES_MAX, (unsigned long long)packet->seq_num);
+			takion_send_buffer_remove(send_buffer, packet->seq_num, false, NULL, NULL);
+			// everything up to this packet is gone, start over
+			i = (size_t)-1;
+			continue;
 		}
+
+		CHIAKI_LOGI(send_buffer->log, "Takion Send Buffer re-sending packet with seqnum %#llx, tries: %llu, timeout: %llu ms",
+				(unsigned long long)packet->seq_num, (unsigned long long)packet->tries, (unsigned long long)packet->resend_timeout_ms);
+		// RFC 6298 5.5: back off on every timeout, for the whole connection until the next RTT sample
+		if(link_quality)
+			chiaki_link_quality_back_off_resend_timeout(link_quality, packet->resend_timeout_ms);
+		packet->resend_timeout_ms *= 2;
+		if(packet->resend_timeout_ms > TAKION_DATA_RESEND_TIMEOUT_MAX_MS)
+			packet->resend_timeout_ms = TAKION_DATA_RESEND_TIMEOUT_MAX_MS;
+		takion_send_buffer_resend_packet(send_buffer, packet, now);
 	}
 }
 
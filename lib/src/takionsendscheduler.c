@@ -0,0 +1,507 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifdef __linux__
+#define _GNU_SOURCE // sendmmsg
+#endif
+
+#include <chiaki/takionsendscheduler.h>
+#include <chiaki/takion.h>
+#include <chiaki/atomic.h>
+#include <chiaki/time.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+// packets handled per wakeup, at most one sendmmsg() each
+#define TAKION_SEND_SCHEDULER_BATCH_MAX 32
+
+// a full queue usually stays full for a while, so don't log every single packet
+#define TAKION_SEND_SCHEDULER_DROP_LOG_INTERVAL_MS 1000
+
+static void *takion_send_scheduler_thread_func(void *user);
+static size_t takion_send_scheduler_run_batch(ChiakiTakionSendScheduler *scheduler);
+static void takion_send_scheduler_drain(ChiakiTakionSendScheduler *scheduler);
+static ChiakiErrorCode takion_send_scheduler_prepare(ChiakiTakionSendScheduler *scheduler, ChiakiTakionSendItem *item);
+static void takion_send_scheduler_send(ChiakiTakionSendScheduler *scheduler, ChiakiTakionSendItem **items, const ChiakiTakionSendClass *classes, size_t items_count);
+static void takion_send_scheduler_log_drop(ChiakiTakionSendScheduler *scheduler, ChiakiTakionSendClass send_class);
+static ChiakiErrorCode takion_send_queue_init(ChiakiTakionSendQueue *queue, size_t size);
+static void takion_send_queue_fini(ChiakiTakionSendQueue *queue);
+static ChiakiTakionSendItem *takion_send_queue_peek(ChiakiTakionSendQueue *queue, uint32_t offset);
+static void takion_send_queue_release(ChiakiTakionSendQueue *queue, uint32_t count);
+static void takion_send_item_free_buf(ChiakiTakionSendItem *item);
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_scheduler_init(ChiakiTakionSendScheduler *scheduler, ChiakiTakion *takion, size_t queue_size)
+{
+	scheduler->log = takion->log;
+	scheduler->takion = takion;
+	scheduler->pending = 0;
+	scheduler->should_stop = false;
+	scheduler->running = false;
+
+	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+	size_t queues_initialized = 0;
+	for(; queues_initialized<CHIAKI_TAKION_SEND_CLASS_COUNT; queues_initialized++)
+	{
+		err = takion_send_queue_init(&scheduler->queues[queues_initialized], queue_size);
+		if(err != CHIAKI_ERR_SUCCESS)
+			goto error_queues;
+	}
+
+	err = chiaki_mutex_init(&scheduler->mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_queues;
+
+	err = chiaki_cond_init(&scheduler->cond);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_mutex;
+
+	return CHIAKI_ERR_SUCCESS;
+error_mutex:
+	chiaki_mutex_fini(&scheduler->mutex);
+error_queues:
+	for(size_t i=0; i<queues_initialized; i++)
+		takion_send_queue_fini(&scheduler->queues[i]);
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_takion_send_scheduler_fini(ChiakiTakionSendScheduler *scheduler)
+{
+	assert(!scheduler->running);
+	chiaki_cond_fini(&scheduler->cond);
+	chiaki_mutex_fini(&scheduler->mutex);
+	for(size_t i=0; i<CHIAKI_TAKION_SEND_CLASS_COUNT; i++)
+		takion_send_queue_fini(&scheduler->queues[i]);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_scheduler_start(ChiakiTakionSendScheduler *scheduler)
+{
+	ChiakiErrorCode err = chiaki_thread_create(&scheduler->thread, takion_send_scheduler_thread_func, scheduler);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	chiaki_thread_set_name(&scheduler->thread, "Chiaki Takion Send");
+	scheduler->running = true;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_takion_send_scheduler_stop(ChiakiTakionSendScheduler *scheduler)
+{
+	if(!scheduler->running)
+		return;
+	ChiakiErrorCode err = chiaki_mutex_lock(&scheduler->mutex);
+	assert(err == CHIAKI_ERR_SUCCESS);
+	scheduler->should_stop = true;
+	chiaki_cond_signal(&scheduler->cond);
+	chiaki_mutex_unlock(&scheduler->mutex);
+	chiaki_thread_join(&scheduler->thread, NULL);
+	scheduler->running = false;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_scheduler_push(ChiakiTakionSendScheduler *scheduler, ChiakiTakionSendClass send_class, const ChiakiTakionSendPacket *packet, uint8_t *buf, size_t buf_size)
+{
+	assert(send_class < CHIAKI_TAKION_SEND_CLASS_COUNT);
+	ChiakiTakionSendQueue *queue = &scheduler->queues[send_class];
+
+	// claim a slot, see Dmitry Vyukov's bounded MPMC queue
+	ChiakiTakionSendItem *item;
+	uint32_t pos = chiaki_atomic_load_u32(&queue->enqueue_pos);
+	while(true)
+	{
+		item = &queue->items[pos & (queue->size - 1)];
+		int32_t diff = (int32_t)(chiaki_atomic_load_u32(&item->sequence) - pos);
+		if(diff == 0)
+		{
+			if(chiaki_atomic_cas_u32(&queue->enqueue_pos, &pos, pos + 1))
+				break;
+		}
+		else if(diff < 0)
+		{
+			if(packet->reliable)
+				free(buf);
+			if(scheduler->takion->link_quality)
+				chiaki_link_quality_push_send_dropped(scheduler->takion->link_quality, send_class);
+			takion_send_scheduler_log_drop(scheduler, send_class);
+			return CHIAKI_ERR_OVERFLOW;
+		}
+		else
+			pos = chiaki_atomic_load_u32(&queue->enqueue_pos);
+	}
+
+	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+	item->packet = *packet;
+	item->buf_size = buf_size;
+	if(packet->reliable)
+		item->buf = buf;
+	else if(buf_size <= sizeof(item->inline_buf))
+	{
+		memcpy(item->inline_buf, buf, buf_size);
+		item->buf = item->inline_buf;
+	}
+	else
+	{
+		item->buf = malloc(buf_size);
+		if(item->buf)
+			memcpy(item->buf, buf, buf_size);
+		else
+			err = CHIAKI_ERR_MEMORY; // the slot is taken anyway, it is skipped when sending
+	}
+	item->queued_us = chiaki_time_now_monotonic_us();
+	chiaki_atomic_store_u32(&item->sequence, pos + 1);
+
+	if((int32_t)chiaki_atomic_fetch_add_u32(&scheduler->pending, 1) == 0)
+	{
+		// the scheduler might be waiting
+		chiaki_mutex_lock(&scheduler->mutex);
+		chiaki_cond_signal(&scheduler->cond);
+		chiaki_mutex_unlock(&scheduler->mutex);
+	}
+
+	return err;
+}
+
+static void *takion_send_scheduler_thread_func(void *user)
+{
+	ChiakiTakionSendScheduler *scheduler = user;
+	chiaki_thread_set_attrs_self(&scheduler->takion->thread_attrs, NULL); // the receive thread already reported what is possible
+
+	while(true)
+	{
+		ChiakiErrorCode err = chiaki_mutex_lock(&scheduler->mutex);
+		assert(err == CHIAKI_ERR_SUCCESS);
+		while(!scheduler->should_stop && (int32_t)chiaki_atomic_load_u32(&scheduler->pending) <= 0)
+			chiaki_cond_wait(&scheduler->cond, &scheduler->mutex);
+		bool stop = scheduler->should_stop;
+		chiaki_mutex_unlock(&scheduler->mutex);
+		if(stop)
+		{
+			// e.g. the DISCONNECT sent right before closing
+			takion_send_scheduler_drain(scheduler);
+			break;
+		}
+
+		takion_send_scheduler_run_batch(scheduler);
+	}
+
+	return NULL;
+}
+
+/**
+ * Send everything that is queued, but not what keeps coming in while doing so.
+ */
+static void takion_send_scheduler_drain(ChiakiTakionSendScheduler *scheduler)
+{
+	size_t left = 0;
+	for(size_t c=0; c<CHIAKI_TAKION_SEND_CLASS_COUNT; c++)
+		left += scheduler->queues[c].size;
+	while(left)
+	{
+		size_t sent = takion_send_scheduler_run_batch(scheduler);
+		if(!sent)
+			break;
+		left = sent < left ? left - sent : 0;
+	}
+}
+
+/**
+ * @return number of packets taken from the queues
+ */
+static size_t takion_send_scheduler_run_batch(ChiakiTakionSendScheduler *scheduler)
+{
+	ChiakiTakion *takion = scheduler->takion;
+	ChiakiTakionSendItem *items[TAKION_SEND_SCHEDULER_BATCH_MAX];
+	ChiakiTakionSendClass classes[TAKION_SEND_SCHEDULER_BATCH_MAX];
+	uint32_t taken[CHIAKI_TAKION_SEND_CLASS_COUNT] = { 0 };
+	size_t items_count = 0;
+
+	// strict priority, the higher classes are never busy enough to starve the lower ones
+	for(size_t c=0; c<CHIAKI_TAKION_SEND_CLASS_COUNT; c++)
+	{
+		while(items_count < TAKION_SEND_SCHEDULER_BATCH_MAX)
+		{
+			ChiakiTakionSendItem *item = takion_send_queue_peek(&scheduler->queues[c], taken[c]);
+			if(!item)
+				break;
+			items[items_count] = item;
+			classes[items_count] = (ChiakiTakionSendClass)c;
+			items_count++;
+			taken[c]++;
+		}
+	}
+
+	if(!items_count)
+		return 0;
+
+	// key positions are handed out in the order the packets go out
+	ChiakiErrorCode err = chiaki_mutex_lock(&takion->gkcrypt_local_mutex);
+	assert(err == CHIAKI_ERR_SUCCESS);
+	for(size_t i=0; i<items_count; i++)
+	{
+		if(!items[i]->buf)
+			continue;
+		err = takion_send_scheduler_prepare(scheduler, items[i]);
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_LOGE(scheduler->log, "Takion send scheduler failed to prepare packet: %s", chiaki_error_string(err));
+			if(items[i]->packet.reliable)
+				chiaki_takion_send_buffer_unreserve(&takion->send_buffer);
+			takion_send_item_free_buf(items[i]);
+		}
+	}
+	chiaki_mutex_unlock(&takion->gkcrypt_local_mutex);
+
+	// tracked before going out, so an ack can never arrive for a packet the send buffer doesn't know yet
+	for(size_t i=0; i<items_count; i++)
+	{
+		ChiakiTakionSendItem *item = items[i];
+		if(!item->buf || !item->packet.reliable)
+			continue;
+		// the send buffer owns buf from here on, also on error where it is already freed
+		err = chiaki_takion_send_buffer_push(&takion->send_buffer, item->packet.seq_num, item->buf, item->buf_size);
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			// without retransmission the packet may never arrive, make that visible instead of sending it once and hoping
+			CHIAKI_LOGE(scheduler->log, "Takion send scheduler failed to track reliable packet %#llx, dropping it: %s",
+				(unsigned long long)item->packet.seq_num, chiaki_error_string(err));
+			if(takion->link_quality)
+				chiaki_link_quality_push_data_resent(takion->link_quality, true);
+			item->buf = NULL;
+		}
+	}
+
+	takion_send_scheduler_send(scheduler, items, classes, items_count);
+
+	uint64_t now_us = chiaki_time_now_monotonic_us();
+	uint64_t latency_sum_us[CHIAKI_TAKION_SEND_CLASS_COUNT] = { 0 };
+	uint64_t latency_max_us[CHIAKI_TAKION_SEND_CLASS_COUNT] = { 0 };
+	for(size_t i=0; i<items_count; i++)
+	{
+		ChiakiTakionSendItem *item = items[i];
+		uint64_t latency_us = now_us > item->queued_us ? now_us - item->queued_us : 0;
+		latency_sum_us[classes[i]] += latency_us;
+		if(latency_us > latency_max_us[classes[i]])
+			latency_max_us[classes[i]] = latency_us;
+
+		if(item->packet.reliable)
+			item->buf = NULL; // owned by the send buffer
+		else
+			takion_send_item_free_buf(item);
+	}
+
+	for(size_t c=0; c<CHIAKI_TAKION_SEND_CLASS_COUNT; c++)
+	{
+		if(!taken[c])
+			continue;
+		takion_send_queue_release(&scheduler->queues[c], taken[c]);
+		if(takion->link_quality)
+			chiaki_link_quality_push_send_queue(takion->link_quality, (unsigned int)c, taken[c], latency_sum_us[c], latency_max_us[c]);
+	}
+	chiaki_atomic_fetch_add_u32(&scheduler->pending, (uint32_t)-(int32_t)items_count);
+	return items_count;
+}
+
+/**
+ * Must be called with takion->gkcrypt_local_mutex locked
+ */
+static ChiakiErrorCode takion_send_scheduler_prepare(ChiakiTakionSendScheduler *scheduler, ChiakiTakionSendItem *item)
+{
+	ChiakiTakion *takion = scheduler->takion;
+	ChiakiTakionSendPacket *packet = &item->packet;
+	uint8_t *buf = item->buf;
+	size_t buf_size = item->buf_size;
+	uint64_t key_pos;
+	ChiakiErrorCode err;
+
+	switch(packet->crypt)
+	{
+		case CHIAKI_TAKION_SEND_CRYPT_NONE:
+			return CHIAKI_ERR_SUCCESS;
+		case CHIAKI_TAKION_SEND_CRYPT_MAC:
+			if(buf_size < packet->key_pos_offset + sizeof(uint32_t))
+				return CHIAKI_ERR_BUF_TOO_SMALL;
+			err = chiaki_takion_crypt_advance_key_pos(takion, packet->key_pos_advance, &key_pos);
+			if(err != CHIAKI_ERR_SUCCESS)
+				return err;
+			*((chiaki_unaligned_uint32_t *)(buf + packet->key_pos_offset)) = htonl((uint32_t)key_pos);
+			return chiaki_takion_packet_mac(takion->gkcrypt_local, buf, buf_size, key_pos, NULL, NULL);
+		case CHIAKI_TAKION_SEND_CRYPT_ENCRYPT:
+		{
+			if(!takion->gkcrypt_local)
+				return CHIAKI_ERR_UNINITIALIZED;
+			if(buf_size < packet->payload_offset
+				|| buf_size < packet->key_pos_offset + sizeof(uint32_t)
+				|| buf_size < packet->mac_offset + CHIAKI_GKCRYPT_GMAC_SIZE)
+				return CHIAKI_ERR_BUF_TOO_SMALL;
+			size_t payload_size = buf_size - packet->payload_offset;
+			err = chiaki_takion_crypt_advance_key_pos(takion, payload_size + CHIAKI_GKCRYPT_BLOCK_SIZE, &key_pos);
+			if(err != CHIAKI_ERR_SUCCESS)
+				return err;
+			err = chiaki_gkcrypt_encrypt(takion->gkcrypt_local, key_pos + CHIAKI_GKCRYPT_BLOCK_SIZE, buf + packet->payload_offset, payload_size);
+			if(err != CHIAKI_ERR_SUCCESS)
+				return err;
+			*((chiaki_unaligned_uint32_t *)(buf + packet->key_pos_offset)) = htonl((uint32_t)key_pos);
+			return chiaki_gkcrypt_gmac(takion->gkcrypt_local, key_pos, buf, buf_size, buf + packet->mac_offset);
+		}
+		default:
+			return CHIAKI_ERR_INVALID_DATA;
+	}
+}
+
+static void takion_send_scheduler_send(ChiakiTakionSendScheduler *scheduler, ChiakiTakionSendItem **items, const ChiakiTakionSendClass *classes, size_t items_count)
+{
+	chiaki_socket_t sock = scheduler->takion->sock;
+#ifdef __linux__
+	struct mmsghdr msgs[TAKION_SEND_SCHEDULER_BATCH_MAX];
+	struct iovec iovs[TAKION_SEND_SCHEDULER_BATCH_MAX];
+
+	// input datagrams carry their DSCP as ancillary data, the rest of the socket stays unmarked
+	const ChiakiSocketTuningApplied *tuning = &scheduler->takion->socket_tuning;
+	union
+	{
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} tos_control;
+	if(tuning->dscp_per_packet && tuning->dscp_input)
+	{
+		memset(&tos_control, 0, sizeof(tos_control));
+		struct cmsghdr *cmsg = (struct cmsghdr *)tos_control.buf;
+		cmsg->cmsg_level = tuning->family == AF_INET6 ? IPPROTO_IPV6 : IPPROTO_IP;
+		cmsg->cmsg_type = tuning->family == AF_INET6 ? IPV6_TCLASS : IP_TOS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		int tos = tuning->dscp_input << 2;
+		memcpy(CMSG_DATA(cmsg), &tos, sizeof(tos));
+	}
+
+	size_t msgs_count = 0;
+	for(size_t i=0; i<items_count; i++)
+	{
+		if(!items[i]->buf)
+			continue;
+		iovs[msgs_count].iov_base = items[i]->buf;
+		iovs[msgs_count].iov_len = items[i]->buf_size;
+		memset(&msgs[msgs_count], 0, sizeof(msgs[msgs_count]));
+		msgs[msgs_count].msg_hdr.msg_iov = &iovs[msgs_count];
+		msgs[msgs_count].msg_hdr.msg_iovlen = 1;
+		if(tuning->dscp_per_packet && tuning->dscp_input && classes[i] == CHIAKI_TAKION_SEND_CLASS_INPUT)
+		{
+			// only read by the kernel, so all messages can share it
+			msgs[msgs_count].msg_hdr.msg_control = tos_control.buf;
+			msgs[msgs_count].msg_hdr.msg_controllen = sizeof(tos_control.buf);
+		}
+		msgs_count++;
+	}
+
+	size_t sent = 0;
+	while(sent < msgs_count)
+	{
+		int r = sendmmsg(sock, msgs + sent, (unsigned int)(msgs_count - sent), 0);
+		if(r < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			// the error belongs to the first message, go on with the rest
+			CHIAKI_LOGE(scheduler->log, "Takion failed to send: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+			sent++;
+			continue;
+		}
+		sent += (size_t)r;
+	}
+#else
+	(void)classes;
+	for(size_t i=0; i<items_count; i++)
+	{
+		if(!items[i]->buf)
+			continue;
+		int r = send(sock, items[i]->buf, items[i]->buf_size, 0);
+		if(r < 0)
+			CHIAKI_LOGE(scheduler->log, "Takion failed to send: " CHIAKI_SOCKET_ERROR_FMT, CHIAKI_SOCKET_ERROR_VALUE);
+	}
+#endif
+}
+
+/**
+ * Called by producers, at most one of them logs per interval and includes the drops of everyone else.
+ */
+static void takion_send_scheduler_log_drop(ChiakiTakionSendScheduler *scheduler, ChiakiTakionSendClass send_class)
+{
+	ChiakiTakionSendQueue *queue = &scheduler->queues[send_class];
+	chiaki_atomic_fetch_add_u32(&queue->drops_unlogged, 1);
+	uint64_t now_ms = chiaki_time_now_monotonic_ms();
+	uint64_t log_ms = chiaki_atomic_load_u64(&queue->drop_log_ms);
+	if(log_ms && now_ms - log_ms < TAKION_SEND_SCHEDULER_DROP_LOG_INTERVAL_MS)
+		return;
+	if(!chiaki_atomic_cas_u64(&queue->drop_log_ms, &log_ms, now_ms))
+		return;
+	uint32_t drops = chiaki_atomic_load_u32(&queue->drops_unlogged);
+	chiaki_atomic_fetch_add_u32(&queue->drops_unlogged, (uint32_t)-(int32_t)drops);
+	CHIAKI_LOGW(scheduler->log, "Takion send queue %d is full, dropped %u packets", (int)send_class, (unsigned int)drops);
+}
+
+static ChiakiErrorCode takion_send_queue_init(ChiakiTakionSendQueue *queue, size_t size)
+{
+	queue->size = 2;
+	while(queue->size < size)
+		queue->size <<= 1;
+	queue->items = calloc(queue->size, sizeof(ChiakiTakionSendItem));
+	if(!queue->items)
+		return CHIAKI_ERR_MEMORY;
+	for(uint32_t i=0; i<queue->size; i++)
+		queue->items[i].sequence = i;
+	queue->enqueue_pos = 0;
+	queue->dequeue_pos = 0;
+	queue->drops_unlogged = 0;
+	queue->drop_log_ms = 0;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static void takion_send_queue_fini(ChiakiTakionSendQueue *queue)
+{
+	// free what was pushed but never sent
+	ChiakiTakionSendItem *item;
+	uint32_t offset = 0;
+	while((item = takion_send_queue_peek(queue, offset++)))
+		takion_send_item_free_buf(item);
+	free(queue->items);
+}
+
+/**
+ * Only for the consumer. Returns the item offset places after the next one to dequeue, if it was pushed completely.
+ */
+static ChiakiTakionSendItem *takion_send_queue_peek(ChiakiTakionSendQueue *queue, uint32_t offset)
+{
+	if(offset >= queue->size)
+		return NULL;
+	uint32_t pos = queue->dequeue_pos + offset;
+	ChiakiTakionSendItem *item = &queue->items[pos & (queue->size - 1)];
+	if(chiaki_atomic_load_u32(&item->sequence) != pos + 1)
+		return NULL;
+	return item;
+}
+
+/**
+ * Only for the consumer. Hand the next count items back to the producers.
+ */
+static void takion_send_queue_release(ChiakiTakionSendQueue *queue, uint32_t count)
+{
+	for(uint32_t i=0; i<count; i++)
+	{
+		ChiakiTakionSendItem *item = &queue->items[queue->dequeue_pos & (queue->size - 1)];
+		chiaki_atomic_store_u32(&item->sequence, queue->dequeue_pos + queue->size);
+		queue->dequeue_pos++;
+	}
+}
+
+static void takion_send_item_free_buf(ChiakiTakionSendItem *item)
+{
+	if(item->buf != item->inline_buf)
+		free(item->buf);
+	item->buf = NULL;
+}
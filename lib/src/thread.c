@@ -4,15 +4,32 @@
 
 #include <chiaki/thread.h>
 #include <chiaki/time.h>
+#include <chiaki/atomic.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
 
 #ifdef __SWITCH__
 #include <switch.h>
 #endif
 
+#if !defined(_WIN32) && !defined(__SWITCH__)
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+// low end of the real-time range, audio servers usually run above this
+#define THREAD_REALTIME_PRIORITY 10
+#define THREAD_HIGH_NICE -10
+
 #if _WIN32
 static DWORD WINAPI win32_thread_func(LPVOID param)
 {
@@ -97,6 +114,159 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_set_name(ChiakiThread *thread, const
 	return CHIAKI_ERR_SUCCESS;
 }
 
+CHIAKI_EXPORT const char *chiaki_thread_priority_string(ChiakiThreadPriority priority)
+{
+	switch(priority)
+	{
+		case CHIAKI_THREAD_PRIORITY_NORMAL:
+			return "normal";
+		case CHIAKI_THREAD_PRIORITY_HIGH:
+			return "high";
+		case CHIAKI_THREAD_PRIORITY_REALTIME:
+			return "realtime";
+		default:
+			return "unknown";
+	}
+}
+
+#if !defined(_WIN32) && !defined(__SWITCH__)
+static bool thread_set_realtime()
+{
+	struct sched_param param = { 0 };
+	param.sched_priority = sched_get_priority_min(SCHED_RR) + THREAD_REALTIME_PRIORITY - 1;
+	if(pthread_setschedparam(pthread_self(), SCHED_RR, &param) == 0)
+		return true;
+#ifdef RLIMIT_RTPRIO
+	// unprivileged processes may still get the real-time priorities up to their limit
+	struct rlimit limit;
+	if(getrlimit(RLIMIT_RTPRIO, &limit) != 0 || limit.rlim_cur == 0)
+		return false;
+	if(limit.rlim_cur < (rlim_t)param.sched_priority)
+		param.sched_priority = (int)limit.rlim_cur;
+	return pthread_setschedparam(pthread_self(), SCHED_RR, &param) == 0;
+#else
+	return false;
+#endif
+}
+
+static bool thread_set_high()
+{
+#ifdef __linux__
+	// nice is per thread on Linux, but only settable by tid
+	pid_t tid = (pid_t)syscall(SYS_gettid);
+	if(setpriority(PRIO_PROCESS, tid, THREAD_HIGH_NICE) == 0)
+		return true;
+	// RLIMIT_NICE allows going down to a nice of 20 - limit
+	struct rlimit limit;
+	if(getrlimit(RLIMIT_NICE, &limit) != 0 || limit.rlim_cur <= 20)
+		return false;
+	int nice = 20 - (int)limit.rlim_cur;
+	if(nice < THREAD_HIGH_NICE)
+		nice = THREAD_HIGH_NICE;
+	return setpriority(PRIO_PROCESS, tid, nice) == 0;
+#else
+	struct sched_param param = { 0 };
+	param.sched_priority = sched_get_priority_max(SCHED_OTHER);
+	return pthread_setschedparam(pthread_self(), SCHED_OTHER, &param) == 0;
+#endif
+}
+#endif
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_set_attrs_self(const ChiakiThreadAttrs *attrs, ChiakiThreadAttrs *applied)
+{
+	ChiakiThreadAttrs result = { 0 };
+	result.priority = CHIAKI_THREAD_PRIORITY_NORMAL;
+
+#if _WIN32
+	if(attrs->priority == CHIAKI_THREAD_PRIORITY_REALTIME && SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+		result.priority = CHIAKI_THREAD_PRIORITY_REALTIME;
+	else if(attrs->priority != CHIAKI_THREAD_PRIORITY_NORMAL && SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST))
+		result.priority = CHIAKI_THREAD_PRIORITY_HIGH;
+	if(attrs->cpu_mask && SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)attrs->cpu_mask))
+		result.cpu_mask = attrs->cpu_mask;
+	// locking the whole working set is not something Windows offers
+#elif defined(__SWITCH__)
+	(void)attrs;
+#else
+	if(attrs->priority == CHIAKI_THREAD_PRIORITY_REALTIME && thread_set_realtime())
+		result.priority = CHIAKI_THREAD_PRIORITY_REALTIME;
+	else if(attrs->priority != CHIAKI_THREAD_PRIORITY_NORMAL && thread_set_high())
+		result.priority = CHIAKI_THREAD_PRIORITY_HIGH;
+
+#ifdef __linux__
+	if(attrs->cpu_mask)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for(int i=0; i<64; i++)
+		{
+			if(attrs->cpu_mask & (1ull << i))
+				CPU_SET(i, &set);
+		}
+		// 0 is the calling thread, unlike pthread_setaffinity_np() this also exists on Android
+		if(sched_setaffinity(0, sizeof(set), &set) == 0)
+			result.cpu_mask = attrs->cpu_mask;
+	}
+#endif
+
+	if(attrs->lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+		result.lock_memory = true;
+#endif
+
+	if(applied)
+		*applied = result;
+	if(result.priority != attrs->priority || result.cpu_mask != attrs->cpu_mask || result.lock_memory != attrs->lock_memory)
+		return CHIAKI_ERR_THREAD;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_thread_reset_attrs_self(void)
+{
+#if _WIN32
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_NORMAL);
+	DWORD_PTR process_mask, system_mask;
+	if(GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+		SetThreadAffinityMask(GetCurrentThread(), process_mask);
+#elif !defined(__SWITCH__)
+	struct sched_param param = { 0 };
+	pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+#ifdef __linux__
+	// the main thread's tid is the pid, so this is what the process was started with
+	errno = 0;
+	int nice = getpriority(PRIO_PROCESS, getpid());
+	if(errno == 0)
+		setpriority(PRIO_PROCESS, (pid_t)syscall(SYS_gettid), nice);
+	cpu_set_t set;
+	if(sched_getaffinity(getpid(), sizeof(set), &set) == 0)
+		sched_setaffinity(0, sizeof(set), &set);
+#endif
+#endif
+}
+
+static volatile uint32_t thread_attrs_failed_priorities;
+
+CHIAKI_EXPORT bool chiaki_thread_attrs_failure_first(const ChiakiThreadAttrs *attrs)
+{
+	uint32_t bit = 1u << attrs->priority;
+	uint32_t failed = chiaki_atomic_load_u32(&thread_attrs_failed_priorities);
+	while(!(failed & bit))
+	{
+		if(chiaki_atomic_cas_u32(&thread_attrs_failed_priorities, &failed, failed | bit))
+			return true;
+	}
+	return false;
+}
+
+CHIAKI_EXPORT void chiaki_thread_profile_default(ChiakiThreadProfile *profile)
+{
+	memset(profile, 0, sizeof(*profile));
+	// anything that delays a received packet shows up as latency or stutter
+	profile->network.priority = CHIAKI_THREAD_PRIORITY_HIGH;
+	profile->crypt.priority = CHIAKI_THREAD_PRIORITY_HIGH;
+	profile->decoder.priority = CHIAKI_THREAD_PRIORITY_HIGH;
+	profile->audio.priority = CHIAKI_THREAD_PRIORITY_HIGH;
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_mutex_init(ChiakiMutex *mutex, bool rec)
 {
 #if _WIN32
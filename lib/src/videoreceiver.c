@@ -2,35 +2,223 @@
 
 #include <chiaki/videoreceiver.h>
 #include <chiaki/session.h>
+#include <chiaki/time.h>
 
 #include <string.h>
 
+// a report is repeated with this many following frames, so a lost one doesn't have to wait for the resend timeout
+#define VIDEO_RECOVERY_REPORT_COPIES 2
+
+// without a clean frame by then, the console is assumed to have missed the report and the next problem reports again
+#define VIDEO_RECOVERY_TIMEOUT_US 1000000
+
+// longer gaps between frames (e.g. the stream was paused) start the delay over instead of counting as jitter
+#define VIDEO_TIMING_GAP_FRAMES_MAX 120
+
 static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *video_receiver);
 
-static void add_ref_frame(ChiakiVideoReceiver *video_receiver, int32_t frame)
+static void video_recovery_send(ChiakiVideoReceiver *video_receiver)
 {
-	if(video_receiver->reference_frames[0] != -1)
+	ChiakiVideoRecovery *recovery = &video_receiver->recovery;
+	ChiakiErrorCode err = stream_connection_send_corrupt_frame(&video_receiver->session->stream_connection, recovery->start, recovery->end);
+	if(err != CHIAKI_ERR_SUCCESS)
+		CHIAKI_LOGW(video_receiver->log, "Error sending corrupt frame.");
+	recovery->reports_sent++;
+}
+
+/**
+ * Report frames start to end as corrupt. Ranges are merged with everything reported since the last recovery,
+ * a range that was already reported completely is not sent again.
+ */
+static void video_recovery_report(ChiakiVideoReceiver *video_receiver, ChiakiSeqNum16 start, ChiakiSeqNum16 end)
+{
+	ChiakiVideoRecovery *recovery = &video_receiver->recovery;
+	if(recovery->active)
 	{
-		memmove(&video_receiver->reference_frames[1], &video_receiver->reference_frames[0], sizeof(int32_t) * 15);
-		video_receiver->reference_frames[0] = frame;
+		recovery->reports_merged++;
+		if(!chiaki_seq_num_16_lt(start, recovery->start) && !chiaki_seq_num_16_gt(end, recovery->end))
+			return;
+		if(chiaki_seq_num_16_lt(start, recovery->start))
+			recovery->start = start;
+		if(chiaki_seq_num_16_gt(end, recovery->end))
+			recovery->end = end;
+	}
+	else
+	{
+		recovery->active = true;
+		recovery->start = start;
+		recovery->end = end;
+		recovery->since_us = chiaki_time_now_monotonic_us();
+	}
+	recovery->copies_left = VIDEO_RECOVERY_REPORT_COPIES;
+	video_recovery_send(video_receiver);
+}
+
+/**
+ * Ask for a clean frame because the decoder is about to get (or miss) frames that depend on something broken.
+ * Nothing is sent if that has been done already and the console did not answer yet.
+ */
+static void video_recovery_request(ChiakiVideoReceiver *video_receiver, ChiakiSeqNum16 start, ChiakiSeqNum16 end)
+{
+	if(video_receiver->recovery.active)
+		return;
+	video_recovery_report(video_receiver, start, end);
+}
+
+/**
+ * Called for every new frame that starts arriving
+ */
+static void video_recovery_frame_begin(ChiakiVideoReceiver *video_receiver)
+{
+	ChiakiVideoRecovery *recovery = &video_receiver->recovery;
+	if(!recovery->active)
+		return;
+	if(chiaki_time_now_monotonic_us() - recovery->since_us > VIDEO_RECOVERY_TIMEOUT_US)
+	{
+		CHIAKI_LOGW(video_receiver->log, "Video did not recover within %d ms after reporting frames %d to %d as corrupt",
+				VIDEO_RECOVERY_TIMEOUT_US / 1000, (int)recovery->start, (int)recovery->end);
+		recovery->active = false;
+		recovery->copies_left = 0;
+		recovery->timeouts++;
 		return;
 	}
-	for(int i=15; i>=0; i--)
+	if(!recovery->copies_left)
+		return;
+	recovery->copies_left--;
+	video_recovery_send(video_receiver);
+}
+
+/**
+ * Called for every frame that was handed to the decoder successfully
+ */
+static void video_recovery_frame_decoded(ChiakiVideoReceiver *video_receiver, ChiakiSeqNum16 frame_index)
+{
+	ChiakiVideoRecovery *recovery = &video_receiver->recovery;
+	if(!recovery->active || !chiaki_seq_num_16_gt(frame_index, recovery->end))
+		return;
+	uint64_t recovery_us = chiaki_time_now_monotonic_us() - recovery->since_us;
+	recovery->active = false;
+	recovery->copies_left = 0;
+	chiaki_link_quality_push_video_recovery(&video_receiver->session->stream_connection.link_quality, recovery_us);
+	CHIAKI_LOGI(video_receiver->log, "Video recovered with frame %d after %.1f ms (corrupt frames %d to %d)",
+			(int)frame_index, (float)recovery_us * 0.001f, (int)recovery->start, (int)recovery->end);
+}
+
+CHIAKI_EXPORT void chiaki_ref_frames_init(ChiakiRefFrames *ref_frames)
+{
+	ref_frames->empty = true;
+	ref_frames->head = 0;
+	ref_frames->decoded = 0;
+	ref_frames->tainted = 0;
+}
+
+CHIAKI_EXPORT void chiaki_ref_frames_add(ChiakiRefFrames *ref_frames, ChiakiSeqNum16 frame, bool tainted)
+{
+	if(ref_frames->empty)
 	{
-		if(video_receiver->reference_frames[i] == -1)
-		{
-			video_receiver->reference_frames[i] = frame;
-			return;
-		}
+		ref_frames->empty = false;
+		ref_frames->head = frame;
+		ref_frames->decoded = 0;
+		ref_frames->tainted = 0;
+	}
+	else if(chiaki_seq_num_16_gt(frame, ref_frames->head))
+	{
+		// frames skipped on the way stay unset
+		ChiakiSeqNum16 shift = frame - ref_frames->head;
+		ref_frames->decoded = shift < CHIAKI_REF_FRAMES_WINDOW ? ref_frames->decoded << shift : 0;
+		ref_frames->tainted = shift < CHIAKI_REF_FRAMES_WINDOW ? ref_frames->tainted << shift : 0;
+		ref_frames->head = frame;
+	}
+
+	ChiakiSeqNum16 d = ref_frames->head - frame;
+	if(d >= CHIAKI_REF_FRAMES_WINDOW)
+		return;
+	uint64_t bit = (uint64_t)1 << d;
+	ref_frames->decoded |= bit;
+	if(tainted)
+		ref_frames->tainted |= bit;
+	else
+		ref_frames->tainted &= ~bit;
+}
+
+CHIAKI_EXPORT void chiaki_video_timing_init(ChiakiVideoTiming *timing, unsigned int fps)
+{
+	memset(timing, 0, sizeof(*timing));
+	timing->interval_us = 1000000 / (fps ? fps : 60);
+}
+
+static void video_timing_frame_end(ChiakiVideoTiming *timing)
+{
+	uint64_t spread_us = timing->frame_last_us - timing->frame_first_us;
+	timing->spread_last_us = spread_us;
+	timing->spread_avg_us = timing->frames ? (timing->spread_avg_us * 15 + spread_us) / 16 : spread_us;
+	if(spread_us > timing->spread_max_us)
+		timing->spread_max_us = spread_us;
+	timing->frames++;
+}
+
+static void video_timing_frame_begin(ChiakiVideoTiming *timing, ChiakiSeqNum16 frame_index, uint64_t arrival_us)
+{
+	ChiakiSeqNum16 frames = frame_index - timing->prev_index;
+	if(timing->prev_valid && frames <= VIDEO_TIMING_GAP_FRAMES_MAX && arrival_us >= timing->prev_first_us)
+	{
+		int64_t d = (int64_t)(arrival_us - timing->prev_first_us) - (int64_t)(frames * timing->interval_us);
+		timing->delay_us += d;
+		if(timing->delay_us < timing->delay_min_us)
+			timing->delay_min_us = timing->delay_us;
+		else
+			timing->delay_min_us += (timing->delay_us - timing->delay_min_us) / 1024;
+		int64_t d_abs = d < 0 ? -d : d;
+		timing->jitter_us = (uint64_t)((int64_t)timing->jitter_us + (d_abs - (int64_t)timing->jitter_us) / 16);
+		timing->delay_trend_us += (d - timing->delay_trend_us) / 16;
+	}
+	else
+	{
+		timing->delay_us = 0;
+		timing->delay_min_us = 0;
+	}
+	timing->prev_valid = true;
+	timing->prev_index = frame_index;
+	timing->prev_first_us = arrival_us;
+
+	timing->frame_active = true;
+	timing->frame_index = frame_index;
+	timing->frame_first_us = arrival_us;
+	timing->frame_last_us = arrival_us;
+}
+
+CHIAKI_EXPORT bool chiaki_video_timing_unit(ChiakiVideoTiming *timing, ChiakiSeqNum16 frame_index, uint64_t arrival_us)
+{
+	if(!arrival_us)
+		return false;
+	if(timing->frame_active && frame_index == timing->frame_index)
+	{
+		if(arrival_us < timing->frame_first_us)
+			timing->frame_first_us = arrival_us;
+		if(arrival_us > timing->frame_last_us)
+			timing->frame_last_us = arrival_us;
+		return false;
+	}
+	if(timing->frame_active)
+	{
+		if(!chiaki_seq_num_16_gt(frame_index, timing->frame_index))
+			return false;
+		video_timing_frame_end(timing);
 	}
+	video_timing_frame_begin(timing, frame_index, arrival_us);
+	return true;
 }
 
-static bool have_ref_frame(ChiakiVideoReceiver *video_receiver, int32_t frame)
+static void video_timing_report(ChiakiVideoReceiver *video_receiver)
 {
-	for(int i=0; i<16; i++)
-		if(video_receiver->reference_frames[i] == frame)
-			return true;
-	return false;
+	ChiakiVideoTiming *timing = &video_receiver->timing;
+	ChiakiLinkQualityVideoTiming stats;
+	stats.spread_avg_us = timing->spread_avg_us;
+	stats.spread_max_us = timing->spread_max_us;
+	stats.jitter_us = timing->jitter_us;
+	stats.queue_delay_us = chiaki_video_timing_queue_delay_us(timing);
+	stats.delay_trend_us = timing->delay_trend_us;
+	chiaki_link_quality_set_video_timing(&video_receiver->session->stream_connection.link_quality, &stats);
 }
 
 CHIAKI_EXPORT void chiaki_video_receiver_init(ChiakiVideoReceiver *video_receiver, struct chiaki_session_t *session, ChiakiPacketStats *packet_stats)
@@ -49,7 +237,9 @@ CHIAKI_EXPORT void chiaki_video_receiver_init(ChiakiVideoReceiver *video_receive
 	video_receiver->packet_stats = packet_stats;
 
 	video_receiver->frames_lost = 0;
-	memset(video_receiver->reference_frames, -1, sizeof(video_receiver->reference_frames));
+	chiaki_ref_frames_init(&video_receiver->ref_frames);
+	memset(&video_receiver->recovery, 0, sizeof(video_receiver->recovery));
+	chiaki_video_timing_init(&video_receiver->timing, session->connect_info.video_profile.max_fps);
 	chiaki_bitstream_init(&video_receiver->bitstream, video_receiver->log, video_receiver->session->connect_info.video_profile.codec);
 }
 
@@ -92,6 +282,9 @@ CHIAKI_EXPORT void chiaki_video_receiver_av_packet(ChiakiVideoReceiver *video_re
 		return;
 	}
 
+	if(chiaki_video_timing_unit(&video_receiver->timing, frame_index, packet->arrival_us) && video_receiver->timing.frames)
+		video_timing_report(video_receiver);
+
 	// check adaptive stream index
 	if(video_receiver->profile_cur < 0 || video_receiver->profile_cur != packet->adaptive_stream_index)
 	{
@@ -126,14 +319,14 @@ CHIAKI_EXPORT void chiaki_video_receiver_av_packet(ChiakiVideoReceiver *video_re
 		if(err != CHIAKI_ERR_SUCCESS)
 			CHIAKI_LOGW(video_receiver->log, "Video receiver could not flush frame.");
 
+		video_recovery_frame_begin(video_receiver);
+
 		ChiakiSeqNum16 next_frame_expected = (ChiakiSeqNum16)(video_receiver->frame_index_prev_complete + 1);
 		if(chiaki_seq_num_16_gt(frame_index, next_frame_expected)
 			&& !(frame_index == 1 && video_receiver->frame_index_cur < 0)) // ok for frame 1
 		{
 			CHIAKI_LOGW(video_receiver->log, "Detected missing or corrupt frame(s) from %d to %d", next_frame_expected, (int)frame_index);
-			err = stream_connection_send_corrupt_frame(&video_receiver->session->stream_connection, next_frame_expected, frame_index - 1);
-			if(err != CHIAKI_ERR_SUCCESS)
-				CHIAKI_LOGW(video_receiver->log, "Error sending corrupt frame.");
+			video_recovery_report(video_receiver, next_frame_expected, frame_index - 1);
 		}
 
 		video_receiver->frame_index_cur = frame_index;
@@ -169,7 +362,7 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 		if (flush_result == CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED)
 		{
 			ChiakiSeqNum16 next_frame_expected = (ChiakiSeqNum16)(video_receiver->frame_index_prev_complete + 1);
-			stream_connection_send_corrupt_frame(&video_receiver->session->stream_connection, next_frame_expected, video_receiver->frame_index_cur);
+			video_recovery_report(video_receiver, next_frame_expected, video_receiver->frame_index_cur);
 			video_receiver->frames_lost += video_receiver->frame_index_cur - next_frame_expected + 1;
 			video_receiver->frame_index_prev = video_receiver->frame_index_cur;
 		}
@@ -179,23 +372,37 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 
 	bool succ = flush_result != CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED;
 	bool recovered = false;
+	bool tainted = false;
+	ChiakiRefFrames *ref_frames = &video_receiver->ref_frames;
+
+	// the slice header is at the start of the first unit, so there is no need to let the parser see the rest of the frame
+	size_t slice_size = chiaki_frame_processor_first_unit_size(&video_receiver->frame_processor);
+	if(!slice_size || slice_size > frame_size)
+		slice_size = frame_size;
 
 	ChiakiBitstreamSlice slice;
-	if(chiaki_bitstream_slice(&video_receiver->bitstream, frame, frame_size, &slice))
+	if(chiaki_bitstream_slice(&video_receiver->bitstream, frame, slice_size, &slice))
 	{
-		if(slice.slice_type == CHIAKI_BITSTREAM_SLICE_P)
+		if(slice.slice_type == CHIAKI_BITSTREAM_SLICE_P && slice.reference_frame != 0xff)
 		{
 			ChiakiSeqNum16 ref_frame_index = video_receiver->frame_index_cur - slice.reference_frame - 1;
-			if(slice.reference_frame != 0xff && !have_ref_frame(video_receiver, ref_frame_index))
+			if(chiaki_ref_frames_tainted(ref_frames, ref_frame_index))
+			{
+				// decodes, but the artifacts of the reference carry over
+				tainted = true;
+				video_recovery_request(video_receiver, ref_frame_index, video_receiver->frame_index_cur);
+			}
+			else if(!chiaki_ref_frames_have(ref_frames, ref_frame_index))
 			{
 				for(unsigned i=slice.reference_frame+1; i<16; i++)
 				{
 					ChiakiSeqNum16 ref_frame_index_new = video_receiver->frame_index_cur - i - 1;
-					if(have_ref_frame(video_receiver, ref_frame_index_new))
+					if(chiaki_ref_frames_have(ref_frames, ref_frame_index_new))
 					{
-						if(chiaki_bitstream_slice_set_reference_frame(&video_receiver->bitstream, frame, frame_size, i))
+						if(chiaki_bitstream_slice_set_reference_frame(&video_receiver->bitstream, frame + slice.offset, slice_size - slice.offset, i))
 						{
 							recovered = true;
+							tainted = true;
 							CHIAKI_LOGW(video_receiver->log, "Missing reference frame %d for decoding frame %d -> changed to %d", (int)ref_frame_index, (int)video_receiver->frame_index_cur, (int)ref_frame_index_new);
 						}
 						break;
@@ -207,6 +414,8 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 					video_receiver->frames_lost++;
 					CHIAKI_LOGW(video_receiver->log, "Missing reference frame %d for decoding frame %d", (int)ref_frame_index, (int)video_receiver->frame_index_cur);
 				}
+				// every following frame will depend on this one, so don't wait for the gap detection to ask for a clean frame
+				video_recovery_request(video_receiver, ref_frame_index, video_receiver->frame_index_cur);
 			}
 		}
 	}
@@ -222,8 +431,10 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 		}
 		else
 		{
-			add_ref_frame(video_receiver, video_receiver->frame_index_cur);
-			CHIAKI_LOGV(video_receiver->log, "Added reference %c frame %d", slice.slice_type == CHIAKI_BITSTREAM_SLICE_I ? 'I' : 'P', (int)video_receiver->frame_index_cur);
+			chiaki_ref_frames_add(ref_frames, video_receiver->frame_index_cur, tainted);
+			if(!tainted)
+				video_recovery_frame_decoded(video_receiver, video_receiver->frame_index_cur);
+			CHIAKI_LOGV(video_receiver->log, "Added reference %c frame %d%s", slice.slice_type == CHIAKI_BITSTREAM_SLICE_I ? 'I' : 'P', (int)video_receiver->frame_index_cur, tainted ? " (tainted)" : "");
 		}
 	}
 
@@ -0,0 +1,172 @@
+// Benchmark of the haptics frequency analysis, doesn't need a Steam Deck.
+// Compares SDeckAnalyzer against the double precision pipeline it replaced.
+// Usage: sdeck-bench-analyzer [iterations] [samples]
+
+#include <sdeck_analyzer.h>
+#include <fftw3.h>
+#include <math.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SAMPLING_RATE 3000.0
+#define CUTOFF_FREQ 250.0
+
+typedef struct reference_t
+{
+	int N;
+	fftw_plan fft;
+	double *hann, *pcm_data;
+	double butterworth[5];
+	fftw_complex *freq_data;
+} Reference;
+
+static double now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static void reference_init(Reference *ref, int samples)
+{
+	ref->N = samples;
+	ref->hann = fftw_malloc(samples * sizeof(double));
+	for (int i = 0; i < samples; i++)
+		ref->hann[i] = 0.5 * (1 - cos(2 * M_PI * i / (samples - 1)));
+	const double ff = CUTOFF_FREQ / SAMPLING_RATE;
+	const double ita = 1.0 / tan(M_PI * ff);
+	const double q = sqrt(2.0);
+	ref->butterworth[0] = 1.0 / (1.0 + q * ita + ita * ita);
+	ref->butterworth[1] = 2 * ref->butterworth[0];
+	ref->butterworth[2] = ref->butterworth[0];
+	ref->butterworth[3] = 2.0 * (ita * ita - 1.0) * ref->butterworth[0];
+	ref->butterworth[4] = -(1.0 - q * ita + ita * ita) * ref->butterworth[0];
+	ref->pcm_data = fftw_malloc(2 * samples * sizeof(double));
+	ref->freq_data = fftw_malloc((samples + 1) * sizeof(fftw_complex));
+	ref->fft = fftw_plan_dft_r2c_1d(2 * samples, ref->pcm_data, ref->freq_data, FFTW_MEASURE);
+}
+
+static void reference_fini(Reference *ref)
+{
+	fftw_destroy_plan(ref->fft);
+	fftw_free(ref->hann);
+	fftw_free(ref->pcm_data);
+	fftw_free(ref->freq_data);
+}
+
+static void reference_run(Reference *ref, const int16_t *buf, double *frequency, double *freq_power)
+{
+	const int N = ref->N;
+	double *data = ref->pcm_data;
+	const double *b = ref->butterworth;
+	for (int i = 0; i < N; i++)
+		data[i] = buf[i];
+	double holder[N];
+	holder[0] = data[0];
+	holder[1] = data[1];
+	for (int i = 2; i < N; i++)
+		holder[i] = b[0] * data[i] + b[1] * data[i - 1] + b[2] * data[i - 2] + b[3] * holder[i - 1] + b[4] * holder[i - 2];
+	for (int i = 2; i < N; i++)
+		data[i] = holder[i];
+	for (int i = 0; i < N; i++)
+		data[i] *= ref->hann[i];
+	for (int i = N; i < 2 * N; i++)
+		data[i] = 0;
+	fftw_execute(ref->fft);
+	int max_pos = 0;
+	for (int i = 0; i < N + 1; i++)
+	{
+		ref->freq_data[i][0] = ref->freq_data[i][0] * ref->freq_data[i][0] + ref->freq_data[i][1] * ref->freq_data[i][1];
+		if (ref->freq_data[i][0] > ref->freq_data[max_pos][0])
+			max_pos = i;
+	}
+	*frequency = 0;
+	*freq_power = 0;
+	if (max_pos == 0)
+		return;
+	*frequency = (max_pos * SAMPLING_RATE) / (2 * N);
+	*freq_power = (2 * sqrt(ref->freq_data[max_pos][0])) / (2 * N);
+}
+
+int main(int argc, char *argv[])
+{
+	long iterations = argc > 1 ? strtol(argv[1], NULL, 0) : 100000;
+	int samples = argc > 2 ? atoi(argv[2]) : 120; // 4 packets of 30 samples, as used in the GUI
+	if (iterations < 1 || samples < 2)
+	{
+		fprintf(stderr, "Usage: %s [iterations] [samples]\n", argv[0]);
+		return 1;
+	}
+
+	// a few batches of noisy tones so the branch predictor doesn't see the same data every time
+	const int batches = 16;
+	int16_t *pcm = malloc(batches * samples * sizeof(int16_t));
+	if (!pcm)
+		return 1;
+	srand(1234);
+	for (int b = 0; b < batches; b++)
+	{
+		double tone = 40.0 + 15.0 * b;
+		for (int i = 0; i < samples; i++)
+			pcm[b * samples + i] = (int16_t)(6000 * sin(2 * M_PI * tone * i / SAMPLING_RATE) + (rand() % 200 - 100));
+	}
+
+	double start = now_us();
+	SDeckAnalyzer *analyzer = sdeck_analyzer_new(samples, SAMPLING_RATE);
+	if (!analyzer)
+	{
+		fprintf(stderr, "Failed to create analyzer\n");
+		return 1;
+	}
+	printf("analyzer setup (FFTW_MEASURE): %.1f us\n", now_us() - start);
+
+	Reference ref;
+	reference_init(&ref, samples);
+
+	int mismatches = 0;
+	for (int b = 0; b < batches; b++)
+	{
+		float freq, power;
+		double ref_freq, ref_power;
+		sdeck_analyzer_run(analyzer, pcm + b * samples, samples, &freq, &power);
+		reference_run(&ref, pcm + b * samples, &ref_freq, &ref_power);
+		if (fabs(freq - ref_freq) > 0.01 || fabs(power - ref_power) > 0.01 * ref_power + 0.01)
+		{
+			printf("batch %d differs: %.2f Hz / %.3f vs reference %.2f Hz / %.3f\n", b, freq, power, ref_freq, ref_power);
+			mismatches++;
+		}
+	}
+
+	volatile double sink = 0;
+	start = now_us();
+	for (long it = 0; it < iterations; it++)
+	{
+		double freq, power;
+		reference_run(&ref, pcm + (it % batches) * samples, &freq, &power);
+		sink += freq;
+	}
+	double ref_us = (now_us() - start) / iterations;
+
+	start = now_us();
+	for (long it = 0; it < iterations; it++)
+	{
+		float freq, power;
+		sdeck_analyzer_run(analyzer, pcm + (it % batches) * samples, samples, &freq, &power);
+		sink += freq;
+	}
+	double analyzer_us = (now_us() - start) / iterations;
+
+	printf("%ld iterations of %d samples\n", iterations, samples);
+	printf("reference (double): %8.3f us/batch\n", ref_us);
+	printf("analyzer (float):   %8.3f us/batch\n", analyzer_us);
+	printf("%d of %d batches differ from the reference\n", mismatches, batches);
+
+	reference_fini(&ref);
+	sdeck_analyzer_free(analyzer);
+	fftw_cleanup();
+	fftwf_cleanup();
+	free(pcm);
+	return mismatches ? 1 : 0;
+}
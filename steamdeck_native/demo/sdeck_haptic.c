@@ -23,17 +23,17 @@ void play_single_trackpad_rand(SDeck * sdeck)
 	char enter = 0;
 	while (enter != '\r' && enter != '\n') { enter = getchar(); }
 	fprintf(stderr, "Playing random mono tunes now...\n\n");
-    float haptic_interval_sec = (float)STEAMDECK_HAPTIC_INTERVAL / (float)1000000;
+	float haptic_interval_sec = (float)STEAMDECK_HAPTIC_INTERVAL / (float)1000000;
 	time_t end = time(0) + PLAYTIME;
-    srand((unsigned)end);
+	srand((unsigned)end);
 	while (time(0) < end)
 	{
 		double amp = (double)(rand() % 1000); // rand # from 0 to 999
 		clock_t start2 = clock();
-        uint16_t repeat = floor(haptic_interval_sec * amp);
+		uint16_t repeat = floor(haptic_interval_sec * amp);
 		sdeck_haptic(sdeck, TRACKPAD_RIGHT, amp, STEAMDECK_HAPTIC_INTERVAL, repeat);
 		clock_t end2 = clock();
-        printf("Playing haptic with frequency of %f, repeat of %u with total period of %f seconds.\n", amp, repeat, haptic_interval_sec);
+		printf("Playing haptic with frequency of %f, repeat of %u with total period of %f seconds.\n", amp, repeat, haptic_interval_sec);
 		printf("Took %f seconds\n", (((float)(end2-start2) / CLOCKS_PER_SEC)));
 		usleep(STEAMDECK_HAPTIC_INTERVAL);
 	}
@@ -57,17 +57,17 @@ void play_both_trackpads(SDeck * sdeck)
 		playtimel = sdeck_haptic(sdeck, TRACKPAD_RIGHT, freql[i], STEAMDECK_HAPTIC_INTERVAL, repeatl[i]);
 		playtimer = sdeck_haptic(sdeck, TRACKPAD_RIGHT, freqr[i], STEAMDECK_HAPTIC_INTERVAL, repeatr[i]);
 		printf("\ncurrent i %i\n left haptic - freq: %f, playtime: %i\n right haptic - freq: %f, playtime: %i\n", i, freql[i], playtimel, freqr[i], playtimer);
-        if (playtimel > playtimer)
-		    usleep(playtimel);
-        else
-            usleep(playtimer);
+		if (playtimel > playtimer)
+			usleep(playtimel);
+		else
+			usleep(playtimer);
 	}
 }
 
 void generate_signal(const int num_samples, const double sampling_rate, double signal_freq, double * data)
 {
-    for (int i = 0; i < num_samples; i++)
-        data[i] = -25 * cos(signal_freq * 2.0f * M_PI * (double)i/(double)sampling_rate); //+ sin(signal_freq * 2.0f * M_PI * ((double)i/(double)sampling_rate));
+	for (int i = 0; i < num_samples; i++)
+		data[i] = -25 * cos(signal_freq * 2.0f * M_PI * (double)i/(double)sampling_rate); //+ sin(signal_freq * 2.0f * M_PI * ((double)i/(double)sampling_rate));
 }
 
 void print_complex_array(fftw_complex * data, int N)
@@ -100,21 +100,21 @@ void print_autocorr(double * autocorr, int N, float sampling_rate)
 
 void frequency_demo()
 {
-    fprintf(stderr, "\n\nFREQUENCY DETECTION DEMO\n---------------------------\n");
+	fprintf(stderr, "\n\nFREQUENCY DETECTION DEMO\n---------------------------\n");
 	fprintf(stderr, "Press ENTER to play demo\n");
 	char enter = 0;
 	while (enter != '\r' && enter != '\n') { enter = getchar(); }
 	fprintf(stderr, "Detecting frequency now...\n\n");
 	double sampling_rate = 3000; // samples per second
-    double sampling_period = 50; // milliseconds
+	double sampling_period = 50; // milliseconds
 	const double max_freq = 1000; // maximum allowed haptic frequency for DualSense
-    const double target_freq = 100;
+	const double target_freq = 100;
 	const int num_samples = sampling_rate * sampling_period / 1000.0;
 	int realN = num_samples * 2; // zero padded array
 	int complexN = num_samples + 1;
-    double *hann, *pcm_data, frequency = 0, freq_power = 0;
-    fftw_complex *freq_data;
-    fftw_plan fft, ifft;
+	double *hann, *pcm_data, frequency = 0, freq_power = 0;
+	fftw_complex *freq_data;
+	fftw_plan fft, ifft;
 	hann = hann_init(num_samples);
 	pcm_data = fftw_malloc(realN * sizeof(double));
 	freq_data = fftw_malloc(complexN * sizeof(fftw_complex));
@@ -126,28 +126,28 @@ void frequency_demo()
 	clock_t start = clock();
 	hann_apply(pcm_data, hann, num_samples);
 	zero_pad(pcm_data, num_samples);
-    fftw_execute(fft);
+	fftw_execute(fft);
 	calc_powers(freq_data, complexN);
 	max_power_freq(complexN, sampling_rate, &frequency, &freq_power, freq_data);
 	clock_t end1 = clock();
 	//print_powers(freq_data, complexN, sampling_rate);
-    fftw_execute(ifft);
-    clock_t end2 = clock();
-    // Get autocoorelation of period using convolution thereorem (fft->powers->ifft)
-    print_autocorr(pcm_data, complexN, sampling_rate);
-    printf("\n\nFREQUENCY RESULTS\n-------------------\n");
-    printf("Power Calculated Frequency is: %f Hz with power: %f\n", frequency, freq_power);
-    if (compute_freq(pcm_data, complexN, sampling_rate, &frequency, max_freq) == 0)
-        printf("Autocorrelation Calculated Frequency is: %f Hz\n", frequency);
-    printf("Real Frquency of signal is: %f Hz\n", target_freq);
+	fftw_execute(ifft);
+	clock_t end2 = clock();
+	// Get autocoorelation of period using convolution thereorem (fft->powers->ifft)
+	print_autocorr(pcm_data, complexN, sampling_rate);
+	printf("\n\nFREQUENCY RESULTS\n-------------------\n");
+	printf("Power Calculated Frequency is: %f Hz with power: %f\n", frequency, freq_power);
+	if (compute_freq(pcm_data, complexN, sampling_rate, &frequency, max_freq) == 0)
+		printf("Autocorrelation Calculated Frequency is: %f Hz\n", frequency);
+	printf("Real Frquency of signal is: %f Hz\n", target_freq);
 	printf("\n\nFinding frequency via max power frequency took %f seconds\n", (((float)(end1-start) / CLOCKS_PER_SEC)));
-    printf("Finding frquency via autocorrelation took %f seconds\n", (((float)(end2-start) / CLOCKS_PER_SEC)));
-	
-    fftw_destroy_plan(fft);
-    fftw_destroy_plan(ifft);
+	printf("Finding frquency via autocorrelation took %f seconds\n", (((float)(end2-start) / CLOCKS_PER_SEC)));
+
+	fftw_destroy_plan(fft);
+	fftw_destroy_plan(ifft);
 
 	fftw_free(hann);
-    fftw_free(pcm_data);
+	fftw_free(pcm_data);
 	fftw_free(freq_data);
 	fftw_cleanup();
 }
@@ -161,9 +161,9 @@ int main()
 		printf("Failed to init sdeck\n");
 		return 1;
 	}
-    play_single_trackpad_rand(sdeck);
-    play_both_trackpads(sdeck);
-    sdeck_free(sdeck);
-    frequency_demo();
+	play_single_trackpad_rand(sdeck);
+	play_both_trackpads(sdeck);
+	sdeck_free(sdeck);
+	frequency_demo();
 	return 0;
 }
\ No newline at end of file
@@ -112,6 +112,12 @@ int sdeck_haptic_ratio(SDeck *sdeck, uint8_t position, double frequency, uint32_
 int send_haptic(SDeck* sdeck, uint8_t position, uint16_t period_high, uint16_t period_low, uint16_t repeat_count);
 int sdeck_haptic_init(SDeck * sdeck, int samples);
 int play_pcm_haptic(SDeck *sdeck, uint8_t position, int16_t *buf, const int32_t num_elements, const int sampling_rate);
+// Runs play_pcm_haptic on a dedicated thread, requires sdeck_haptic_init() first.
+// The worker is stopped by sdeck_free().
+int sdeck_haptic_worker_start(SDeck *sdeck, int sampling_rate);
+// Queue one batch for position, replacing a batch that hasn't been played yet.
+// buf may be NULL to mark an interval without haptics.
+int sdeck_haptic_submit(SDeck *sdeck, uint8_t position, const int16_t *buf, const int num_elements);
 
 #ifdef __cplusplus
 }
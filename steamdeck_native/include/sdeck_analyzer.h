@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef _SDECK_ANALYZER_H
+#define _SDECK_ANALYZER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/**
+ * Finds the dominant frequency and its power in a batch of haptics pcm data.
+ *
+ * All buffers and the FFTW plan are created once for a fixed batch size,
+ * running an analysis does not allocate.
+ * An analyzer may be used from any thread, but only from one at a time.
+ */
+typedef struct sdeck_analyzer_t SDeckAnalyzer;
+
+SDeckAnalyzer *sdeck_analyzer_new(int samples, float sampling_rate);
+void sdeck_analyzer_free(SDeckAnalyzer *analyzer);
+int sdeck_analyzer_samples(SDeckAnalyzer *analyzer);
+
+/**
+ * Low-pass filter, window and transform buf and pick the bin with the highest power.
+ *
+ * @param num_elements must match the samples the analyzer was created with
+ * @param frequency set to the dominant frequency in Hz, or 0 if there is none
+ * @param freq_power set to the amplitude of the dominant frequency
+ * @return 0 on success, -1 on size mismatch
+ */
+int sdeck_analyzer_run(SDeckAnalyzer *analyzer, const int16_t *buf, int num_elements, float *frequency, float *freq_power);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,4 +1,5 @@
 #include <sdeck.h>
+#include <sdeck_analyzer.h>
 #include <stdio.h>
 #include <wchar.h>
 #include <string.h>
@@ -7,6 +8,7 @@
 #include <math.h>
 #include <unistd.h>
 #include <fftw3.h>
+#include <pthread.h>
 #define ENABLE_LOG
 
 #ifdef ENABLE_LOG
@@ -32,16 +34,23 @@
 #define STEAM_DECK_HAPTIC_COMMAND 0x8f
 #define STEAM_DECK_HAPTIC_LENGTH 0x07
 #define STEAM_DECK_HAPTIC_INTENSITY 0.38f
-#define STEAM_DECK_CUTOFF_FREQ 250.0f
 #define STEAM_DECK_HAPTIC_SAMPLING_FREQ 3000.0f
 
-typedef struct freq_t
-{
-	int N;
-	fftw_plan fft;
-	double *hann, *butterworth, *pcm_data;
-	fftw_complex *freq_data;
-} FreqFinder;
+typedef struct haptic_worker_t
+{
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool running;
+	bool stop;
+	int sampling_rate;
+	// indexed by SDHapticPos
+	int16_t *pending[2];
+	bool has_pending[2];
+	bool pending_silent[2];
+	bool skip[2];
+	int16_t *work;
+} HapticWorker;
 
 struct sdeck_t
 {
@@ -50,7 +59,8 @@ struct sdeck_t
 	SDeckMotion prev_motion;
 	int gyro;
 	bool motion_dirty;
-	FreqFinder *freqfinder;
+	SDeckAnalyzer *analyzer;
+	HapticWorker *haptic_worker;
 };
 
 hid_device *is_steam_deck();
@@ -58,9 +68,7 @@ void movemult_accel(float *accel, float mult);
 void calc_powers(fftw_complex *data, int N);
 void max_power_freq(const int N, const double sampling_rate, double *frequency, double *freq_power, fftw_complex *power);
 void generate_event(SDeck *sdeck, SDeckEventType type, SDeckEventCb cb, void *user);
-double * butterworth_init();
-void lpf_apply(double * pcm_data, double * butterworth, int N);
-FreqFinder *freqfinder_new(int samples);
+void haptic_worker_free(SDeck *sdeck);
 
 SDeck *sdeck_new()
 {
@@ -85,51 +93,42 @@ SDeck *sdeck_new()
 	memset(&sdeck->prev_motion, 0, sizeof(SDeckMotion));
 	sdeck->motion_dirty = false;
 	sdeck->gyro = STEAM_DECK_MOTION_COOLDOWN;
-	sdeck->freqfinder = NULL;
+	sdeck->analyzer = NULL;
+	sdeck->haptic_worker = NULL;
 	return sdeck;
 }
 
 int sdeck_haptic_init(SDeck *sdeck, int samples)
 {
-	sdeck->freqfinder = freqfinder_new(samples);
-	if (!sdeck->freqfinder)
+	if (sdeck->analyzer)
+	{
+		if (sdeck_analyzer_samples(sdeck->analyzer) == samples)
+			return 0;
+		if (sdeck->haptic_worker)
+		{
+			SDECK_LOG("Can't change haptic sample count while the haptic worker is running\n");
+			return -1;
+		}
+		sdeck_analyzer_free(sdeck->analyzer);
+	}
+	sdeck->analyzer = sdeck_analyzer_new(samples, STEAM_DECK_HAPTIC_SAMPLING_FREQ);
+	if (!sdeck->analyzer)
 		return -1;
 	return 0;
 }
 
-FreqFinder *freqfinder_new(int samples)
-{
-	FreqFinder *freqfinder = fftw_malloc(sizeof(FreqFinder));
-	freqfinder->N = samples;
-	freqfinder->hann = hann_init(samples);
-	freqfinder->butterworth = butterworth_init();
-	freqfinder->pcm_data = fftw_malloc(2 * samples * sizeof(double));
-	freqfinder->freq_data = fftw_malloc((samples + 1) * sizeof(fftw_complex));
-	freqfinder->fft = fftw_plan_dft_r2c_1d(2 * samples, freqfinder->pcm_data, freqfinder->freq_data, FFTW_MEASURE);
-	return freqfinder;
-}
-
-void haptic_free(FreqFinder *freqfinder)
-{
-	fftw_destroy_plan(freqfinder->fft);
-
-	fftw_free(freqfinder->hann);
-	fftw_free(freqfinder->butterworth);
-	fftw_free(freqfinder->pcm_data);
-	fftw_free(freqfinder->freq_data);
-	fftw_free(freqfinder);
-
-	fftw_cleanup();
-}
-
 void sdeck_free(SDeck *sdeck)
 {
 	if (!sdeck)
 		return;
+	haptic_worker_free(sdeck);
 	hid_close(sdeck->hiddev);
 	hid_exit();
-	if (sdeck->freqfinder)
-		haptic_free(sdeck->freqfinder);
+	if (sdeck->analyzer)
+	{
+		sdeck_analyzer_free(sdeck->analyzer);
+		fftwf_cleanup();
+	}
 	free(sdeck);
 }
 
@@ -225,33 +224,6 @@ double *hann_init(int N) // calc hann coefficients (once per array size and can
 		han[i] = 0.5 * (1 - cos(2 * M_PI * i / (N - 1)));
 	return han;
 }
-double *butterworth_init()
-{
-	double *butterworth = fftw_malloc(5 * sizeof(double));
-	const double ff = STEAM_DECK_CUTOFF_FREQ / STEAM_DECK_HAPTIC_SAMPLING_FREQ;
-	const double ita = 1.0/tan(M_PI * ff);
-	const double q = sqrt(2.0);
-	butterworth[0] = 1.0 / (1.0 + q*ita + ita*ita);
-	butterworth[1] = 2 * butterworth[0];
-	butterworth[2] = butterworth[0];
-	butterworth[3] = 2.0 * (ita * ita - 1.0) * butterworth[0];
-	butterworth[4] = -(1.0 - q * ita + ita * ita) * butterworth[0];
-	return butterworth;
-}
-
-void lpf_apply(double *buf, double * butterworth, int buf_count)
-{
-	double holder_buffer[buf_count];
-	holder_buffer[0] = buf[0];
-	holder_buffer[1] = buf[1];
-	for (int i = 2; i < buf_count; i++)
-		holder_buffer[i] = butterworth[0] * buf[i] + butterworth[1] * buf[i - 1] + butterworth[2] * buf[i - 2] + butterworth[3] * holder_buffer[i - 1] + butterworth[4] * holder_buffer[i - 2];
-	for (int i = 2; i < buf_count; i++)
-	{
-		buf[i] = holder_buffer[i];
-	}
-}
-
 void hann_apply(double *data, double *han, int N) // apply hann window to data
 {
 	for (int i = 0; i < N; i++)
@@ -309,32 +281,6 @@ void max_power_freq(const int N, const double sampling_rate, double *frequency,
 	*freq_power = ((2 * sqrt(power[max_pos][0])) / originalN);
 }
 
-void calc_freqs(FreqFinder *freqfinder, const int sampling_rate, double *freq, double *freq_power)
-{
-	int N = freqfinder->N;
-	int complexN = freqfinder->N + 1;
-	lpf_apply(freqfinder->pcm_data, freqfinder->butterworth, N);
-	hann_apply(freqfinder->pcm_data, freqfinder->hann, N);
-	zero_pad(freqfinder->pcm_data, N);
-	fftw_execute(freqfinder->fft);
-	calc_powers(freqfinder->freq_data, complexN);
-	max_power_freq(complexN, sampling_rate, freq, freq_power, freqfinder->freq_data);
-}
-
-int get_data(FreqFinder *freqfinder, int16_t *buf, const int num_elements)
-{
-	if (freqfinder->N != num_elements)
-	{
-		SDECK_LOG("\nBuffer size mismatch...initialized buffer is not right size!\n");
-		return -1;
-	}
-	for (int i = 0; i < num_elements; i++)
-	{
-		freqfinder->pcm_data[i] = buf[i];
-	}
-	return 0;
-}
-
 void find_repeat(double * data, const int num_samples, const double frequency, const int sampling_rate, const double avg_min, double * total_avg, int * repeat_count)
 {
 	int counter = 0;
@@ -378,12 +324,14 @@ int play_pcm_haptic(SDeck *sdeck, uint8_t position, int16_t *buf, const int num_
 	const int avg_min = 50; // don't play samples that are less than 1% volume
 	int repeat = 0;
 	int32_t playtime = 0;
-	double freq = 0, avg = 0, ratio = 0, freq_power = 0;
-	if (get_data(sdeck->freqfinder, buf, num_elements))
+	float freq = 0, freq_power = 0;
+	double avg = 0;
+	if (!sdeck->analyzer)
+		return -1;
+	if (sdeck_analyzer_run(sdeck->analyzer, buf, num_elements, &freq, &freq_power))
 		return -1;
 	// interval in microseconds
 	interval = 1000000 * ((double)num_elements / (double)sampling_rate);
-	calc_freqs(sdeck->freqfinder, sampling_rate, &freq, &freq_power);
 	if (!freq)
 		return 0;
 	avg = 5 * freq_power;
@@ -399,6 +347,128 @@ int play_pcm_haptic(SDeck *sdeck, uint8_t position, int16_t *buf, const int num_
 	return 2;
 }
 
+static void *haptic_worker_func(void *user)
+{
+	SDeck *sdeck = user;
+	HapticWorker *worker = sdeck->haptic_worker;
+	const int samples = sdeck_analyzer_samples(sdeck->analyzer);
+	pthread_mutex_lock(&worker->mutex);
+	while (true)
+	{
+		while (!worker->stop && !worker->has_pending[TRACKPAD_RIGHT] && !worker->has_pending[TRACKPAD_LEFT])
+			pthread_cond_wait(&worker->cond, &worker->mutex);
+		if (worker->stop)
+			break;
+		for (int position = 0; position < 2; position++)
+		{
+			if (!worker->has_pending[position])
+				continue;
+			worker->has_pending[position] = false;
+			// an interval without haptics ends skipping, same as one that was borrowed from
+			if (worker->pending_silent[position] || worker->skip[position])
+			{
+				worker->skip[position] = false;
+				continue;
+			}
+			memcpy(worker->work, worker->pending[position], samples * sizeof(int16_t));
+			// analysis and hid write happen without the lock so submitting never waits for them
+			pthread_mutex_unlock(&worker->mutex);
+			int intervals = play_pcm_haptic(sdeck, position, worker->work, samples, worker->sampling_rate);
+			pthread_mutex_lock(&worker->mutex);
+			if (intervals < 0)
+				SDECK_LOG("Failed to submit haptics audio to Steam Deck\n");
+			else if (intervals == 2)
+				worker->skip[position] = true;
+		}
+	}
+	pthread_mutex_unlock(&worker->mutex);
+	return NULL;
+}
+
+int sdeck_haptic_worker_start(SDeck *sdeck, int sampling_rate)
+{
+	if (!sdeck->analyzer)
+	{
+		SDECK_LOG("sdeck_haptic_init() must be called before starting the haptic worker\n");
+		return -1;
+	}
+	if (sdeck->haptic_worker)
+		return 0;
+	const int samples = sdeck_analyzer_samples(sdeck->analyzer);
+	HapticWorker *worker = calloc(1, sizeof(HapticWorker));
+	if (!worker)
+		return -1;
+	worker->sampling_rate = sampling_rate;
+	worker->pending[0] = calloc(samples, sizeof(int16_t));
+	worker->pending[1] = calloc(samples, sizeof(int16_t));
+	worker->work = calloc(samples, sizeof(int16_t));
+	if (!worker->pending[0] || !worker->pending[1] || !worker->work)
+		goto error_bufs;
+	if (pthread_mutex_init(&worker->mutex, NULL) != 0)
+		goto error_bufs;
+	if (pthread_cond_init(&worker->cond, NULL) != 0)
+		goto error_mutex;
+	sdeck->haptic_worker = worker;
+	if (pthread_create(&worker->thread, NULL, haptic_worker_func, sdeck) != 0)
+	{
+		sdeck->haptic_worker = NULL;
+		goto error_cond;
+	}
+	worker->running = true;
+	return 0;
+error_cond:
+	pthread_cond_destroy(&worker->cond);
+error_mutex:
+	pthread_mutex_destroy(&worker->mutex);
+error_bufs:
+	free(worker->pending[0]);
+	free(worker->pending[1]);
+	free(worker->work);
+	free(worker);
+	return -1;
+}
+
+int sdeck_haptic_submit(SDeck *sdeck, uint8_t position, const int16_t *buf, const int num_elements)
+{
+	HapticWorker *worker = sdeck->haptic_worker;
+	if (!worker || position > TRACKPAD_LEFT)
+		return -1;
+	if (buf && num_elements != sdeck_analyzer_samples(sdeck->analyzer))
+	{
+		SDECK_LOG("\nBuffer size mismatch...initialized buffer is not right size!\n");
+		return -1;
+	}
+	pthread_mutex_lock(&worker->mutex);
+	// a batch that the worker hasn't picked up yet is stale by now and just gets replaced
+	if (buf)
+		memcpy(worker->pending[position], buf, num_elements * sizeof(int16_t));
+	worker->pending_silent[position] = !buf;
+	worker->has_pending[position] = true;
+	pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&worker->mutex);
+	return 0;
+}
+
+void haptic_worker_free(SDeck *sdeck)
+{
+	HapticWorker *worker = sdeck->haptic_worker;
+	if (!worker)
+		return;
+	pthread_mutex_lock(&worker->mutex);
+	worker->stop = true;
+	pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&worker->mutex);
+	if (worker->running)
+		pthread_join(worker->thread, NULL);
+	pthread_cond_destroy(&worker->cond);
+	pthread_mutex_destroy(&worker->mutex);
+	free(worker->pending[0]);
+	free(worker->pending[1]);
+	free(worker->work);
+	free(worker);
+	sdeck->haptic_worker = NULL;
+}
+
 int send_haptic(SDeck *sdeck, uint8_t position, uint16_t period_high, uint16_t period_low, uint16_t repeat_count)
 {
 	hid_device *handle = sdeck->hiddev;
@@ -0,0 +1,140 @@
+#include <sdeck_analyzer.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <fftw3.h>
+
+#define SDECK_ANALYZER_CUTOFF_FREQ 250.0f
+
+struct sdeck_analyzer_t
+{
+	int N;
+	float sampling_rate;
+	fftwf_plan fft;
+	// feedforward (b0, b1, b2) and feedback (a1, a2) coefficients of the 2nd order Butterworth lpf
+	float b0, b1, b2, a1, a2;
+	// all allocated with fftwf_malloc for SIMD alignment
+	float *hann;
+	float *feedforward;
+	float *pcm_data; // 2 * N, upper half stays zero for padding
+	fftwf_complex *freq_data; // N + 1
+};
+
+SDeckAnalyzer *sdeck_analyzer_new(int samples, float sampling_rate)
+{
+	if (samples < 2)
+		return NULL;
+	SDeckAnalyzer *analyzer = calloc(1, sizeof(SDeckAnalyzer));
+	if (!analyzer)
+		return NULL;
+	analyzer->N = samples;
+	analyzer->sampling_rate = sampling_rate;
+	analyzer->hann = fftwf_malloc(samples * sizeof(float));
+	analyzer->feedforward = fftwf_malloc(samples * sizeof(float));
+	analyzer->pcm_data = fftwf_malloc(2 * samples * sizeof(float));
+	analyzer->freq_data = fftwf_malloc((samples + 1) * sizeof(fftwf_complex));
+	if (!analyzer->hann || !analyzer->feedforward || !analyzer->pcm_data || !analyzer->freq_data)
+	{
+		sdeck_analyzer_free(analyzer);
+		return NULL;
+	}
+
+	// FFTW_MEASURE overwrites the arrays, so plan before filling them
+	analyzer->fft = fftwf_plan_dft_r2c_1d(2 * samples, analyzer->pcm_data, analyzer->freq_data, FFTW_MEASURE | FFTW_PRESERVE_INPUT);
+	if (!analyzer->fft)
+	{
+		sdeck_analyzer_free(analyzer);
+		return NULL;
+	}
+	memset(analyzer->pcm_data, 0, 2 * samples * sizeof(float));
+
+	for (int i = 0; i < samples; i++)
+		analyzer->hann[i] = (float)(0.5 * (1 - cos(2 * M_PI * i / (samples - 1))));
+
+	const double ff = SDECK_ANALYZER_CUTOFF_FREQ / sampling_rate;
+	const double ita = 1.0 / tan(M_PI * ff);
+	const double q = sqrt(2.0);
+	const double b0 = 1.0 / (1.0 + q * ita + ita * ita);
+	analyzer->b0 = (float)b0;
+	analyzer->b1 = (float)(2 * b0);
+	analyzer->b2 = (float)b0;
+	analyzer->a1 = (float)(2.0 * (ita * ita - 1.0) * b0);
+	analyzer->a2 = (float)(-(1.0 - q * ita + ita * ita) * b0);
+	return analyzer;
+}
+
+void sdeck_analyzer_free(SDeckAnalyzer *analyzer)
+{
+	if (!analyzer)
+		return;
+	if (analyzer->fft)
+		fftwf_destroy_plan(analyzer->fft);
+	fftwf_free(analyzer->hann);
+	fftwf_free(analyzer->feedforward);
+	fftwf_free(analyzer->pcm_data);
+	fftwf_free(analyzer->freq_data);
+	free(analyzer);
+}
+
+int sdeck_analyzer_samples(SDeckAnalyzer *analyzer)
+{
+	return analyzer->N;
+}
+
+int sdeck_analyzer_run(SDeckAnalyzer *analyzer, const int16_t *buf, int num_elements, float *frequency, float *freq_power)
+{
+	const int N = analyzer->N;
+	if (num_elements != N)
+	{
+		fprintf(stderr, "\nBuffer size mismatch...initialized buffer is not right size!\n");
+		return -1;
+	}
+	float *restrict pcm = analyzer->pcm_data;
+	float *restrict ffw = analyzer->feedforward;
+	const float *restrict hann = analyzer->hann;
+	const float b0 = analyzer->b0, b1 = analyzer->b1, b2 = analyzer->b2;
+	const float a1 = analyzer->a1, a2 = analyzer->a2;
+
+	// The feedforward half of the filter has no loop-carried dependency and vectorizes,
+	// only the feedback half has to run sample by sample.
+	for (int i = 2; i < N; i++)
+		ffw[i] = b0 * (float)buf[i] + b1 * (float)buf[i - 1] + b2 * (float)buf[i - 2];
+
+	// filtered samples before windowing, the first two are passed through like before
+	float y2 = buf[0], y1 = buf[1];
+	pcm[0] = y2 * hann[0];
+	pcm[1] = y1 * hann[1];
+	for (int i = 2; i < N; i++)
+	{
+		float y = ffw[i] + a1 * y1 + a2 * y2;
+		pcm[i] = y * hann[i];
+		y2 = y1;
+		y1 = y;
+	}
+
+	// pcm[N..2N) is the zero padding, preserved by the plan
+	fftwf_execute(analyzer->fft);
+
+	const fftwf_complex *restrict freq = analyzer->freq_data;
+	const int complexN = N + 1;
+	int max_pos = 0;
+	float max_power = freq[0][0] * freq[0][0] + freq[0][1] * freq[0][1];
+	for (int i = 1; i < complexN; i++)
+	{
+		float power = freq[i][0] * freq[i][0] + freq[i][1] * freq[i][1];
+		if (power > max_power)
+		{
+			max_power = power;
+			max_pos = i;
+		}
+	}
+	*frequency = 0;
+	*freq_power = 0;
+	if (max_pos == 0)
+		return 0;
+	const int originalN = 2 * N;
+	*frequency = (max_pos * analyzer->sampling_rate) / originalN;
+	*freq_power = (2 * sqrtf(max_power)) / originalN;
+	return 0;
+}
@@ -46,6 +46,7 @@ extern "C"
 
 #include <chiaki/controller.h>
 #include <chiaki/log.h>
+#include <chiaki/haptics.h>
 
 #include "exception.h"
 
@@ -53,7 +53,7 @@ void DiscoveryManager::SetService(bool enable)
 	if(enable)
 	{
 		IfAddrs addresses = GetIPv4BroadcastAddr();
-		ChiakiDiscoveryServiceOptions options;
+		ChiakiDiscoveryServiceOptions options = {};
 		options.ping_ms = PING_MS;
 		options.ping_initial_ms = PING_MS;
 		options.hosts_max = HOSTS_MAX;
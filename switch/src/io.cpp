@@ -525,22 +525,11 @@ void IO::SetRumble(uint8_t left, uint8_t right)
 }
 
 void IO::HapticCB(uint8_t *buf, size_t buf_size) {
-		int16_t amplitudel = 0, amplituder = 0;
-		int32_t suml = 0, sumr = 0;
-		const size_t sample_size = 2 * sizeof(int16_t); // stereo samples
-
-		size_t buf_count = buf_size / sample_size;
-		for (size_t i = 0; i < buf_count; i++){
-			size_t cur = i * sample_size;
-
-			memcpy(&amplitudel, buf + cur, sizeof(int16_t));
-			memcpy(&amplituder, buf + cur + sizeof(int16_t), sizeof(int16_t));
-			suml += amplitudel;
-			sumr += amplituder;
-		}
+		ChiakiHapticsEnvelope envelope;
+		chiaki_haptics_envelope(buf, buf_size / CHIAKI_HAPTICS_FRAME_SIZE, &envelope);
 		uint16_t left = 0, right = 0;
-		left = suml / buf_count;
-		right = sumr / buf_count;
+		left = envelope.mean_left > 0 ? envelope.mean_left : 0;
+		right = envelope.mean_right > 0 ? envelope.mean_right : 0;
 		SetHapticRumble(left, right);
 		if ((left != 0 || right != 0) && !haptic_lock) {
 			haptic_lock = true;
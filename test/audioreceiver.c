@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/audioreceiver.h>
+#include <chiaki/session.h>
+
+#include <string.h>
+
+#define UNIT_SIZE 4
+#define FEC_UNITS 2
+#define FRAMES_MAX 64
+
+typedef struct frame_record_t
+{
+	uint16_t frames[FRAMES_MAX];
+	size_t count;
+	bool failed;
+} FrameRecord;
+
+static void frame_cb(uint8_t *buf, size_t buf_size, void *user)
+{
+	FrameRecord *record = user;
+	if(buf_size != UNIT_SIZE || record->count >= FRAMES_MAX)
+	{
+		record->failed = true;
+		return;
+	}
+	uint16_t frame_index;
+	memcpy(&frame_index, buf, sizeof(frame_index));
+	record->frames[record->count++] = frame_index;
+}
+
+static void push_packet(ChiakiAudioReceiver *receiver, ChiakiSeqNum16 frame_index)
+{
+	// one source unit followed by the two frames before it, each unit holds its own frame index
+	uint8_t data[(1 + FEC_UNITS) * UNIT_SIZE] = { 0 };
+	ChiakiSeqNum16 units[1 + FEC_UNITS] = { frame_index, frame_index - 2, frame_index - 1 };
+	for(size_t i = 0; i < 1 + FEC_UNITS; i++)
+		memcpy(data + i * UNIT_SIZE, &units[i], sizeof(ChiakiSeqNum16));
+
+	ChiakiTakionAVPacket packet = { 0 };
+	packet.frame_index = frame_index;
+	packet.codec = 5;
+	packet.units_in_frame_total = 1 + FEC_UNITS;
+	packet.units_in_frame_fec = (UNIT_SIZE << 8) | (FEC_UNITS << 4) | 1;
+	packet.data = data;
+	packet.data_size = sizeof(data);
+	chiaki_audio_receiver_av_packet(receiver, &packet);
+}
+
+static MunitResult test_audio_receiver_window(const MunitParameter params[], void *user)
+{
+	static ChiakiSession session;
+	static FrameRecord record;
+	memset(&session, 0, sizeof(session));
+	memset(&record, 0, sizeof(record));
+	session.audio_sink.frame_cb = frame_cb;
+	session.audio_sink.user = &record;
+
+	static ChiakiAudioReceiver receiver;
+	ChiakiErrorCode err = chiaki_audio_receiver_init(&receiver, &session, NULL, "test_audio");
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	// in order, the fec units only repeat what was already delivered
+	for(ChiakiSeqNum16 i = 0; i < 4; i++)
+		push_packet(&receiver, i);
+	// 4 and 5 are lost and recovered from the fec units of 6
+	for(ChiakiSeqNum16 i = 6; i < 10; i++)
+		push_packet(&receiver, i);
+	// reordered, 12 already brings 10 and 11
+	push_packet(&receiver, 10);
+	push_packet(&receiver, 12);
+	push_packet(&receiver, 11);
+	// 13 to 16 are lost, 17 brings 15 and 16, 13 and 14 are given up eventually
+	push_packet(&receiver, 17);
+	push_packet(&receiver, 18);
+	// too late
+	push_packet(&receiver, 14);
+	push_packet(&receiver, 19);
+
+	munit_assert_false(record.failed);
+	static const uint16_t expected[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 15, 16, 17, 18, 19 };
+	munit_assert_size(record.count, ==, sizeof(expected) / sizeof(expected[0]));
+	for(size_t i = 0; i < record.count; i++)
+		munit_assert_uint16(record.frames[i], ==, expected[i]);
+	munit_assert_uint64(receiver.frames_delivered, ==, record.count);
+	munit_assert_uint64(receiver.frames_recovered, ==, 5);
+	munit_assert_uint64(receiver.frames_lost, ==, 2);
+
+	// counted under its own name, not mixed with other receivers
+	ChiakiMetric *delivered = chiaki_metrics_find(chiaki_metrics_default(), "test_audio.frames_delivered");
+	munit_assert_ptr_equal(delivered, receiver.metrics.frames_delivered);
+	munit_assert_uint64(delivered->value, ==, record.count);
+	munit_assert_ptr_not_equal(receiver.metrics.frames_delivered, chiaki_metrics_register_counter(chiaki_metrics_default(), "audio.frames_delivered"));
+
+	chiaki_audio_receiver_fini(&receiver);
+	return MUNIT_OK;
+}
+
+MunitTest tests_audio_receiver[] = {
+	{
+		"/window",
+		test_audio_receiver_window,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
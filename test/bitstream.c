@@ -170,6 +170,41 @@ static MunitResult test_bitstream_set_ref_h265(const MunitParameter params[], vo
 	return MUNIT_OK;
 }
 
+static MunitResult test_bitstream_slice_first_unit(const MunitParameter params[], void *fixture)
+{
+	ChiakiBitstream bs;
+	ChiakiBitstreamSlice slice_unit, slice_full;
+
+	chiaki_bitstream_init(&bs, NULL, CHIAKI_CODEC_H264);
+
+	uint8_t header[] = {
+		0x00, 0x00, 0x00, 0x01, 0x67, 0x4d, 0x40, 0x32, 0x91, 0x8a, 0x01, 0xe0, 0x08, 0x9f, 0x97, 0x01,
+		0x6a, 0x02, 0x02, 0x02, 0x80, 0x00, 0x03, 0xe9, 0x00, 0x01, 0xd4, 0xc0, 0x44, 0xd0, 0xf1, 0xf1,
+		0x50, 0x00, 0x00, 0x00, 0x01, 0x68, 0xee, 0x3c, 0x80,
+	};
+	munit_assert(chiaki_bitstream_header(&bs, header, ARRAY_SIZE(header)));
+
+	// two slices of one frame, the header of the first must parse the same with or without the second
+	uint8_t frame[] = {
+		0x00, 0x00, 0x00, 0x01, 0x41, 0x9b, 0xfd, 0x98, 0x89, 0xdf, 0x00, 0x03, 0x24, 0x60, 0x47, 0x1a,
+		0x90, 0x10, 0xb3, 0x2c, 0x4e, 0x45, 0xfc, 0xff, 0x45, 0x24, 0x8c, 0x79, 0xec, 0x12, 0xe5, 0x9b,
+		0x00, 0x00, 0x00, 0x01, 0x41, 0x9a, 0x04, 0x44, 0x3f, 0x41, 0x5b, 0xf4, 0x65, 0xb4, 0x3e, 0x1a,
+		0xd3, 0xa0, 0x28, 0x1f, 0x83, 0x63, 0x0e, 0xc2, 0xfc, 0x9d, 0x7a, 0xc7, 0xc4, 0x7d, 0xf9, 0x18,
+	};
+	memset(&slice_unit, -1, sizeof(slice_unit));
+	memset(&slice_full, -1, sizeof(slice_full));
+	munit_assert(chiaki_bitstream_slice(&bs, frame, 32, &slice_unit));
+	munit_assert(chiaki_bitstream_slice(&bs, frame, ARRAY_SIZE(frame), &slice_full));
+	munit_assert(slice_unit.slice_type == CHIAKI_BITSTREAM_SLICE_P);
+	munit_assert(slice_unit.reference_frame == 5);
+	munit_assert(slice_full.slice_type == slice_unit.slice_type);
+	munit_assert(slice_full.reference_frame == slice_unit.reference_frame);
+	munit_assert(slice_unit.offset == 0);
+	munit_assert(slice_full.offset == 0);
+
+	return MUNIT_OK;
+}
+
 MunitTest tests_bitstream[] = {
 	{
 		"/bitstream_parse_h264",
@@ -203,5 +238,13 @@ MunitTest tests_bitstream[] = {
 		MUNIT_TEST_OPTION_NONE,
 		NULL
 	},
+	{
+		"/bitstream_slice_first_unit",
+		test_bitstream_slice_first_unit,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
 	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
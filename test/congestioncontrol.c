@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/congestioncontrol.h>
+
+#include <string.h>
+
+static MunitResult test_tune(const MunitParameter params[], void *user)
+{
+	uint64_t interval_ms;
+	double loss_max;
+
+	// nothing measured yet
+	chiaki_congestion_control_tune(NULL, 0.05, &interval_ms, &loss_max);
+	munit_assert_uint64(interval_ms, ==, 200);
+	munit_assert_double(loss_max, ==, 0.05);
+
+	ChiakiLinkQualityStats stats;
+	memset(&stats, 0, sizeof(stats));
+	stats.srtt_us = 40000;
+	stats.resend_timeout_ms = 60;
+	chiaki_congestion_control_tune(&stats, 0.05, &interval_ms, &loss_max);
+	munit_assert_uint64(interval_ms, ==, 200);
+	munit_assert_double(loss_max, ==, 0.05);
+
+	// LAN, no queueing
+	stats.rtt_samples = 100;
+	stats.rtt_min_us = 2000;
+	stats.srtt_us = 2000;
+	stats.resend_timeout_ms = 20;
+	chiaki_congestion_control_tune(&stats, 0.05, &interval_ms, &loss_max);
+	munit_assert_uint64(interval_ms, ==, 200);
+	munit_assert_double(loss_max, ==, 0.05);
+
+	// slow link, reports wait for late packets
+	stats.rtt_min_us = 150000;
+	stats.srtt_us = 150000;
+	stats.resend_timeout_ms = 350;
+	chiaki_congestion_control_tune(&stats, 0.05, &interval_ms, &loss_max);
+	munit_assert_uint64(interval_ms, ==, 350);
+	munit_assert_double(loss_max, ==, 0.05);
+
+	stats.resend_timeout_ms = 1000;
+	chiaki_congestion_control_tune(&stats, 0.05, &interval_ms, &loss_max);
+	munit_assert_uint64(interval_ms, ==, 500);
+
+	// queues building up, less loss is hidden from the console
+	stats.rtt_min_us = 10000;
+	stats.srtt_us = 40000;
+	stats.resend_timeout_ms = 80;
+	chiaki_congestion_control_tune(&stats, 0.05, &interval_ms, &loss_max);
+	munit_assert_uint64(interval_ms, ==, 200);
+	munit_assert_double_equal(loss_max, 0.0125, 6);
+
+	return MUNIT_OK;
+}
+
+MunitTest tests_congestion_control[] = {
+	{
+		"/tune",
+		test_tune,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,448 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/discoveryservice.h>
+#include <chiaki/time.h>
+
+#include "test_log.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#define HOSTS_COUNT 24
+#define HOSTS_GONE 4
+
+typedef struct host_events_t
+{
+	ChiakiMutex mutex;
+	ChiakiCond cond;
+	unsigned added[HOSTS_COUNT];
+	unsigned changed[HOSTS_COUNT];
+	unsigned removed[HOSTS_COUNT];
+	bool failed;
+} HostEvents;
+
+static void host_cb(ChiakiDiscoveryServiceHostEvent event, ChiakiDiscoveryHost *host, void *user)
+{
+	HostEvents *events = user;
+	unsigned id;
+	chiaki_mutex_lock(&events->mutex);
+	if(!host->host_id || sscanf(host->host_id, "%x", &id) != 1 || id >= HOSTS_COUNT)
+		events->failed = true;
+	else if(event == CHIAKI_DISCOVERY_SERVICE_HOST_ADDED)
+		events->added[id]++;
+	else if(event == CHIAKI_DISCOVERY_SERVICE_HOST_CHANGED)
+		events->changed[id]++;
+	else
+		events->removed[id]++;
+	chiaki_cond_signal(&events->cond);
+	chiaki_mutex_unlock(&events->mutex);
+}
+
+static void send_response(chiaki_socket_t sock, void *addr, size_t addr_size, unsigned id, bool standby)
+{
+	char buf[256];
+	int len = snprintf(buf, sizeof(buf),
+			"HTTP/1.1 %s\r\n"
+			"host-id:%012X\r\n"
+			"host-type:PS5\r\n"
+			"host-name:Lab%u\r\n"
+			"host-request-port:997\r\n"
+			"device-discovery-protocol-version:00030010\r\n"
+			"system-version:07020001\r\n\r\n",
+			standby ? "620 Server Standby" : "200 Ok", id, id);
+	sendto(sock, buf, (size_t)len, 0, (struct sockaddr *)addr, addr_size);
+}
+
+static bool wait_events(HostEvents *events, unsigned *counters, unsigned from, unsigned to)
+{
+	bool done = false;
+	chiaki_mutex_lock(&events->mutex);
+	uint64_t start = chiaki_time_now_monotonic_ms();
+	while(!done && chiaki_time_now_monotonic_ms() - start < 20)
+	{
+		done = true;
+		for(unsigned i=from; i<to; i++)
+			done = done && counters[i];
+		if(!done)
+			chiaki_cond_timedwait(&events->cond, &events->mutex, 5);
+	}
+	chiaki_mutex_unlock(&events->mutex);
+	return done;
+}
+
+static MunitResult test_discovery_service_hosts(const MunitParameter params[], void *user)
+{
+	static HostEvents events;
+	memset(&events, 0, sizeof(events));
+	munit_assert_int(chiaki_mutex_init(&events.mutex, false), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_cond_init(&events.cond), ==, CHIAKI_ERR_SUCCESS);
+
+	struct sockaddr_in send_addr = { 0 };
+	send_addr.sin_family = AF_INET;
+	send_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	struct sockaddr_storage send_addr_storage;
+	memcpy(&send_addr_storage, &send_addr, sizeof(send_addr));
+
+	ChiakiDiscoveryServiceOptions options = { 0 };
+	options.hosts_max = HOSTS_COUNT;
+	options.host_drop_pings = 3;
+	options.ping_ms = 80;
+	options.ping_fast_ms = 10;
+	options.ping_initial_ms = 10;
+	options.send_addr = &send_addr_storage;
+	options.send_addr_size = sizeof(send_addr);
+	options.host_cb = host_cb;
+	options.cb_user = &events;
+
+	static ChiakiDiscoveryService service;
+	ChiakiErrorCode err = chiaki_discovery_service_init(&service, &options, get_test_log());
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		// no network available to bind to
+		chiaki_cond_fini(&events.cond);
+		chiaki_mutex_fini(&events.mutex);
+		return MUNIT_SKIP;
+	}
+
+	chiaki_socket_t sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	munit_assert(!CHIAKI_SOCKET_IS_INVALID(sock));
+	struct sockaddr_in service_addr = send_addr;
+	service_addr.sin_port = ((struct sockaddr_in *)&service.discovery.local_addr)->sin_port;
+
+	// all consoles answer, one of them then goes to standby and a few disappear
+	uint64_t start = chiaki_time_now_monotonic_ms();
+	bool all_added = false;
+	while(!all_added && chiaki_time_now_monotonic_ms() - start < 5000)
+	{
+		for(unsigned i=0; i<HOSTS_COUNT; i++)
+			send_response(sock, &service_addr, sizeof(service_addr), i, false);
+		all_added = wait_events(&events, events.added, 0, HOSTS_COUNT);
+	}
+	munit_assert(all_added);
+
+	start = chiaki_time_now_monotonic_ms();
+	bool standby_seen = false, gone_seen = false;
+	while(!(standby_seen && gone_seen) && chiaki_time_now_monotonic_ms() - start < 5000)
+	{
+		for(unsigned i=0; i<HOSTS_COUNT - HOSTS_GONE; i++)
+			send_response(sock, &service_addr, sizeof(service_addr), i, i == 0);
+		standby_seen = wait_events(&events, events.changed, 0, 1);
+		gone_seen = wait_events(&events, events.removed, HOSTS_COUNT - HOSTS_GONE, HOSTS_COUNT);
+	}
+
+	chiaki_discovery_service_fini(&service);
+	CHIAKI_SOCKET_CLOSE(sock);
+
+	munit_assert(standby_seen);
+	munit_assert(gone_seen);
+	munit_assert_false(events.failed);
+	for(unsigned i=0; i<HOSTS_COUNT; i++)
+	{
+		munit_assert_uint(events.added[i], ==, 1);
+		munit_assert_uint(events.changed[i], ==, i == 0 ? 1 : 0);
+		munit_assert_uint(events.removed[i], ==, i >= HOSTS_COUNT - HOSTS_GONE ? 1 : 0);
+	}
+
+	chiaki_cond_fini(&events.cond);
+	chiaki_mutex_fini(&events.mutex);
+	return MUNIT_OK;
+}
+
+static MunitResult test_discovery_service_ipv6(const MunitParameter params[], void *user)
+{
+	static HostEvents events;
+	memset(&events, 0, sizeof(events));
+	munit_assert_int(chiaki_mutex_init(&events.mutex, false), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_cond_init(&events.cond), ==, CHIAKI_ERR_SUCCESS);
+
+	struct sockaddr_in send_addr = { 0 };
+	send_addr.sin_family = AF_INET;
+	send_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	struct sockaddr_storage send_addr_storage;
+	memcpy(&send_addr_storage, &send_addr, sizeof(send_addr));
+
+	struct sockaddr_in6 send_addr_ipv6 = { 0 };
+	send_addr_ipv6.sin6_family = AF_INET6;
+	send_addr_ipv6.sin6_addr = in6addr_loopback;
+	struct sockaddr_storage send_addr_ipv6_storage;
+	memcpy(&send_addr_ipv6_storage, &send_addr_ipv6, sizeof(send_addr_ipv6));
+
+	ChiakiDiscoveryServiceOptions options = { 0 };
+	options.hosts_max = HOSTS_COUNT;
+	options.host_drop_pings = 3;
+	options.ping_ms = 20;
+	options.ping_initial_ms = 10;
+	options.send_addr = &send_addr_storage;
+	options.send_addr_size = sizeof(send_addr);
+	options.send_addr_ipv6 = &send_addr_ipv6_storage;
+	options.send_addr_ipv6_size = sizeof(send_addr_ipv6);
+	options.host_cb = host_cb;
+	options.cb_user = &events;
+
+	static ChiakiDiscoveryService service;
+	ChiakiErrorCode err = chiaki_discovery_service_init(&service, &options, get_test_log());
+	if(err != CHIAKI_ERR_SUCCESS || !service.discovery_ipv6_active)
+	{
+		if(err == CHIAKI_ERR_SUCCESS)
+			chiaki_discovery_service_fini(&service);
+		chiaki_cond_fini(&events.cond);
+		chiaki_mutex_fini(&events.mutex);
+		return MUNIT_SKIP;
+	}
+
+	chiaki_socket_t sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	munit_assert(!CHIAKI_SOCKET_IS_INVALID(sock));
+	chiaki_socket_t sock_ipv6 = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+	munit_assert(!CHIAKI_SOCKET_IS_INVALID(sock_ipv6));
+	struct sockaddr_in service_addr = send_addr;
+	service_addr.sin_port = ((struct sockaddr_in *)&service.discovery.local_addr)->sin_port;
+	struct sockaddr_in6 service_addr_ipv6 = send_addr_ipv6;
+	service_addr_ipv6.sin6_port = ((struct sockaddr_in6 *)&service.discovery_ipv6.local_addr)->sin6_port;
+
+	// host 0 is known from IPv4 first
+	uint64_t start = chiaki_time_now_monotonic_ms();
+	bool added = false;
+	while(!added && chiaki_time_now_monotonic_ms() - start < 5000)
+	{
+		send_response(sock, &service_addr, sizeof(service_addr), 0, false);
+		added = wait_events(&events, events.added, 0, 1);
+	}
+	munit_assert(added);
+
+	// then answers on both, host 1 only on IPv6, host 0 stays a single host
+	start = chiaki_time_now_monotonic_ms();
+	while(chiaki_time_now_monotonic_ms() - start < 300)
+	{
+		send_response(sock, &service_addr, sizeof(service_addr), 0, false);
+		send_response(sock_ipv6, &service_addr_ipv6, sizeof(service_addr_ipv6), 0, false);
+		send_response(sock_ipv6, &service_addr_ipv6, sizeof(service_addr_ipv6), 1, false);
+		wait_events(&events, events.removed, 0, 1);
+	}
+
+	// stopping does not wait for the next ping
+	start = chiaki_time_now_monotonic_ms();
+	chiaki_discovery_service_fini(&service);
+	uint64_t stop_ms = chiaki_time_now_monotonic_ms() - start;
+	CHIAKI_SOCKET_CLOSE(sock);
+	CHIAKI_SOCKET_CLOSE(sock_ipv6);
+
+	munit_assert_false(events.failed);
+	munit_assert_uint(events.added[0], ==, 1);
+	munit_assert_uint(events.removed[0], ==, 0);
+	munit_assert_uint(events.added[1], ==, 1);
+	munit_assert_uint64(stop_ms, <, 1000);
+
+	chiaki_cond_fini(&events.cond);
+	chiaki_mutex_fini(&events.mutex);
+	return MUNIT_OK;
+}
+
+static MunitResult test_discovery_service_dual_stack(const MunitParameter params[], void *user)
+{
+	static HostEvents events;
+	memset(&events, 0, sizeof(events));
+	munit_assert_int(chiaki_mutex_init(&events.mutex, false), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_cond_init(&events.cond), ==, CHIAKI_ERR_SUCCESS);
+
+	struct sockaddr_in send_addr = { 0 };
+	send_addr.sin_family = AF_INET;
+	send_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	struct sockaddr_storage send_addr_storage;
+	memcpy(&send_addr_storage, &send_addr, sizeof(send_addr));
+
+	struct sockaddr_in6 send_addr_ipv6 = { 0 };
+	send_addr_ipv6.sin6_family = AF_INET6;
+	send_addr_ipv6.sin6_addr = in6addr_loopback;
+	struct sockaddr_storage send_addr_ipv6_storage;
+	memcpy(&send_addr_ipv6_storage, &send_addr_ipv6, sizeof(send_addr_ipv6));
+
+	ChiakiDiscoveryServiceOptions options = { 0 };
+	options.hosts_max = HOSTS_COUNT;
+	options.host_drop_pings = 3;
+	options.ping_ms = 20;
+	options.ping_initial_ms = 10;
+	options.send_addr = &send_addr_storage;
+	options.send_addr_size = sizeof(send_addr);
+	options.send_addr_ipv6 = &send_addr_ipv6_storage;
+	options.send_addr_ipv6_size = sizeof(send_addr_ipv6);
+	options.host_cb = host_cb;
+	options.cb_user = &events;
+
+	static ChiakiDiscoveryService service;
+	ChiakiErrorCode err = chiaki_discovery_service_init(&service, &options, get_test_log());
+	if(err != CHIAKI_ERR_SUCCESS || !service.discovery_ipv6_active)
+	{
+		if(err == CHIAKI_ERR_SUCCESS)
+			chiaki_discovery_service_fini(&service);
+		chiaki_cond_fini(&events.cond);
+		chiaki_mutex_fini(&events.mutex);
+		return MUNIT_SKIP;
+	}
+
+	chiaki_socket_t sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	munit_assert(!CHIAKI_SOCKET_IS_INVALID(sock));
+	chiaki_socket_t sock_ipv6 = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+	munit_assert(!CHIAKI_SOCKET_IS_INVALID(sock_ipv6));
+	struct sockaddr_in service_addr = send_addr;
+	service_addr.sin_port = ((struct sockaddr_in *)&service.discovery.local_addr)->sin_port;
+	struct sockaddr_in6 service_addr_ipv6 = send_addr_ipv6;
+	service_addr_ipv6.sin6_port = ((struct sockaddr_in6 *)&service.discovery_ipv6.local_addr)->sin6_port;
+
+	uint64_t start = chiaki_time_now_monotonic_ms();
+	bool added = false;
+	while(!added && chiaki_time_now_monotonic_ms() - start < 5000)
+	{
+		send_response(sock, &service_addr, sizeof(service_addr), 0, false);
+		added = wait_events(&events, events.added, 0, 1);
+	}
+	munit_assert(added);
+
+	// answers alternate between both families, the address must not follow every answer
+	start = chiaki_time_now_monotonic_ms();
+	for(unsigned i=0; chiaki_time_now_monotonic_ms() - start < 300; i++)
+	{
+		if(i % 2)
+			send_response(sock_ipv6, &service_addr_ipv6, sizeof(service_addr_ipv6), 0, false);
+		else
+			send_response(sock, &service_addr, sizeof(service_addr), 0, false);
+		wait_events(&events, events.removed, 0, 1);
+	}
+	chiaki_mutex_lock(&events.mutex);
+	unsigned changed_alternating = events.changed[0];
+	chiaki_mutex_unlock(&events.mutex);
+
+	// IPv4 goes away, so the host moves over to IPv6 once
+	start = chiaki_time_now_monotonic_ms();
+	bool moved = false;
+	while(!moved && chiaki_time_now_monotonic_ms() - start < 5000)
+	{
+		send_response(sock_ipv6, &service_addr_ipv6, sizeof(service_addr_ipv6), 0, false);
+		moved = wait_events(&events, events.changed, 0, 1);
+	}
+	start = chiaki_time_now_monotonic_ms();
+	while(chiaki_time_now_monotonic_ms() - start < 200)
+	{
+		send_response(sock_ipv6, &service_addr_ipv6, sizeof(service_addr_ipv6), 0, false);
+		wait_events(&events, events.removed, 0, 1);
+	}
+
+	chiaki_discovery_service_fini(&service);
+	CHIAKI_SOCKET_CLOSE(sock);
+	CHIAKI_SOCKET_CLOSE(sock_ipv6);
+
+	munit_assert_false(events.failed);
+	munit_assert_uint(changed_alternating, ==, 0);
+	munit_assert(moved);
+	munit_assert_uint(events.added[0], ==, 1);
+	munit_assert_uint(events.changed[0], ==, 1);
+	munit_assert_uint(events.removed[0], ==, 0);
+
+	chiaki_cond_fini(&events.cond);
+	chiaki_mutex_fini(&events.mutex);
+	return MUNIT_OK;
+}
+
+static MunitResult test_discovery_service_manual_hosts(const MunitParameter params[], void *user)
+{
+	struct sockaddr_in send_addr = { 0 };
+	send_addr.sin_family = AF_INET;
+	send_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	struct sockaddr_storage send_addr_storage;
+	memcpy(&send_addr_storage, &send_addr, sizeof(send_addr));
+
+	ChiakiDiscoveryServiceOptions options = { 0 };
+	options.hosts_max = HOSTS_COUNT;
+	options.host_drop_pings = 3;
+	options.ping_ms = 20;
+	options.ping_initial_ms = 10;
+	options.send_addr = &send_addr_storage;
+	options.send_addr_size = sizeof(send_addr);
+
+	static ChiakiDiscoveryService service;
+	munit_assert_int(chiaki_discovery_service_init(&service, &options, get_test_log()), ==, CHIAKI_ERR_SUCCESS);
+
+	const char *hosts[] = { "127.0.0.1", "nonexistent.invalid" };
+	munit_assert_int(chiaki_discovery_service_set_manual_hosts(&service, hosts, 2), ==, CHIAKI_ERR_SUCCESS);
+
+	// the failed one is retried later instead of on every ping
+	ChiakiBoolPredCond sleep_cond;
+	munit_assert_int(chiaki_bool_pred_cond_init(&sleep_cond), ==, CHIAKI_ERR_SUCCESS);
+	chiaki_bool_pred_cond_lock(&sleep_cond);
+	bool done = false;
+	uint64_t start = chiaki_time_now_monotonic_ms();
+	while(!done && chiaki_time_now_monotonic_ms() - start < 5000)
+	{
+		chiaki_mutex_lock(&service.state_mutex);
+		done = service.manual_hosts[0].addr_size && service.manual_hosts[1].resolve_failures;
+		chiaki_mutex_unlock(&service.state_mutex);
+		if(!done)
+			chiaki_bool_pred_cond_timedwait(&sleep_cond, 10);
+	}
+	chiaki_bool_pred_cond_unlock(&sleep_cond);
+	chiaki_bool_pred_cond_fini(&sleep_cond);
+	munit_assert(done);
+	chiaki_mutex_lock(&service.state_mutex);
+	munit_assert_size(service.manual_hosts[1].addr_size, ==, 0);
+	munit_assert_uint(service.manual_hosts[1].resolve_failures, ==, 1);
+	munit_assert_uint64(service.manual_hosts[1].resolve_next_ms, >, chiaki_time_now_monotonic_ms() + 500);
+	chiaki_mutex_unlock(&service.state_mutex);
+
+	// replacing the list keeps the state of hosts that stay
+	const char *hosts_new[] = { "nonexistent.invalid" };
+	munit_assert_int(chiaki_discovery_service_set_manual_hosts(&service, hosts_new, 1), ==, CHIAKI_ERR_SUCCESS);
+	chiaki_mutex_lock(&service.state_mutex);
+	munit_assert_uint(service.manual_hosts[0].resolve_failures, ==, 1);
+	chiaki_mutex_unlock(&service.state_mutex);
+
+	start = chiaki_time_now_monotonic_ms();
+	chiaki_discovery_service_fini(&service);
+	munit_assert_uint64(chiaki_time_now_monotonic_ms() - start, <, 1000);
+	return MUNIT_OK;
+}
+
+MunitTest tests_discovery_service[] = {
+	{
+		"/hosts",
+		test_discovery_service_hosts,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/ipv6",
+		test_discovery_service_ipv6,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/dual_stack",
+		test_discovery_service_dual_stack,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/manual_hosts",
+		test_discovery_service_manual_hosts,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/haptics.h>
+
+#include <string.h>
+
+#define FRAMES_COUNT 30
+
+static void make_haptics_frames(uint8_t *buf, size_t frames_count)
+{
+	for(size_t i = 0; i < frames_count; i++)
+	{
+		int16_t l = (int16_t)((i * 2311) % 65536 - 32768);
+		int16_t r = (int16_t)(1000 - (int32_t)i * 97);
+		memcpy(buf + i * CHIAKI_HAPTICS_FRAME_SIZE, &l, sizeof(l));
+		memcpy(buf + i * CHIAKI_HAPTICS_FRAME_SIZE + sizeof(int16_t), &r, sizeof(r));
+	}
+}
+
+static MunitResult test_deinterleave(const MunitParameter params[], void *user)
+{
+	// one extra byte to test unaligned input
+	uint8_t raw[FRAMES_COUNT * CHIAKI_HAPTICS_FRAME_SIZE + 1];
+	uint8_t *buf = raw + 1;
+	make_haptics_frames(buf, FRAMES_COUNT);
+
+	int16_t left[FRAMES_COUNT], right[FRAMES_COUNT];
+	chiaki_haptics_deinterleave(buf, FRAMES_COUNT, left, right);
+
+	for(size_t i = 0; i < FRAMES_COUNT; i++)
+	{
+		munit_assert_int16(left[i], ==, (int16_t)((i * 2311) % 65536 - 32768));
+		munit_assert_int16(right[i], ==, (int16_t)(1000 - (int32_t)i * 97));
+	}
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_envelope(const MunitParameter params[], void *user)
+{
+	uint8_t buf[FRAMES_COUNT * CHIAKI_HAPTICS_FRAME_SIZE];
+	make_haptics_frames(buf, FRAMES_COUNT);
+
+	ChiakiHapticsEnvelope envelope;
+	chiaki_haptics_envelope(buf, FRAMES_COUNT, &envelope);
+	munit_assert_int32(envelope.mean_left, ==, -1443);
+	munit_assert_int32(envelope.mean_right, ==, -406);
+	munit_assert_uint16(envelope.rms_left, ==, 19853);
+	munit_assert_uint16(envelope.rms_right, ==, 932);
+	munit_assert_uint16(envelope.peak_left, ==, 32767);
+	munit_assert_uint16(envelope.peak_right, ==, 1813);
+
+	// odd lengths must take the tail path and give the same result as a scalar sum
+	chiaki_haptics_envelope(buf, 7, &envelope);
+	munit_assert_int32(envelope.mean_left, ==, -32768 + 2311 * 3);
+	munit_assert_int32(envelope.mean_right, ==, 709);
+	munit_assert_uint16(envelope.peak_right, ==, 1000);
+
+	chiaki_haptics_envelope(buf, 0, &envelope);
+	munit_assert_int32(envelope.mean_left, ==, 0);
+	munit_assert_uint16(envelope.rms_left, ==, 0);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_resampler_dualsense(const MunitParameter params[], void *user)
+{
+	const int16_t in[] = {
+		1600, -1600,
+		-32768, 32767,
+		0, 17,
+	};
+	static const int16_t expected_left[3 * CHIAKI_HAPTICS_UPSAMPLE_FACTOR] = {
+		100, 200, 300, 400, 500, 600, 700, 800, 900, 1000, 1100, 1200, 1300, 1400, 1500, 1600,
+		-548, -2696, -4844, -6992, -9140, -11288, -13436, -15584, -17732, -19880, -22028, -24176, -26324, -28472, -30620, -32768,
+		-30720, -28672, -26624, -24576, -22528, -20480, -18432, -16384, -14336, -12288, -10240, -8192, -6144, -4096, -2048, 0,
+	};
+	static const int16_t expected_right[3 * CHIAKI_HAPTICS_UPSAMPLE_FACTOR] = {
+		-100, -200, -300, -400, -500, -600, -700, -800, -900, -1000, -1100, -1200, -1300, -1400, -1500, -1600,
+		548, 2696, 4844, 6992, 9140, 11288, 13436, 15584, 17731, 19879, 22027, 24175, 26323, 28471, 30619, 32767,
+		30720, 28673, 26626, 24580, 22533, 20486, 18439, 16392, 14345, 12298, 10251, 8205, 6158, 4111, 2064, 17,
+	};
+
+	uint8_t buf[sizeof(in)];
+	memcpy(buf, in, sizeof(in));
+
+	ChiakiHapticsResampler resampler;
+	chiaki_haptics_resampler_init(&resampler);
+
+	int16_t out[3 * CHIAKI_HAPTICS_UPSAMPLE_FACTOR * CHIAKI_HAPTICS_DUALSENSE_CHANNELS];
+	munit_assert_size(chiaki_haptics_resampler_dualsense_samples(3), ==, sizeof(out) / sizeof(out[0]));
+
+	// feed the first frame separately to check that state is carried between calls
+	munit_assert_size(chiaki_haptics_resampler_dualsense(&resampler, buf, 1, out), ==, CHIAKI_HAPTICS_UPSAMPLE_FACTOR);
+	munit_assert_size(chiaki_haptics_resampler_dualsense(&resampler, buf + CHIAKI_HAPTICS_FRAME_SIZE, 2,
+				out + chiaki_haptics_resampler_dualsense_samples(1)), ==, 2 * CHIAKI_HAPTICS_UPSAMPLE_FACTOR);
+
+	for(size_t i = 0; i < 3 * CHIAKI_HAPTICS_UPSAMPLE_FACTOR; i++)
+	{
+		munit_assert_int16(out[i * 4 + 0], ==, 0);
+		munit_assert_int16(out[i * 4 + 1], ==, 0);
+		munit_assert_int16(out[i * 4 + 2], ==, expected_left[i]);
+		munit_assert_int16(out[i * 4 + 3], ==, expected_right[i]);
+	}
+
+	munit_assert_int16(resampler.prev_left, ==, 0);
+	munit_assert_int16(resampler.prev_right, ==, 17);
+
+	return MUNIT_OK;
+}
+
+MunitTest tests_haptics[] = {
+	{
+		"/deinterleave",
+		test_deinterleave,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/envelope",
+		test_envelope,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/resampler_dualsense",
+		test_resampler_dualsense,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -12,6 +12,14 @@ extern MunitTest tests_takion[];
 extern MunitTest tests_fec[];
 extern MunitTest tests_regist[];
 extern MunitTest tests_bitstream[];
+extern MunitTest tests_haptics[];
+extern MunitTest tests_ring_buffer[];
+extern MunitTest tests_audio_receiver[];
+extern MunitTest tests_video_receiver[];
+extern MunitTest tests_discovery_service[];
+extern MunitTest tests_stop_pipe[];
+extern MunitTest tests_metrics[];
+extern MunitTest tests_congestion_control[];
 
 static MunitSuite suites[] = {
 	{
@@ -84,6 +92,62 @@ static MunitSuite suites[] = {
 		1,
 		MUNIT_SUITE_OPTION_NONE
 	},
+	{
+		"/haptics",
+		tests_haptics,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/ring_buffer",
+		tests_ring_buffer,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/audio_receiver",
+		tests_audio_receiver,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/video_receiver",
+		tests_video_receiver,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/discovery_service",
+		tests_discovery_service,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/stop_pipe",
+		tests_stop_pipe,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/metrics",
+		tests_metrics,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
+	{
+		"/congestion_control",
+		tests_congestion_control,
+		NULL,
+		1,
+		MUNIT_SUITE_OPTION_NONE
+	},
 	{ NULL, NULL, NULL, 0, MUNIT_SUITE_OPTION_NONE }
 };
 
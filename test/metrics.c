@@ -0,0 +1,226 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/metrics.h>
+#include <chiaki/thread.h>
+
+#include <string.h>
+
+static MunitResult test_register(const MunitParameter params[], void *user)
+{
+	ChiakiMetrics metrics;
+	chiaki_metrics_init(&metrics);
+
+	ChiakiMetric *packets = chiaki_metrics_register_counter(&metrics, "takion.packets_received");
+	munit_assert_not_null(packets);
+	ChiakiMetric *bitrate = chiaki_metrics_register_gauge(&metrics, "stream.bitrate_kbps");
+	munit_assert_not_null(bitrate);
+
+	// same name again is the same metric, unless the type differs
+	munit_assert_ptr_equal(chiaki_metrics_register_counter(&metrics, "takion.packets_received"), packets);
+	munit_assert_null(chiaki_metrics_register_gauge(&metrics, "takion.packets_received"));
+	munit_assert_ptr_equal(chiaki_metrics_find(&metrics, "stream.bitrate_kbps"), bitrate);
+	munit_assert_null(chiaki_metrics_find(&metrics, "stream.nope"));
+
+	munit_assert_null(chiaki_metrics_register_counter(&metrics, ""));
+	munit_assert_null(chiaki_metrics_register_counter(&metrics, "has space"));
+	munit_assert_null(chiaki_metrics_register_counter(&metrics, "quote\""));
+	uint64_t unsorted[] = { 10, 5 };
+	munit_assert_null(chiaki_metrics_register_histogram(&metrics, "unsorted", unsorted, 2));
+
+	chiaki_metric_inc(packets);
+	chiaki_metric_add(packets, 41);
+	chiaki_metric_set(bitrate, 15000);
+	chiaki_metric_set(bitrate, -3);
+	munit_assert_int64(chiaki_metric_get(packets), ==, 42);
+	munit_assert_int64(chiaki_metric_get(bitrate), ==, -3);
+
+	// missing metrics are ignored
+	chiaki_metric_inc(NULL);
+	chiaki_metric_observe(NULL, 1);
+	munit_assert_int64(chiaki_metric_get(NULL), ==, 0);
+
+	// full registry
+	char name[CHIAKI_METRIC_NAME_SIZE];
+	for(size_t i=2; i<CHIAKI_METRICS_MAX; i++)
+	{
+		snprintf(name, sizeof(name), "fill.m%zu", i);
+		munit_assert_not_null(chiaki_metrics_register_counter(&metrics, name));
+	}
+	munit_assert_null(chiaki_metrics_register_counter(&metrics, "fill.overflow"));
+	munit_assert_ptr_equal(chiaki_metrics_register_counter(&metrics, "takion.packets_received"), packets);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_histogram(const MunitParameter params[], void *user)
+{
+	ChiakiMetrics metrics;
+	chiaki_metrics_init(&metrics);
+
+	uint64_t bounds[] = { 1000, 5000, 20000 };
+	ChiakiMetric *decode = chiaki_metrics_register_histogram(&metrics, "decoder.decode_us", bounds, 3);
+	munit_assert_not_null(decode);
+	uint64_t other_bounds[] = { 1000, 5000 };
+	munit_assert_null(chiaki_metrics_register_histogram(&metrics, "decoder.decode_us", other_bounds, 2));
+	munit_assert_ptr_equal(chiaki_metrics_register_histogram(&metrics, "decoder.decode_us", bounds, 3), decode);
+
+	chiaki_metric_observe(decode, 0);
+	chiaki_metric_observe(decode, 1000);
+	chiaki_metric_observe(decode, 1001);
+	chiaki_metric_observe(decode, 20000);
+	chiaki_metric_observe(decode, 100000);
+
+	ChiakiMetricSample sample;
+	munit_assert_size(chiaki_metrics_sample(&metrics, &sample, 1), ==, 1);
+	munit_assert_string_equal(sample.name, "decoder.decode_us");
+	munit_assert_int(sample.type, ==, CHIAKI_METRIC_TYPE_HISTOGRAM);
+	munit_assert_int64(sample.value, ==, 5);
+	munit_assert_uint64(sample.sum, ==, 122001);
+	munit_assert_size(sample.bounds_count, ==, 3);
+	munit_assert_uint64(sample.buckets[0], ==, 2);
+	munit_assert_uint64(sample.buckets[1], ==, 1);
+	munit_assert_uint64(sample.buckets[2], ==, 1);
+	munit_assert_uint64(sample.buckets[3], ==, 1);
+
+	return MUNIT_OK;
+}
+
+#define WRITER_THREADS 4
+#define WRITER_ITERATIONS 100000
+
+static void *writer_thread_func(void *user)
+{
+	ChiakiMetrics *metrics = user;
+	// registered concurrently by all writers
+	ChiakiMetric *counter = chiaki_metrics_register_counter(metrics, "test.counter");
+	uint64_t bounds[] = { 10 };
+	ChiakiMetric *histogram = chiaki_metrics_register_histogram(metrics, "test.histogram", bounds, 1);
+	for(uint64_t i=0; i<WRITER_ITERATIONS; i++)
+	{
+		chiaki_metric_inc(counter);
+		chiaki_metric_observe(histogram, i % 20);
+	}
+	return NULL;
+}
+
+static MunitResult test_concurrent(const MunitParameter params[], void *user)
+{
+	ChiakiMetrics metrics;
+	chiaki_metrics_init(&metrics);
+
+	ChiakiThread threads[WRITER_THREADS];
+	for(size_t i=0; i<WRITER_THREADS; i++)
+		munit_assert_int(chiaki_thread_create(&threads[i], writer_thread_func, &metrics), ==, CHIAKI_ERR_SUCCESS);
+
+	// readers never see anything half registered or going backwards
+	int64_t last = 0;
+	ChiakiMetricSample samples[2];
+	for(size_t i=0; i<1000; i++)
+	{
+		size_t count = chiaki_metrics_sample(&metrics, samples, 2);
+		for(size_t s=0; s<count; s++)
+		{
+			munit_assert_true(!strcmp(samples[s].name, "test.counter") || !strcmp(samples[s].name, "test.histogram"));
+			if(samples[s].type != CHIAKI_METRIC_TYPE_COUNTER)
+				continue;
+			munit_assert_int64(samples[s].value, >=, last);
+			last = samples[s].value;
+		}
+	}
+
+	for(size_t i=0; i<WRITER_THREADS; i++)
+		chiaki_thread_join(&threads[i], NULL);
+
+	munit_assert_size(chiaki_metrics_sample(&metrics, samples, 2), ==, 2);
+	ChiakiMetricSample *counter = !strcmp(samples[0].name, "test.counter") ? &samples[0] : &samples[1];
+	ChiakiMetricSample *histogram = counter == &samples[0] ? &samples[1] : &samples[0];
+	munit_assert_int64(counter->value, ==, WRITER_THREADS * WRITER_ITERATIONS);
+	munit_assert_int64(histogram->value, ==, WRITER_THREADS * WRITER_ITERATIONS);
+	munit_assert_uint64(histogram->buckets[0], ==, WRITER_THREADS * WRITER_ITERATIONS * 11 / 20);
+	munit_assert_uint64(histogram->buckets[1], ==, WRITER_THREADS * WRITER_ITERATIONS * 9 / 20);
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_export(const MunitParameter params[], void *user)
+{
+	ChiakiMetrics metrics;
+	chiaki_metrics_init(&metrics);
+
+	chiaki_metric_add(chiaki_metrics_register_counter(&metrics, "a.count"), 3);
+	chiaki_metric_set(chiaki_metrics_register_gauge(&metrics, "a.gauge"), -7);
+	uint64_t bounds[] = { 5, 10 };
+	ChiakiMetric *histogram = chiaki_metrics_register_histogram(&metrics, "a.hist", bounds, 2);
+	chiaki_metric_observe(histogram, 4);
+	chiaki_metric_observe(histogram, 11);
+
+	char buf[1024];
+
+	FILE *file = tmpfile();
+	munit_assert_not_null(file);
+	munit_assert_int(chiaki_metrics_export(&metrics, file, CHIAKI_METRICS_FORMAT_CSV, 1234, true), ==, CHIAKI_ERR_SUCCESS);
+	rewind(file);
+	size_t size = fread(buf, 1, sizeof(buf) - 1, file);
+	buf[size] = '\0';
+	fclose(file);
+	munit_assert_string_equal(buf,
+			"timestamp_ms,name,value\n"
+			"1234,a.count,3\n"
+			"1234,a.gauge,-7\n"
+			"1234,a.hist.count,2\n"
+			"1234,a.hist.sum,15\n"
+			"1234,a.hist.le_5,1\n"
+			"1234,a.hist.le_10,0\n"
+			"1234,a.hist.le_inf,1\n");
+
+	file = tmpfile();
+	munit_assert_not_null(file);
+	munit_assert_int(chiaki_metrics_export(&metrics, file, CHIAKI_METRICS_FORMAT_JSONL, 1234, false), ==, CHIAKI_ERR_SUCCESS);
+	rewind(file);
+	size = fread(buf, 1, sizeof(buf) - 1, file);
+	buf[size] = '\0';
+	fclose(file);
+	munit_assert_string_equal(buf,
+			"{\"timestamp_ms\":1234,\"metrics\":{\"a.count\":3,\"a.gauge\":-7,"
+			"\"a.hist\":{\"count\":2,\"sum\":15,\"buckets\":{\"5\":1,\"10\":0,\"inf\":1}}}}\n");
+
+	return MUNIT_OK;
+}
+
+MunitTest tests_metrics[] = {
+	{
+		"/register",
+		test_register,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/histogram",
+		test_histogram,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/concurrent",
+		test_concurrent,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/export",
+		test_export,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,205 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/**
+ * Headless checks for the PresentationScheduler of the GUI (gui/src/presentationscheduler.cpp).
+ * Streams and displays of different cadences are simulated with jittery frame arrivals and present times,
+ * and the estimates and plans of the scheduler are compared against the simulated truth.
+ *
+ * Exits with a failure if any of the checks does not hold.
+ */
+
+#include "presentationscheduler.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+
+// renders start this long after the vsync they followed
+#define RENDER_OFFSET_US 500
+// presents return up to this long after the vsync
+#define PRESENT_JITTER_US 300
+// frames arrive up to this long after their nominal time
+#define ARRIVAL_JITTER_US 2000
+// vsyncs at the start for the estimates to settle, not counted in the results
+#define SETTLE_VSYNCS 120
+
+// counted after the estimates settled
+struct Result {
+    size_t vsyncs = 0;
+    size_t shown = 0;
+    size_t skipped = 0;
+    size_t mixed = 0;
+    bool timestamps_ordered = true;
+    // the estimate moves with every present, so it is averaged over the second half
+    double vsync_interval_avg_us = 0.0;
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+    printf("  %-60s %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok)
+        failures++;
+}
+
+// deterministic, so a failure can be reproduced
+static int64_t jitter(uint32_t *state, int64_t max_us)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return static_cast<int64_t>((*state >> 8) % static_cast<uint32_t>(max_us + 1));
+}
+
+// Render loop of QmlMainWindow::render() against a FIFO swapchain, one render per vsync
+static Result simulate(PresentationScheduler *scheduler, double stream_hz, double display_hz, double seconds, bool vsync_paced)
+{
+    const double frame_us = 1000000.0 / stream_hz;
+    const double vsync_us = 1000000.0 / display_hz;
+    uint32_t rng = 1;
+
+    Result result;
+    std::deque<int64_t> queue;
+    size_t next_frame = 0;
+    const size_t vsyncs = static_cast<size_t>(seconds * display_hz);
+    for (size_t n = 1; n <= vsyncs; n++) {
+        const int64_t render_us = static_cast<int64_t>((n - 1) * vsync_us) + RENDER_OFFSET_US;
+        for (;;) {
+            const int64_t arrival_us = static_cast<int64_t>(next_frame * frame_us) + 1 + jitter(&rng, ARRIVAL_JITTER_US);
+            if (arrival_us > render_us)
+                break;
+            queue.push_back(arrival_us);
+            next_frame++;
+        }
+
+        int64_t queued_us[8];
+        size_t count = 0;
+        for (int64_t t : queue) {
+            if (count == sizeof(queued_us) / sizeof(queued_us[0]))
+                break;
+            queued_us[count++] = t;
+        }
+        const PresentationScheduler::Plan plan = scheduler->plan(render_us, queued_us, count);
+        if (plan.show)
+            queue.erase(queue.begin(), queue.begin() + plan.skip + 1);
+        if (n > SETTLE_VSYNCS) {
+            result.vsyncs++;
+            if (plan.show) {
+                result.shown++;
+                result.skipped += plan.skip;
+            }
+            if (plan.mix) {
+                result.mixed++;
+                if (!(plan.timestamps[0] < plan.timestamps[1]))
+                    result.timestamps_ordered = false;
+            }
+        }
+
+        const int64_t present_us = static_cast<int64_t>(n * vsync_us) + jitter(&rng, PRESENT_JITTER_US);
+        scheduler->presented(present_us, plan.show, vsync_paced);
+        if (n > vsyncs / 2)
+            result.vsync_interval_avg_us += static_cast<double>(scheduler->vsyncIntervalUs()) / static_cast<double>(vsyncs - vsyncs / 2);
+    }
+    return result;
+}
+
+static void pllConvergence()
+{
+    printf("vsync PLL, 59.94 Hz display guessed as 60 Hz\n");
+    PresentationScheduler scheduler;
+    scheduler.setMode(PresentationScheduler::Mode::Smoothest);
+    scheduler.setRefreshRate(60.0);
+    const Result result = simulate(&scheduler, 60.0, 59.94, 10.0, true);
+    const double expected_us = 1000000.0 / 59.94;
+    printf("  measured %.1f us, expected %.1f us\n", result.vsync_interval_avg_us, expected_us);
+    // the guess is 17 us off
+    check(std::abs(result.vsync_interval_avg_us - expected_us) <= 3.0, "converges to the display refresh interval");
+
+    // presents that did not wait for a vsync must not pull the estimate away
+    const int64_t locked_us = scheduler.vsyncIntervalUs();
+    uint32_t rng = 7;
+    for (int64_t t = 20000000; t < 21000000; t += 5000 + jitter(&rng, 20000))
+        scheduler.presented(t, false, false);
+    check(scheduler.vsyncIntervalUs() == locked_us, "ignores presents that are not vsync paced");
+}
+
+static void freeRunning()
+{
+    printf("free-running, presents never vsync paced\n");
+    PresentationScheduler scheduler;
+    scheduler.setMode(PresentationScheduler::Mode::Smoothest);
+    scheduler.setRefreshRate(60.0);
+    const Result result = simulate(&scheduler, 60.0, 144.0, 5.0, false);
+    check(scheduler.vsyncIntervalUs() == static_cast<int64_t>(1000000.0 / 60.0), "keeps the refresh rate guess");
+    check(result.shown > 0, "still shows frames");
+}
+
+static void cadenceMatch()
+{
+    printf("60 fps stream on a 59.94 Hz display\n");
+    PresentationScheduler scheduler;
+    scheduler.setMode(PresentationScheduler::Mode::Smoothest);
+    scheduler.setRefreshRate(59.94);
+    const Result result = simulate(&scheduler, 60.0, 59.94, 30.0, true);
+    printf("  %zu vsyncs, %zu frames shown, %zu skipped, %zu mixed\n", result.vsyncs, result.shown, result.skipped, result.mixed);
+    const int64_t frame_us = scheduler.frameIntervalUs();
+    check(std::llabs(frame_us - static_cast<int64_t>(1000000.0 / 60.0)) <= 50, "estimates the stream frame interval");
+    check(result.mixed == 0, "close cadences are not blended");
+    // the display is 0.1% slower, so one frame in a thousand has to go
+    check(result.skipped <= result.vsyncs / 1000 + 1, "skips only the frames the display has no vsync for");
+    check(result.shown >= result.vsyncs * 99 / 100, "shows a new frame nearly every vsync");
+}
+
+static void cadenceEven()
+{
+    printf("30 fps stream on a 60 Hz display\n");
+    PresentationScheduler scheduler;
+    scheduler.setMode(PresentationScheduler::Mode::Smoothest);
+    scheduler.setRefreshRate(60.0);
+    const Result result = simulate(&scheduler, 30.0, 60.0, 10.0, true);
+    printf("  %zu vsyncs, %zu frames shown, %zu skipped, %zu mixed\n", result.vsyncs, result.shown, result.skipped, result.mixed);
+    check(result.mixed == 0, "whole ratios are not blended");
+    check(result.skipped == 0, "no frames skipped");
+}
+
+static void oversampleMixing()
+{
+    printf("60 fps stream on a 144 Hz display\n");
+    PresentationScheduler scheduler;
+    scheduler.setMode(PresentationScheduler::Mode::Smoothest);
+    scheduler.setRefreshRate(144.0);
+    const Result result = simulate(&scheduler, 60.0, 144.0, 10.0, true);
+    printf("  %zu vsyncs, %zu frames shown, %zu skipped, %zu mixed\n", result.vsyncs, result.shown, result.skipped, result.mixed);
+    // 2.4 vsyncs per frame, every frame starts inside a vsync interval it shares with the one before
+    check(result.mixed >= result.shown * 9 / 10, "uneven cadence blends frames");
+    check(result.timestamps_ordered, "previous frame is placed before the current one");
+    check(result.skipped == 0, "no frames skipped");
+}
+
+static void lowestLatency()
+{
+    printf("lowest latency, 60 fps stream on a 144 Hz display\n");
+    PresentationScheduler scheduler;
+    scheduler.setMode(PresentationScheduler::Mode::LowestLatency);
+    scheduler.setRefreshRate(144.0);
+    const Result result = simulate(&scheduler, 60.0, 144.0, 10.0, true);
+    check(result.mixed == 0, "never blends");
+    check(scheduler.delayUs() == 0, "never delays");
+}
+
+int main()
+{
+    pllConvergence();
+    freeRunning();
+    cadenceMatch();
+    cadenceEven();
+    oversampleMixing();
+    lowestLatency();
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("all checks passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/ringbuffer.h>
+#include <chiaki/miccapture.h>
+#include <chiaki/time.h>
+
+#include <string.h>
+
+static MunitResult test_ring_buffer(const MunitParameter params[], void *user)
+{
+	ChiakiRingBuffer ring;
+	ChiakiErrorCode err = chiaki_ring_buffer_init(&ring, 12);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_uint32(ring.size, ==, 16);
+	munit_assert_size(chiaki_ring_buffer_available(&ring), ==, 0);
+	munit_assert_size(chiaki_ring_buffer_free(&ring), ==, 16);
+
+	uint8_t in[32], out[32];
+	for(size_t i = 0; i < sizeof(in); i++)
+		in[i] = (uint8_t)i;
+
+	munit_assert_size(chiaki_ring_buffer_write(&ring, in, 10), ==, 10);
+	munit_assert_size(chiaki_ring_buffer_read(&ring, out, 6), ==, 6);
+	munit_assert_memory_equal(6, out, in);
+
+	// wraps around the end of the buffer and is cut off when full
+	munit_assert_size(chiaki_ring_buffer_write(&ring, in + 10, 20), ==, 12);
+	munit_assert_size(chiaki_ring_buffer_free(&ring), ==, 0);
+	munit_assert_size(chiaki_ring_buffer_write(&ring, in, 1), ==, 0);
+	munit_assert_size(chiaki_ring_buffer_available(&ring), ==, 16);
+
+	munit_assert_size(chiaki_ring_buffer_read(&ring, out, sizeof(out)), ==, 16);
+	munit_assert_memory_equal(16, out, in + 6);
+	munit_assert_size(chiaki_ring_buffer_read(&ring, out, sizeof(out)), ==, 0);
+
+	// the producer makes room by dropping the oldest bytes
+	munit_assert_size(chiaki_ring_buffer_write(&ring, in, 16), ==, 16);
+	munit_assert_size(chiaki_ring_buffer_drop_oldest(&ring, 4), ==, 4);
+	munit_assert_size(chiaki_ring_buffer_write(&ring, in + 16, 4), ==, 4);
+	munit_assert_size(chiaki_ring_buffer_read(&ring, out, sizeof(out)), ==, 16);
+	munit_assert_memory_equal(16, out, in + 4);
+	munit_assert_size(chiaki_ring_buffer_drop_oldest(&ring, 4), ==, 0);
+
+	munit_assert_size(chiaki_ring_buffer_write(&ring, in, 5), ==, 5);
+	chiaki_ring_buffer_clear(&ring);
+	munit_assert_size(chiaki_ring_buffer_available(&ring), ==, 0);
+
+	chiaki_ring_buffer_fini(&ring);
+	return MUNIT_OK;
+}
+
+#define MIC_FRAME_SAMPLES 480
+#define MIC_FRAMES 5
+
+typedef struct mic_record_t
+{
+	int16_t samples[MIC_FRAME_SAMPLES * MIC_FRAMES];
+	size_t frames;
+	bool failed;
+} MicRecord;
+
+static void mic_frame_cb(int16_t *buf, size_t samples_count, void *user)
+{
+	MicRecord *record = user;
+	if(samples_count != MIC_FRAME_SAMPLES || record->frames >= MIC_FRAMES)
+	{
+		record->failed = true;
+		return;
+	}
+	memcpy(record->samples + record->frames * MIC_FRAME_SAMPLES, buf, samples_count * sizeof(int16_t));
+	record->frames++;
+}
+
+static MunitResult test_mic_capture(const MunitParameter params[], void *user)
+{
+	static MicRecord record;
+	memset(&record, 0, sizeof(record));
+
+	ChiakiMicCapture capture;
+	ChiakiErrorCode err = chiaki_mic_capture_init(&capture, NULL, MIC_FRAME_SAMPLES, MIC_FRAMES, mic_frame_cb, &record, NULL);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	// chunks that do not line up with frames, like from an audio device callback
+	static int16_t samples[MIC_FRAME_SAMPLES * MIC_FRAMES];
+	for(size_t i = 0; i < MIC_FRAME_SAMPLES * MIC_FRAMES; i++)
+		samples[i] = (int16_t)(i * 7);
+	size_t pushed = 0;
+	while(pushed < MIC_FRAME_SAMPLES * MIC_FRAMES)
+	{
+		size_t chunk = MIC_FRAME_SAMPLES * MIC_FRAMES - pushed;
+		if(chunk > 333)
+			chunk = 333;
+		chiaki_mic_capture_push(&capture, samples + pushed, chunk);
+		pushed += chunk;
+	}
+
+	ChiakiMicCaptureStats stats;
+	uint64_t start = chiaki_time_now_monotonic_ms();
+	do
+	{
+		chiaki_mic_capture_get_stats(&capture, &stats);
+	} while(stats.frames < MIC_FRAMES && chiaki_time_now_monotonic_ms() - start < 5000);
+	chiaki_mic_capture_fini(&capture);
+
+	munit_assert_false(record.failed);
+	munit_assert_size(record.frames, ==, MIC_FRAMES);
+	munit_assert_memory_equal(sizeof(samples), record.samples, samples);
+	munit_assert_uint32(stats.frames, ==, MIC_FRAMES);
+	munit_assert_uint32(stats.dropped_samples, ==, 0);
+	munit_assert_uint32(stats.latency_max_us, >=, stats.latency_us);
+
+	return MUNIT_OK;
+}
+
+MunitTest tests_ring_buffer[] = {
+	{
+		"/basic",
+		test_ring_buffer,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/mic_capture",
+		test_mic_capture,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
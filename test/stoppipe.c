@@ -0,0 +1,157 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/stoppipe.h>
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+static chiaki_socket_t bound_socket(struct sockaddr_in *addr)
+{
+	chiaki_socket_t sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	munit_assert(!CHIAKI_SOCKET_IS_INVALID(sock));
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addr_size = sizeof(*addr);
+	munit_assert_int(bind(sock, (struct sockaddr *)addr, sizeof(*addr)), ==, 0);
+	munit_assert_int(getsockname(sock, (struct sockaddr *)addr, &addr_size), ==, 0);
+	return sock;
+}
+
+static void drain(chiaki_socket_t sock)
+{
+	uint8_t buf[16];
+	munit_assert_int(recv(sock, buf, sizeof(buf), 0), >, 0);
+}
+
+static MunitResult test_stop_pipe_select_single(const MunitParameter params[], void *user)
+{
+	ChiakiStopPipe stop_pipe;
+	munit_assert_int(chiaki_stop_pipe_init(&stop_pipe), ==, CHIAKI_ERR_SUCCESS);
+
+	struct sockaddr_in addr;
+	chiaki_socket_t sock = bound_socket(&addr);
+	chiaki_socket_t send_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	munit_assert(!CHIAKI_SOCKET_IS_INVALID(send_sock));
+
+	munit_assert_int(chiaki_stop_pipe_select_single(&stop_pipe, sock, false, 10), ==, CHIAKI_ERR_TIMEOUT);
+	munit_assert_int(chiaki_stop_pipe_sleep(&stop_pipe, 10), ==, CHIAKI_ERR_TIMEOUT);
+
+	// waiting on the same socket over and over is the common case
+	for(int i=0; i<8; i++)
+	{
+		sendto(send_sock, "x", 1, 0, (struct sockaddr *)&addr, sizeof(addr));
+		munit_assert_int(chiaki_stop_pipe_select_single(&stop_pipe, sock, false, 1000), ==, CHIAKI_ERR_SUCCESS);
+		drain(sock);
+	}
+	munit_assert_int(chiaki_stop_pipe_select_single(&stop_pipe, send_sock, true, 1000), ==, CHIAKI_ERR_SUCCESS);
+
+	// stopping wins over a readable socket and stays until reset
+	sendto(send_sock, "x", 1, 0, (struct sockaddr *)&addr, sizeof(addr));
+	chiaki_stop_pipe_stop(&stop_pipe);
+	munit_assert_int(chiaki_stop_pipe_select_single(&stop_pipe, sock, false, 1000), ==, CHIAKI_ERR_CANCELED);
+	munit_assert_int(chiaki_stop_pipe_sleep(&stop_pipe, 1000), ==, CHIAKI_ERR_CANCELED);
+	chiaki_stop_pipe_reset(&stop_pipe);
+	munit_assert_int(chiaki_stop_pipe_select_single(&stop_pipe, sock, false, 1000), ==, CHIAKI_ERR_SUCCESS);
+	drain(sock);
+
+	// a new socket that gets the fd of a closed one must still be waited on
+	CHIAKI_SOCKET_CLOSE(sock);
+	sock = bound_socket(&addr);
+	sendto(send_sock, "x", 1, 0, (struct sockaddr *)&addr, sizeof(addr));
+	munit_assert_int(chiaki_stop_pipe_select_single(&stop_pipe, sock, false, 1000), ==, CHIAKI_ERR_SUCCESS);
+	drain(sock);
+
+	CHIAKI_SOCKET_CLOSE(sock);
+	CHIAKI_SOCKET_CLOSE(send_sock);
+	chiaki_stop_pipe_fini(&stop_pipe);
+	return MUNIT_OK;
+}
+
+#define MULTI_SOCKETS 3
+
+static MunitResult test_stop_pipe_select_multi(const MunitParameter params[], void *user)
+{
+	ChiakiStopPipe stop_pipe;
+	munit_assert_int(chiaki_stop_pipe_init(&stop_pipe), ==, CHIAKI_ERR_SUCCESS);
+
+	struct sockaddr_in addrs[MULTI_SOCKETS];
+	chiaki_socket_t socks[MULTI_SOCKETS];
+	for(size_t i=0; i<MULTI_SOCKETS; i++)
+		socks[i] = bound_socket(&addrs[i]);
+	chiaki_socket_t send_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	munit_assert(!CHIAKI_SOCKET_IS_INVALID(send_sock));
+
+	bool readable[MULTI_SOCKETS];
+	munit_assert_int(chiaki_stop_pipe_select_multi(&stop_pipe, socks, MULTI_SOCKETS, 10, readable), ==, CHIAKI_ERR_TIMEOUT);
+
+	sendto(send_sock, "x", 1, 0, (struct sockaddr *)&addrs[0], sizeof(addrs[0]));
+	sendto(send_sock, "x", 1, 0, (struct sockaddr *)&addrs[2], sizeof(addrs[2]));
+	// the datagrams might not all be there for the first wakeup
+	bool seen[MULTI_SOCKETS] = { 0 };
+	for(int tries=0; tries<10 && !(seen[0] && seen[2]); tries++)
+	{
+		munit_assert_int(chiaki_stop_pipe_select_multi(&stop_pipe, socks, MULTI_SOCKETS, 1000, readable), ==, CHIAKI_ERR_SUCCESS);
+		for(size_t i=0; i<MULTI_SOCKETS; i++)
+		{
+			if(!readable[i])
+				continue;
+			drain(socks[i]);
+			seen[i] = true;
+		}
+	}
+	munit_assert(seen[0]);
+	munit_assert_false(seen[1]);
+	munit_assert(seen[2]);
+
+	// only the sockets of the current wait count, even if an earlier one is readable
+	sendto(send_sock, "x", 1, 0, (struct sockaddr *)&addrs[0], sizeof(addrs[0]));
+	munit_assert_int(chiaki_stop_pipe_select_single(&stop_pipe, socks[0], false, 1000), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_stop_pipe_select_multi(&stop_pipe, socks + 1, MULTI_SOCKETS - 1, 10, readable), ==, CHIAKI_ERR_TIMEOUT);
+	munit_assert_int(chiaki_stop_pipe_select_single(&stop_pipe, socks[1], false, 10), ==, CHIAKI_ERR_TIMEOUT);
+	drain(socks[0]);
+
+	chiaki_stop_pipe_stop(&stop_pipe);
+	munit_assert_int(chiaki_stop_pipe_select_multi(&stop_pipe, socks, MULTI_SOCKETS, 1000, readable), ==, CHIAKI_ERR_CANCELED);
+
+	chiaki_socket_t too_many[CHIAKI_STOP_PIPE_SELECT_MULTI_MAX + 1];
+	for(size_t i=0; i<CHIAKI_STOP_PIPE_SELECT_MULTI_MAX + 1; i++)
+		too_many[i] = socks[0];
+	munit_assert_int(chiaki_stop_pipe_select_multi(&stop_pipe, too_many, CHIAKI_STOP_PIPE_SELECT_MULTI_MAX + 1, 10, NULL), ==, CHIAKI_ERR_INVALID_DATA);
+
+	for(size_t i=0; i<MULTI_SOCKETS; i++)
+		CHIAKI_SOCKET_CLOSE(socks[i]);
+	CHIAKI_SOCKET_CLOSE(send_sock);
+	chiaki_stop_pipe_fini(&stop_pipe);
+	return MUNIT_OK;
+}
+
+MunitTest tests_stop_pipe[] = {
+	{
+		"/select_single",
+		test_stop_pipe_select_single,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/select_multi",
+		test_stop_pipe_select_multi,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -11,6 +11,15 @@
 
 #include "test_log.h"
 
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#endif
+
 
 static MunitResult test_av_packet_parse(const MunitParameter params[], void *user)
 {
@@ -160,13 +169,86 @@ static MunitResult test_takion_send_buffer(const MunitParameter params[], void *
 #undef nums_count
 }
 
+static MunitResult test_takion_send_buffer_reserve(const MunitParameter params[], void *user)
+{
+	ChiakiTakionSendBuffer send_buffer;
+	ChiakiErrorCode err = chiaki_takion_send_buffer_init(&send_buffer, NULL, 2);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	send_buffer.log = get_test_log();
+
+	munit_assert_int(chiaki_takion_send_buffer_reserve(&send_buffer), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_takion_send_buffer_reserve(&send_buffer), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_takion_send_buffer_reserve(&send_buffer), ==, CHIAKI_ERR_OVERFLOW);
+
+	// a reserved packet always fits
+	munit_assert_int(chiaki_takion_send_buffer_push(&send_buffer, 42, malloc(8), 8), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_size(send_buffer.packets_reserved, ==, 1);
+	chiaki_takion_send_buffer_unreserve(&send_buffer);
+	munit_assert_size(send_buffer.packets_reserved, ==, 0);
+
+	munit_assert_int(chiaki_takion_send_buffer_reserve(&send_buffer), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_takion_send_buffer_push(&send_buffer, 43, malloc(8), 8), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(chiaki_takion_send_buffer_push(&send_buffer, 44, malloc(8), 8), ==, CHIAKI_ERR_OVERFLOW);
+	munit_assert_int(chiaki_takion_send_buffer_reserve(&send_buffer), ==, CHIAKI_ERR_OVERFLOW);
+
+	chiaki_takion_send_buffer_ack(&send_buffer, 42, NULL, NULL);
+	munit_assert_int(chiaki_takion_send_buffer_reserve(&send_buffer), ==, CHIAKI_ERR_SUCCESS);
+
+	chiaki_takion_send_buffer_fini(&send_buffer);
+	return MUNIT_OK;
+}
+
+static MunitResult test_takion_send_buffer_fast_retransmit(const MunitParameter params[], void *user)
+{
+	ChiakiTakionSendBuffer send_buffer;
+	ChiakiErrorCode err = chiaki_takion_send_buffer_init(&send_buffer, NULL, 4);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	send_buffer.log = get_test_log();
+
+	for(ChiakiSeqNum32 seq_num=100; seq_num<103; seq_num++)
+	{
+		err = chiaki_takion_send_buffer_push(&send_buffer, seq_num, malloc(8), 8);
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	}
+
+	// 100 is lost, every later packet repeats the ack for 99
+	for(int i=0; i<2; i++)
+		chiaki_takion_send_buffer_ack(&send_buffer, 99, NULL, NULL);
+	munit_assert_uint64(send_buffer.packets[0].tries, ==, 0);
+	chiaki_takion_send_buffer_ack(&send_buffer, 99, NULL, NULL);
+	munit_assert_uint64(send_buffer.packets[0].tries, ==, 1);
+	munit_assert_true(send_buffer.packets[0].fast_retransmitted);
+
+	// only once, after that the timeout takes over
+	for(int i=0; i<3; i++)
+		chiaki_takion_send_buffer_ack(&send_buffer, 99, NULL, NULL);
+	munit_assert_uint64(send_buffer.packets[0].tries, ==, 1);
+
+	chiaki_takion_send_buffer_gap_ack(&send_buffer, 101, 101);
+	munit_assert_false(send_buffer.packets[0].gap_acked);
+	munit_assert_true(send_buffer.packets[1].gap_acked);
+	munit_assert_false(send_buffer.packets[2].gap_acked);
+
+	ChiakiSeqNum32 acked[4];
+	size_t acked_count;
+	chiaki_takion_send_buffer_ack(&send_buffer, 101, acked, &acked_count);
+	munit_assert_size(acked_count, ==, 2);
+	munit_assert_uint32(acked[0], ==, 100);
+	munit_assert_uint32(acked[1], ==, 101);
+	munit_assert_size(send_buffer.packets_count, ==, 1);
+	munit_assert_uint32(send_buffer.packets[0].seq_num, ==, 102);
+
+	chiaki_takion_send_buffer_fini(&send_buffer);
+	return MUNIT_OK;
+}
+
 static MunitResult test_takion_format_congestion(const MunitParameter params[], void *user)
 {
 	static const uint8_t handshake_key[] = { 0x54, 0x65, 0x4c, 0x34, 0x5c, 0xac, 0x56, 0xb8, 0xea, 0xe6, 0x15, 0x2a, 0xde, 0x1c, 0xe2, 0xe8 };
 	static const uint8_t ecdh_secret[] = { 0x00, 0x34, 0xf8, 0x21, 0xc7, 0xd9, 0xde, 0xa9, 0xe9, 0x11, 0xca, 0x5a, 0xd6, 0x7d, 0x11, 0xce, 0x4f, 0x02, 0xb1, 0xce, 0x1e, 0xe7, 0xc3, 0x8d, 0x54, 0x39, 0xfa, 0x64, 0xe3, 0xdb, 0xd8, 0x0d };
 
 	ChiakiGKCrypt gkcrypt;
-	ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt, NULL, 0, 2, handshake_key, ecdh_secret);
+	ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt, NULL, 0, 2, handshake_key, ecdh_secret, NULL);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return MUNIT_ERROR;
 
@@ -195,6 +277,286 @@ static MunitResult test_takion_format_congestion(const MunitParameter params[],
 	return MUNIT_OK;
 }
 
+/**
+ * @param tos optional, set to the TOS byte the datagram arrived with or -1 if unknown
+ */
+static size_t recv_timeout(chiaki_socket_t sock, uint8_t *buf, size_t buf_size, int *tos)
+{
+	if(tos)
+		*tos = -1;
+	fd_set fds;
+	FD_ZERO(&fds);
+	FD_SET(sock, &fds);
+	struct timeval timeout = { 1, 0 };
+	if(select((int)sock + 1, &fds, NULL, NULL, &timeout) <= 0)
+		return 0;
+#ifdef __linux__
+	struct iovec iov = { buf, buf_size };
+	union
+	{
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr msg = { 0 };
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	ssize_t r = recvmsg(sock, &msg, 0);
+	if(r < 0)
+		return 0;
+	for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg && tos; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if(cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_TOS)
+			*tos = *(uint8_t *)CMSG_DATA(cmsg);
+	}
+	return (size_t)r;
+#else
+	int r = recv(sock, buf, buf_size, 0);
+	return r < 0 ? 0 : (size_t)r;
+#endif
+}
+
+static MunitResult test_takion_send_scheduler(const MunitParameter params[], void *user)
+{
+	static const uint8_t handshake_key[] = { 0x54, 0x65, 0x4c, 0x34, 0x5c, 0xac, 0x56, 0xb8, 0xea, 0xe6, 0x15, 0x2a, 0xde, 0x1c, 0xe2, 0xe8 };
+	static const uint8_t ecdh_secret[] = { 0x00, 0x34, 0xf8, 0x21, 0xc7, 0xd9, 0xde, 0xa9, 0xe9, 0x11, 0xca, 0x5a, 0xd6, 0x7d, 0x11, 0xce, 0x4f, 0x02, 0xb1, 0xce, 0x1e, 0xe7, 0xc3, 0x8d, 0x54, 0x39, 0xfa, 0x64, 0xe3, 0xdb, 0xd8, 0x0d };
+
+	ChiakiGKCrypt gkcrypt;
+	ChiakiErrorCode err = chiaki_gkcrypt_init(&gkcrypt, NULL, 0, 2, handshake_key, ecdh_secret, NULL);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return MUNIT_ERROR;
+
+	chiaki_socket_t recv_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	munit_assert(!CHIAKI_SOCKET_IS_INVALID(recv_sock));
+	struct sockaddr_in addr = { 0 };
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addr_size = sizeof(addr);
+	if(bind(recv_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0
+		|| getsockname(recv_sock, (struct sockaddr *)&addr, &addr_size) < 0)
+	{
+		CHIAKI_SOCKET_CLOSE(recv_sock);
+		chiaki_gkcrypt_fini(&gkcrypt);
+		return MUNIT_SKIP;
+	}
+
+	static ChiakiTakion takion;
+	memset(&takion, 0, sizeof(takion));
+	takion.log = get_test_log();
+	takion.gkcrypt_local = &gkcrypt;
+	takion.key_pos_local = 0x1e5;
+	munit_assert_int(chiaki_mutex_init(&takion.gkcrypt_local_mutex, true), ==, CHIAKI_ERR_SUCCESS);
+	ChiakiLinkQuality quality;
+	munit_assert_int(chiaki_link_quality_init(&quality, 0), ==, CHIAKI_ERR_SUCCESS);
+	takion.link_quality = &quality;
+	takion.sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	munit_assert(!CHIAKI_SOCKET_IS_INVALID(takion.sock));
+	munit_assert_int(connect(takion.sock, (struct sockaddr *)&addr, sizeof(addr)), ==, 0);
+
+	ChiakiSocketTuning tuning = { 0 };
+	tuning.sndbuf = 0x10000;
+	tuning.dscp_input = 46; // EF
+	munit_assert_int(chiaki_socket_tuning_apply(takion.sock, &tuning, 0, &takion.socket_tuning, get_test_log()), ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_int(takion.socket_tuning.family, ==, AF_INET);
+	munit_assert_int(takion.socket_tuning.sndbuf, >=, tuning.sndbuf);
+#ifdef __linux__
+	munit_assert(takion.socket_tuning.dscp_per_packet);
+	munit_assert_uint8(takion.socket_tuning.dscp_input, ==, 46);
+	const int recv_tos_val = 1;
+	munit_assert_int(setsockopt(recv_sock, IPPROTO_IP, IP_RECVTOS, &recv_tos_val, sizeof(recv_tos_val)), ==, 0);
+#endif
+
+	munit_assert_int(chiaki_takion_send_scheduler_init(&takion.send_scheduler, &takion, 4), ==, CHIAKI_ERR_SUCCESS);
+
+	// queued before the scheduler runs, so everything ends up in one batch
+	ChiakiTakionSendPacket raw = { 0 };
+	raw.crypt = CHIAKI_TAKION_SEND_CRYPT_NONE;
+	static uint8_t bulk[CHIAKI_TAKION_SEND_INLINE_SIZE + 100];
+	for(size_t i=0; i<4; i++)
+	{
+		memset(bulk, 0x40 + (int)i, i == 3 ? sizeof(bulk) : 8);
+		err = chiaki_takion_send_scheduler_push(&takion.send_scheduler, CHIAKI_TAKION_SEND_CLASS_BULK, &raw, bulk, i == 3 ? sizeof(bulk) : 8);
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	}
+	err = chiaki_takion_send_scheduler_push(&takion.send_scheduler, CHIAKI_TAKION_SEND_CLASS_BULK, &raw, bulk, 8);
+	munit_assert_int(err, ==, CHIAKI_ERR_OVERFLOW);
+
+	ChiakiTakionCongestionPacket congestion;
+	congestion.word_0 = 0x42;
+	congestion.received = 26;
+	congestion.lost = 10;
+	uint8_t buf[CHIAKI_TAKION_SEND_INLINE_SIZE + 100];
+	chiaki_takion_format_congestion(buf, &congestion, 0);
+	ChiakiTakionSendPacket mac = { 0 };
+	mac.crypt = CHIAKI_TAKION_SEND_CRYPT_MAC;
+	mac.key_pos_advance = CHIAKI_TAKION_CONGESTION_PACKET_SIZE;
+	mac.key_pos_offset = 0xb;
+	err = chiaki_takion_send_scheduler_push(&takion.send_scheduler, CHIAKI_TAKION_SEND_CLASS_CONTROL, &mac, buf, CHIAKI_TAKION_CONGESTION_PACKET_SIZE);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	memset(buf, 0x11, 8);
+	err = chiaki_takion_send_scheduler_push(&takion.send_scheduler, CHIAKI_TAKION_SEND_CLASS_INPUT, &raw, buf, 8);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	munit_assert_int(chiaki_takion_send_scheduler_start(&takion.send_scheduler), ==, CHIAKI_ERR_SUCCESS);
+
+	// input first, then control with its key pos filled in, then bulk in push order
+	// only input is marked
+	int tos;
+	size_t received = recv_timeout(recv_sock, buf, sizeof(buf), &tos);
+	munit_assert_size(received, ==, 8);
+	munit_assert_uint8(buf[0], ==, 0x11);
+#ifdef __linux__
+	munit_assert_int(tos, ==, 46 << 2);
+#endif
+
+	received = recv_timeout(recv_sock, buf, sizeof(buf), &tos);
+#ifdef __linux__
+	munit_assert_int(tos, ==, 0);
+#endif
+	static const uint8_t congestion_expected[] = { 0x05, 0x00, 0x42, 0x00, 0x1a, 0x00, 0x0a, 0x64, 0x8a, 0x7c, 0x74, 0x00, 0x00, 0x01, 0xe5 };
+	munit_assert_size(received, ==, sizeof(congestion_expected));
+	munit_assert_memory_equal(sizeof(congestion_expected), buf, congestion_expected);
+
+	for(size_t i=0; i<4; i++)
+	{
+		received = recv_timeout(recv_sock, buf, sizeof(buf), NULL);
+		munit_assert_size(received, ==, i == 3 ? sizeof(bulk) : 8);
+		munit_assert_uint8(buf[received - 1], ==, 0x40 + i);
+	}
+
+	// stopping right away still sends what was queued before,
+	// the slot of the last batch may not be released yet
+	for(size_t i=0; i<3; i++)
+	{
+		memset(buf, 0x20 + (int)i, 8);
+		err = chiaki_takion_send_scheduler_push(&takion.send_scheduler, CHIAKI_TAKION_SEND_CLASS_CONTROL, &raw, buf, 8);
+		munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	}
+	chiaki_takion_send_scheduler_stop(&takion.send_scheduler);
+	for(size_t i=0; i<3; i++)
+	{
+		received = recv_timeout(recv_sock, buf, sizeof(buf), NULL);
+		munit_assert_size(received, ==, 8);
+		munit_assert_uint8(buf[0], ==, 0x20 + i);
+	}
+	chiaki_takion_send_scheduler_fini(&takion.send_scheduler);
+
+	ChiakiLinkQualityStats stats;
+	chiaki_link_quality_get_stats(&quality, &stats);
+	munit_assert_uint64(stats.send_packets[CHIAKI_TAKION_SEND_CLASS_INPUT], ==, 1);
+	munit_assert_uint64(stats.send_packets[CHIAKI_TAKION_SEND_CLASS_CONTROL], ==, 4);
+	munit_assert_uint64(stats.send_packets[CHIAKI_TAKION_SEND_CLASS_BULK], ==, 4);
+	munit_assert_uint64(stats.send_dropped[CHIAKI_TAKION_SEND_CLASS_BULK], ==, 1);
+	munit_assert_uint64(stats.send_dropped[CHIAKI_TAKION_SEND_CLASS_INPUT], ==, 0);
+
+	CHIAKI_SOCKET_CLOSE(takion.sock);
+	CHIAKI_SOCKET_CLOSE(recv_sock);
+	chiaki_link_quality_fini(&quality);
+	chiaki_mutex_fini(&takion.gkcrypt_local_mutex);
+	chiaki_gkcrypt_fini(&gkcrypt);
+	return MUNIT_OK;
+}
+
+static MunitResult test_link_quality(const MunitParameter params[], void *user)
+{
+	ChiakiLinkQuality quality;
+	ChiakiErrorCode err = chiaki_link_quality_init(&quality, 0);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+	munit_assert_uint64(chiaki_link_quality_resend_timeout_ms(&quality), ==, 200);
+
+	// the seed is replaced entirely by the first sample
+	chiaki_link_quality_reset(&quality, 80000);
+	munit_assert_uint64(chiaki_link_quality_resend_timeout_ms(&quality), ==, 240);
+	chiaki_link_quality_push_rtt(&quality, 8000);
+
+	ChiakiLinkQualityStats stats;
+	chiaki_link_quality_get_stats(&quality, &stats);
+	munit_assert_uint64(stats.srtt_us, ==, 8000);
+	munit_assert_uint64(stats.rttvar_us, ==, 4000);
+	munit_assert_uint64(stats.resend_timeout_ms, ==, 24);
+
+	chiaki_link_quality_push_rtt(&quality, 16000);
+	chiaki_link_quality_get_stats(&quality, &stats);
+	munit_assert_uint64(stats.srtt_us, ==, 9000);
+	munit_assert_uint64(stats.rttvar_us, ==, 5000);
+	munit_assert_uint64(stats.rtt_min_us, ==, 8000);
+	munit_assert_uint64(stats.rtt_last_us, ==, 16000);
+	munit_assert_uint64(stats.rtt_samples, ==, 2);
+	munit_assert_uint64(stats.resend_timeout_ms, ==, 29);
+
+	// a quiet LAN still gets a sane lower bound
+	for(int i=0; i<64; i++)
+		chiaki_link_quality_push_rtt(&quality, 500);
+	munit_assert_uint64(chiaki_link_quality_resend_timeout_ms(&quality), ==, 20);
+
+	chiaki_link_quality_push_loss(&quality, 90, 10);
+	chiaki_link_quality_push_loss(&quality, 0, 0);
+	chiaki_link_quality_get_stats(&quality, &stats);
+	munit_assert_double(stats.loss, >, 0.0124);
+	munit_assert_double(stats.loss, <, 0.0126);
+
+	chiaki_link_quality_fini(&quality);
+	return MUNIT_OK;
+}
+
+static MunitResult test_link_quality_back_off(const MunitParameter params[], void *user)
+{
+	ChiakiLinkQuality quality;
+	ChiakiErrorCode err = chiaki_link_quality_init(&quality, 0);
+	munit_assert_int(err, ==, CHIAKI_ERR_SUCCESS);
+
+	// a quiet LAN brings the timeout down to its floor
+	for(int i=0; i<64; i++)
+		chiaki_link_quality_push_rtt(&quality, 500);
+	munit_assert_uint64(chiaki_link_quality_resend_timeout_ms(&quality), ==, 20);
+
+	// then the RTT jumps way above it, so every packet expires before its ack
+	// and only packets sent once may be sampled
+	const uint64_t rtt_us = 150000;
+	uint64_t expired = 0;
+	uint64_t samples = 0;
+	for(int i=0; i<64; i++)
+	{
+		uint64_t timeout_ms = chiaki_link_quality_resend_timeout_ms(&quality);
+		if(timeout_ms * 1000 <= rtt_us)
+		{
+			// several packets in flight expire together
+			for(int j=0; j<4; j++)
+				chiaki_link_quality_back_off_resend_timeout(&quality, timeout_ms);
+			expired++;
+			continue;
+		}
+		chiaki_link_quality_push_rtt(&quality, rtt_us);
+		samples++;
+	}
+	// 20, 40, 80, 160, one doubling per round of expired packets
+	munit_assert_uint64(expired, ==, 3);
+	munit_assert_uint64(samples, ==, 61);
+
+	ChiakiLinkQualityStats stats;
+	chiaki_link_quality_get_stats(&quality, &stats);
+	munit_assert_uint64(stats.srtt_us, >, 140000);
+	munit_assert_uint64(stats.resend_timeout_ms, >, rtt_us / 1000);
+
+	// an old packet expiring with a smaller timeout does not undo the backoff
+	chiaki_link_quality_back_off_resend_timeout(&quality, 20);
+	munit_assert_uint64(chiaki_link_quality_resend_timeout_ms(&quality), ==, stats.resend_timeout_ms);
+
+	// and the backoff stops at the upper bound
+	for(int i=0; i<8; i++)
+		chiaki_link_quality_back_off_resend_timeout(&quality, chiaki_link_quality_resend_timeout_ms(&quality));
+	munit_assert_uint64(chiaki_link_quality_resend_timeout_ms(&quality), ==, 1000);
+
+	// the next sample takes over again
+	chiaki_link_quality_push_rtt(&quality, rtt_us);
+	munit_assert_uint64(chiaki_link_quality_resend_timeout_ms(&quality), <, 1000);
+
+	chiaki_link_quality_fini(&quality);
+	return MUNIT_OK;
+}
+
 MunitTest tests_takion[] = {
 	{
 		"/av_packet_parse",
@@ -220,6 +582,22 @@ MunitTest tests_takion[] = {
 		MUNIT_TEST_OPTION_NONE,
 		NULL
 	},
+	{
+		"/send_buffer_reserve",
+		test_takion_send_buffer_reserve,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/send_buffer_fast_retransmit",
+		test_takion_send_buffer_fast_retransmit,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
 	{
 		"/format_congestion",
 		test_takion_format_congestion,
@@ -228,5 +606,29 @@ MunitTest tests_takion[] = {
 		MUNIT_TEST_OPTION_NONE,
 		NULL
 	},
+	{
+		"/send_scheduler",
+		test_takion_send_scheduler,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/link_quality",
+		test_link_quality,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/link_quality_back_off",
+		test_link_quality_back_off,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
 	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
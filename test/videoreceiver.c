@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <munit.h>
+
+#include <chiaki/videoreceiver.h>
+
+static MunitResult test_ref_frames(const MunitParameter params[], void *user)
+{
+	ChiakiRefFrames ref_frames;
+	chiaki_ref_frames_init(&ref_frames);
+	munit_assert_false(chiaki_ref_frames_have(&ref_frames, 0));
+
+	chiaki_ref_frames_add(&ref_frames, 1, false);
+	chiaki_ref_frames_add(&ref_frames, 2, false);
+	// 3 is lost, 4 was decoded from a substitute reference
+	chiaki_ref_frames_add(&ref_frames, 4, true);
+	munit_assert_true(chiaki_ref_frames_have(&ref_frames, 1));
+	munit_assert_true(chiaki_ref_frames_have(&ref_frames, 2));
+	munit_assert_false(chiaki_ref_frames_have(&ref_frames, 3));
+	munit_assert_true(chiaki_ref_frames_have(&ref_frames, 4));
+	munit_assert_false(chiaki_ref_frames_have(&ref_frames, 5));
+	munit_assert_false(chiaki_ref_frames_tainted(&ref_frames, 2));
+	munit_assert_true(chiaki_ref_frames_tainted(&ref_frames, 4));
+
+	// frames leave the window
+	chiaki_ref_frames_add(&ref_frames, 4 + CHIAKI_REF_FRAMES_WINDOW - 1, false);
+	munit_assert_true(chiaki_ref_frames_have(&ref_frames, 4));
+	munit_assert_false(chiaki_ref_frames_have(&ref_frames, 2));
+
+	// across the seqnum wraparound
+	chiaki_ref_frames_init(&ref_frames);
+	chiaki_ref_frames_add(&ref_frames, 0xfffe, false);
+	chiaki_ref_frames_add(&ref_frames, 1, false);
+	munit_assert_true(chiaki_ref_frames_have(&ref_frames, 0xfffe));
+	munit_assert_false(chiaki_ref_frames_have(&ref_frames, 0xffff));
+	munit_assert_false(chiaki_ref_frames_have(&ref_frames, 0));
+	munit_assert_true(chiaki_ref_frames_have(&ref_frames, 1));
+	munit_assert_false(chiaki_ref_frames_tainted(&ref_frames, 1));
+
+	return MUNIT_OK;
+}
+
+static MunitResult test_video_timing(const MunitParameter params[], void *user)
+{
+	ChiakiVideoTiming timing;
+	chiaki_video_timing_init(&timing, 50);
+	munit_assert_uint64(timing.interval_us, ==, 20000);
+
+	// steady frames of 3 units, 1 ms apart, starting right before the seqnum wraps
+	uint64_t t = 1000000;
+	ChiakiSeqNum16 frame = 0xfff0;
+	for(int i=0; i<32; i++, frame++, t += timing.interval_us)
+	{
+		munit_assert_true(chiaki_video_timing_unit(&timing, frame, t));
+		munit_assert_false(chiaki_video_timing_unit(&timing, frame, t + 2000));
+		munit_assert_false(chiaki_video_timing_unit(&timing, frame, t + 1000));
+	}
+	munit_assert_uint64(timing.frames, ==, 31);
+	munit_assert_uint64(timing.spread_last_us, ==, 2000);
+	munit_assert_uint64(timing.spread_avg_us, ==, 2000);
+	munit_assert_uint64(timing.jitter_us, ==, 0);
+	munit_assert_int64(timing.delay_trend_us, ==, 0);
+	munit_assert_uint64(chiaki_video_timing_queue_delay_us(&timing), ==, 0);
+
+	// old frames and packets without an arrival time change nothing
+	munit_assert_false(chiaki_video_timing_unit(&timing, frame - 3, t));
+	munit_assert_false(chiaki_video_timing_unit(&timing, frame, 0));
+	munit_assert_uint64(timing.frames, ==, 31);
+
+	// a queue builds up, every frame is 1 ms later than the one before
+	for(int i=0; i<32; i++, frame++, t += timing.interval_us + 1000)
+		chiaki_video_timing_unit(&timing, frame, t);
+	munit_assert_int64(timing.delay_trend_us, >, 800);
+	munit_assert_uint64(timing.jitter_us, >, 800);
+	munit_assert_uint64(chiaki_video_timing_queue_delay_us(&timing), >=, 30000);
+	munit_assert_uint64(chiaki_video_timing_queue_delay_us(&timing), <=, 32000);
+
+	// and drains again
+	for(int i=0; i<64; i++, frame++, t += timing.interval_us - 1000)
+		chiaki_video_timing_unit(&timing, frame, t);
+	munit_assert_int64(timing.delay_trend_us, <, 0);
+	munit_assert_uint64(chiaki_video_timing_queue_delay_us(&timing), ==, 0);
+
+	// a lost frame is no jitter
+	for(int i=0; i<64; i++, frame++, t += timing.interval_us)
+		chiaki_video_timing_unit(&timing, frame, t);
+	uint64_t jitter_us = timing.jitter_us;
+	frame++;
+	t += timing.interval_us;
+	chiaki_video_timing_unit(&timing, frame, t);
+	munit_assert_uint64(timing.jitter_us, <=, jitter_us);
+
+	return MUNIT_OK;
+}
+
+MunitTest tests_video_receiver[] = {
+	{
+		"/ref_frames",
+		test_ref_frames,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{
+		"/timing",
+		test_video_timing,
+		NULL,
+		NULL,
+		MUNIT_TEST_OPTION_NONE,
+		NULL
+	},
+	{ NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};